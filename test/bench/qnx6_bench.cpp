@@ -0,0 +1,296 @@
+/*
+ * qnx6_bench.cpp
+ *
+ * Throughput benchmark for the QNX6 driver.  Times file system open,
+ * a recursive directory walk (fls -r), an inode walk (ils), reads of the
+ * largest files (icat) and an unallocated block walk (blkls) over either
+ * an existing image or a synthetic one built by Qnx6ImageBuilder, and
+ * reports MB/s, image reads and cache hit rate from IMG_INFO::stats.
+ *
+ * Run via "make bench" or directly:
+ *   test/bench/qnx6_bench [options] [image]
+ */
+
+#include "tsk/libtsk.h"
+#include "tsk/img/tsk_img_i.h"
+
+#include "test/tsk/fs/qnx6_image.h"
+#include "test/tools/tsk_tempfile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+const size_t READ_CHUNK = 1024 * 1024;
+const size_t MAX_ICAT_FILES = 16;
+
+struct Phase {
+    const char *name;
+    double secs;
+    uint64_t items;
+    uint64_t bytes;         // bytes delivered to the caller
+    Stats before, after;
+};
+
+struct WalkState {
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+    std::vector<std::pair<TSK_OFF_T, TSK_INUM_T>> big;   // (size, inum) of large regular files
+};
+
+Stats img_stats(TSK_IMG_INFO *img) {
+    Stats s;
+    tsk_img_collect_stats(img, &s);
+    return s;
+}
+
+double now() {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TSK_WALK_RET_ENUM fls_cb(TSK_FS_FILE *file, const char *, void *ptr) {
+    auto *st = static_cast<WalkState *>(ptr);
+    st->entries++;
+    if (file->name && !TSK_FS_ISDOT(file->name->name) && file->meta &&
+        file->meta->type == TSK_FS_META_TYPE_REG && file->meta->size > 0)
+        st->big.push_back(std::make_pair(file->meta->size, file->meta->addr));
+    return TSK_WALK_CONT;
+}
+
+TSK_WALK_RET_ENUM ils_cb(TSK_FS_FILE *file, void *ptr) {
+    auto *st = static_cast<WalkState *>(ptr);
+    st->entries++;
+    if (file->meta)
+        st->bytes += sizeof(*file->meta);
+    return TSK_WALK_CONT;
+}
+
+TSK_WALK_RET_ENUM blkls_cb(const TSK_FS_BLOCK *blk, void *ptr) {
+    auto *st = static_cast<WalkState *>(ptr);
+    st->entries++;
+    st->bytes += blk->fs_info->block_size;
+    return TSK_WALK_CONT;
+}
+
+void print_phase(const Phase &p) {
+    uint64_t hits = p.after.hits - p.before.hits;
+    uint64_t misses = p.after.misses - p.before.misses;
+    uint64_t reads = hits + misses;
+    double mb = p.bytes / (1024.0 * 1024.0);
+    printf("%-8s %9.3f %10" PRIu64 " %10.1f %10.1f %10" PRIu64 " %10" PRIu64 " %7.1f%%\n",
+        p.name, p.secs, p.items, mb, p.secs > 0 ? mb / p.secs : 0.0,
+        reads, misses, reads ? 100.0 * hits / reads : 0.0);
+}
+
+void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [-b blocksize] [-n blocks] [-d dirs] [-f files] [-m max_file_blocks]\n"
+        "          [-B big_file_MiB] [-l big_file_level] [-F fragmentation] [-s seed]\n"
+        "          [-S] [-k path] [image]\n"
+        "\t-b: block size of the generated image (default 4096)\n"
+        "\t-n: blocks in the generated data area (default 262144)\n"
+        "\t-d: subdirectories of the root directory (default 64)\n"
+        "\t-f: small files (default 20000)\n"
+        "\t-m: maximum size of a small file in blocks (default 8)\n"
+        "\t-B: size of /bigfile.bin in MiB (default 256)\n"
+        "\t-l: pointer tree level of /bigfile.bin (default: smallest that fits)\n"
+        "\t-F: chance of leaving a gap between allocations, 0..1 (default 0.1)\n"
+        "\t-s: random seed (default 1)\n"
+        "\t-S: use short names only (no longfile entries)\n"
+        "\t-k: keep the generated image at path\n"
+        "\timage: benchmark an existing QNX6 image instead of generating one\n",
+        prog);
+    exit(1);
+}
+
+}
+
+int main(int argc, char **argv) {
+    Qnx6ImageOptions opts;
+    opts.block_size = 4096;
+    opts.num_blocks = 262144;
+    opts.num_dirs = 64;
+    opts.num_files = 20000;
+    opts.max_file_blocks = 8;
+    opts.big_file_size = 256ULL * 1024 * 1024;
+    opts.fragmentation = 0.1;
+    std::string keep, image;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a.size() == 2 && a[0] == '-' && a[1] == 'S') {
+            opts.long_names = false;
+            continue;
+        }
+        if (a.size() == 2 && a[0] == '-') {
+            if (i + 1 >= argc)
+                usage(argv[0]);
+            const char *v = argv[++i];
+            switch (a[1]) {
+            case 'b': opts.block_size = (uint32_t)strtoul(v, nullptr, 0); break;
+            case 'n': opts.num_blocks = (uint32_t)strtoul(v, nullptr, 0); break;
+            case 'd': opts.num_dirs = (uint32_t)strtoul(v, nullptr, 0); break;
+            case 'f': opts.num_files = (uint32_t)strtoul(v, nullptr, 0); break;
+            case 'm': opts.max_file_blocks = (uint32_t)strtoul(v, nullptr, 0); break;
+            case 'B': opts.big_file_size = strtoull(v, nullptr, 0) * 1024 * 1024; break;
+            case 'l': opts.big_file_level = atoi(v); break;
+            case 'F': opts.fragmentation = atof(v); break;
+            case 's': opts.seed = (uint32_t)strtoul(v, nullptr, 0); break;
+            case 'k': keep = v; break;
+            default: usage(argv[0]);
+            }
+        }
+        else if (image.empty() && a[0] != '-') {
+            image = a;
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+    if (opts.block_size < 512 || opts.block_size > 65536 ||
+        (opts.block_size & (opts.block_size - 1)))
+        usage(argv[0]);
+
+    bool generated = image.empty();
+    if (generated) {
+        FILE *f;
+        if (!keep.empty()) {
+            image = keep;
+            f = fopen(image.c_str(), "w+b");
+        }
+        else {
+            f = tsk_make_named_tempfile(&image);
+        }
+        if (!f) {
+            fprintf(stderr, "cannot create image file\n");
+            return 1;
+        }
+        Qnx6ImageBuilder builder(opts);
+        double t0 = now();
+        bool ok = builder.write(f);
+        fclose(f);
+        if (!ok) {
+            fprintf(stderr, "image generation failed (volume too small?)\n");
+            remove(image.c_str());
+            return 1;
+        }
+        printf("generated %s: %.1f MiB, block size %u, %u inodes, %" PRIu64
+            " blocks allocated, %.2fs\n", image.c_str(),
+            builder.image_size() / (1024.0 * 1024.0), opts.block_size,
+            builder.num_inodes(), builder.allocated_blocks(), now() - t0);
+    }
+
+    const char *paths[] = { image.c_str() };
+    TSK_IMG_INFO *img = tsk_img_open_utf8(1, paths, TSK_IMG_TYPE_DETECT, 0);
+    if (!img) {
+        tsk_error_print(stderr);
+        return 1;
+    }
+
+    std::vector<Phase> phases;
+    WalkState st;
+    Phase p;
+
+    p = Phase{ "open", 0, 1, 0, img_stats(img), Stats() };
+    double t0 = now();
+    TSK_FS_INFO *fs = tsk_fs_open_img(img, 0, TSK_FS_TYPE_QNX6);
+    p.secs = now() - t0;
+    if (!fs) {
+        tsk_error_print(stderr);
+        tsk_img_close(img);
+        return 1;
+    }
+    p.after = img_stats(img);
+    p.bytes = (p.after.hit_bytes + p.after.miss_bytes) - (p.before.hit_bytes + p.before.miss_bytes);
+    phases.push_back(p);
+
+    p = Phase{ "fls -r", 0, 0, 0, img_stats(img), Stats() };
+    t0 = now();
+    if (tsk_fs_dir_walk(fs, fs->root_inum,
+            (TSK_FS_DIR_WALK_FLAG_ENUM)(TSK_FS_DIR_WALK_FLAG_ALLOC |
+                TSK_FS_DIR_WALK_FLAG_UNALLOC | TSK_FS_DIR_WALK_FLAG_RECURSE),
+            fls_cb, &st))
+        tsk_error_print(stderr);
+    p.secs = now() - t0;
+    p.after = img_stats(img);
+    p.items = st.entries;
+    p.bytes = (p.after.hit_bytes + p.after.miss_bytes) - (p.before.hit_bytes + p.before.miss_bytes);
+    phases.push_back(p);
+
+    WalkState ils;
+    p = Phase{ "ils", 0, 0, 0, img_stats(img), Stats() };
+    t0 = now();
+    if (tsk_fs_meta_walk(fs, fs->first_inum, fs->last_inum,
+            (TSK_FS_META_FLAG_ENUM)(TSK_FS_META_FLAG_ALLOC | TSK_FS_META_FLAG_UNALLOC),
+            ils_cb, &ils))
+        tsk_error_print(stderr);
+    p.secs = now() - t0;
+    p.after = img_stats(img);
+    p.items = ils.entries;
+    p.bytes = (p.after.hit_bytes + p.after.miss_bytes) - (p.before.hit_bytes + p.before.miss_bytes);
+    phases.push_back(p);
+
+    // icat of the largest regular files, in 1 MiB reads
+    std::sort(st.big.begin(), st.big.end(),
+        [](const std::pair<TSK_OFF_T, TSK_INUM_T> &a, const std::pair<TSK_OFF_T, TSK_INUM_T> &b) {
+            return a.first > b.first; });
+    st.big.erase(std::unique(st.big.begin(), st.big.end()), st.big.end());
+    if (st.big.size() > MAX_ICAT_FILES)
+        st.big.resize(MAX_ICAT_FILES);
+    std::vector<char> buf(READ_CHUNK);
+    p = Phase{ "icat", 0, 0, 0, img_stats(img), Stats() };
+    t0 = now();
+    for (const auto &f : st.big) {
+        TSK_FS_FILE *file = tsk_fs_file_open_meta(fs, nullptr, f.second);
+        if (!file) {
+            tsk_error_print(stderr);
+            continue;
+        }
+        for (TSK_OFF_T off = 0; off < f.first; ) {
+            ssize_t n = tsk_fs_file_read(file, off, buf.data(), buf.size(),
+                TSK_FS_FILE_READ_FLAG_NONE);
+            if (n <= 0)
+                break;
+            off += n;
+            p.bytes += n;
+        }
+        tsk_fs_file_close(file);
+        p.items++;
+    }
+    p.secs = now() - t0;
+    p.after = img_stats(img);
+    phases.push_back(p);
+
+    WalkState blk;
+    p = Phase{ "blkls", 0, 0, 0, img_stats(img), Stats() };
+    t0 = now();
+    if (tsk_fs_block_walk(fs, fs->first_block, fs->last_block,
+            (TSK_FS_BLOCK_WALK_FLAG_ENUM)(TSK_FS_BLOCK_WALK_FLAG_UNALLOC),
+            blkls_cb, &blk))
+        tsk_error_print(stderr);
+    p.secs = now() - t0;
+    p.after = img_stats(img);
+    p.items = blk.entries;
+    p.bytes = blk.bytes;
+    phases.push_back(p);
+
+    printf("%-8s %9s %10s %10s %10s %10s %10s %8s\n", "phase", "seconds",
+        "items", "MiB", "MiB/s", "reads", "backend", "hit");
+    for (const Phase &ph : phases)
+        print_phase(ph);
+
+    fs->close(fs);
+    tsk_img_close(img);
+    if (generated && keep.empty())
+        remove(image.c_str());
+    return 0;
+}
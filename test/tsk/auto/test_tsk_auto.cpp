@@ -0,0 +1,271 @@
+/*
+ * test_tsk_auto.cpp
+ *
+ * Tests for TskAuto's worker threads: preprocessFile() results must reach
+ * processFile() in the order of the directory walk.
+ */
+
+#include "tsk/libtsk.h"
+#include "tsk/auto/tsk_case_db.h"
+
+#include "catch.hpp"
+
+#include "test/tsk/fs/ntfs_image.h"
+#include "test/tsk/fs/qnx6_image.h"
+#include "test/tools/tsk_tempfile.h"
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// FNV-1a of the file content
+struct ContentHash : public TskAutoFileResult {
+    uint64_t value = 0;
+    bool ok = false;
+};
+
+TSK_WALK_RET_ENUM hash_cb(TSK_FS_FILE *, TSK_OFF_T, TSK_DADDR_T, char *buf,
+    size_t len, TSK_FS_BLOCK_FLAG_ENUM, void *ptr) {
+    uint64_t *h = static_cast<uint64_t *>(ptr);
+    for (size_t i = 0; i < len; i++) {
+        *h ^= (uint8_t) buf[i];
+        *h *= 0x100000001b3ULL;
+    }
+    return TSK_WALK_CONT;
+}
+
+ContentHash hash_file(TSK_FS_FILE *fs_file) {
+    ContentHash h;
+    h.value = 0xcbf29ce484222325ULL;
+    h.ok = tsk_fs_file_walk(fs_file, TSK_FS_FILE_WALK_FLAG_NONE, hash_cb,
+        &h.value) == 0;
+    tsk_error_reset();
+    return h;
+}
+
+struct Seen {
+    std::string path;
+    uint64_t hash;
+    bool ok;
+    bool preprocessed;
+
+    bool operator==(const Seen &o) const {
+        return path == o.path && hash == o.hash && ok == o.ok;
+    }
+};
+
+class RecordingAuto : public TskAuto {
+  public:
+    std::vector<Seen> seen;
+    size_t stopAfter = 0;
+    std::thread::id walkThread = std::this_thread::get_id();
+    std::atomic<int> preprocessCalls{0};
+    std::atomic<int> preprocessOnWalkThread{0};
+    size_t foreignAttrs = 0;
+
+    TSK_RETVAL_ENUM processFile(TSK_FS_FILE *fs_file, const char *path) override {
+        Seen s;
+        s.path = std::string(path) + fs_file->name->name;
+        const ContentHash *pre = (const ContentHash *) getFileResult();
+        s.preprocessed = pre != nullptr;
+        if (isFile(fs_file)) {
+            ContentHash h = pre ? *pre : hash_file(fs_file);
+            s.hash = h.value;
+            s.ok = h.ok;
+        }
+        else {
+            s.hash = 0;
+            s.ok = false;
+        }
+        seen.push_back(s);
+
+        // the loaded attributes belong to this file
+        if (fs_file->meta && fs_file->meta->attr) {
+            for (const TSK_FS_ATTR *a = fs_file->meta->attr->head; a; a = a->next) {
+                if ((a->flags & TSK_FS_ATTR_INUSE) && a->fs_file != fs_file)
+                    foreignAttrs++;
+            }
+        }
+        if (stopAfter && seen.size() == stopAfter)
+            return TSK_STOP;
+        return TSK_OK;
+    }
+
+  protected:
+    TskAutoFileResult *preprocessFile(TSK_FS_FILE *fs_file, const char *) override {
+        preprocessCalls++;
+        if (std::this_thread::get_id() == walkThread)
+            preprocessOnWalkThread++;
+        if (!isFile(fs_file))
+            return nullptr;
+        return new ContentHash(hash_file(fs_file));
+    }
+};
+
+struct AutoImage {
+    std::string path;
+
+    explicit AutoImage(const NtfsImageOptions &opts) {
+        NtfsImageBuilder builder(opts);
+        FILE *f = tsk_make_named_tempfile(&path);
+        REQUIRE(f != nullptr);
+        bool ok = builder.write(f);
+        fclose(f);
+        REQUIRE(ok);
+    }
+
+    AutoImage() {
+        Qnx6ImageOptions opts;
+        opts.num_files = 200;
+        opts.num_dirs = 6;
+        opts.max_file_blocks = 12;
+        opts.big_file_size = 300 * 1024;
+        opts.fragmentation = 0.2;
+        Qnx6ImageBuilder builder(opts);
+        FILE *f = tsk_make_named_tempfile(&path);
+        REQUIRE(f != nullptr);
+        bool ok = builder.write(f);
+        fclose(f);
+        REQUIRE(ok);
+    }
+
+    ~AutoImage() {
+        remove(path.c_str());
+    }
+
+    void run(RecordingAuto &a) {
+        const char *paths[] = { path.c_str() };
+        REQUIRE(a.openImageUtf8(1, paths, TSK_IMG_TYPE_RAW, 512) == 0);
+        a.findFilesInImg();
+        a.closeImage();
+    }
+};
+
+}
+
+TEST_CASE("TskAuto worker threads keep the walk order", "[tsk_auto]") {
+    AutoImage image;
+
+    RecordingAuto inline_auto;
+    image.run(inline_auto);
+    REQUIRE(inline_auto.seen.size() > 200);
+    CHECK(inline_auto.preprocessCalls == 0);
+    CHECK(inline_auto.getErrorList().empty());
+
+    RecordingAuto threaded;
+    threaded.setNumThreads(4);
+    CHECK(threaded.getNumThreads() == 4);
+    image.run(threaded);
+    CHECK(threaded.getErrorList().empty());
+    CHECK(threaded.foreignAttrs == 0);
+    REQUIRE(threaded.seen.size() == inline_auto.seen.size());
+    for (size_t i = 0; i < threaded.seen.size(); i++) {
+        INFO(inline_auto.seen[i].path);
+        CHECK(threaded.seen[i] == inline_auto.seen[i]);
+    }
+
+#ifdef TSK_MULTITHREAD_LIB
+    CHECK(threaded.preprocessCalls == (int) threaded.seen.size());
+    CHECK(threaded.preprocessOnWalkThread == 0);
+    size_t files = 0, preprocessed = 0;
+    for (const Seen &s : threaded.seen) {
+        if (s.ok) {
+            files++;
+            preprocessed += s.preprocessed;
+        }
+    }
+    CHECK(files > 200);
+    CHECK(preprocessed == files);
+#endif
+}
+
+TEST_CASE("TskAuto worker threads stop where processFile() stops", "[tsk_auto]") {
+    AutoImage image;
+
+    RecordingAuto inline_auto;
+    inline_auto.stopAfter = 37;
+    image.run(inline_auto);
+
+    RecordingAuto threaded;
+    threaded.stopAfter = 37;
+    threaded.setNumThreads(3);
+    image.run(threaded);
+
+    REQUIRE(inline_auto.seen.size() == 37);
+    REQUIRE(threaded.seen.size() == 37);
+    for (size_t i = 0; i < threaded.seen.size(); i++)
+        CHECK(threaded.seen[i] == inline_auto.seen[i]);
+}
+
+TEST_CASE("TskAuto worker threads get files with their own attributes", "[tsk_auto]") {
+    // NTFS loads the attributes in file_add_meta()
+    NtfsImageOptions opts;
+    opts.num_files = 120;
+    opts.num_dirs = 4;
+    opts.compressed = true;
+    opts.fragmentation = 0.2;
+    AutoImage image(opts);
+
+    RecordingAuto inline_auto;
+    image.run(inline_auto);
+    REQUIRE(inline_auto.seen.size() > 120);
+    CHECK(inline_auto.foreignAttrs == 0);
+
+    RecordingAuto threaded;
+    threaded.setNumThreads(4);
+    image.run(threaded);
+    CHECK(threaded.getErrorList().empty());
+    CHECK(threaded.foreignAttrs == 0);
+    REQUIRE(threaded.seen.size() == inline_auto.seen.size());
+    for (size_t i = 0; i < threaded.seen.size(); i++) {
+        INFO(inline_auto.seen[i].path);
+        CHECK(threaded.seen[i] == inline_auto.seen[i]);
+    }
+}
+
+namespace {
+
+class DecompThreadsDb : public TskAutoDb {
+  public:
+    explicit DecompThreadsDb(TskDb *db) : TskAutoDb(db, NULL, NULL) {}
+
+    std::vector<unsigned int> decompThreads;
+
+    TSK_FILTER_ENUM filterFs(TSK_FS_INFO *fs_info) override {
+        TSK_FILTER_ENUM retval = TskAutoDb::filterFs(fs_info);
+        decompThreads.push_back(fs_info->decomp_threads);
+        return retval;
+    }
+};
+
+}
+
+TEST_CASE("TskAutoDb decompresses with as many threads as it hashes with", "[tsk_auto]") {
+    NtfsImageOptions opts;
+    opts.num_files = 20;
+    opts.compressed = true;
+    AutoImage image(opts);
+    const std::string db_path = image.path + ".db";
+
+    const char *paths[] = { image.path.c_str() };
+    TSK_IMG_INFO *img = tsk_img_open_utf8(1, paths, TSK_IMG_TYPE_RAW, 512);
+    REQUIRE(img != nullptr);
+    TskDbSqlite db(db_path.c_str(), false);
+    REQUIRE(db.open(true) == 0);
+    {
+        DecompThreadsDb autoDb(&db);
+        autoDb.setNumThreads(3);
+        autoDb.hashFiles(true);
+        CHECK(autoDb.startAddImage(img) == 0);
+        CHECK(autoDb.commitAddImage() > 0);
+        REQUIRE(autoDb.decompThreads.size() == 1);
+        CHECK(autoDb.decompThreads[0] == 3);
+    }
+    db.close();
+    tsk_img_close(img);
+    remove(db_path.c_str());
+}
@@ -0,0 +1,1040 @@
+/*
+ * Synthetic NTFS image generator, see ntfs_image.h.
+ */
+#include "ntfs_image.h"
+
+#include <algorithm>
+#include <cstring>
+
+typedef std::vector<std::pair<uint64_t, uint64_t> > NtfsRunList;
+
+static const uint64_t NT_TIME = 132223104000000000ULL;     // 2020-01-01
+static const uint64_t FIRST_USER_ENTRY = 16;
+static const uint64_t RESIDENT_MAX = 256;
+static const uint16_t USN = 1;
+static const uint64_t SPARSE = ~(uint64_t)0;                // first cluster of a sparse run
+static const uint32_t COMP_UNIT = 16;                       // clusters per compression unit
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static size_t roundup8(size_t v) {
+    return (v + 7) & ~(size_t)7;
+}
+
+// splitmix64; file contents are derived from (inum, offset).
+static uint64_t mix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static void fill_content(uint64_t inum, uint64_t off, uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        uint64_t pos = off + i;
+        uint64_t w = mix64((inum << 40) ^ (pos >> 3));
+        buf[i] = (uint8_t)(w >> (8 * (pos & 7)));
+    }
+}
+
+// Content of compressed files: zero 64 KiB regions (sparse compression
+// units) and 2 KiB pieces of random bytes, byte runs, short and long
+// repeating patterns, so that LZNT1 finds phrases of every length.
+static void fill_compressible(uint64_t inum, uint64_t off, uint8_t *buf,
+    size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        uint64_t pos = off + i;
+        if (mix64((inum << 40) ^ 0x5A5A0000000ULL ^ (pos >> 16)) % 6 == 0) {
+            buf[i] = 0;
+            continue;
+        }
+        uint64_t piece = mix64((inum << 40) ^ 0xC0FFEE000000ULL ^ (pos >> 11));
+        uint64_t arg = piece >> 8;
+        switch (piece % 4) {
+        case 0:
+            buf[i] = (uint8_t)(mix64((inum << 40) ^ (pos >> 3)) >> (8 * (pos & 7)));
+            break;
+        case 1:
+            buf[i] = (uint8_t)arg;
+            break;
+        case 2:
+            buf[i] = (uint8_t)mix64(piece ^ (pos % (2 + arg % 14)));
+            break;
+        default:
+            buf[i] = (uint8_t)mix64(piece ^ (pos % (40 + arg % 1000)));
+            break;
+        }
+    }
+}
+
+static void file_content(uint64_t inum, bool compressed, uint64_t off,
+    uint8_t *buf, size_t len) {
+    if (compressed)
+        fill_compressible(inum, off, buf, len);
+    else
+        fill_content(inum, off, buf, len);
+}
+
+// LZNT1: 4 KiB chunks, each a sequence of groups of a flag byte and eight
+// literals or phrases (greedy matching through hash chains).  A chunk that
+// does not get smaller is stored uncompressed.
+static std::vector<uint8_t> lznt1_compress(const uint8_t *data, size_t len) {
+    std::vector<uint8_t> out;
+    std::vector<int> head(4096), prev(4096);
+    for (size_t start = 0; start < len; start += 4096) {
+        const uint8_t *src = data + start;
+        size_t n = std::min<size_t>(4096, len - start);
+        auto hash = [src](size_t p) {
+            return ((src[p] << 4) ^ (src[p + 1] << 2) ^ src[p + 2]) & 0xFFF;
+        };
+        auto insert = [&](size_t p) {
+            if (p + 3 <= n) {
+                size_t h = hash(p);
+                prev[p] = head[h];
+                head[h] = (int)p;
+            }
+        };
+        std::fill(head.begin(), head.end(), -1);
+
+        std::vector<uint8_t> tok;
+        size_t pos = 0;
+        while (pos < n) {
+            size_t flags = tok.size();
+            tok.push_back(0);
+            for (int t = 0; t < 8 && pos < n; t++) {
+                size_t best_len = 0, best_off = 0;
+                int shift = 0;
+                if (pos > 0 && pos + 3 <= n) {
+                    for (size_t i = pos - 1; i >= 0x10; i >>= 1)
+                        shift++;
+                    size_t max_len = (0xFFFu >> shift) + 3;
+                    size_t max_off = (size_t)1 << (4 + shift);
+                    int steps = 0;
+                    for (int c = head[hash(pos)]; c >= 0 && steps < 64;
+                        c = prev[c], steps++) {
+                        if (pos - c > max_off)
+                            break;
+                        size_t l = 0;
+                        while (l < max_len && pos + l < n && src[pos + l] == src[c + l])
+                            l++;
+                        if (l > best_len) {
+                            best_len = l;
+                            best_off = pos - c;
+                            if (l == max_len)
+                                break;
+                        }
+                    }
+                }
+                if (best_len >= 3) {
+                    uint16_t v = (uint16_t)(((best_off - 1) << (12 - shift))
+                        | (best_len - 3));
+                    tok[flags] |= (uint8_t)(1u << t);
+                    tok.push_back((uint8_t)v);
+                    tok.push_back((uint8_t)(v >> 8));
+                    for (size_t i = 0; i < best_len; i++)
+                        insert(pos + i);
+                    pos += best_len;
+                }
+                else {
+                    tok.push_back(src[pos]);
+                    insert(pos);
+                    pos++;
+                }
+            }
+        }
+
+        size_t hdr = out.size();
+        out.resize(hdr + 2);
+        if (tok.size() < n) {
+            put16(&out[hdr], (uint16_t)(0xB000 | (tok.size() - 1)));
+            out.insert(out.end(), tok.begin(), tok.end());
+        }
+        else {
+            put16(&out[hdr], (uint16_t)(0x3000 | (n - 1)));
+            out.insert(out.end(), src, src + n);
+        }
+    }
+    return out;
+}
+
+// Names are UTF-8 with characters below U+0800.
+static std::u16string to_utf16(const std::string &s) {
+    std::u16string r;
+    for (size_t i = 0; i < s.size(); i++) {
+        uint8_t c = (uint8_t)s[i];
+        if (c >= 0xC0 && i + 1 < s.size())
+            r += (char16_t)(((c & 0x1F) << 6) | ((uint8_t)s[++i] & 0x3F));
+        else
+            r += (char16_t)c;
+    }
+    return r;
+}
+
+// The upper case of a UTF-16 code unit, as in the $UpCase table that the
+// builder writes: ASCII and Latin-1 letters.
+static char16_t upcase_char(char16_t c) {
+    if (c >= u'a' && c <= u'z')
+        return (char16_t)(c - u'a' + u'A');
+    if (c >= 0xE0 && c <= 0xFE && c != 0xF7)
+        return (char16_t)(c - 0x20);
+    return c;
+}
+
+// NTFS collates $I30 names by their upper case UTF-16 code units.
+static std::u16string upcase(const std::u16string &s) {
+    std::u16string r(s);
+    for (char16_t &c : r)
+        c = upcase_char(c);
+    return r;
+}
+
+// Offset of the first byte after the update sequence array of a record
+// whose update sequence starts at upd_off.
+static size_t after_fixup(size_t upd_off, size_t rec_size) {
+    return roundup8(upd_off + 2 * (rec_size / 512 + 1));
+}
+
+// Put the update sequence value at the end of every sector of a record.
+static void apply_fixup(uint8_t *rec, size_t rec_size, size_t upd_off) {
+    size_t cnt = rec_size / 512 + 1;
+    put16(rec + 4, (uint16_t)upd_off);
+    put16(rec + 6, (uint16_t)cnt);
+    put16(rec + upd_off, USN);
+    for (size_t i = 1; i < cnt; i++) {
+        uint8_t *end = rec + i * 512 - 2;
+        rec[upd_off + 2 * i] = end[0];
+        rec[upd_off + 2 * i + 1] = end[1];
+        put16(end, USN);
+    }
+}
+
+static std::vector<uint8_t> encode_runs(const NtfsRunList &runs) {
+    std::vector<uint8_t> out;
+    int64_t prev = 0;
+    for (const auto &run : runs) {
+        // lengths are signed too, like Windows writes them
+        uint8_t lenb = 1, offb = 1;
+        while (lenb < 8 && (run.second >> (8 * lenb - 1)))
+            lenb++;
+        if (run.first == SPARSE) {
+            out.push_back(lenb);
+            for (int i = 0; i < lenb; i++)
+                out.push_back((uint8_t)(run.second >> (8 * i)));
+            continue;
+        }
+        int64_t delta = (int64_t)run.first - prev;
+        while (offb < 8 && (delta < -(INT64_C(1) << (8 * offb - 1))
+                || delta >= (INT64_C(1) << (8 * offb - 1))))
+            offb++;
+        out.push_back((uint8_t)((offb << 4) | lenb));
+        for (int i = 0; i < lenb; i++)
+            out.push_back((uint8_t)(run.second >> (8 * i)));
+        for (int i = 0; i < offb; i++)
+            out.push_back((uint8_t)((uint64_t)delta >> (8 * i)));
+        prev = (int64_t)run.first;
+    }
+    out.push_back(0);
+    return out;
+}
+
+static uint64_t run_clusters(const NtfsRunList &runs) {
+    uint64_t n = 0;
+    for (const auto &run : runs)
+        n += run.second;
+    return n;
+}
+
+static void append_run(NtfsRunList *runs, uint64_t first, uint64_t count) {
+    if (count == 0)
+        return;
+    if (!runs->empty() && ((first == SPARSE && runs->back().first == SPARSE)
+            || (first != SPARSE && runs->back().first != SPARSE
+                && runs->back().first + runs->back().second == first)))
+        runs->back().second += count;
+    else
+        runs->push_back(std::make_pair(first, count));
+}
+
+/* The attributes of one MFT entry. */
+class NtfsEntryWriter {
+public:
+    NtfsEntryWriter(size_t size)
+        : m_buf(size, 0), m_pos(after_fixup(48, size)) {}
+
+    // bytes left for attributes (keeping the end marker)
+    size_t room() const { return m_buf.size() - m_pos - 8; }
+
+    bool resident(uint32_t type, const std::u16string &name,
+        const std::vector<uint8_t> &content, uint8_t idxflag = 0) {
+        size_t soff = roundup8(24 + 2 * name.size());
+        size_t len = roundup8(soff + content.size());
+        uint8_t *a = header(type, name, len, 0, 24);
+        if (a == nullptr)
+            return false;
+        put32(a + 16, (uint32_t)content.size());
+        put16(a + 20, (uint16_t)soff);
+        a[22] = idxflag;
+        if (!content.empty())
+            memcpy(a + soff, content.data(), content.size());
+        return true;
+    }
+
+    // compsize is the number of bytes in the non-sparse clusters of a
+    // compressed attribute
+    bool nonresident(uint32_t type, const std::u16string &name,
+        const NtfsRunList &runs, uint64_t size, uint64_t alloc,
+        uint64_t initsize, bool compressed = false, uint64_t compsize = 0) {
+        std::vector<uint8_t> rl = encode_runs(runs);
+        size_t hdr = compressed ? 72 : 64;
+        size_t run_off = roundup8(hdr + 2 * name.size());
+        size_t len = roundup8(run_off + rl.size());
+        uint8_t *a = header(type, name, len, 1, hdr);
+        if (a == nullptr)
+            return false;
+        uint64_t nclust = run_clusters(runs);
+        put64(a + 16, 0);
+        put64(a + 24, nclust ? nclust - 1 : 0);
+        put16(a + 32, (uint16_t)run_off);
+        put64(a + 40, alloc);
+        put64(a + 48, size);
+        put64(a + 56, initsize);
+        if (compressed) {
+            put16(a + 12, 0x0001);
+            a[34] = 4;                          // 2^4 clusters per unit
+            put64(a + 64, compsize);
+        }
+        memcpy(a + run_off, rl.data(), rl.size());
+        return true;
+    }
+
+    std::vector<uint8_t> finish(uint64_t inum, uint16_t flags) {
+        uint8_t *b = m_buf.data();
+        put32(b + m_pos, 0xFFFFFFFF);
+        memcpy(b, "FILE", 4);
+        put16(b + 16, 1);                       // sequence
+        put16(b + 18, 1);                       // link count
+        put16(b + 20, (uint16_t)after_fixup(48, m_buf.size()));
+        put16(b + 22, flags);
+        put32(b + 24, (uint32_t)(m_pos + 8));
+        put32(b + 28, (uint32_t)m_buf.size());
+        put16(b + 40, m_id);
+        put32(b + 44, (uint32_t)inum);
+        apply_fixup(b, m_buf.size(), 48);
+        return m_buf;
+    }
+
+private:
+    uint8_t *header(uint32_t type, const std::u16string &name, size_t len,
+        uint8_t nonres, size_t name_off) {
+        if (len > room())
+            return nullptr;
+        uint8_t *a = &m_buf[m_pos];
+        put32(a, type);
+        put32(a + 4, (uint32_t)len);
+        a[8] = nonres;
+        a[9] = (uint8_t)name.size();
+        put16(a + 10, (uint16_t)name_off);
+        put16(a + 14, m_id++);
+        for (size_t i = 0; i < name.size(); i++)
+            put16(a + name_off + 2 * i, (uint16_t)name[i]);
+        m_pos += len;
+        return a;
+    }
+
+    std::vector<uint8_t> m_buf;
+    size_t m_pos;
+    uint16_t m_id = 0;
+};
+
+NtfsImageBuilder::NtfsImageBuilder(const NtfsImageOptions &opts)
+    : m_opts(opts), m_rng(opts.seed ? opts.seed : 1)
+{
+    static const char *const system_names[FIRST_USER_ENTRY] = {
+        "$MFT", "$MFTMirr", "$LogFile", "$Volume", "$AttrDef", ".",
+        "$Bitmap", "$Boot", "$BadClus", "$Secure", "$UpCase", "$Extend",
+        nullptr, nullptr, nullptr, nullptr
+    };
+    const uint64_t root = 5;
+
+    for (uint64_t i = 0; i < FIRST_USER_ENTRY; i++) {
+        Node n;
+        n.name = system_names[i] ? system_names[i] : "";
+        n.parent = root;
+        n.is_dir = (i == root) || (i == 11);
+        n.in_use = system_names[i] != nullptr;
+        n.size = 0;
+        m_nodes.push_back(n);
+    }
+
+    char name[64];
+    for (uint32_t d = 0; d < m_opts.num_dirs; d++) {
+        Node n;
+        snprintf(name, sizeof(name), "dir_%03u", d);
+        n.name = name;
+        n.parent = root;
+        n.is_dir = true;
+        n.in_use = true;
+        n.size = 0;
+        m_nodes.push_back(n);
+        m_files.push_back({ std::string("/") + name, m_nodes.size() - 1, 0,
+            true, false, 0 });
+    }
+
+    for (uint32_t f = 0; f < m_opts.num_files; f++) {
+        Node n;
+        uint32_t slot = f % (m_opts.num_dirs + 1);
+        if (m_opts.mixed_names) {
+            // the order of these depends on the case of the letters
+            // after them, "_" and "[" sort between upper and lower case
+            // ASCII, "\xc3\x97" (U+00D7) between upper and lower case
+            // Latin-1
+            static const char *const formats[] = {
+                "file_%05u.bin", "File%05u.BIN", "~file%05u", "[fi]le%05u.txt",
+                "caf\xc3\xa9%05u", "caf\xc3\x97%05u", "CAF\xc3\x89_%05u",
+            };
+            snprintf(name, sizeof(name), formats[f % 7], f);
+        }
+        else {
+            snprintf(name, sizeof(name), "file_%05u.bin", f);
+        }
+        n.name = name;
+        n.parent = slot ? FIRST_USER_ENTRY + slot - 1 : root;
+        n.is_dir = false;
+        n.in_use = true;
+        m_rng ^= m_rng << 13;
+        m_rng ^= m_rng >> 17;
+        m_rng ^= m_rng << 5;
+        if (f % 5 == 0)
+            n.size = m_rng % (RESIDENT_MAX + 1);
+        else
+            n.size = m_rng % (m_opts.max_file_size + 1);
+        n.compressed = m_opts.compressed && n.size > RESIDENT_MAX;
+        n.initsize = n.size;
+        if (n.compressed && m_opts.short_initsize && (f % 2))
+            n.initsize = n.size - (m_rng >> 8) % (n.size / 2);
+        m_nodes.push_back(n);
+        std::string path = slot ? m_files[slot - 1].path : std::string();
+        m_files.push_back({ path + "/" + name, m_nodes.size() - 1, n.size,
+            false, n.compressed, n.initsize });
+    }
+
+    for (uint32_t s = 0; s < m_opts.spare_entries; s++) {
+        Node n;
+        n.parent = root;
+        n.is_dir = false;
+        n.in_use = false;
+        n.size = 0;
+        m_nodes.push_back(n);
+    }
+
+    for (uint64_t i = 0; i < m_nodes.size(); i++) {
+        if (m_nodes[i].in_use && i != m_nodes[i].parent)
+            m_nodes[m_nodes[i].parent].children.push_back(i);
+    }
+    m_nodes[root].children.push_back(root);     // the "." entry
+    m_num_entries = m_nodes.size();
+}
+
+bool NtfsImageBuilder::alloc(uint64_t nclust, RunList *runs, bool fragment) {
+    for (uint64_t i = 0; i < nclust; i++) {
+        if (fragment && m_opts.fragmentation > 0) {
+            m_rng ^= m_rng << 13;
+            m_rng ^= m_rng >> 17;
+            m_rng ^= m_rng << 5;
+            if ((m_rng % 10000) < (uint32_t)(m_opts.fragmentation * 10000))
+                m_next += 1 + (m_rng >> 16) % 3;
+        }
+        if (m_next >= m_opts.num_clusters)
+            return false;
+        if (!runs->empty() && runs->back().first + runs->back().second == m_next)
+            runs->back().second++;
+        else
+            runs->push_back(std::make_pair(m_next, (uint64_t)1));
+        m_bitmap[m_next / 8] |= (uint8_t)(1u << (m_next % 8));
+        m_next++;
+    }
+    return true;
+}
+
+void NtfsImageBuilder::write_runs(const RunList &runs, const uint8_t *data,
+    uint64_t len) {
+    uint64_t off = 0;
+    for (const auto &run : runs) {
+        if (off >= len)
+            break;
+        uint64_t n = std::min(len - off, run.second * m_opts.cluster_size);
+        if (run.first == SPARSE) {
+            off += n;
+            continue;
+        }
+        if (m_image.size() < run.first * m_opts.cluster_size + n)
+            m_image.resize(run.first * m_opts.cluster_size + n, 0);
+        memcpy(&m_image[run.first * m_opts.cluster_size], data + off, n);
+        off += n;
+    }
+}
+
+/* Lay out the $DATA of a compressed file: each compression unit is sparse
+ * if it is all zeros, LZNT1 data followed by a sparse run if that saves at
+ * least a cluster, and otherwise stored as is. */
+bool NtfsImageBuilder::write_compressed(uint64_t inum) {
+    Node &n = m_nodes[inum];
+    const uint64_t unit = (uint64_t)COMP_UNIT * m_opts.cluster_size;
+    std::vector<uint8_t> data(unit);
+    for (uint64_t off = 0; off < n.size; off += unit) {
+        size_t len = (size_t)std::min(unit, n.size - off);
+        fill_compressible(inum, off, data.data(), len);
+        if (std::all_of(data.begin(), data.begin() + len,
+                [](uint8_t b) { return b == 0; })) {
+            append_run(&n.runs, SPARSE, COMP_UNIT);
+            continue;
+        }
+
+        std::vector<uint8_t> comp = lznt1_compress(data.data(), len);
+        uint64_t nclust = ncluster(comp.size());
+        if (nclust >= COMP_UNIT) {
+            comp.assign(data.begin(), data.begin() + len);
+            nclust = COMP_UNIT;
+        }
+        RunList runs;
+        if (!alloc(nclust, &runs, true))
+            return false;
+        write_runs(runs, comp.data(), comp.size());
+        for (const auto &run : runs)
+            append_run(&n.runs, run.first, run.second);
+        append_run(&n.runs, SPARSE, COMP_UNIT - nclust);
+    }
+    return true;
+}
+
+uint64_t NtfsImageBuilder::entry_addr(uint64_t inum) const {
+    uint64_t off = inum * m_opts.mft_entry_size;
+    for (const auto &run : m_mft_runs) {
+        uint64_t len = run.second * m_opts.cluster_size;
+        if (off < len)
+            return run.first * m_opts.cluster_size + off;
+        off -= len;
+    }
+    return 0;
+}
+
+int NtfsImageBuilder::index_depth(uint64_t inum) const {
+    return m_nodes[inum].depth;
+}
+
+void NtfsImageBuilder::expected_content(const NtfsExpectedFile &file,
+    uint64_t off, uint8_t *buf, size_t len) {
+    file_content(file.inum, file.compressed, off, buf, len);
+    for (size_t i = 0; i < len; i++) {
+        if (off + i >= file.initsize)
+            buf[i] = 0;
+    }
+}
+
+std::vector<uint8_t> NtfsImageBuilder::fname_content(uint64_t inum) const {
+    const Node &n = m_nodes[inum];
+    std::u16string name = to_utf16(n.name);
+    std::vector<uint8_t> c(66 + 2 * name.size(), 0);
+    put64(&c[0], n.parent | ((uint64_t)1 << 48));
+    for (int t = 0; t < 4; t++)
+        put64(&c[8 + 8 * t], NT_TIME);
+    uint64_t alloc = n.runs.empty() ? roundup8(n.size)
+        : run_clusters(n.runs) * m_opts.cluster_size;
+    put64(&c[40], alloc);
+    put64(&c[48], n.size);
+    put64(&c[56], n.is_dir ? 0x10000000 : (inum < FIRST_USER_ENTRY ? 0x6 : 0x20));
+    c[64] = (uint8_t)name.size();
+    c[65] = 1;                                  // WIN32 name space
+    for (size_t i = 0; i < name.size(); i++)
+        put16(&c[66 + 2 * i], (uint16_t)name[i]);
+    return c;
+}
+
+uint64_t NtfsImageBuilder::record_vcn(int64_t rec) const {
+    return (uint64_t)rec * m_opts.index_record_size / m_opts.cluster_size;
+}
+
+/* Index record number r (INDX) holding the serialized entries ents. */
+void NtfsImageBuilder::index_record(uint8_t *rec,
+    const std::vector<uint8_t> &ents, int64_t r, bool children) const {
+    const size_t rec_size = m_opts.index_record_size;
+    const size_t rec_start = after_fixup(40, rec_size);
+    memcpy(rec, "INDX", 4);
+    put64(rec + 16, record_vcn(r));
+    put32(rec + 24, (uint32_t)(rec_start - 24));
+    put32(rec + 28, (uint32_t)(rec_start - 24 + ents.size()));
+    put32(rec + 32, (uint32_t)(rec_size - 24));
+    put32(rec + 36, children ? 1 : 0);
+    memcpy(rec + rec_start, ents.data(), ents.size());
+    apply_fixup(rec, rec_size, 40);
+}
+
+/* The index entries of one node, from offset start of a buffer of cap
+ * bytes; returns an empty vector if they do not fit. */
+std::vector<uint8_t> NtfsImageBuilder::serialize_node(
+    const std::vector<IndexEntry> &entries, int64_t end_child, size_t start,
+    size_t cap) const {
+    std::vector<uint8_t> out;
+    bool sub = end_child >= 0;
+    for (const IndexEntry &e : entries) {
+        size_t len = roundup8(16 + e.key.size()) + (sub ? 8 : 0);
+        size_t pos = out.size();
+        out.resize(pos + len, 0);
+        put64(&out[pos], e.ref);
+        put16(&out[pos + 8], (uint16_t)len);
+        put16(&out[pos + 10], (uint16_t)e.key.size());
+        out[pos + 12] = sub ? 0x01 : 0;
+        memcpy(&out[pos + 16], e.key.data(), e.key.size());
+        if (sub)
+            put64(&out[pos + len - 8], record_vcn(e.child));
+    }
+    size_t pos = out.size();
+    size_t len = 16 + (sub ? 8 : 0);
+    out.resize(pos + len, 0);
+    put16(&out[pos + 8], (uint16_t)len);
+    out[pos + 12] = (sub ? 0x01 : 0) | 0x02;
+    if (sub)
+        put64(&out[pos + len - 8], record_vcn(end_child));
+    if (start + out.size() > cap)
+        out.clear();
+    return out;
+}
+
+/* Build the $I30 B-tree of a directory bottom-up: while a level does not
+ * fit in $INDEX_ROOT, it is split into index records and every entry
+ * between two records moves up a level. */
+void NtfsImageBuilder::add_index(uint64_t inum, NtfsEntryWriter &w, bool *ok) {
+    const size_t rec_size = m_opts.index_record_size;
+    const size_t rec_start = after_fixup(40, rec_size);
+    const std::u16string i30 = u"$I30";
+    Node &dir = m_nodes[inum];
+
+    std::vector<IndexEntry> level;
+    for (uint64_t c : dir.children) {
+        IndexEntry e;
+        e.key = fname_content(c);
+        e.upname = upcase(to_utf16(m_nodes[c].name));
+        e.ref = c | ((uint64_t)1 << 48);
+        e.child = -1;
+        level.push_back(e);
+    }
+    std::sort(level.begin(), level.end(),
+        [](const IndexEntry &a, const IndexEntry &b) { return a.upname < b.upname; });
+    int64_t end_child = -1;
+
+    // room for the $INDEX_ROOT, $INDEX_ALLOCATION and $BITMAP headers
+    size_t root_cap = w.room() > 240 ? w.room() - 240 : 0;
+    std::vector<IndexRecord> recs;
+    dir.depth = 1;
+    while (serialize_node(level, end_child, 0, root_cap).empty()) {
+        std::vector<IndexEntry> parent, cur;
+        for (IndexEntry &e : level) {
+            std::vector<IndexEntry> next(cur);
+            next.push_back(e);
+            if (!cur.empty()
+                && serialize_node(next, e.child >= 0 ? 0 : -1, rec_start, rec_size).empty()) {
+                recs.push_back({ cur, e.child });
+                e.child = (int64_t)recs.size() - 1;
+                parent.push_back(e);
+                cur.clear();
+            }
+            else {
+                cur.push_back(e);
+            }
+        }
+        recs.push_back({ cur, end_child });
+        level = parent;
+        end_child = (int64_t)recs.size() - 1;
+        dir.depth++;
+    }
+
+    std::vector<uint8_t> root(32, 0);
+    put32(&root[0], 0x30);
+    put32(&root[4], 1);                         // collate file names
+    put32(&root[8], (uint32_t)rec_size);
+    root[12] = (uint8_t)(rec_size / m_opts.cluster_size);
+    std::vector<uint8_t> list = serialize_node(level, end_child, 0, root_cap);
+    put32(&root[16], 16);
+    put32(&root[20], (uint32_t)(16 + list.size()));
+    put32(&root[24], (uint32_t)(16 + list.size()));
+    put32(&root[28], end_child >= 0 ? 1 : 0);
+    root.insert(root.end(), list.begin(), list.end());
+    if (!w.resident(0x90, i30, root)) {
+        *ok = false;
+        return;
+    }
+    if (recs.empty())
+        return;
+
+    std::vector<uint8_t> records(recs.size() * rec_size, 0);
+    std::vector<uint8_t> bitmap(roundup8((recs.size() + 7) / 8), 0);
+    for (size_t r = 0; r < recs.size(); r++) {
+        std::vector<uint8_t> ents = serialize_node(recs[r].entries,
+            recs[r].end_child, rec_start, rec_size);
+        index_record(&records[r * rec_size], ents, (int64_t)r,
+            recs[r].end_child >= 0);
+        bitmap[r / 8] |= (uint8_t)(1u << (r % 8));
+    }
+
+    RunList runs;
+    if (!alloc(ncluster(records.size()), &runs, false)) {
+        *ok = false;
+        return;
+    }
+    write_runs(runs, records.data(), records.size());
+    if (!w.nonresident(0xA0, i30, runs, records.size(),
+            run_clusters(runs) * m_opts.cluster_size, records.size())
+        || !w.resident(0xB0, i30, bitmap))
+        *ok = false;
+}
+
+static const char OWNER_DOMAIN[] = "S-1-5-21-1004336348-1177238915-682003330";
+
+uint32_t NtfsImageBuilder::sec_id(uint64_t inum) const {
+    return m_opts.security_ids ? 256 + (uint32_t)(inum % m_opts.security_ids) : 0;
+}
+
+std::string NtfsImageBuilder::owner_sid(uint64_t inum) const {
+    if (!m_opts.security_ids)
+        return std::string();
+    return std::string(OWNER_DOMAIN) + "-"
+        + std::to_string(1000 + inum % m_opts.security_ids);
+}
+
+/* $Secure with one security descriptor per owner.  $SDS keeps them in
+ * 256 KiB blocks that are each followed by a mirror copy, and $SII
+ * indexes them by security id in leaf records under at most one more
+ * level of index records. */
+bool NtfsImageBuilder::add_secure() {
+    const uint64_t block = 256 * 1024;
+    const size_t rec_size = m_opts.index_record_size;
+    const size_t rec_start = after_fixup(40, rec_size);
+    const uint32_t ent_size = 20 + 20 + 28;     // header, descriptor, owner SID
+    static const uint32_t domain[4] = { 21, 1004336348, 1177238915, 682003330 };
+
+    std::vector<uint8_t> sds;
+    std::vector<std::vector<uint8_t> > sii;
+    uint64_t next = 0;
+    for (uint32_t k = 0; k < m_opts.security_ids; k++) {
+        uint32_t id = 256 + k;
+        uint32_t hash = (uint32_t)mix64(id);
+        uint64_t off = next;
+        if (off % block + ent_size > block)
+            off = (off / block + 2) * block;    // past the mirror
+        next = off + ((ent_size + 15) & ~15u);
+        sds.resize(off + ent_size, 0);
+        uint8_t *e = &sds[off];
+        put32(e, hash);
+        put32(e + 4, id);
+        put64(e + 8, off);
+        put32(e + 16, ent_size);
+        uint8_t *sd = e + 20;                   // self-relative descriptor
+        sd[0] = 1;
+        put16(sd + 2, 0x8000);
+        put32(sd + 4, 20);
+        uint8_t *sid = sd + 20;
+        sid[0] = 1;
+        sid[1] = 5;
+        sid[7] = 5;                             // NT authority
+        for (int i = 0; i < 4; i++)
+            put32(sid + 8 + 4 * i, domain[i]);
+        put32(sid + 24, 1000 + k);
+
+        std::vector<uint8_t> ie(40, 0);
+        put16(&ie[0], 0x14);
+        put16(&ie[2], 0x14);
+        put16(&ie[8], 0x28);
+        put16(&ie[10], 4);
+        put32(&ie[16], id);
+        put32(&ie[20], hash);
+        put32(&ie[24], id);
+        put64(&ie[28], off);
+        put32(&ie[36], ent_size);
+        sii.push_back(ie);
+    }
+    // the mirror of every block
+    uint64_t nblocks = (sds.size() + 2 * block - 1) / (2 * block);
+    sds.resize(std::max<uint64_t>(sds.size(), (2 * nblocks - 1) * block), 0);
+    for (uint64_t b = 0; b < nblocks; b++) {
+        uint64_t used = std::min<uint64_t>(block, next - 2 * b * block);
+        if (sds.size() < (2 * b + 1) * block + used)
+            sds.resize((2 * b + 1) * block + used, 0);
+        memcpy(&sds[(2 * b + 1) * block], &sds[2 * b * block], used);
+    }
+
+    // leaf records, with one entry moving up between two leaves
+    const size_t per_leaf = (rec_size - rec_start - 16) / 40;
+    std::vector<std::vector<uint8_t> > leaves;
+    std::vector<uint8_t> upper;
+    for (size_t i = 0; i < sii.size();) {
+        std::vector<uint8_t> leaf;
+        for (size_t j = 0; j < per_leaf && i < sii.size(); j++, i++)
+            leaf.insert(leaf.end(), sii[i].begin(), sii[i].end());
+        leaf.resize(leaf.size() + 16, 0);
+        put16(&leaf[leaf.size() - 8], 0x10);
+        put16(&leaf[leaf.size() - 4], 0x02);
+        leaves.push_back(leaf);
+        if (i + 1 < sii.size()) {
+            std::vector<uint8_t> ie = sii[i++];
+            ie.resize(0x30, 0);
+            put16(&ie[8], 0x30);
+            put16(&ie[12], 0x01);
+            put64(&ie[40], record_vcn((int64_t)leaves.size() - 1));
+            upper.insert(upper.end(), ie.begin(), ie.end());
+        }
+    }
+    if (upper.size() + 24 > rec_size - rec_start)
+        return false;
+
+    // the top node points to the last leaf, the root to the top node
+    int64_t top = 0;
+    std::vector<uint8_t> records(leaves.size() * rec_size, 0);
+    for (size_t r = 0; r < leaves.size(); r++)
+        index_record(&records[r * rec_size], leaves[r], (int64_t)r, false);
+    if (leaves.size() > 1) {
+        upper.resize(upper.size() + 24, 0);
+        put16(&upper[upper.size() - 16], 0x18);
+        put16(&upper[upper.size() - 12], 0x03);
+        put64(&upper[upper.size() - 8], record_vcn((int64_t)leaves.size() - 1));
+        top = (int64_t)leaves.size();
+        records.resize(records.size() + rec_size, 0);
+        index_record(&records[top * rec_size], upper, top, true);
+    }
+    uint64_t nrecs = records.size() / rec_size;
+    m_sii_bitmap.assign(roundup8((nrecs + 7) / 8), 0);
+    for (uint64_t r = 0; r < nrecs; r++)
+        m_sii_bitmap[r / 8] |= (uint8_t)(1u << (r % 8));
+
+    m_sii_root.assign(32 + 24, 0);
+    put32(&m_sii_root[4], 0x10);                // collate as 32-bit numbers
+    put32(&m_sii_root[8], (uint32_t)rec_size);
+    m_sii_root[12] = (uint8_t)(rec_size / m_opts.cluster_size);
+    put32(&m_sii_root[16], 16);
+    put32(&m_sii_root[20], 16 + 24);
+    put32(&m_sii_root[24], 16 + 24);
+    put32(&m_sii_root[28], 1);
+    put16(&m_sii_root[32 + 8], 0x18);
+    put16(&m_sii_root[32 + 12], 0x03);
+    put64(&m_sii_root[32 + 16], record_vcn(top));
+
+    RunList sds_runs;
+    m_sii_runs.clear();
+    if (!alloc(ncluster(sds.size()), &sds_runs, false)
+        || !alloc(ncluster(records.size()), &m_sii_runs, false))
+        return false;
+    write_runs(sds_runs, sds.data(), sds.size());
+    write_runs(m_sii_runs, records.data(), records.size());
+    m_sii_size = records.size();
+    m_nodes[9].runs = sds_runs;
+    m_nodes[9].size = sds.size();
+    return true;
+}
+
+std::vector<uint8_t> NtfsImageBuilder::make_entry(uint64_t inum, bool *ok) {
+    const Node &n = m_nodes[inum];
+    NtfsEntryWriter w(m_opts.mft_entry_size);
+    if (!n.in_use)
+        return w.finish(inum, 0);
+
+    std::vector<uint8_t> si(72, 0);
+    for (int t = 0; t < 4; t++)
+        put64(&si[8 * t], NT_TIME);
+    put32(&si[32], inum < FIRST_USER_ENTRY ? 0x6 : 0x20);
+    put32(&si[52], sec_id(inum));
+    bool good = w.resident(0x10, u"", si)
+        && w.resident(0x30, u"", fname_content(inum), 1);
+
+    if (inum == 3) {
+        std::vector<uint8_t> vinfo(12, 0);
+        vinfo[8] = 3;
+        vinfo[9] = 1;
+        good = good && w.resident(0x70, u"", vinfo);
+    }
+
+    if (n.is_dir) {
+        if (good)
+            add_index(inum, w, &good);
+    }
+    else if (inum == 9 && !m_sii_root.empty()) {
+        good = good
+            && w.nonresident(0x80, u"$SDS", n.runs, n.size,
+                run_clusters(n.runs) * m_opts.cluster_size, n.size)
+            && w.resident(0x90, u"$SII", m_sii_root)
+            && w.nonresident(0xA0, u"$SII", m_sii_runs, m_sii_size,
+                run_clusters(m_sii_runs) * m_opts.cluster_size, m_sii_size)
+            && w.resident(0xB0, u"$SII", m_sii_bitmap);
+    }
+    else if (!n.runs.empty()) {
+        uint64_t compsize = 0;
+        for (const auto &run : n.runs) {
+            if (run.first != SPARSE)
+                compsize += run.second * m_opts.cluster_size;
+        }
+        good = good && w.nonresident(0x80, u"", n.runs, n.size,
+            run_clusters(n.runs) * m_opts.cluster_size,
+            n.compressed ? n.initsize : n.size, n.compressed, compsize);
+    }
+    else {
+        std::vector<uint8_t> data(n.size);
+        file_content(inum, n.compressed, 0, data.data(), data.size());
+        good = good && w.resident(0x80, u"", data);
+    }
+    if (!good)
+        *ok = false;
+
+    std::vector<uint8_t> entry = w.finish(inum, n.is_dir ? 0x3 : 0x1);
+    if (std::find(m_opts.corrupt_entries.begin(), m_opts.corrupt_entries.end(),
+            inum) != m_opts.corrupt_entries.end())
+        put16(&entry[510], USN + 1);
+    return entry;
+}
+
+bool NtfsImageBuilder::write(FILE *out) {
+    const uint64_t cs = m_opts.cluster_size;
+    const uint64_t rsize = m_opts.mft_entry_size;
+    if (cs < 512 || cs > 4096 || (cs & (cs - 1)) || rsize < 512
+        || m_opts.index_record_size < cs)
+        return false;
+
+    m_rng = m_opts.seed ? m_opts.seed : 1;
+    m_image.assign(std::min<uint64_t>(m_opts.num_clusters, 16) * cs, 0);
+    m_bitmap.assign(roundup8((m_opts.num_clusters + 7) / 8), 0);
+    m_next = 0;
+    m_mft_runs.clear();
+    m_sii_root.clear();
+    for (Node &n : m_nodes)
+        n.runs.clear();
+
+    // boot sector and the rest of $Boot
+    RunList boot;
+    if (!alloc(ncluster(8192), &boot, false))
+        return false;
+    m_nodes[7].runs = boot;
+    m_nodes[7].size = run_clusters(boot) * cs;
+
+    // $MFT, split into runs with a gap after each
+    uint64_t mft_size = m_num_entries * rsize;
+    uint64_t mft_left = ncluster(mft_size);
+    uint32_t nruns = m_opts.mft_runs ? m_opts.mft_runs : 1;
+    for (uint32_t r = 0; r < nruns && mft_left > 0; r++) {
+        uint64_t len = (r + 1 == nruns) ? mft_left : mft_left / (nruns - r);
+        if (r == 0)
+            len = std::max(len, ncluster(FIRST_USER_ENTRY * rsize));
+        if (m_opts.mft_odd_runs && (len % 2) == 0)
+            len++;
+        len = std::max<uint64_t>(len, 1);
+        RunList piece;
+        if (!alloc(len, &piece, false))
+            return false;
+        m_mft_runs.push_back(piece[0]);
+        mft_left = len < mft_left ? mft_left - len : 0;
+        m_next += 3;
+    }
+    m_nodes[0].runs = m_mft_runs;
+    m_nodes[0].size = mft_size;
+
+    RunList mirr;
+    if (!alloc(ncluster(4 * rsize), &mirr, false))
+        return false;
+    m_nodes[1].runs = mirr;
+    m_nodes[1].size = 4 * rsize;
+
+    RunList bmap;
+    if (!alloc(ncluster(m_bitmap.size()), &bmap, false))
+        return false;
+    m_nodes[6].runs = bmap;
+    m_nodes[6].size = m_bitmap.size();
+
+    if (m_opts.upcase_table) {
+        std::vector<uint8_t> table(2 * 65536);
+        for (uint32_t c = 0; c < 65536; c++)
+            put16(&table[2 * c], upcase_char((char16_t)c));
+        RunList runs;
+        if (!alloc(ncluster(table.size()), &runs, false))
+            return false;
+        write_runs(runs, table.data(), table.size());
+        m_nodes[10].runs = runs;
+        m_nodes[10].size = table.size();
+    }
+
+    if (m_opts.security_ids && !add_secure())
+        return false;
+
+    for (uint64_t i = FIRST_USER_ENTRY; i < m_num_entries; i++) {
+        Node &n = m_nodes[i];
+        if (!n.in_use || n.is_dir || n.size <= RESIDENT_MAX)
+            continue;
+        if (n.compressed) {
+            if (!write_compressed(i))
+                return false;
+            continue;
+        }
+        if (!alloc(ncluster(n.size), &n.runs, true))
+            return false;
+        std::vector<uint8_t> data(n.size);
+        fill_content(i, 0, data.data(), data.size());
+        write_runs(n.runs, data.data(), data.size());
+    }
+
+    // the entries (this also lays out the directory indexes)
+    std::vector<uint8_t> mft(mft_size);
+    bool ok = true;
+    for (uint64_t i = 0; i < m_num_entries; i++) {
+        std::vector<uint8_t> e = make_entry(i, &ok);
+        memcpy(&mft[i * rsize], e.data(), rsize);
+    }
+    if (!ok)
+        return false;
+    write_runs(m_mft_runs, mft.data(), mft.size());
+    write_runs(mirr, mft.data(), 4 * rsize);
+
+    // allocation is done
+    for (const auto &run : m_opts.reserved_runs) {
+        for (uint64_t c = run.first; c < run.first + run.second
+            && c < m_opts.num_clusters; c++)
+            m_bitmap[c / 8] |= (uint8_t)(1u << (c % 8));
+    }
+    for (uint64_t c = m_opts.num_clusters; c < m_bitmap.size() * 8; c++)
+        m_bitmap[c / 8] |= (uint8_t)(1u << (c % 8));
+    write_runs(bmap, m_bitmap.data(), m_bitmap.size());
+
+    uint8_t *bs = m_image.data();
+    bs[0] = 0xEB;
+    bs[1] = 0x52;
+    bs[2] = 0x90;
+    memcpy(bs + 3, "NTFS    ", 8);
+    put16(bs + 11, 512);
+    bs[13] = (uint8_t)(cs / 512);
+    bs[21] = 0xF8;
+    put64(bs + 40, m_opts.num_clusters * cs / 512);
+    put64(bs + 48, m_mft_runs[0].first);
+    put64(bs + 56, mirr[0].first);
+    int8_t log2 = 0;
+    while (((uint64_t)1 << log2) < rsize)
+        log2++;
+    bs[64] = rsize >= cs ? (uint8_t)(rsize / cs) : (uint8_t)-log2;
+    bs[68] = (uint8_t)(m_opts.index_record_size / cs);
+    put64(bs + 72, 0x1234567890ABCDEFULL);
+    bs[510] = 0x55;
+    bs[511] = 0xAA;
+
+    if (fwrite(m_image.data(), m_image.size(), 1, out) != 1)
+        return false;
+    if (m_image.size() < m_opts.num_clusters * cs) {
+        if (fseek(out, (long)(m_opts.num_clusters * cs - 1), SEEK_SET) != 0
+            || fputc(0, out) != 0)
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,150 @@
+/*
+ * Synthetic NTFS image generator used by the NTFS unit tests.  Builds a
+ * small but complete volume (boot sector, $MFT with an optionally
+ * fragmented run list, $Volume, $Bitmap, optionally $UpCase, root and
+ * subdirectories with $I30 B-tree indexes, resident, non-resident and
+ * LZNT1 compressed files) with configurable geometry; file contents are a
+ * pure function of the MFT entry number and offset.
+ */
+#ifndef _TSK_TEST_NTFS_IMAGE_H
+#define _TSK_TEST_NTFS_IMAGE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+class NtfsEntryWriter;
+
+struct NtfsImageOptions {
+    uint32_t cluster_size = 4096;       // 512..4096, power of two
+    uint32_t mft_entry_size = 1024;
+    uint32_t index_record_size = 4096;  // $I30 index record (INDX) size
+    uint64_t num_clusters = 4096;       // volume size
+    uint32_t num_dirs = 2;              // subdirectories of the root directory
+    uint32_t num_files = 40;            // spread over root and subdirectories
+    uint32_t max_file_size = 20000;     // files are 0..max_file_size bytes long
+    uint32_t spare_entries = 16;        // unused MFT entries after the last file
+    uint32_t mft_runs = 1;              // fragments of $MFT
+    bool mft_odd_runs = false;          // make the $MFT runs an odd number of clusters
+    double fragmentation = 0.0;         // chance (0..1) of splitting file data
+    std::vector<uint32_t> corrupt_entries;  // entries written with a bad update sequence
+    std::vector<std::pair<uint64_t, uint64_t> > reserved_runs;  // (first, count) marked allocated, no owner
+    bool compressed = false;            // store non-resident files LZNT1 compressed, with compressible content
+    bool short_initsize = false;        // give every other compressed file an initialized size below its size
+    bool upcase_table = false;          // write an $UpCase table (ASCII and Latin-1 letters)
+    bool mixed_names = false;           // name files in mixed case, with symbols and Latin-1 letters
+    uint32_t security_ids = 0;          // owners given to the entries in turn, in $Secure ($SDS and $SII)
+    uint32_t seed = 1;
+};
+
+struct NtfsExpectedFile {
+    std::string path;                   // e.g. "/dir_001/file_00004.bin"
+    uint64_t inum;
+    uint64_t size;
+    bool is_dir;
+    bool compressed;
+    uint64_t initsize;                  // bytes from here on read as zeros
+};
+
+class NtfsImageBuilder {
+public:
+    explicit NtfsImageBuilder(const NtfsImageOptions &opts);
+
+    /**
+     * Write the image to out.  Clusters after the last one in use are left
+     * as a hole, so large volumes make sparse files.
+     * @returns false on I/O error or if the volume is too small
+     */
+    bool write(FILE *out);
+
+    const std::vector<NtfsExpectedFile> &files() const { return m_files; }
+    uint64_t num_entries() const { return m_num_entries; }
+
+    /** Runs of $MFT as (first cluster, number of clusters). */
+    const std::vector<std::pair<uint64_t, uint64_t> > &mft_runs() const {
+        return m_mft_runs;
+    }
+
+    /** Byte address of the start of an MFT entry in the volume. */
+    uint64_t entry_addr(uint64_t inum) const;
+
+    /** Depth of the $I30 tree of a directory (1 = only $INDEX_ROOT). */
+    int index_depth(uint64_t inum) const;
+
+    /** Owner SID of an MFT entry ("" without security_ids). */
+    std::string owner_sid(uint64_t inum) const;
+
+    /** Size of $Secure:$SDS (0 without security_ids). */
+    uint64_t sds_size() const { return m_opts.security_ids ? m_nodes[9].size : 0; }
+
+    bool cluster_allocated(uint64_t clust) const {
+        return (m_bitmap[clust / 8] >> (clust % 8)) & 1;
+    }
+
+    /** Expected content of bytes [off, off + len) of a regular file. */
+    static void expected_content(const NtfsExpectedFile &file, uint64_t off,
+        uint8_t *buf, size_t len);
+
+private:
+    typedef std::vector<std::pair<uint64_t, uint64_t> > RunList;
+
+    struct Node {
+        std::string name;
+        uint64_t parent;
+        bool is_dir;
+        bool in_use;
+        uint64_t size;
+        bool compressed = false;
+        uint64_t initsize = 0;
+        RunList runs;                   // non-resident $DATA
+        std::vector<uint64_t> children;
+        int depth = 1;
+    };
+
+    struct IndexEntry {
+        std::vector<uint8_t> key;       // $FILE_NAME content
+        std::u16string upname;
+        uint64_t ref;
+        int64_t child;                  // index record number or -1
+    };
+
+    struct IndexRecord {
+        std::vector<IndexEntry> entries;
+        int64_t end_child;
+    };
+
+    bool alloc(uint64_t nclust, RunList *runs, bool fragment);
+    uint64_t ncluster(uint64_t bytes) const {
+        return (bytes + m_opts.cluster_size - 1) / m_opts.cluster_size;
+    }
+    std::vector<uint8_t> fname_content(uint64_t inum) const;
+    std::vector<uint8_t> make_entry(uint64_t inum, bool *ok);
+    void add_index(uint64_t inum, NtfsEntryWriter &w, bool *ok);
+    std::vector<uint8_t> serialize_node(const std::vector<IndexEntry> &entries,
+        int64_t end_child, size_t start, size_t cap) const;
+    uint64_t record_vcn(int64_t rec) const;
+    void index_record(uint8_t *rec, const std::vector<uint8_t> &ents,
+        int64_t r, bool children) const;
+    uint32_t sec_id(uint64_t inum) const;
+    bool add_secure();
+    void write_runs(const RunList &runs, const uint8_t *data, uint64_t len);
+    bool write_compressed(uint64_t inum);
+
+    NtfsImageOptions m_opts;
+    uint32_t m_rng;
+    uint64_t m_next = 0;
+    uint64_t m_num_entries = 0;
+    std::vector<Node> m_nodes;
+    std::vector<uint8_t> m_image;
+    std::vector<uint8_t> m_bitmap;
+    RunList m_mft_runs;
+    std::vector<uint8_t> m_sii_root;    // $Secure:$SII $INDEX_ROOT
+    RunList m_sii_runs;
+    uint64_t m_sii_size = 0;
+    std::vector<uint8_t> m_sii_bitmap;
+    std::vector<NtfsExpectedFile> m_files;
+};
+
+#endif
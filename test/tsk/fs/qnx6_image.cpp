@@ -0,0 +1,399 @@
+/*
+ * Synthetic QNX6 image generator, see qnx6_image.h.
+ */
+#include "qnx6_image.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#define QNX6_FSEEK _fseeki64
+#else
+#define QNX6_FSEEK fseeko
+#endif
+
+static const uint32_t UNUSED_PTR = 0xFFFFFFFFu;
+static const uint32_t INODE_SIZE = 128;
+static const uint32_t DIRENT_SIZE = 32;
+static const uint64_t SB0_OFFSET = 0x2000;
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+// Superblock checksum: CRC32, polynomial 0x04C11DB7, MSB first, init 0.
+static uint32_t crc32_msb(const uint8_t *buf, size_t len) {
+    uint32_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint32_t)buf[i] << 24;
+        for (int b = 0; b < 8; b++)
+            crc = (crc & 0x80000000u) ? (crc << 1) ^ 0x04C11DB7u : crc << 1;
+    }
+    return crc;
+}
+
+// splitmix64; file contents are derived from (inum, offset).
+static uint64_t mix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static void fill_content(uint32_t inum, uint64_t off, uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        uint64_t pos = off + i;
+        uint64_t w = mix64(((uint64_t)inum << 40) ^ (pos >> 3));
+        buf[i] = (uint8_t)(w >> (8 * (pos & 7)));
+    }
+}
+
+Qnx6ImageBuilder::Qnx6ImageBuilder(const Qnx6ImageOptions &opts)
+    : m_opts(opts), m_rng(opts.seed ? opts.seed : 1)
+{
+    uint32_t bs = m_opts.block_size;
+    if (bs <= 0x1000)
+        m_data_start = 0x3000;
+    else if (bs >= 0x3000)
+        m_data_start = bs;
+    else
+        m_data_start = 0x6000 - bs;
+    m_fanout = bs / 4;
+}
+
+uint64_t Qnx6ImageBuilder::image_size() const {
+    return m_data_start + (uint64_t)m_opts.num_blocks * m_opts.block_size + 0x1000;
+}
+
+void Qnx6ImageBuilder::expected_content(const Qnx6ExpectedFile &file,
+    uint64_t off, uint8_t *buf, size_t len) const
+{
+    const uint32_t bs = m_opts.block_size;
+    fill_content(file.inum, off, buf, len);
+    if (file.inum != m_big_inum || !m_opts.big_file_holes)
+        return;
+    for (size_t i = 0; i < len; ) {
+        uint64_t blk = (off + i) / bs;
+        size_t n = (size_t)((blk + 1) * bs - (off + i));
+        if (n > len - i) n = len - i;
+        if (is_hole(blk)) memset(buf + i, 0, n);
+        i += n;
+    }
+}
+
+bool Qnx6ImageBuilder::alloc_block(uint32_t *blk) {
+    if (m_opts.fragmentation > 0) {
+        m_rng ^= m_rng << 13;
+        m_rng ^= m_rng >> 17;
+        m_rng ^= m_rng << 5;
+        if ((m_rng % 10000) < (uint32_t)(m_opts.fragmentation * 10000))
+            m_next += 1 + (m_rng >> 16) % 3;
+    }
+    if (m_next >= m_opts.num_blocks)
+        return false;
+    *blk = m_next++;
+    m_bitmap[*blk / 8] |= (uint8_t)(1u << (*blk % 8));
+    m_alloc_count++;
+    return true;
+}
+
+bool Qnx6ImageBuilder::write_block(uint32_t blk, const uint8_t *data) {
+    uint64_t off = m_data_start + (uint64_t)blk * m_opts.block_size;
+    if (QNX6_FSEEK(m_out, (int64_t)off, SEEK_SET) != 0)
+        return false;
+    return fwrite(data, m_opts.block_size, 1, m_out) == 1;
+}
+
+// Blocks addressed by one more tree level, saturating at UINT64_MAX so
+// that levels too deep for a real volume can still be written.
+static uint64_t span_mul(uint64_t span, uint32_t fanout) {
+    return (span > UINT64_MAX / fanout) ? UINT64_MAX : span * fanout;
+}
+
+uint32_t Qnx6ImageBuilder::build_tree(uint64_t first, uint8_t depth,
+    uint64_t nblocks, FillFn fill, const void *ctx, bool holes, bool *ok)
+{
+    const uint32_t bs = m_opts.block_size;
+    uint32_t blk;
+
+    if (!*ok || first >= nblocks)
+        return UNUSED_PTR;
+    if (depth == 0) {
+        if (holes && is_hole(first))
+            return UNUSED_PTR;
+        if (!alloc_block(&blk)) {
+            *ok = false;
+            return UNUSED_PTR;
+        }
+        fill(this, ctx, first * bs, m_block.data(), bs);
+        if (!write_block(blk, m_block.data()))
+            *ok = false;
+        if (m_record)
+            m_record->push_back(blk);
+        return blk;
+    }
+
+    // Indirect blocks are allocated in front of the blocks they point to.
+    if (!alloc_block(&blk)) {
+        *ok = false;
+        return UNUSED_PTR;
+    }
+    uint64_t span = 1;
+    for (uint8_t i = 1; i < depth; i++) span = span_mul(span, m_fanout);
+    std::vector<uint8_t> ind(bs);
+    for (uint32_t i = 0; i < m_fanout; i++) {
+        uint64_t child = (i == 0 || span < nblocks) ? first + i * span : nblocks;
+        uint32_t p = (child < nblocks) ?
+            build_tree(child, depth - 1, nblocks, fill, ctx, holes, ok) : UNUSED_PTR;
+        put32(&ind[i * 4], p);
+    }
+    if (!write_block(blk, ind.data()))
+        *ok = false;
+    return blk;
+}
+
+bool Qnx6ImageBuilder::write_file(uint64_t size, int level, FillFn fill,
+    const void *ctx, bool holes, FileRef *ref)
+{
+    const uint64_t nblocks = (size + m_opts.block_size - 1) / m_opts.block_size;
+    uint64_t span = 1;
+    uint8_t lvl = 0;
+
+    if (level < 0) {
+        while (span < (nblocks + 15) / 16 && lvl < 5) {
+            span *= m_fanout;
+            lvl++;
+        }
+    }
+    else {
+        lvl = (uint8_t)level;
+        for (uint8_t i = 0; i < lvl; i++) span = span_mul(span, m_fanout);
+    }
+    if (span < (nblocks + 15) / 16)
+        return false;
+
+    bool ok = true;
+    ref->level = lvl;
+    for (int i = 0; i < 16; i++) {
+        uint64_t first = (i == 0 || span < nblocks) ? i * span : nblocks;
+        ref->ptr[i] = build_tree(first, lvl, nblocks, fill, ctx, holes, &ok);
+    }
+    return ok;
+}
+
+static void fill_buffer(const Qnx6ImageBuilder *, const void *ctx,
+    uint64_t off, uint8_t *buf, size_t len)
+{
+    const std::vector<uint8_t> *data = (const std::vector<uint8_t> *)ctx;
+    size_t n = (off < data->size()) ? (size_t)(data->size() - off) : 0;
+    if (n > len) n = len;
+    if (n) memcpy(buf, data->data() + off, n);
+    memset(buf + n, 0, len - n);
+}
+
+static void fill_file(const Qnx6ImageBuilder *, const void *ctx,
+    uint64_t off, uint8_t *buf, size_t len)
+{
+    fill_content(*(const uint32_t *)ctx, off, buf, len);
+}
+
+bool Qnx6ImageBuilder::write_buffer(const std::vector<uint8_t> &data, FileRef *ref) {
+    return write_file(data.size(), -1, fill_buffer, &data, false, ref);
+}
+
+void Qnx6ImageBuilder::put_inode(uint32_t inum, uint64_t size, uint16_t mode,
+    const FileRef &ref)
+{
+    uint8_t *p = &m_inodes[(size_t)(inum - 1) * INODE_SIZE];
+    put64(p, size);
+    put32(p + 16, 1000000000u);     // ftime
+    put32(p + 20, 1000000001u);     // mtime
+    put32(p + 24, 1000000002u);     // atime
+    put32(p + 28, 1000000003u);     // ctime
+    put16(p + 32, mode);
+    for (int i = 0; i < 16; i++)
+        put32(p + 36 + i * 4, ref.ptr[i]);
+    p[100] = ref.level;
+    p[101] = 1;                     // status: in use
+}
+
+void Qnx6ImageBuilder::put_rootnode(uint8_t *p, uint64_t size, const FileRef &ref) const {
+    put64(p, size);
+    for (int i = 0; i < 16; i++)
+        put32(p + 8 + i * 4, ref.ptr[i]);
+    p[72] = ref.level;
+}
+
+void Qnx6ImageBuilder::make_superblock(uint8_t *sb, uint64_t serial) const {
+    FileRef none;
+    for (int i = 0; i < 16; i++) none.ptr[i] = UNUSED_PTR;
+    none.level = 0;
+
+    memset(sb, 0, 512);
+    sb[0] = 0x22; sb[1] = 0x11; sb[2] = 0x19; sb[3] = 0x68;
+    put64(sb + 8, serial);
+    put32(sb + 48, m_opts.block_size);
+    put32(sb + 52, m_num_inodes);
+    put32(sb + 56, 0);
+    put32(sb + 60, m_opts.num_blocks);
+    put32(sb + 64, (uint32_t)(m_opts.num_blocks - m_alloc_count));
+    put_rootnode(sb + 72, m_inodes_size, m_rn_inodes);
+    put_rootnode(sb + 152, m_bitmap.size(), m_rn_bitmap);
+    put_rootnode(sb + 232, m_longfile_size, m_rn_longfile);
+    put_rootnode(sb + 312, 0, none);    // iclaim
+    put_rootnode(sb + 392, 0, none);    // iextra
+    put32(sb + 4, crc32_msb(sb + 8, 512 - 8));
+}
+
+bool Qnx6ImageBuilder::write(FILE *out) {
+    const uint32_t bs = m_opts.block_size;
+    const uint32_t ndirs = m_opts.num_dirs;
+
+    m_out = out;
+    m_next = 0;
+    m_alloc_count = 0;
+    m_rng = m_opts.seed ? m_opts.seed : 1;
+    m_bitmap.assign((m_opts.num_blocks + 7) / 8, 0);
+    m_block.assign(bs, 0);
+    m_files.clear();
+
+    // Inode numbers: root, subdirectories, big file, small files, spares.
+    uint32_t inum = 2 + ndirs;
+    m_big_inum = m_opts.big_file_size ? inum++ : 0;
+    uint32_t first_file = inum;
+    m_num_inodes = first_file + m_opts.num_files - 1 + m_opts.spare_inodes;
+    m_inodes.assign((size_t)m_num_inodes * INODE_SIZE, 0);
+
+    std::vector<std::vector<std::pair<uint32_t, std::string>>> entries(ndirs + 1);
+    std::vector<std::string> longnames;
+    std::vector<std::string> dir_paths(ndirs + 1);
+    for (uint32_t d = 1; d <= ndirs; d++) {
+        char name[32];
+        snprintf(name, sizeof(name), "dir_%03u", d);
+        entries[0].push_back(std::make_pair(1 + d, std::string(name)));
+        dir_paths[d] = std::string("/") + name;
+    }
+
+    if (m_big_inum) {
+        FileRef ref;
+        if (!write_file(m_opts.big_file_size, m_opts.big_file_level, fill_file,
+                &m_big_inum, m_opts.big_file_holes, &ref))
+            return false;
+        put_inode(m_big_inum, m_opts.big_file_size, 0100644, ref);
+        entries[0].push_back(std::make_pair(m_big_inum, std::string("bigfile.bin")));
+        m_files.push_back({ "/bigfile.bin", m_big_inum, m_opts.big_file_size, false });
+    }
+
+    for (uint32_t i = 0; i < m_opts.num_files; i++) {
+        uint32_t finum = first_file + i;
+        m_rng ^= m_rng << 13;
+        m_rng ^= m_rng >> 17;
+        m_rng ^= m_rng << 5;
+        uint64_t size = m_rng % ((uint64_t)m_opts.max_file_blocks * bs + 1);
+
+        FileRef ref;
+        if (!write_file(size, -1, fill_file, &finum, false, &ref))
+            return false;
+        put_inode(finum, size, 0100644, ref);
+
+        char name[80];
+        if (m_opts.long_names && i % 3 == 0)
+            snprintf(name, sizeof(name), "a_rather_long_file_name_kept_in_the_longfile_%05u.dat", i);
+        else
+            snprintf(name, sizeof(name), "file_%05u", i);
+        uint32_t d = i % (ndirs + 1);
+        entries[d].push_back(std::make_pair(finum, std::string(name)));
+        m_files.push_back({ dir_paths[d] + "/" + name, finum, size, false });
+    }
+
+    // Directories, subdirectories first so the root is written last.
+    for (uint32_t n = 0; n <= ndirs; n++) {
+        uint32_t d = (n + 1) % (ndirs + 1);
+        uint32_t dinum = d ? 1 + d : 1;
+        std::vector<uint8_t> dirents;
+        std::vector<std::pair<uint32_t, std::string>> all;
+        all.push_back(std::make_pair(dinum, std::string(".")));
+        all.push_back(std::make_pair(1u, std::string("..")));
+        all.insert(all.end(), entries[d].begin(), entries[d].end());
+        for (size_t k = 0; k < all.size(); k++) {
+            uint8_t de[DIRENT_SIZE];
+            memset(de, 0, sizeof(de));
+            put32(de, all[k].first);
+            const std::string &nm = all[k].second;
+            if (nm.size() <= 27) {
+                de[4] = (uint8_t)nm.size();
+                memcpy(de + 5, nm.data(), nm.size());
+            }
+            else {
+                de[4] = 0xFF;
+                put32(de + 8, (uint32_t)longnames.size());
+                longnames.push_back(nm);
+            }
+            dirents.insert(dirents.end(), de, de + DIRENT_SIZE);
+        }
+        FileRef ref;
+        if (!write_buffer(dirents, &ref))
+            return false;
+        put_inode(dinum, dirents.size(), 040755, ref);
+        if (d)
+            m_files.push_back({ dir_paths[d], dinum, dirents.size(), true });
+    }
+
+    // Long file names, one per block: 16-bit length, then the name.
+    std::vector<uint8_t> lf((size_t)longnames.size() * bs, 0);
+    for (size_t k = 0; k < longnames.size(); k++) {
+        put16(&lf[k * bs], (uint16_t)longnames[k].size());
+        memcpy(&lf[k * bs + 2], longnames[k].data(), longnames[k].size());
+    }
+    m_longfile_size = lf.size();
+    if (!write_buffer(lf, &m_rn_longfile))
+        return false;
+
+    m_inodes_size = m_inodes.size();
+    if (!write_buffer(m_inodes, &m_rn_inodes))
+        return false;
+
+    // The bitmap covers its own blocks: write it once to allocate them,
+    // then rewrite its data blocks with the final contents.
+    std::vector<uint32_t> bm_blocks;
+    m_record = &bm_blocks;
+    std::vector<uint8_t> bm_copy(m_bitmap);
+    bool ok = write_buffer(bm_copy, &m_rn_bitmap);
+    m_record = nullptr;
+    if (!ok)
+        return false;
+    for (size_t k = 0; k < bm_blocks.size(); k++) {
+        fill_buffer(this, &m_bitmap, (uint64_t)k * bs, m_block.data(), bs);
+        if (!write_block(bm_blocks[k], m_block.data()))
+            return false;
+    }
+
+    // Boot block, both superblocks (sb0 is the newer generation) and
+    // the end of the image.
+    uint64_t sb1_off = m_data_start + (uint64_t)m_opts.num_blocks * bs;
+    uint8_t boot[16] = { 0xEB, 0x10, 0x90, 0x00 };
+    put32(boot + 8, (uint32_t)(SB0_OFFSET / 512));
+    put32(boot + 12, (uint32_t)(sb1_off / 512));
+    uint8_t sb[512];
+    uint8_t tail = 0;
+
+    if (QNX6_FSEEK(out, 0, SEEK_SET) != 0 || fwrite(boot, sizeof(boot), 1, out) != 1)
+        return false;
+    make_superblock(sb, 2);
+    if (QNX6_FSEEK(out, (int64_t)SB0_OFFSET, SEEK_SET) != 0 || fwrite(sb, sizeof(sb), 1, out) != 1)
+        return false;
+    make_superblock(sb, 1);
+    if (QNX6_FSEEK(out, (int64_t)sb1_off, SEEK_SET) != 0 || fwrite(sb, sizeof(sb), 1, out) != 1)
+        return false;
+    if (QNX6_FSEEK(out, (int64_t)image_size() - 1, SEEK_SET) != 0 || fwrite(&tail, 1, 1, out) != 1)
+        return false;
+    return fflush(out) == 0;
+}
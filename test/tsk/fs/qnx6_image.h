@@ -0,0 +1,102 @@
+/*
+ * Synthetic QNX6 image generator used by the QNX6 unit tests and
+ * benchmark.  Builds a complete file system (boot block, both
+ * superblocks, inode file, directories, long file names, bitmap) with
+ * configurable geometry; file contents are a pure function of the inode
+ * number and offset so large images never need to be held in memory.
+ */
+#ifndef _TSK_TEST_QNX6_IMAGE_H
+#define _TSK_TEST_QNX6_IMAGE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+struct Qnx6ImageOptions {
+    uint32_t block_size = 1024;     // 512..65536, power of two
+    uint32_t num_blocks = 16384;    // blocks in the data area
+    uint32_t num_dirs = 3;          // subdirectories of the root directory
+    uint32_t num_files = 48;        // small files, spread over root and subdirectories
+    uint32_t max_file_blocks = 4;   // small files are 0..max_file_blocks blocks long
+    uint64_t big_file_size = 0;     // size of /bigfile.bin in bytes (0 = none)
+    int big_file_level = -1;        // pointer tree level of the big file (-1 = smallest that fits)
+    bool big_file_holes = true;     // leave every 97th block of the big file sparse
+    uint32_t spare_inodes = 8;      // unused inode slots after the last file
+    bool long_names = true;         // every third file name goes to the longfile
+    double fragmentation = 0.0;     // chance (0..1) of skipping blocks between allocations
+    uint32_t seed = 1;
+};
+
+struct Qnx6ExpectedFile {
+    std::string path;               // e.g. "/dir_001/file_00004"
+    uint32_t inum;
+    uint64_t size;
+    bool is_dir;
+};
+
+class Qnx6ImageBuilder {
+public:
+    explicit Qnx6ImageBuilder(const Qnx6ImageOptions &opts);
+
+    /**
+     * Write the image to out (which must be seekable).
+     * @returns false on I/O error or if the volume is too small
+     */
+    bool write(FILE *out);
+
+    const std::vector<Qnx6ExpectedFile> &files() const { return m_files; }
+    uint32_t data_start_blk() const { return (uint32_t)(m_data_start / m_opts.block_size); }
+    uint32_t num_inodes() const { return m_num_inodes; }
+    uint64_t allocated_blocks() const { return m_alloc_count; }
+    uint64_t image_size() const;
+
+    /** Allocation state of a data-area block (QNX6 block pointer). */
+    bool block_allocated(uint32_t blk) const {
+        return (m_bitmap[blk / 8] >> (blk % 8)) & 1;
+    }
+
+    /** Expected content of bytes [off, off + len) of a regular file. */
+    void expected_content(const Qnx6ExpectedFile &file, uint64_t off,
+        uint8_t *buf, size_t len) const;
+
+private:
+    typedef void (*FillFn)(const Qnx6ImageBuilder *, const void *ctx,
+        uint64_t off, uint8_t *buf, size_t len);
+
+    struct FileRef {
+        uint32_t ptr[16];
+        uint8_t level;
+    };
+
+    bool alloc_block(uint32_t *blk);
+    bool write_block(uint32_t blk, const uint8_t *data);
+    uint32_t build_tree(uint64_t first, uint8_t depth, uint64_t nblocks,
+        FillFn fill, const void *ctx, bool holes, bool *ok);
+    bool write_file(uint64_t size, int level, FillFn fill, const void *ctx,
+        bool holes, FileRef *ref);
+    bool write_buffer(const std::vector<uint8_t> &data, FileRef *ref);
+    void put_inode(uint32_t inum, uint64_t size, uint16_t mode, const FileRef &ref);
+    void put_rootnode(uint8_t *p, uint64_t size, const FileRef &ref) const;
+    void make_superblock(uint8_t *sb, uint64_t serial) const;
+    static bool is_hole(uint64_t blk) { return blk % 97 == 5; }
+
+    Qnx6ImageOptions m_opts;
+    uint64_t m_data_start;
+    uint32_t m_fanout;
+    FILE *m_out = nullptr;
+    uint32_t m_next = 0;
+    uint64_t m_alloc_count = 0;
+    uint32_t m_rng;
+    uint32_t m_num_inodes = 0;
+    uint32_t m_big_inum = 0;
+    std::vector<uint32_t> *m_record = nullptr;   // collects data block numbers when set
+    std::vector<uint8_t> m_bitmap;
+    std::vector<uint8_t> m_inodes;
+    std::vector<uint8_t> m_block;
+    std::vector<Qnx6ExpectedFile> m_files;
+    FileRef m_rn_inodes, m_rn_bitmap, m_rn_longfile;
+    uint64_t m_inodes_size = 0, m_longfile_size = 0;
+};
+
+#endif
@@ -1,5 +1,13 @@
 #include "catch.hpp"
 #include "tsk/fs/tsk_fs_i.h"
+#include "test/tools/tsk_tempfile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
 
 // Test tsk_fs_attr_run_alloc
 TEST_CASE("tsk_fs_attr_run_alloc creates valid run structure", "[fs_attr]") {
@@ -218,3 +226,356 @@ TEST_CASE("tsk_fs_attr_read with null parameters", "[fs_attr]") {
     
     tsk_fs_attr_free(attr);
 }
+
+namespace {
+
+const unsigned MOCK_BLOCK_SIZE = 512;
+const TSK_DADDR_T MOCK_BLOCKS = 64;
+
+// Blocks 20-23 are unallocated, the rest are allocated.
+TSK_FS_BLOCK_FLAG_ENUM mock_block_getflags(TSK_FS_INFO *, TSK_DADDR_T addr) {
+    return (addr >= 20 && addr < 24) ? TSK_FS_BLOCK_FLAG_UNALLOC : TSK_FS_BLOCK_FLAG_ALLOC;
+}
+
+// A file system over a raw image in which every byte depends on its offset.
+struct MockFs {
+    std::string path;
+    TSK_IMG_INFO *img = nullptr;
+    TSK_FS_INFO fs{};
+    TSK_FS_META meta{};
+    TSK_FS_FILE file{};
+
+    MockFs() {
+        FILE *f = tsk_make_named_tempfile(&path);
+        REQUIRE(f);
+        for (size_t i = 0; i < MOCK_BLOCKS * MOCK_BLOCK_SIZE; i++) {
+            fputc(byte_at(i), f);
+        }
+        fclose(f);
+
+        const char *const images[] = { path.c_str() };
+        img = tsk_img_open_utf8(1, images, TSK_IMG_TYPE_RAW, 0);
+        REQUIRE(img);
+
+        fs.tag = TSK_FS_INFO_TAG;
+        fs.ftype = TSK_FS_TYPE_RAW;
+        fs.img_info = img;
+        fs.block_size = MOCK_BLOCK_SIZE;
+        fs.last_block = fs.last_block_act = MOCK_BLOCKS - 1;
+        fs.block_getflags = mock_block_getflags;
+        meta.addr = 5;
+        file.fs_info = &fs;
+        file.meta = &meta;
+    }
+
+    ~MockFs() {
+        tsk_img_close(img);
+        remove(path.c_str());
+    }
+
+    static char byte_at(size_t off) {
+        return (char) (off * 7 + off / MOCK_BLOCK_SIZE);
+    }
+
+    struct Run {
+        TSK_DADDR_T addr;
+        TSK_DADDR_T len;
+        TSK_FS_ATTR_RUN_FLAG_ENUM flags;
+    };
+
+    // A non-resident attribute with the given runs.
+    TSK_FS_ATTR *attr(const std::vector<Run> &runs,
+        TSK_OFF_T size, TSK_OFF_T initsize, uint32_t skiplen = 0) {
+        TSK_FS_ATTR *a = tsk_fs_attr_alloc(TSK_FS_ATTR_NONRES);
+        REQUIRE(a);
+        a->fs_file = &file;
+        a->size = size;
+        a->nrd.initsize = initsize;
+        a->nrd.skiplen = skiplen;
+
+        TSK_FS_ATTR_RUN **tail = &a->nrd.run;
+        TSK_DADDR_T offset = 0;
+        for (const auto &r : runs) {
+            TSK_FS_ATTR_RUN *run = tsk_fs_attr_run_alloc();
+            REQUIRE(run);
+            run->addr = r.addr;
+            run->len = r.len;
+            run->flags = r.flags;
+            run->offset = offset;
+            offset += r.len;
+            *tail = run;
+            tail = &run->next;
+        }
+        a->nrd.allocsize = (TSK_OFF_T) offset * MOCK_BLOCK_SIZE;
+        return a;
+    }
+};
+
+// What a walk returned, split into blocks so that chunked and
+// block-at-a-time walks compare equal.
+struct WalkBlock {
+    TSK_OFF_T off;
+    TSK_DADDR_T addr;
+    int flags;
+    std::string data;
+
+    bool operator==(const WalkBlock &o) const {
+        return off == o.off && addr == o.addr && flags == o.flags && data == o.data;
+    }
+};
+
+struct Walk {
+    size_t calls = 0;
+    std::vector<WalkBlock> blocks;
+};
+
+TSK_WALK_RET_ENUM
+collect_walk(TSK_FS_FILE *fs_file, TSK_OFF_T a_off, TSK_DADDR_T a_addr,
+    char *a_buf, size_t a_len, TSK_FS_BLOCK_FLAG_ENUM a_flags, void *a_ptr)
+{
+    Walk *walk = (Walk *) a_ptr;
+    const size_t bs = fs_file->fs_info->block_size;
+    walk->calls++;
+    for (size_t i = 0; i < a_len; i += bs) {
+        const size_t len = std::min(bs, a_len - i);
+        walk->blocks.push_back(WalkBlock{a_off + (TSK_OFF_T) i,
+            a_addr ? a_addr + i / bs : 0, (int) a_flags,
+            std::string(a_buf + i, len)});
+    }
+    return TSK_WALK_CONT;
+}
+
+Walk walk_attr(TSK_FS_ATTR *attr, int flags) {
+    Walk walk;
+    REQUIRE(tsk_fs_attr_walk(attr, (TSK_FS_FILE_WALK_FLAG_ENUM) flags,
+        collect_walk, &walk) == 0);
+    return walk;
+}
+
+// Walk with and without TSK_FS_FILE_WALK_FLAG_CHUNK and compare.
+size_t check_chunked_walk(TSK_FS_ATTR *attr, int flags) {
+    const Walk blocks = walk_attr(attr, flags);
+    const Walk chunks = walk_attr(attr, flags | TSK_FS_FILE_WALK_FLAG_CHUNK);
+    CHECK(blocks.calls == blocks.blocks.size());
+    CHECK(chunks.blocks == blocks.blocks);
+    return chunks.calls;
+}
+
+}
+
+TEST_CASE("tsk_fs_attr_walk chunks split where the block flags change", "[fs_attr]") {
+    MockFs m;
+    TSK_FS_ATTR *attr = m.attr({{16, 12, TSK_FS_ATTR_RUN_FLAG_NONE}},
+        12 * MOCK_BLOCK_SIZE, 12 * MOCK_BLOCK_SIZE);
+
+    // 16-19 allocated, 20-23 not, 24-27 allocated
+    CHECK(check_chunked_walk(attr, TSK_FS_FILE_WALK_FLAG_NONE) == 3);
+
+    const Walk walk = walk_attr(attr, TSK_FS_FILE_WALK_FLAG_CHUNK);
+    REQUIRE(walk.blocks.size() == 12);
+    for (const auto &b : walk.blocks) {
+        CHECK(b.flags == (mock_block_getflags(&m.fs, b.addr) | TSK_FS_BLOCK_FLAG_RAW));
+        CHECK(b.data[0] == MockFs::byte_at((size_t) b.addr * MOCK_BLOCK_SIZE));
+    }
+    tsk_fs_attr_free(attr);
+}
+
+TEST_CASE("tsk_fs_attr_walk chunks with initsize less than size", "[fs_attr]") {
+    MockFs m;
+    TSK_FS_ATTR *attr = m.attr({{30, 10, TSK_FS_ATTR_RUN_FLAG_NONE}},
+        10 * MOCK_BLOCK_SIZE - 30, 3 * MOCK_BLOCK_SIZE + 100);
+
+    // the initialized blocks, the block with the end, then the rest
+    CHECK(check_chunked_walk(attr, TSK_FS_FILE_WALK_FLAG_NONE) < 10);
+    check_chunked_walk(attr, TSK_FS_FILE_WALK_FLAG_SLACK);
+
+    const Walk walk = walk_attr(attr, TSK_FS_FILE_WALK_FLAG_CHUNK);
+    REQUIRE(walk.blocks.size() == 10);
+    CHECK(walk.blocks[3].data.substr(100) == std::string(MOCK_BLOCK_SIZE - 100, 0));
+    CHECK(walk.blocks[9].data.size() == MOCK_BLOCK_SIZE - 30);
+    tsk_fs_attr_free(attr);
+}
+
+TEST_CASE("tsk_fs_attr_walk chunks with skipped leading bytes", "[fs_attr]") {
+    MockFs m;
+    TSK_FS_ATTR *attr = m.attr({{30, 10, TSK_FS_ATTR_RUN_FLAG_NONE}},
+        10 * MOCK_BLOCK_SIZE - 100, 10 * MOCK_BLOCK_SIZE, 100);
+
+    // the partial first block, then the rest in one chunk
+    CHECK(check_chunked_walk(attr, TSK_FS_FILE_WALK_FLAG_NONE) == 2);
+
+    const Walk walk = walk_attr(attr, TSK_FS_FILE_WALK_FLAG_CHUNK);
+    REQUIRE(!walk.blocks.empty());
+    CHECK(walk.blocks[0].off == 0);
+    CHECK(walk.blocks[0].data.size() == MOCK_BLOCK_SIZE - 100);
+    CHECK(walk.blocks[0].data[0] == MockFs::byte_at(30 * MOCK_BLOCK_SIZE + 100));
+    tsk_fs_attr_free(attr);
+}
+
+TEST_CASE("tsk_fs_attr_walk chunks over sparse and FILLER runs", "[fs_attr]") {
+    MockFs m;
+    TSK_FS_ATTR *attr = m.attr({
+            {2, 3, TSK_FS_ATTR_RUN_FLAG_NONE},
+            {0, 4, TSK_FS_ATTR_RUN_FLAG_SPARSE},
+            {0, 2, TSK_FS_ATTR_RUN_FLAG_FILLER},
+            {40, 3, TSK_FS_ATTR_RUN_FLAG_NONE},
+        }, 12 * MOCK_BLOCK_SIZE - 10, 12 * MOCK_BLOCK_SIZE);
+
+    CHECK(check_chunked_walk(attr, TSK_FS_FILE_WALK_FLAG_NONE) == 4);
+    CHECK(check_chunked_walk(attr, TSK_FS_FILE_WALK_FLAG_NOSPARSE) == 2);
+
+    const Walk walk = walk_attr(attr, TSK_FS_FILE_WALK_FLAG_CHUNK);
+    REQUIRE(walk.blocks.size() == 12);
+    for (size_t i = 3; i < 9; i++) {
+        CHECK(walk.blocks[i].addr == 0);
+        CHECK((walk.blocks[i].flags & TSK_FS_BLOCK_FLAG_SPARSE));
+        CHECK(walk.blocks[i].data == std::string(MOCK_BLOCK_SIZE, 0));
+    }
+    CHECK(walk.blocks[9].addr == 40);
+    tsk_fs_attr_free(attr);
+}
+
+namespace {
+
+// Read the first nblocks blocks of the attribute, last to first, and
+// check that block i holds image block addr_of(i).
+template<typename F>
+bool read_blocks(TSK_FS_ATTR *attr, int nblocks, F addr_of) {
+    char buf[MOCK_BLOCK_SIZE];
+    for (int i = nblocks - 1; i >= 0; i--) {
+        if (tsk_fs_attr_read(attr, (TSK_OFF_T) i * MOCK_BLOCK_SIZE, buf,
+                sizeof(buf), TSK_FS_FILE_READ_FLAG_NONE) != (ssize_t) sizeof(buf)) {
+            return false;
+        }
+        const size_t img_off = (size_t) addr_of(i) * MOCK_BLOCK_SIZE;
+        for (size_t j = 0; j < sizeof(buf); j++) {
+            if (buf[j] != MockFs::byte_at(img_off + j)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// 40 one-block runs, where offset i maps to block 63 - i
+TSK_FS_ATTR *long_run_list(MockFs &m) {
+    std::vector<MockFs::Run> runs;
+    for (TSK_DADDR_T i = 0; i < 40; i++) {
+        runs.push_back({MOCK_BLOCKS - 1 - i, 1, TSK_FS_ATTR_RUN_FLAG_NONE});
+    }
+    return m.attr(runs, 40 * MOCK_BLOCK_SIZE, 40 * MOCK_BLOCK_SIZE);
+}
+
+bool read_long_run_list(TSK_FS_ATTR *attr) {
+    return read_blocks(attr, 40, [](int i) { return MOCK_BLOCKS - 1 - i; });
+}
+
+}
+
+TEST_CASE("tsk_fs_attr_read with a long run list", "[fs_attr]") {
+    MockFs m;
+    TSK_FS_ATTR *attr = long_run_list(m);
+    CHECK(read_long_run_list(attr));
+    CHECK(tsk_fs_attr_run_index_count(attr) == 40);
+    tsk_fs_attr_free(attr);
+}
+
+TEST_CASE("tsk_fs_attr_read with a short run list", "[fs_attr]") {
+    MockFs m;
+    TSK_FS_ATTR *attr = m.attr({
+            {30, 2, TSK_FS_ATTR_RUN_FLAG_NONE},
+            {10, 3, TSK_FS_ATTR_RUN_FLAG_NONE},
+        }, 5 * MOCK_BLOCK_SIZE, 5 * MOCK_BLOCK_SIZE);
+
+    const auto addr_of = [](int i) { return (TSK_DADDR_T) (i < 2 ? 30 + i : 8 + i); };
+    CHECK(read_blocks(attr, 5, addr_of));
+    CHECK(read_blocks(attr, 5, addr_of));
+    CHECK(tsk_fs_attr_run_index_count(attr) == 0);
+    tsk_fs_attr_free(attr);
+}
+
+TEST_CASE("tsk_fs_attr_read at random offsets of a fragmented attribute", "[fs_attr]") {
+    MockFs m;
+
+    // runs of one and two blocks, placed back to front in the image
+    std::vector<MockFs::Run> runs;
+    std::vector<TSK_DADDR_T> addr_of;
+    TSK_DADDR_T next = MOCK_BLOCKS;
+    for (int i = 0; i < 36; i++) {
+        const TSK_DADDR_T len = 1 + (i % 2);
+        next -= len;
+        runs.push_back({next, len, TSK_FS_ATTR_RUN_FLAG_NONE});
+        for (TSK_DADDR_T j = 0; j < len; j++) {
+            addr_of.push_back(next + j);
+        }
+    }
+    const TSK_OFF_T size = (TSK_OFF_T) addr_of.size() * MOCK_BLOCK_SIZE - 100;
+    TSK_FS_ATTR *attr = m.attr(runs, size, size);
+
+    // read backwards and forwards, crossing run boundaries
+    std::vector<char> got(1500);
+    uint32_t seed = 12345;
+    for (int i = 0; i < 300; i++) {
+        seed = seed * 1103515245 + 12345;
+        const TSK_OFF_T off = (seed >> 4) % size;
+        const size_t len = (size_t) std::min<TSK_OFF_T>(got.size(), size - off);
+        INFO("offset " << off);
+        REQUIRE(tsk_fs_attr_read(attr, off, got.data(), len,
+            TSK_FS_FILE_READ_FLAG_NONE) == (ssize_t) len);
+        for (size_t j = 0; j < len; j++) {
+            const TSK_OFF_T pos = off + j;
+            const size_t img_off = (size_t) addr_of[pos / MOCK_BLOCK_SIZE]
+                * MOCK_BLOCK_SIZE + pos % MOCK_BLOCK_SIZE;
+            REQUIRE(got[j] == MockFs::byte_at(img_off));
+        }
+    }
+    CHECK(tsk_fs_attr_run_index_count(attr) == 36);
+
+    // reading past the end still fails
+    CHECK(tsk_fs_attr_read(attr, size, got.data(), 1,
+        TSK_FS_FILE_READ_FLAG_NONE) == -1);
+    tsk_fs_attr_free(attr);
+}
+
+TEST_CASE("tsk_fs_attr_read with a long run list out of offset order", "[fs_attr]") {
+    MockFs m;
+
+    // blocks 0-19 in one run, then one-block runs that overlap it (which
+    // a walk of the list never reaches) and one-block runs for 20-39
+    std::vector<MockFs::Run> runs;
+    runs.push_back({0, 20, TSK_FS_ATTR_RUN_FLAG_NONE});
+    for (TSK_DADDR_T i = 1; i < 40; i++) {
+        runs.push_back({i < 20 ? 40 + i : i, 1, TSK_FS_ATTR_RUN_FLAG_NONE});
+    }
+    TSK_FS_ATTR *attr = m.attr(runs, 40 * MOCK_BLOCK_SIZE, 40 * MOCK_BLOCK_SIZE);
+    TSK_DADDR_T offset = 1;
+    for (TSK_FS_ATTR_RUN *run = attr->nrd.run->next; run; run = run->next) {
+        run->offset = offset++;
+    }
+
+    // the same as a walk of the list from its head
+    const auto addr_of = [](int i) { return (TSK_DADDR_T) i; };
+    CHECK(read_blocks(attr, 40, addr_of));
+    CHECK(read_blocks(attr, 40, addr_of));
+    CHECK(tsk_fs_attr_run_index_count(attr) == 0);
+    tsk_fs_attr_free(attr);
+}
+
+TEST_CASE("tsk_fs_attr_read with a long run list from several threads", "[fs_attr]") {
+    MockFs m;
+    for (int round = 0; round < 20; round++) {
+        TSK_FS_ATTR *attr = long_run_list(m);
+        std::vector<std::thread> threads;
+        std::vector<char> ok(4, 0);
+        for (size_t t = 0; t < ok.size(); t++) {
+            threads.emplace_back([attr, &ok, t]() {
+                ok[t] = read_long_run_list(attr);
+            });
+        }
+        for (auto &th : threads) {
+            th.join();
+        }
+        CHECK(std::count(ok.begin(), ok.end(), 1) == 4);
+        tsk_fs_attr_free(attr);
+    }
+}
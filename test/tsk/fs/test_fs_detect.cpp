@@ -0,0 +1,240 @@
+/*
+ * test_fs_detect.cpp
+ *
+ * Tests for the signature checks and parallel opening used by file
+ * system auto-detection.
+ */
+
+#include "tsk/libtsk.h"
+#include "tsk/fs/tsk_fs_i.h"
+#include "tsk/fs/tsk_ffs.h"
+
+#include "catch.hpp"
+
+#include "qnx6_image.h"
+#include "test/tools/tsk_tempfile.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace {
+
+// A zero-filled raw image with a few patched bytes.
+struct ProbeImage {
+    std::string path;
+    TSK_IMG_INFO *img = nullptr;
+
+    explicit ProbeImage(uint64_t size) {
+        FILE *f = tsk_make_named_tempfile(&path);
+        REQUIRE(f != nullptr);
+        REQUIRE(fseek(f, (long)(size - 1), SEEK_SET) == 0);
+        REQUIRE(fputc(0, f) == 0);
+        fclose(f);
+    }
+
+    ~ProbeImage() {
+        if (img)
+            tsk_img_close(img);
+        remove(path.c_str());
+    }
+
+    void patch(uint64_t off, const void *data, size_t len) {
+        FILE *f = fopen(path.c_str(), "r+b");
+        REQUIRE(f != nullptr);
+        REQUIRE(fseek(f, (long)off, SEEK_SET) == 0);
+        REQUIRE(fwrite(data, len, 1, f) == 1);
+        fclose(f);
+    }
+
+    TSK_IMG_INFO *open() {
+        const char *paths[] = { path.c_str() };
+        img = tsk_img_open_utf8(1, paths, TSK_IMG_TYPE_RAW, 512);
+        REQUIRE(img != nullptr);
+        return img;
+    }
+};
+
+int fake_calls = 0;
+
+TSK_FS_INFO *fake_bitlocker_open(TSK_IMG_INFO *, TSK_OFF_T, TSK_FS_TYPE_ENUM,
+    const char *, uint8_t) {
+    tsk_error_reset();
+    tsk_error_set_errno(TSK_ERR_FS_BITLOCKER_ERROR);
+    tsk_error_set_errstr("volume is locked");
+    fake_calls++;
+    return nullptr;
+}
+
+TSK_FS_INFO *fake_magic_open(TSK_IMG_INFO *, TSK_OFF_T, TSK_FS_TYPE_ENUM,
+    const char *, uint8_t) {
+    tsk_error_reset();
+    tsk_error_set_errno(TSK_ERR_FS_MAGIC);
+    tsk_error_set_errstr("bad magic");
+    fake_calls++;
+    return nullptr;
+}
+
+}
+
+TEST_CASE("tsk_fs_probe_load reads the start of the volume", "[fs_detect]") {
+    ProbeImage pi(2 * 1024 * 1024);
+    TSK_IMG_INFO *img = pi.open();
+
+    TSK_FS_PROBE *probe = tsk_fs_probe_load(img, 0);
+    REQUIRE(probe != nullptr);
+    CHECK(probe->len == TSK_FS_PROBE_SIZE);
+    tsk_fs_probe_free(probe);
+
+    // clipped at the end of the image
+    probe = tsk_fs_probe_load(img, img->size - 4096);
+    REQUIRE(probe != nullptr);
+    CHECK(probe->len == 4096);
+    tsk_fs_probe_free(probe);
+
+    CHECK(tsk_fs_probe_load(img, img->size) == nullptr);
+}
+
+TEST_CASE("driver probes match only their own signature", "[fs_detect]") {
+    ProbeImage pi(2 * 1024 * 1024);
+
+    SECTION("blank volume") {
+        TSK_FS_PROBE *probe = tsk_fs_probe_load(pi.open(), 0);
+        REQUIRE(probe != nullptr);
+        CHECK(ntfs_probe(probe) == 0);
+        CHECK(fatfs_probe(probe) == 0);
+        CHECK(ext2fs_probe(probe) == 0);
+        CHECK(ffs_probe(probe) == 0);
+        CHECK(xfs_probe(probe) == 0);
+        CHECK(qnx6fs_probe(probe) == 0);
+        CHECK(iso9660_probe(probe) == 0);
+        CHECK(hfs_probe(probe) == 0);
+        CHECK(apfs_probe(probe) == 0);
+        CHECK(btrfs_probe(probe) == 0);
+        tsk_fs_probe_free(probe);
+    }
+
+    SECTION("ext superblock") {
+        const uint8_t magic[] = { 0x53, 0xef };
+        pi.patch(1024 + 56, magic, sizeof(magic));
+        TSK_FS_PROBE *probe = tsk_fs_probe_load(pi.open(), 0);
+        REQUIRE(probe != nullptr);
+        CHECK(ext2fs_probe(probe) == 1);
+        CHECK(ntfs_probe(probe) == 0);
+        CHECK(fatfs_probe(probe) == 0);
+        CHECK(xfs_probe(probe) == 0);
+        tsk_fs_probe_free(probe);
+    }
+
+    SECTION("boot sector magic is shared by NTFS and FAT") {
+        const uint8_t magic[] = { 0x55, 0xaa };
+        pi.patch(510, magic, sizeof(magic));
+        TSK_FS_PROBE *probe = tsk_fs_probe_load(pi.open(), 0);
+        REQUIRE(probe != nullptr);
+        CHECK(ntfs_probe(probe) == 1);
+        CHECK(fatfs_probe(probe) == 1);
+        CHECK(ext2fs_probe(probe) == 0);
+        tsk_fs_probe_free(probe);
+    }
+
+    SECTION("FAT backup boot sector") {
+        const uint8_t magic[] = { 0x55, 0xaa };
+        pi.patch(6 * 512 + 510, magic, sizeof(magic));
+        TSK_FS_PROBE *probe = tsk_fs_probe_load(pi.open(), 0);
+        REQUIRE(probe != nullptr);
+        CHECK(fatfs_probe(probe) == 1);
+        CHECK(ntfs_probe(probe) == 0);
+        tsk_fs_probe_free(probe);
+    }
+
+    SECTION("UFS2 backup superblock") {
+        const uint8_t magic[] = { 0x19, 0x01, 0x54, 0x19 };   // 0x19540119, little endian
+        pi.patch(UFS2_SBOFF2 + offsetof(ffs_sb2, magic), magic, sizeof(magic));
+        TSK_FS_PROBE *probe = tsk_fs_probe_load(pi.open(), 0);
+        REQUIRE(probe != nullptr);
+        CHECK(ffs_probe(probe) == 1);
+        tsk_fs_probe_free(probe);
+    }
+
+    SECTION("raw-sector ISO9660") {
+        pi.patch(32768 + 16 * 304 + 24 + 1, "CD001", 5);
+        TSK_FS_PROBE *probe = tsk_fs_probe_load(pi.open(), 0);
+        REQUIRE(probe != nullptr);
+        CHECK(iso9660_probe(probe) == 1);
+        tsk_fs_probe_free(probe);
+    }
+}
+
+TEST_CASE("btrfs probe reads mirror superblocks past the probe buffer", "[fs_detect]") {
+    ProbeImage pi((64 << 20) + 4096);
+    pi.patch((64 << 20) + 0x40, "_BHRfS_M", 8);
+    TSK_FS_PROBE *probe = tsk_fs_probe_load(pi.open(), 0);
+    REQUIRE(probe != nullptr);
+    CHECK(btrfs_probe(probe) == 1);
+    tsk_fs_probe_free(probe);
+
+    // the same signature relative to a later volume start is out of range
+    probe = tsk_fs_probe_load(pi.img, 4096);
+    REQUIRE(probe != nullptr);
+    CHECK(btrfs_probe(probe) == 0);
+    tsk_fs_probe_free(probe);
+}
+
+TEST_CASE("tsk_fs_open_jobs keeps each driver's error", "[fs_detect]") {
+    ProbeImage pi(64 * 1024);
+    TSK_IMG_INFO *img = pi.open();
+
+    TSK_FS_OPEN_JOB jobs[3];
+    jobs[0].open = fake_magic_open;
+    jobs[1].open = fake_bitlocker_open;
+    jobs[2].open = fake_magic_open;
+    for (TSK_FS_OPEN_JOB &job : jobs)
+        job.type = TSK_FS_TYPE_DETECT;
+
+    fake_calls = 0;
+    tsk_error_set_errno(TSK_ERR_FS_ARG);
+    tsk_fs_open_jobs(img, 0, "", jobs, 3);
+
+    CHECK(fake_calls == 3);
+    CHECK(tsk_error_get_errno() == 0);
+    CHECK(jobs[0].fs == nullptr);
+    CHECK(jobs[0].t_errno == TSK_ERR_FS_MAGIC);
+    CHECK(std::string(jobs[0].errstr) == "bad magic");
+    CHECK(jobs[1].t_errno == TSK_ERR_FS_BITLOCKER_ERROR);
+    CHECK(std::string(jobs[1].errstr) == "volume is locked");
+    CHECK(jobs[2].t_errno == TSK_ERR_FS_MAGIC);
+}
+
+TEST_CASE("auto-detection opens only the matching driver", "[fs_detect]") {
+    SECTION("blank volume") {
+        ProbeImage pi(2 * 1024 * 1024);
+        TSK_IMG_INFO *img = pi.open();
+        CHECK(tsk_fs_open_img(img, 0, TSK_FS_TYPE_DETECT) == nullptr);
+        CHECK(tsk_error_get_errno() == TSK_ERR_FS_UNKTYPE);
+        tsk_error_reset();
+    }
+
+    SECTION("QNX6 volume") {
+        Qnx6ImageOptions opts;
+        opts.num_blocks = 4096;
+        opts.num_files = 8;
+        Qnx6ImageBuilder builder(opts);
+        std::string path;
+        FILE *f = tsk_make_named_tempfile(&path);
+        REQUIRE(f != nullptr);
+        bool ok = builder.write(f);
+        fclose(f);
+        REQUIRE(ok);
+
+        const char *paths[] = { path.c_str() };
+        TSK_IMG_INFO *img = tsk_img_open_utf8(1, paths, TSK_IMG_TYPE_RAW, 512);
+        REQUIRE(img != nullptr);
+        TSK_FS_INFO *fs = tsk_fs_open_img(img, 0, TSK_FS_TYPE_DETECT);
+        REQUIRE(fs != nullptr);
+        CHECK(fs->ftype == TSK_FS_TYPE_QNX6);
+        tsk_fs_close(fs);
+        tsk_img_close(img);
+        remove(path.c_str());
+    }
+}
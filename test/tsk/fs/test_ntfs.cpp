@@ -2,6 +2,15 @@
 #include "tsk/fs/tsk_fs_i.h"
 #include "tsk/fs/tsk_ntfs.h"
 
+#include "ntfs_image.h"
+#include "test/tools/tsk_tempfile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
 // Test nt2unixtime with zero input
 TEST_CASE("nt2unixtime_zero", "[ntfs]") {
     uint64_t ntdate = 0;
@@ -108,3 +117,638 @@ TEST_CASE("nt2unixtime_valid_1970", "[ntfs]") {
     uint32_t result = nt2unixtime(ntdate);
     REQUIRE(result > 0); 
 }
+
+namespace {
+
+// A synthetic NTFS volume in a temporary file.
+struct NtfsTestImage {
+    NtfsImageBuilder builder;
+    std::string path;
+    TSK_IMG_INFO *img = nullptr;
+    TSK_FS_INFO *fs = nullptr;
+
+    explicit NtfsTestImage(const NtfsImageOptions &opts) : builder(opts) {
+        FILE *f = tsk_make_named_tempfile(&path);
+        REQUIRE(f != nullptr);
+        bool ok = builder.write(f);
+        fclose(f);
+        REQUIRE(ok);
+
+        const char *paths[] = { path.c_str() };
+        img = tsk_img_open_utf8(1, paths, TSK_IMG_TYPE_RAW, 512);
+        REQUIRE(img != nullptr);
+        fs = tsk_fs_open_img(img, 0, TSK_FS_TYPE_NTFS);
+        REQUIRE(fs != nullptr);
+    }
+
+    ~NtfsTestImage() {
+        if (fs)
+            tsk_fs_close(fs);
+        if (img)
+            tsk_img_close(img);
+        remove(path.c_str());
+    }
+};
+
+struct WalkedEntry {
+    TSK_INUM_T addr;
+    TSK_OFF_T start_of_inode;
+    TSK_FS_META_FLAG_ENUM flags;
+    TSK_OFF_T size;
+};
+
+TSK_WALK_RET_ENUM record_entry(TSK_FS_FILE *fs_file, void *ptr) {
+    auto *seen = static_cast<std::vector<WalkedEntry> *>(ptr);
+    seen->push_back({ fs_file->meta->addr, fs_file->meta->start_of_inode,
+        fs_file->meta->flags, fs_file->meta->size });
+    return TSK_WALK_CONT;
+}
+
+TSK_WALK_RET_ENUM stop_at_third(TSK_FS_FILE *fs_file, void *ptr) {
+    auto *seen = static_cast<std::vector<WalkedEntry> *>(ptr);
+    record_entry(fs_file, ptr);
+    return seen->size() == 3 ? TSK_WALK_STOP : TSK_WALK_CONT;
+}
+
+struct BlockWalk {
+    const NtfsImageBuilder *builder;
+    std::vector<TSK_DADDR_T> addrs;
+    size_t wrong_flags = 0;
+    size_t stop_after = 0;
+};
+
+TSK_WALK_RET_ENUM record_block(const TSK_FS_BLOCK *fs_block, void *ptr) {
+    auto *walk = static_cast<BlockWalk *>(ptr);
+    bool alloc = walk->builder->cluster_allocated(fs_block->addr);
+    if (((fs_block->flags & TSK_FS_BLOCK_FLAG_ALLOC) != 0) != alloc
+        || ((fs_block->flags & TSK_FS_BLOCK_FLAG_UNALLOC) != 0) == alloc)
+        walk->wrong_flags++;
+    walk->addrs.push_back(fs_block->addr);
+    if (walk->stop_after && walk->addrs.size() == walk->stop_after)
+        return TSK_WALK_STOP;
+    return TSK_WALK_CONT;
+}
+
+// Walk [first, last] and compare with the clusters that the builder allocated.
+void check_block_walk(NtfsTestImage &image, TSK_DADDR_T first,
+    TSK_DADDR_T last, int flags) {
+    BlockWalk walk;
+    walk.builder = &image.builder;
+    REQUIRE(tsk_fs_block_walk(image.fs, first, last,
+        (TSK_FS_BLOCK_WALK_FLAG_ENUM) flags, record_block, &walk) == 0);
+
+    std::vector<TSK_DADDR_T> want;
+    for (TSK_DADDR_T c = first; c <= last; c++) {
+        bool alloc = image.builder.cluster_allocated(c);
+        if ((alloc && (flags & TSK_FS_BLOCK_WALK_FLAG_ALLOC))
+            || (!alloc && (flags & TSK_FS_BLOCK_WALK_FLAG_UNALLOC)))
+            want.push_back(c);
+    }
+    CHECK(walk.wrong_flags == 0);
+    CHECK(walk.addrs == want);
+}
+
+void check_file_contents(NtfsTestImage &image,
+    const std::vector<uint32_t> &skip = {}) {
+    for (const NtfsExpectedFile &ef : image.builder.files()) {
+        if (std::find(skip.begin(), skip.end(), ef.inum) != skip.end())
+            continue;
+        INFO(ef.path);
+        TSK_FS_FILE *fs_file = tsk_fs_file_open(image.fs, NULL, ef.path.c_str());
+        REQUIRE(fs_file != nullptr);
+        CHECK(fs_file->meta->addr == ef.inum);
+        if (!ef.is_dir) {
+            REQUIRE(fs_file->meta->size == (TSK_OFF_T) ef.size);
+            std::vector<char> got(ef.size), want(ef.size);
+            NtfsImageBuilder::expected_content(ef, 0, (uint8_t *) want.data(), want.size());
+            if (ef.size)
+                CHECK(tsk_fs_file_read(fs_file, 0, got.data(), got.size(),
+                    TSK_FS_FILE_READ_FLAG_NONE) == (ssize_t) ef.size);
+            CHECK(got == want);
+        }
+        tsk_fs_file_close(fs_file);
+    }
+}
+
+struct ContentWalk {
+    std::vector<char> data;
+    size_t out_of_order = 0;
+    size_t stop_at = 0;
+};
+
+TSK_WALK_RET_ENUM record_content(TSK_FS_FILE *, TSK_OFF_T a_off, TSK_DADDR_T,
+    char *a_buf, size_t a_len, TSK_FS_BLOCK_FLAG_ENUM, void *ptr) {
+    auto *walk = static_cast<ContentWalk *>(ptr);
+    if ((size_t) a_off != walk->data.size())
+        walk->out_of_order++;
+    walk->data.insert(walk->data.end(), a_buf, a_buf + a_len);
+    if (walk->stop_at && walk->data.size() >= walk->stop_at)
+        return TSK_WALK_STOP;
+    return TSK_WALK_CONT;
+}
+
+// Read and walk the compressed files of an image, in full and in pieces.
+void check_compressed_files(NtfsTestImage &image, uint32_t seed,
+    size_t *ncompressed) {
+    for (const NtfsExpectedFile &ef : image.builder.files()) {
+        if (!ef.compressed)
+            continue;
+        INFO(ef.path);
+        TSK_FS_FILE *fs_file = tsk_fs_file_open(image.fs, NULL, ef.path.c_str());
+        REQUIRE(fs_file != nullptr);
+        const TSK_FS_ATTR *fs_attr = tsk_fs_file_attr_get(fs_file);
+        REQUIRE(fs_attr != nullptr);
+        CHECK((fs_attr->flags & TSK_FS_ATTR_COMP) != 0);
+        CHECK(fs_attr->nrd.initsize == (TSK_OFF_T) ef.initsize);
+        (*ncompressed)++;
+
+        std::vector<char> want(ef.size);
+        NtfsImageBuilder::expected_content(ef, 0, (uint8_t *) want.data(), want.size());
+        std::vector<char> got(ef.size);
+        CHECK(tsk_fs_file_read(fs_file, 0, got.data(), got.size(),
+            TSK_FS_FILE_READ_FLAG_NONE) == (ssize_t) ef.size);
+        CHECK(got == want);
+
+        for (int i = 0; i < 12; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            size_t off = seed % ef.size;
+            size_t len = 1 + (seed >> 7) % 90000;
+            size_t expect = std::min(len, (size_t) ef.size - off);
+            std::vector<char> piece(len);
+            INFO("offset " << off << " length " << len);
+            REQUIRE(tsk_fs_file_read(fs_file, off, piece.data(), len,
+                TSK_FS_FILE_READ_FLAG_NONE) == (ssize_t) expect);
+            CHECK(std::equal(piece.begin(), piece.begin() + expect,
+                want.begin() + off));
+        }
+
+        ContentWalk walk;
+        REQUIRE(tsk_fs_file_walk(fs_file, TSK_FS_FILE_WALK_FLAG_NONE,
+            record_content, &walk) == 0);
+        CHECK(walk.out_of_order == 0);
+        CHECK(walk.data == want);
+
+        ContentWalk part;
+        part.stop_at = ef.size / 3 + 1;
+        REQUIRE(tsk_fs_file_walk(fs_file, TSK_FS_FILE_WALK_FLAG_NONE,
+            record_content, &part) == 0);
+        CHECK(part.data.size() >= part.stop_at);
+        CHECK(part.data.size() < part.stop_at + 16 * image.fs->block_size);
+        CHECK(std::equal(part.data.begin(), part.data.end(), want.begin()));
+        tsk_fs_file_close(fs_file);
+    }
+}
+
+// The directory of a file and its name in it.
+std::pair<TSK_INUM_T, std::string> split_path(const NtfsImageBuilder &builder,
+    const std::string &path) {
+    size_t slash = path.rfind('/');
+    std::string dir = path.substr(0, slash);
+    TSK_INUM_T dir_inum = 5;
+    for (const NtfsExpectedFile &ef : builder.files()) {
+        if (ef.is_dir && ef.path == dir)
+            dir_inum = ef.inum;
+    }
+    return std::make_pair(dir_inum, path.substr(slash + 1));
+}
+
+std::string swap_ascii_case(std::string s) {
+    for (char &c : s) {
+        if (c >= 'a' && c <= 'z')
+            c = (char) (c - 'a' + 'A');
+        else if (c >= 'A' && c <= 'Z')
+            c = (char) (c - 'A' + 'a');
+    }
+    return s;
+}
+
+// Owner SID of an MFT entry, or "" if TSK cannot tell.
+std::string owner_of(TSK_FS_INFO *fs, TSK_INUM_T inum) {
+    std::string sid;
+    TSK_FS_FILE *fs_file = tsk_fs_file_open_meta(fs, NULL, inum);
+    if (fs_file == nullptr)
+        return sid;
+    char *str = nullptr;
+    if (tsk_fs_file_get_owner_sid(fs_file, &str) == 0) {
+        sid = str;
+        free(str);
+    }
+    tsk_error_reset();
+    tsk_fs_file_close(fs_file);
+    return sid;
+}
+
+// Bytes that TSK asked the image for, cached or not.
+size_t bytes_requested(TSK_IMG_INFO *img) {
+    Stats stats;
+    REQUIRE(tsk_img_get_stats(img, &stats) == 0);
+    return stats.hit_bytes + stats.miss_bytes;
+}
+
+}
+
+TEST_CASE("ntfs_inode_walk reads every MFT entry", "[ntfs]") {
+    NtfsImageOptions opts;
+    opts.num_files = 60;
+    opts.corrupt_entries = { 20, 41 };
+
+    SECTION("contiguous $MFT") {
+    }
+    SECTION("fragmented $MFT with entries that cross runs") {
+        opts.cluster_size = 512;
+        opts.num_clusters = 16384;
+        opts.mft_runs = 6;
+        opts.mft_odd_runs = true;
+        opts.fragmentation = 0.1;
+    }
+
+    NtfsTestImage image(opts);
+    NTFS_INFO *ntfs = (NTFS_INFO *) image.fs;
+    REQUIRE(image.fs->last_inum == image.builder.num_entries());
+    if (opts.mft_runs > 1)
+        REQUIRE(image.builder.mft_runs().size() == opts.mft_runs);
+
+    std::vector<WalkedEntry> seen;
+    REQUIRE(tsk_fs_meta_walk(image.fs, image.fs->first_inum, image.fs->last_inum,
+        (TSK_FS_META_FLAG_ENUM) (TSK_FS_META_FLAG_ALLOC | TSK_FS_META_FLAG_UNALLOC),
+        record_entry, &seen) == 0);
+
+    // every entry but the corrupt ones, and the orphan directory
+    REQUIRE(seen.size() == image.builder.num_entries() - 2 + 1);
+    std::vector<char> buf(ntfs->mft_rsize_b);
+    for (const WalkedEntry &e : seen) {
+        INFO("entry " << e.addr);
+        CHECK(e.addr != 20);
+        CHECK(e.addr != 41);
+        if (e.addr == TSK_FS_ORPHANDIR_INUM(image.fs))
+            continue;
+        CHECK(e.start_of_inode == (TSK_OFF_T) image.builder.entry_addr(e.addr));
+
+        // same as a lookup of the single entry
+        TSK_OFF_T addr = 0;
+        REQUIRE(ntfs_dinode_lookup(ntfs, buf.data(), e.addr, &addr) == TSK_OK);
+        CHECK(addr == e.start_of_inode);
+        TSK_FS_FILE *fs_file = tsk_fs_file_open_meta(image.fs, NULL, e.addr);
+        REQUIRE(fs_file != nullptr);
+        CHECK(fs_file->meta->flags == e.flags);
+        CHECK(fs_file->meta->size == e.size);
+        tsk_fs_file_close(fs_file);
+    }
+
+    TSK_OFF_T addr;
+    CHECK(ntfs_dinode_lookup(ntfs, buf.data(), 41, &addr) == TSK_COR);
+    tsk_error_reset();
+
+    check_file_contents(image, opts.corrupt_entries);
+}
+
+TEST_CASE("ntfs_inode_walk ranges and early stop", "[ntfs]") {
+    NtfsImageOptions opts;
+    opts.cluster_size = 512;
+    opts.num_clusters = 8192;
+    opts.mft_runs = 4;
+    opts.mft_odd_runs = true;
+    NtfsTestImage image(opts);
+
+    std::vector<WalkedEntry> seen;
+    REQUIRE(tsk_fs_meta_walk(image.fs, 17, 30, TSK_FS_META_FLAG_ALLOC,
+        record_entry, &seen) == 0);
+    REQUIRE(seen.size() == 14);
+    for (size_t i = 0; i < seen.size(); i++) {
+        CHECK(seen[i].addr == 17 + i);
+        CHECK(seen[i].start_of_inode
+            == (TSK_OFF_T) image.builder.entry_addr(17 + i));
+    }
+
+    seen.clear();
+    REQUIRE(tsk_fs_meta_walk(image.fs, 16, image.fs->last_inum,
+        TSK_FS_META_FLAG_ALLOC, stop_at_third, &seen) == 0);
+    REQUIRE(seen.size() == 3);
+    CHECK(seen[2].addr == 18);
+
+    // only unallocated entries
+    seen.clear();
+    REQUIRE(tsk_fs_meta_walk(image.fs, 0, image.fs->last_inum - 1,
+        TSK_FS_META_FLAG_UNALLOC, record_entry, &seen) == 0);
+    CHECK(seen.size() == 4 + opts.spare_entries);
+}
+
+TEST_CASE("ntfs_block_walk follows the cluster bitmap", "[ntfs]") {
+    NtfsImageOptions opts;
+    opts.cluster_size = 512;
+    const int aonly = TSK_FS_BLOCK_WALK_FLAG_AONLY;
+
+    SECTION("small volume") {
+        opts.num_clusters = 8192;
+        opts.num_files = 80;
+        opts.fragmentation = 0.3;
+        opts.reserved_runs = { { 5000, 1 }, { 5063, 2 }, { 6000, 700 } };
+    }
+    SECTION("volume with several bitmap pages") {
+        // 512 KiB clusters (64 KiB of $Bitmap) per page of the cache
+        opts.num_clusters = 1200000;
+        opts.reserved_runs = {
+            { 524280, 16 },     // across the end of the first page
+            { 600000, 1 },
+            { 700001, 63 },
+            { 800064, 64 },
+            { 1048000, 10 },    // unallocated across the second page
+            { 1048600, 5 },
+            { 1100000, 100000 } // up to the end of the volume
+        };
+    }
+
+    NtfsTestImage image(opts);
+    const TSK_DADDR_T last = image.fs->last_block;
+    REQUIRE(last == opts.num_clusters - 1);
+
+    size_t wrong = 0;
+    for (TSK_DADDR_T c = 0; c <= last; c++) {
+        int want = image.builder.cluster_allocated(c)
+            ? TSK_FS_BLOCK_FLAG_ALLOC : TSK_FS_BLOCK_FLAG_UNALLOC;
+        if (image.fs->block_getflags(image.fs, c) != want)
+            wrong++;
+    }
+    CHECK(wrong == 0);
+
+    check_block_walk(image, 0, last,
+        TSK_FS_BLOCK_WALK_FLAG_ALLOC | TSK_FS_BLOCK_WALK_FLAG_UNALLOC | aonly);
+    check_block_walk(image, 0, last, TSK_FS_BLOCK_WALK_FLAG_UNALLOC | aonly);
+    check_block_walk(image, 0, last, TSK_FS_BLOCK_WALK_FLAG_ALLOC | aonly);
+    for (const auto &run : opts.reserved_runs) {
+        // starting and ending inside runs of both kinds
+        TSK_DADDR_T first = run.first > 3 ? run.first - 3 : 0;
+        TSK_DADDR_T end = std::min<TSK_DADDR_T>(run.first + run.second + 70, last);
+        check_block_walk(image, first, end, TSK_FS_BLOCK_WALK_FLAG_UNALLOC | aonly);
+        check_block_walk(image, run.first + 1, end, TSK_FS_BLOCK_WALK_FLAG_ALLOC | aonly);
+        check_block_walk(image, end, end, TSK_FS_BLOCK_WALK_FLAG_ALLOC
+            | TSK_FS_BLOCK_WALK_FLAG_UNALLOC | aonly);
+    }
+
+    // block contents, not just flags
+    check_block_walk(image, 0, std::min<TSK_DADDR_T>(last, 20000),
+        TSK_FS_BLOCK_WALK_FLAG_UNALLOC);
+
+    BlockWalk walk;
+    walk.builder = &image.builder;
+    walk.stop_after = 5;
+    REQUIRE(tsk_fs_block_walk(image.fs, 0, last,
+        (TSK_FS_BLOCK_WALK_FLAG_ENUM) (TSK_FS_BLOCK_WALK_FLAG_UNALLOC | aonly),
+        record_block, &walk) == 0);
+    REQUIRE(walk.addrs.size() == 5);
+    CHECK(walk.wrong_flags == 0);
+    CHECK(walk.addrs[0] > 0);
+}
+
+TEST_CASE("NTFS cluster bitmap lookups from several threads", "[ntfs]") {
+    NtfsImageOptions opts;
+    opts.cluster_size = 512;
+    opts.num_clusters = 1200000;
+    opts.reserved_runs = { { 300000, 333 }, { 700000, 50000 }, { 1150000, 7 } };
+    NtfsTestImage image(opts);
+
+    // the pages after the first are loaded by whichever thread gets there first
+    std::vector<size_t> wrong(4, 0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < wrong.size(); t++) {
+        threads.emplace_back([&image, &wrong, t]() {
+            for (TSK_DADDR_T c = t; c <= image.fs->last_block; c += 3) {
+                int want = image.builder.cluster_allocated(c)
+                    ? TSK_FS_BLOCK_FLAG_ALLOC : TSK_FS_BLOCK_FLAG_UNALLOC;
+                if (image.fs->block_getflags(image.fs, c) != want)
+                    wrong[t]++;
+            }
+        });
+    }
+    for (std::thread &t : threads)
+        t.join();
+    for (size_t w : wrong)
+        CHECK(w == 0);
+}
+
+TEST_CASE("NTFS compressed files decompress the same on worker threads", "[ntfs]") {
+    NtfsImageOptions opts;
+    opts.compressed = true;
+    opts.short_initsize = true;
+    opts.num_files = 24;
+    opts.max_file_size = 400000;
+    opts.fragmentation = 0.02;
+
+    SECTION("4 KiB clusters") {
+        opts.num_clusters = 8192;
+    }
+    SECTION("512 byte clusters") {
+        opts.cluster_size = 512;
+        opts.num_clusters = 40000;
+    }
+
+    NtfsTestImage image(opts);
+    for (unsigned int threads : { 0u, 4u }) {
+        INFO(threads << " decompression threads");
+        tsk_fs_set_decomp_threads(image.fs, threads);
+        CHECK(image.fs->decomp_threads == threads);
+        check_file_contents(image);
+        size_t ncompressed = 0;
+        check_compressed_files(image, 7, &ncompressed);
+        CHECK(ncompressed > 10);
+    }
+
+    // several readers share the worker threads
+    std::vector<size_t> counts(3, 0);
+    std::vector<std::thread> readers;
+    for (size_t t = 0; t < counts.size(); t++) {
+        readers.emplace_back([&image, &counts, t]() {
+            for (const NtfsExpectedFile &ef : image.builder.files()) {
+                if (!ef.compressed)
+                    continue;
+                TSK_FS_FILE *fs_file = tsk_fs_file_open(image.fs, NULL,
+                    ef.path.c_str());
+                if (fs_file == nullptr)
+                    continue;
+                std::vector<char> got(ef.size), want(ef.size);
+                NtfsImageBuilder::expected_content(ef, 0,
+                    (uint8_t *) want.data(), want.size());
+                if (tsk_fs_file_read(fs_file, 0, got.data(), got.size(),
+                        TSK_FS_FILE_READ_FLAG_NONE) == (ssize_t) ef.size
+                    && got == want)
+                    counts[t]++;
+                tsk_fs_file_close(fs_file);
+            }
+        });
+    }
+    for (std::thread &t : readers)
+        t.join();
+    size_t ncompressed = 0;
+    for (const NtfsExpectedFile &ef : image.builder.files())
+        ncompressed += ef.compressed;
+    for (size_t c : counts)
+        CHECK(c == ncompressed);
+}
+
+TEST_CASE("NTFS path lookups descend the $I30 B-tree", "[ntfs]") {
+    NtfsImageOptions opts;
+    opts.cluster_size = 512;
+    opts.num_clusters = 32768;
+    opts.index_record_size = 1024;
+    opts.num_files = 900;
+    opts.max_file_size = 600;
+    opts.mixed_names = true;
+
+    SECTION("with $UpCase") {
+        opts.upcase_table = true;
+    }
+    SECTION("without $UpCase") {
+        // TSK folds only ASCII then, so the Latin-1 names seem out of
+        // order and are found in the full listing instead
+    }
+
+    NtfsTestImage image(opts);
+    REQUIRE(image.fs->dir_lookup != nullptr);
+    REQUIRE(image.builder.index_depth(5) >= 3);
+    const NtfsExpectedFile &dir0 = image.builder.files()[0];
+    REQUIRE(dir0.is_dir);
+    REQUIRE(image.builder.index_depth(dir0.inum) >= 3);
+
+    // every name is found with the same details as in the listing
+    size_t fallbacks = 0;
+    for (TSK_INUM_T dir : { (TSK_INUM_T) 5, (TSK_INUM_T) dir0.inum }) {
+        TSK_FS_DIR *fs_dir = tsk_fs_dir_open_meta(image.fs, dir);
+        REQUIRE(fs_dir != nullptr);
+        size_t names = 0;
+        for (size_t i = 0; i < tsk_fs_dir_getsize(fs_dir); i++) {
+            const TSK_FS_NAME *want = tsk_fs_dir_get_name(fs_dir, i);
+            REQUIRE(want != nullptr);
+            if (std::string(want->name) == "." || std::string(want->name) == ".."
+                || want->meta_addr == TSK_FS_ORPHANDIR_INUM(image.fs))
+                continue;
+            names++;
+            INFO(want->name);
+            TSK_FS_NAME *got = nullptr;
+            TSK_RETVAL_ENUM ret = image.fs->dir_lookup(image.fs, dir,
+                swap_ascii_case(want->name).c_str(), &got);
+            if (ret == TSK_COR && !opts.upcase_table) {
+                tsk_error_reset();
+                fallbacks++;
+                continue;
+            }
+            REQUIRE(ret == TSK_OK);
+            REQUIRE(got != nullptr);
+            CHECK(std::string(got->name) == want->name);
+            CHECK(std::string(got->shrt_name) == (want->shrt_name ? want->shrt_name : ""));
+            CHECK(got->meta_addr == want->meta_addr);
+            CHECK(got->meta_seq == want->meta_seq);
+            CHECK(got->par_addr == want->par_addr);
+            CHECK(got->par_seq == want->par_seq);
+            CHECK(got->type == want->type);
+            CHECK(got->flags == want->flags);
+            tsk_fs_name_free(got);
+        }
+        CHECK(names > 250);
+        tsk_fs_dir_close(fs_dir);
+    }
+    if (opts.upcase_table)
+        CHECK(fallbacks == 0);
+    else
+        CHECK(fallbacks > 0);
+
+    // paths resolve either way, in any ASCII case
+    check_file_contents(image);
+    for (const NtfsExpectedFile &ef : image.builder.files()) {
+        INFO(ef.path);
+        TSK_INUM_T inum = 0;
+        CHECK(tsk_fs_path2inum(image.fs, swap_ascii_case(ef.path).c_str(),
+            &inum, NULL) == 0);
+        CHECK(inum == ef.inum);
+    }
+
+    // names that are not there
+    TSK_FS_NAME *got = nullptr;
+    CHECK(image.fs->dir_lookup(image.fs, 5, "no_such_file", &got) == TSK_COR);
+    CHECK(got == nullptr);
+    tsk_error_reset();
+    TSK_INUM_T inum = 0;
+    CHECK(tsk_fs_path2inum(image.fs, "/no_such_file", &inum, NULL) == 1);
+    CHECK(tsk_fs_path2inum(image.fs, "/dir_000/file_00000.bin", &inum, NULL) == 1);
+    CHECK(tsk_fs_path2inum(image.fs, "/file_00000.bin/x", &inum, NULL) == -1);
+    tsk_error_reset();
+
+    if (opts.upcase_table) {
+        // a lookup reads the index records on one path down the tree,
+        // a listing reads all of them
+        const NtfsExpectedFile &ef = image.builder.files().back();
+        size_t before = bytes_requested(image.img);
+        REQUIRE(tsk_fs_path2inum(image.fs, ef.path.c_str(), &inum, NULL) == 0);
+        size_t lookup = bytes_requested(image.img) - before;
+
+        before = bytes_requested(image.img);
+        TSK_FS_DIR *fs_dir = tsk_fs_dir_open_meta(image.fs,
+            split_path(image.builder, ef.path).first);
+        REQUIRE(fs_dir != nullptr);
+        tsk_fs_dir_close(fs_dir);
+        size_t listing = bytes_requested(image.img) - before;
+        CHECK(lookup * 4 < listing);
+    }
+}
+
+TEST_CASE("NTFS owner SIDs are read from $Secure when first needed", "[ntfs]") {
+    NtfsImageOptions opts;
+    opts.num_files = 80;
+    opts.max_file_size = 2000;
+    opts.num_clusters = 8192;
+
+    SECTION("$SII in one index record") {
+        opts.security_ids = 50;
+    }
+    SECTION("$SII in two levels, $SDS in mirrored blocks") {
+        opts.security_ids = 7000;
+    }
+
+    NtfsTestImage image(opts);
+    NTFS_INFO *ntfs = (NTFS_INFO *) image.fs;
+#ifdef TSK_USE_SID
+    CHECK(ntfs->sec_index_loaded == 0);
+#endif
+
+    std::vector<TSK_INUM_T> inums = { 5 };
+    for (const NtfsExpectedFile &ef : image.builder.files())
+        inums.push_back(ef.inum);
+
+    // the first lookups race to build the index
+    std::vector<size_t> wrong(4, 0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < wrong.size(); t++) {
+        threads.emplace_back([&image, &inums, &wrong, t]() {
+            for (size_t i = t; i < inums.size() + t; i++) {
+                TSK_INUM_T inum = inums[i % inums.size()];
+                if (owner_of(image.fs, inum) != image.builder.owner_sid(inum))
+                    wrong[t]++;
+            }
+        });
+    }
+    for (std::thread &t : threads)
+        t.join();
+    for (size_t w : wrong)
+        CHECK(w == 0);
+#ifdef TSK_USE_SID
+    CHECK(ntfs->sec_index_loaded == 1);
+    CHECK(ntfs->sec_index != nullptr);
+#endif
+
+    // once indexed, an owner costs its MFT entry and one $SDS entry
+    const NtfsExpectedFile &ef = image.builder.files().back();
+    size_t before = bytes_requested(image.img);
+    CHECK(owner_of(image.fs, ef.inum) == image.builder.owner_sid(ef.inum));
+    size_t lookup = bytes_requested(image.img) - before;
+    CHECK(lookup <= 4 * image.fs->block_size);
+    if (opts.security_ids > 1000)
+        CHECK(image.builder.sds_size() > 2 * 256 * 1024);
+}
+
+TEST_CASE("NTFS owner SIDs without $Secure", "[ntfs]") {
+    NtfsImageOptions opts;
+    opts.num_files = 4;
+    NtfsTestImage image(opts);
+    CHECK(owner_of(image.fs, image.builder.files().back().inum) == "");
+}
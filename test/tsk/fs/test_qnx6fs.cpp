@@ -0,0 +1,251 @@
+/*
+ * test_qnx6fs.cpp
+ *
+ * Functional tests for the QNX6 file system driver, run against images
+ * built by Qnx6ImageBuilder.
+ */
+
+#include "tsk/libtsk.h"
+#include "tsk/fs/tsk_fs_i.h"
+#include "tsk/fs/qnx6fs.h"
+
+#include "catch.hpp"
+
+#include "qnx6_image.h"
+#include "test/tools/tsk_tempfile.h"
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Qnx6Fixture {
+    Qnx6ImageBuilder builder;
+    std::string path;
+    TSK_IMG_INFO *img = nullptr;
+    TSK_FS_INFO *fs = nullptr;
+
+    explicit Qnx6Fixture(const Qnx6ImageOptions &opts) : builder(opts) {
+        FILE *f = tsk_make_named_tempfile(&path);
+        REQUIRE(f != nullptr);
+        bool ok = builder.write(f);
+        fclose(f);
+        REQUIRE(ok);
+    }
+
+    ~Qnx6Fixture() {
+        close();
+        if (!path.empty())
+            remove(path.c_str());
+    }
+
+    TSK_FS_INFO *open() {
+        const char *paths[] = { path.c_str() };
+        img = tsk_img_open_utf8(1, paths, TSK_IMG_TYPE_RAW, 512);
+        REQUIRE(img != nullptr);
+        fs = tsk_fs_open_img(img, 0, TSK_FS_TYPE_QNX6);
+        return fs;
+    }
+
+    void close() {
+        if (fs) fs->close(fs);
+        if (img) tsk_img_close(img);
+        fs = nullptr;
+        img = nullptr;
+    }
+
+    // Overwrite bytes at an absolute image offset.
+    void patch(uint64_t off, const void *data, size_t len) {
+        FILE *f = fopen(path.c_str(), "r+b");
+        REQUIRE(f != nullptr);
+        REQUIRE(fseek(f, (long)off, SEEK_SET) == 0);
+        REQUIRE(fwrite(data, len, 1, f) == 1);
+        fclose(f);
+    }
+};
+
+TSK_WALK_RET_ENUM collect_names(TSK_FS_FILE *file, const char *path, void *ptr) {
+    auto *names = static_cast<std::map<std::string, TSK_INUM_T> *>(ptr);
+    if (!file->name || TSK_FS_ISDOT(file->name->name))
+        return TSK_WALK_CONT;
+    (*names)["/" + std::string(path) + file->name->name] = file->name->meta_addr;
+    return TSK_WALK_CONT;
+}
+
+struct BlockCheck {
+    const Qnx6ImageBuilder *builder;
+    TSK_DADDR_T data_start;
+    size_t mismatches;
+    size_t visited;
+};
+
+TSK_WALK_RET_ENUM check_block(const TSK_FS_BLOCK *blk, void *ptr) {
+    auto *c = static_cast<BlockCheck *>(ptr);
+    bool alloc = (blk->flags & TSK_FS_BLOCK_FLAG_ALLOC) != 0;
+    if (alloc != c->builder->block_allocated((uint32_t)(blk->addr - c->data_start)))
+        c->mismatches++;
+    c->visited++;
+    return TSK_WALK_CONT;
+}
+
+std::map<std::string, TSK_INUM_T> list_all(TSK_FS_INFO *fs) {
+    std::map<std::string, TSK_INUM_T> names;
+    REQUIRE(tsk_fs_dir_walk(fs, fs->root_inum,
+        (TSK_FS_DIR_WALK_FLAG_ENUM)(TSK_FS_DIR_WALK_FLAG_ALLOC |
+            TSK_FS_DIR_WALK_FLAG_RECURSE | TSK_FS_DIR_WALK_FLAG_NOORPHAN),
+        collect_names, &names) == 0);
+    return names;
+}
+
+Qnx6ImageOptions small_options() {
+    Qnx6ImageOptions opts;
+    opts.block_size = 1024;
+    opts.num_blocks = 8192;
+    opts.num_dirs = 3;
+    opts.num_files = 60;
+    opts.big_file_size = 600 * 1024;   // needs a level 2 tree at 1 KiB
+    opts.fragmentation = 0.3;
+    opts.seed = 7;
+    return opts;
+}
+
+}
+
+TEST_CASE("qnx6fs opens a synthetic image", "[qnx6]") {
+    Qnx6Fixture fx(small_options());
+    TSK_FS_INFO *fs = fx.open();
+    REQUIRE(fs != nullptr);
+
+    CHECK(fs->ftype == TSK_FS_TYPE_QNX6);
+    CHECK(fs->block_size == 1024);
+    CHECK(fs->root_inum == 1);
+    CHECK(fs->first_inum == 1);
+    CHECK(fs->last_inum >= fx.builder.num_inodes());
+}
+
+TEST_CASE("qnx6fs directory walk finds every file", "[qnx6]") {
+    Qnx6Fixture fx(small_options());
+    TSK_FS_INFO *fs = fx.open();
+    REQUIRE(fs != nullptr);
+
+    std::map<std::string, TSK_INUM_T> names = list_all(fs);
+    size_t expected = 0;
+    for (const Qnx6ExpectedFile &f : fx.builder.files()) {
+        INFO(f.path);
+        REQUIRE(names.count(f.path) == 1);
+        CHECK(names[f.path] == f.inum);
+        expected++;
+    }
+    CHECK(names.size() == expected);
+}
+
+TEST_CASE("qnx6fs file contents match the generator", "[qnx6]") {
+    Qnx6Fixture fx(small_options());
+    TSK_FS_INFO *fs = fx.open();
+    REQUIRE(fs != nullptr);
+
+    std::vector<char> got, want;
+    for (const Qnx6ExpectedFile &f : fx.builder.files()) {
+        if (f.is_dir)
+            continue;
+        INFO(f.path);
+        TSK_FS_FILE *file = tsk_fs_file_open_meta(fs, nullptr, f.inum);
+        REQUIRE(file != nullptr);
+        REQUIRE(file->meta != nullptr);
+        CHECK((uint64_t)file->meta->size == f.size);
+
+        got.assign(f.size, 0);
+        want.assign(f.size, 0);
+        if (f.size) {
+            ssize_t n = tsk_fs_file_read(file, 0, got.data(), f.size,
+                TSK_FS_FILE_READ_FLAG_NONE);
+            CHECK(n == (ssize_t)f.size);
+            fx.builder.expected_content(f, 0, (uint8_t *)want.data(), f.size);
+        }
+        CHECK(got == want);
+        tsk_fs_file_close(file);
+    }
+}
+
+TEST_CASE("qnx6fs block allocation follows the bitmap", "[qnx6]") {
+    Qnx6ImageOptions opts = small_options();
+    Qnx6Fixture fx(opts);
+    TSK_FS_INFO *fs = fx.open();
+    REQUIRE(fs != nullptr);
+
+    BlockCheck c = { &fx.builder, fx.builder.data_start_blk(), 0, 0 };
+    REQUIRE(tsk_fs_block_walk(fs, c.data_start, c.data_start + opts.num_blocks - 1,
+        (TSK_FS_BLOCK_WALK_FLAG_ENUM)(TSK_FS_BLOCK_WALK_FLAG_ALLOC |
+            TSK_FS_BLOCK_WALK_FLAG_UNALLOC | TSK_FS_BLOCK_WALK_FLAG_AONLY),
+        check_block, &c) == 0);
+    CHECK(c.visited == opts.num_blocks);
+    CHECK(c.mismatches == 0);
+}
+
+TEST_CASE("qnx6fs superblock check and snapshot view", "[qnx6]") {
+    Qnx6Fixture fx(small_options());
+    FILE *sink = tsk_make_tempfile();
+    REQUIRE(sink != nullptr);
+
+    SECTION("clean image passes and the snapshot lists the same files") {
+        TSK_FS_INFO *fs = fx.open();
+        REQUIRE(fs != nullptr);
+        REQUIRE(fs->fscheck != nullptr);
+        CHECK(fs->fscheck(fs, sink) == 0);
+
+        TSK_FS_INFO *snap = tsk_qnx6_open_snapshot(fs);
+        REQUIRE(snap != nullptr);
+        CHECK(list_all(snap) == list_all(fs));
+        snap->close(snap);
+    }
+
+    SECTION("damaged second superblock is reported") {
+        uint64_t sb1 = (uint64_t)fx.builder.data_start_blk() * 1024 +
+            (uint64_t)small_options().num_blocks * 1024;
+        const uint8_t junk[4] = { 0xde, 0xad, 0xbe, 0xef };
+        fx.patch(sb1 + 16, junk, sizeof(junk));
+
+        TSK_FS_INFO *fs = fx.open();
+        REQUIRE(fs != nullptr);
+        CHECK(fs->fscheck(fs, sink) == 1);
+        CHECK(tsk_error_get_errno() == TSK_ERR_FS_CORRUPT);
+        tsk_error_reset();
+        CHECK(tsk_qnx6_open_snapshot(fs) == nullptr);
+        tsk_error_reset();
+    }
+
+    fclose(sink);
+}
+
+TEST_CASE("qnx6fs rejects a pointer tree too deep for 64-bit block counts", "[qnx6]") {
+    // 16 * (64 KiB / 4)^5 blocks does not fit in 64 bits
+    Qnx6ImageOptions opts;
+    opts.block_size = 65536;
+    opts.num_blocks = 64;
+    opts.num_dirs = 0;
+    opts.num_files = 2;
+    opts.big_file_size = 100 * 1024;
+    opts.big_file_level = 5;
+    Qnx6Fixture fx(opts);
+    TSK_FS_INFO *fs = fx.open();
+    REQUIRE(fs != nullptr);
+
+    const Qnx6ExpectedFile *big = nullptr;
+    for (const Qnx6ExpectedFile &f : fx.builder.files())
+        if (!f.is_dir && (!big || f.size > big->size))
+            big = &f;
+    REQUIRE(big != nullptr);
+    REQUIRE(big->size == opts.big_file_size);
+
+    TSK_FS_FILE *file = tsk_fs_file_open_meta(fs, nullptr, big->inum);
+    REQUIRE(file != nullptr);
+    char buf[512];
+    tsk_error_reset();
+    CHECK(tsk_fs_file_read(file, 0, buf, sizeof(buf),
+        TSK_FS_FILE_READ_FLAG_NONE) == -1);
+    CHECK(tsk_error_get_errno() == TSK_ERR_FS_CORRUPT);
+    tsk_error_reset();
+    tsk_fs_file_close(file);
+}
@@ -1,14 +1,17 @@
 #include "tsk/img/tsk_img_i.h"
 #include "tsk/img/img_open.h"
 #include "test/tsk/img/test_img.h"
+#include "test/tools/tsk_tempfile.h"
 #include "catch.hpp"
 
 
 #include <algorithm>
+#include <cstdio>
 #include <memory>
 #include <string>
 #include <tuple>
 #include <utility>
+#include <vector>
 
 TEST_CASE("tsk_img_open 0 images") {
   const TSK_TCHAR* const images[] = {};
@@ -238,3 +241,153 @@ TEST_CASE("tsk_img_open") {
 #endif
   }
 }
+
+TEST_CASE("tsk_img_options_parse") {
+  TSK_IMG_OPTIONS opts;
+  tsk_img_options_init(&opts);
+  CHECK(opts.cache == TSK_IMG_CACHE_DEFAULT);
+  CHECK(opts.cache_size == 0);
+  CHECK(opts.readahead == TSK_IMG_READAHEAD_DEFAULT);
+
+  REQUIRE(tsk_img_options_parse(&opts, "cache=lru,cache_size=64M,readahead=512k") == 0);
+  CHECK(opts.cache == TSK_IMG_CACHE_LRU);
+  CHECK(opts.cache_size == 64 * 1024 * 1024);
+  CHECK(opts.readahead == 512 * 1024);
+  CHECK(opts.backend == TSK_IMG_BACKEND_DEFAULT);
+
+  REQUIRE(tsk_img_options_parse(&opts, "cache=none,,backend=mmap") == 0);
+  CHECK(opts.cache == TSK_IMG_CACHE_NONE);
+  CHECK(opts.backend == TSK_IMG_BACKEND_MMAP);
+  CHECK(opts.cache_size == 64 * 1024 * 1024);
+
+  CHECK(tsk_img_options_parse(&opts, "") == 0);
+  CHECK(tsk_img_options_parse(&opts, "cache=fast") == 1);
+  CHECK(tsk_error_get_errno() == TSK_ERR_IMG_ARG);
+  CHECK(tsk_img_options_parse(&opts, "cache_size=12Q") == 1);
+  CHECK(tsk_img_options_parse(&opts, "readahead") == 1);
+  CHECK(tsk_img_options_parse(&opts, "colour=blue") == 1);
+}
+
+#ifndef TSK_WIN32
+TEST_CASE("tsk_img_options_getenv") {
+  TSK_IMG_OPTIONS opts;
+  unsetenv("TSK_IMG_OPTIONS");
+  REQUIRE(tsk_img_options_getenv(&opts) == 0);
+  CHECK(opts.cache == TSK_IMG_CACHE_DEFAULT);
+
+  setenv("TSK_IMG_OPTIONS", "cache=sharded,readahead=2M", 1);
+  REQUIRE(tsk_img_options_getenv(&opts) == 0);
+  CHECK(opts.cache == TSK_IMG_CACHE_SHARDED);
+  CHECK(opts.readahead == 2 * 1024 * 1024);
+
+  // the library itself does not read it
+  std::string path;
+  FILE* f = tsk_make_named_tempfile(&path);
+  REQUIRE(f);
+  REQUIRE(fputc(0, f) == 0);
+  fclose(f);
+  const char* const images[] = { path.c_str() };
+  TSK_IMG_INFO* img = tsk_img_open_utf8(1, images, TSK_IMG_TYPE_RAW, 0);
+  REQUIRE(img);
+  CHECK(reinterpret_cast<IMG_INFO*>(img)->cache_read == tsk_img_read_legacy);
+  tsk_img_close(img);
+  remove(path.c_str());
+
+  setenv("TSK_IMG_OPTIONS", "cache=fast", 1);
+  CHECK(tsk_img_options_getenv(&opts) == 1);
+  CHECK(tsk_error_get_errno() == TSK_ERR_IMG_ARG);
+  unsetenv("TSK_IMG_OPTIONS");
+}
+#endif
+
+TEST_CASE("tsk_img_open_opt cache policies") {
+  std::string path;
+  FILE* f = tsk_make_named_tempfile(&path);
+  REQUIRE(f);
+  std::vector<char> data(1 << 20);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (char) (i * 7);
+  }
+  REQUIRE(fwrite(data.data(), data.size(), 1, f) == 1);
+  fclose(f);
+
+  const auto check = [&](TSK_IMG_CACHE_ENUM cache, decltype(IMG_INFO::cache_read) expected) {
+    TSK_IMG_OPTIONS opts;
+    tsk_img_options_init(&opts);
+    opts.cache = cache;
+    opts.cache_size = 256 * 1024;
+    const char* const images[] = { path.c_str() };
+    std::unique_ptr<TSK_IMG_INFO, decltype(&tsk_img_close)> img{
+      tsk_img_open_utf8_opt(1, images, TSK_IMG_TYPE_RAW, 0, &opts),
+      tsk_img_close
+    };
+    REQUIRE(img);
+    CHECK(reinterpret_cast<IMG_INFO*>(img.get())->cache_read == expected);
+    CHECK(reinterpret_cast<IMG_INFO*>(img.get())->opts.cache_size == 256 * 1024);
+
+    char buf[1000];
+    REQUIRE(tsk_img_read(img.get(), 70000, buf, sizeof(buf)) == (ssize_t) sizeof(buf));
+    CHECK(std::equal(buf, buf + sizeof(buf), data.begin() + 70000));
+  };
+
+  check(TSK_IMG_CACHE_DEFAULT, tsk_img_read_legacy);
+  check(TSK_IMG_CACHE_NONE, tsk_img_read_no_cache);
+  check(TSK_IMG_CACHE_LEGACY, tsk_img_read_legacy);
+  check(TSK_IMG_CACHE_LRU, tsk_img_read_sharded);
+  check(TSK_IMG_CACHE_SHARDED, tsk_img_read_sharded);
+
+  TSK_IMG_OPTIONS bad;
+  tsk_img_options_init(&bad);
+  bad.cache = (TSK_IMG_CACHE_ENUM) 42;
+  const char* const images[] = { path.c_str() };
+  CHECK(!tsk_img_open_utf8_opt(1, images, TSK_IMG_TYPE_RAW, 0, &bad));
+  CHECK(tsk_error_get_errno() == TSK_ERR_IMG_ARG);
+
+  remove(path.c_str());
+}
+
+TEST_CASE("tsk_img_open_opt readahead=0 turns read-ahead off") {
+  std::string path;
+  FILE* f = tsk_make_named_tempfile(&path);
+  REQUIRE(f);
+  const size_t size = 4 << 20;
+  std::vector<char> data(size);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = (char) (i * 13);
+  }
+  REQUIRE(fwrite(data.data(), data.size(), 1, f) == 1);
+  fclose(f);
+
+  const auto read_all = [&](size_t readahead) {
+    TSK_IMG_OPTIONS opts;
+    tsk_img_options_init(&opts);
+    opts.cache = TSK_IMG_CACHE_SHARDED;
+    opts.cache_size = 8 << 20;
+    opts.readahead = readahead;
+    const char* const images[] = { path.c_str() };
+    std::unique_ptr<TSK_IMG_INFO, decltype(&tsk_img_close)> img{
+      tsk_img_open_utf8_opt(1, images, TSK_IMG_TYPE_RAW, 0, &opts),
+      tsk_img_close
+    };
+    REQUIRE(img);
+
+    char buf[4096];
+    for (size_t off = 0; off < size; off += sizeof(buf)) {
+      REQUIRE(tsk_img_read(img.get(), off, buf, sizeof(buf)) == (ssize_t) sizeof(buf));
+      REQUIRE(std::equal(buf, buf + sizeof(buf), data.begin() + off));
+    }
+    Stats s;
+    tsk_img_collect_stats(img.get(), &s);
+    return s;
+  };
+
+  // one backend read per cache line without read-ahead
+  const Stats off = read_all(0);
+  CHECK(off.backend_reads == size / TSK_IMG_INFO_CACHE_LEN);
+  CHECK(off.backend_bytes == size);
+  const Stats on = read_all(TSK_IMG_READAHEAD_DEFAULT);
+  CHECK(on.backend_reads < size / TSK_IMG_INFO_CACHE_LEN / 4);
+  CHECK(on.backend_bytes == size);
+
+  remove(path.c_str());
+}
@@ -3,9 +3,15 @@
 
 #include "catch.hpp"
 #include "test/tsk/img/test_img.h"  // includes prepend_test_data_dir and fix_slashes_for_windows
+#include "test/tools/tsk_tempfile.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
 #include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 TEST_CASE("raw_open not a file") {
   std::basic_string<TSK_TCHAR> path = prepend_test_data_dir(_TSK_T("not_a_file"));
@@ -55,3 +61,138 @@ TEST_CASE("raw_open backslash path separator ok") {
   REQUIRE(img);
 }
 #endif
+
+namespace {
+
+char split_pattern(size_t off) {
+  return (char) ((off * 13) ^ (off >> 9));
+}
+
+struct SplitImage {
+  std::vector<std::string> paths;
+  size_t size = 0;
+
+  explicit SplitImage(int segments) {
+    for (int i = 0; i < segments; ++i) {
+      std::string path;
+      FILE* f = tsk_make_named_tempfile(&path);
+      REQUIRE(f);
+      // uneven sizes, and an empty segment
+      const size_t len = i == 7 ? 0 : 3000 + 517 * i;
+      std::vector<char> data(len);
+      for (size_t j = 0; j < len; ++j) {
+        data[j] = split_pattern(size + j);
+      }
+      REQUIRE(fwrite(data.data(), 1, len, f) == len);
+      fclose(f);
+      paths.push_back(path);
+      size += len;
+    }
+  }
+
+  ~SplitImage() {
+    for (const auto& p: paths) {
+      remove(p.c_str());
+    }
+  }
+
+  TSK_IMG_INFO* open(TSK_IMG_BACKEND_ENUM backend, size_t max_files) {
+    TSK_IMG_OPTIONS opts;
+    tsk_img_options_init(&opts);
+    opts.cache = TSK_IMG_CACHE_NONE;
+    opts.backend = backend;
+    opts.max_files = max_files;
+    std::vector<const char*> names;
+    for (const auto& p: paths) {
+      names.push_back(p.c_str());
+    }
+    return tsk_img_open_utf8_opt((int) names.size(), names.data(), TSK_IMG_TYPE_RAW, 0, &opts);
+  }
+};
+
+bool split_matches(const char* buf, size_t off, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    if (buf[i] != split_pattern(off + i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}
+
+TEST_CASE("raw split image backends") {
+  SplitImage split(40);
+
+  const TSK_IMG_BACKEND_ENUM backends[] = {
+    TSK_IMG_BACKEND_DEFAULT,
+    TSK_IMG_BACKEND_PREAD,
+    TSK_IMG_BACKEND_MMAP,
+    TSK_IMG_BACKEND_DIRECT
+  };
+
+  for (const auto backend: backends) {
+    CAPTURE(backend);
+    std::unique_ptr<TSK_IMG_INFO, decltype(&tsk_img_close)> img{
+      split.open(backend, 3),
+      tsk_img_close
+    };
+    REQUIRE(img);
+    REQUIRE(img->size == (TSK_OFF_T) split.size);
+
+    // a few reads across segment boundaries, then the end of the image
+    std::vector<char> buf(20000);
+    size_t bad = 0;
+    uint32_t x = 99;
+    for (int i = 0; i < 500; ++i) {
+      x = x * 1103515245 + 12345;
+      const size_t off = (x >> 3) % split.size;
+      const size_t len = std::min((size_t) 1 + (x >> 17) % buf.size(), split.size - off);
+      if (tsk_img_read(img.get(), off, buf.data(), len) != (ssize_t) len
+          || !split_matches(buf.data(), off, len)) {
+        ++bad;
+      }
+    }
+    CHECK(bad == 0);
+
+    CHECK(tsk_img_read(img.get(), split.size - 10, buf.data(), 100) == 10);
+    CHECK(split_matches(buf.data(), split.size - 10, 10));
+  }
+}
+
+#ifndef TSK_WIN32
+TEST_CASE("raw split image concurrent reads") {
+  SplitImage split(60);
+
+  for (const auto backend: { TSK_IMG_BACKEND_PREAD, TSK_IMG_BACKEND_MMAP }) {
+    std::unique_ptr<TSK_IMG_INFO, decltype(&tsk_img_close)> img{
+      split.open(backend, 4),
+      tsk_img_close
+    };
+    REQUIRE(img);
+    CHECK(reinterpret_cast<IMG_INFO*>(img.get())->parallel_read);
+
+    std::atomic<size_t> bad{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+      threads.emplace_back([&, t]() {
+        uint32_t x = 1000 + t;
+        char buf[5000];
+        for (int i = 0; i < 2000; ++i) {
+          x = x * 1103515245 + 12345;
+          const size_t off = (x >> 3) % split.size;
+          const size_t len = std::min((size_t) 1 + (x >> 19) % sizeof(buf), split.size - off);
+          if (tsk_img_read(img.get(), off, buf, len) != (ssize_t) len
+              || !split_matches(buf, off, len)) {
+            ++bad;
+          }
+        }
+      });
+    }
+    for (auto& th: threads) {
+      th.join();
+    }
+    CHECK(bad == 0);
+  }
+}
+#endif
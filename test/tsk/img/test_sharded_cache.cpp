@@ -0,0 +1,507 @@
+#include "tsk/img/tsk_img_i.h"
+#include "tsk/img/sharded_cache.h"
+#include "tsk/img/legacy_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+
+namespace {
+
+std::atomic<size_t> backend_reads{0};
+std::atomic<size_t> backend_bytes{0};
+std::atomic<bool> backend_fail{false};
+
+char pattern(TSK_OFF_T off) {
+  return (char) ((off * 31) ^ (off >> 16));
+}
+
+ssize_t pattern_read(TSK_IMG_INFO* img, TSK_OFF_T off, char* buf, size_t len) {
+  ++backend_reads;
+  if (backend_fail) {
+    return -1;
+  }
+  if (off >= img->size) {
+    return 0;
+  }
+  if ((TSK_OFF_T) len > img->size - off) {
+    len = (size_t) (img->size - off);
+  }
+  for (size_t i = 0; i < len; ++i) {
+    buf[i] = pattern(off + i);
+  }
+  backend_bytes += len;
+  return (ssize_t) len;
+}
+
+struct CachedImg {
+  TSK_IMG_INFO* img;
+
+  CachedImg(TSK_OFF_T size, ShardedCache* cache) {
+    img = (TSK_IMG_INFO*) tsk_img_malloc(sizeof(IMG_INFO));
+    REQUIRE(img);
+    img->size = size;
+    img->sector_size = 512;
+    IMG_INFO* iif = reinterpret_cast<IMG_INFO*>(img);
+    iif->cache = cache;
+    iif->cache_read = tsk_img_read_sharded;
+    iif->read = pattern_read;
+    backend_reads = 0;
+    backend_bytes = 0;
+    backend_fail = false;
+  }
+
+  ~CachedImg() {
+    delete static_cast<ImgCache*>(reinterpret_cast<IMG_INFO*>(img)->cache);
+    tsk_img_free(img);
+  }
+
+  Stats stats() {
+    Stats s;
+    tsk_img_collect_stats(img, &s);
+    return s;
+  }
+};
+
+bool matches(const char* buf, TSK_OFF_T off, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    if (buf[i] != pattern(off + i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}
+
+TEST_CASE("sharded cache serves repeated reads from memory") {
+  CachedImg ci(1 << 20, new ShardedCache(256 * 1024, 4096, 4));
+  char buf[512];
+
+  REQUIRE(tsk_img_read(ci.img, 10000, buf, sizeof(buf)) == (ssize_t) sizeof(buf));
+  CHECK(matches(buf, 10000, sizeof(buf)));
+  CHECK(backend_reads == 1);
+
+  REQUIRE(tsk_img_read(ci.img, 10100, buf, 100) == 100);
+  CHECK(matches(buf, 10100, 100));
+  CHECK(backend_reads == 1);
+
+  const Stats s = ci.stats();
+  CHECK(s.hits == 1);
+  CHECK(s.misses == 1);
+  CHECK(s.hit_bytes == 100);
+  CHECK(s.miss_bytes == 512);
+}
+
+TEST_CASE("sharded cache reads spanning two lines") {
+  CachedImg ci(1 << 20, new ShardedCache(256 * 1024, 4096, 4));
+  char buf[4096];
+
+  REQUIRE(tsk_img_read(ci.img, 4096 * 3 + 100, buf, sizeof(buf)) == (ssize_t) sizeof(buf));
+  CHECK(matches(buf, 4096 * 3 + 100, sizeof(buf)));
+  CHECK(backend_reads == 2);
+
+  REQUIRE(tsk_img_read(ci.img, 4096 * 4 - 10, buf, 20) == 20);
+  CHECK(matches(buf, 4096 * 4 - 10, 20));
+  CHECK(backend_reads == 2);
+}
+
+TEST_CASE("sharded cache clips reads at the end of the image") {
+  const TSK_OFF_T size = 3 * 4096 + 1000;
+  CachedImg ci(size, new ShardedCache(256 * 1024, 4096, 4));
+  char buf[2048];
+
+  CHECK(tsk_img_read(ci.img, size - 500, buf, sizeof(buf)) == 500);
+  CHECK(matches(buf, size - 500, 500));
+  CHECK(tsk_img_read(ci.img, size - 1, buf, 1) == 1);
+  CHECK(backend_reads == 1);
+}
+
+TEST_CASE("sharded cache bypasses reads larger than a line") {
+  CachedImg ci(1 << 20, new ShardedCache(256 * 1024, 4096, 4));
+  std::vector<char> buf(3 * 4096);
+
+  REQUIRE(tsk_img_read(ci.img, 512, buf.data(), buf.size()) == (ssize_t) buf.size());
+  CHECK(matches(buf.data(), 512, buf.size()));
+  REQUIRE(tsk_img_read(ci.img, 512, buf.data(), buf.size()) == (ssize_t) buf.size());
+  CHECK(backend_reads == 2);
+}
+
+TEST_CASE("sharded cache evicts the least recently used line") {
+  // one shard of two lines
+  CachedImg ci(1 << 20, new ShardedCache(2 * 4096, 4096, 1));
+  char buf[16];
+
+  tsk_img_read(ci.img, 0, buf, sizeof(buf));
+  tsk_img_read(ci.img, 4096, buf, sizeof(buf));
+  tsk_img_read(ci.img, 0, buf, sizeof(buf));       // line 0 is now the newest
+  tsk_img_read(ci.img, 8192, buf, sizeof(buf));    // evicts line 1
+  CHECK(backend_reads == 3);
+
+  tsk_img_read(ci.img, 0, buf, sizeof(buf));
+  CHECK(backend_reads == 3);
+  tsk_img_read(ci.img, 4096, buf, sizeof(buf));
+  CHECK(backend_reads == 4);
+  CHECK(matches(buf, 4096, sizeof(buf)));
+}
+
+TEST_CASE("sharded cache reports backend errors") {
+  CachedImg ci(1 << 20, new ShardedCache(256 * 1024, 4096, 4));
+  char buf[16];
+
+  backend_fail = true;
+  CHECK(tsk_img_read(ci.img, 0, buf, sizeof(buf)) == -1);
+
+  // failed lines are not cached
+  backend_fail = false;
+  CHECK(tsk_img_read(ci.img, 0, buf, sizeof(buf)) == (ssize_t) sizeof(buf));
+  CHECK(matches(buf, 0, sizeof(buf)));
+}
+
+TEST_CASE("sharded cache returns correct data to concurrent readers") {
+  const TSK_OFF_T size = 4 << 20;
+  CachedImg ci(size, new ShardedCache(512 * 1024, 4096, 8));
+  std::atomic<size_t> bad{0};
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&ci, &bad, t, size]() {
+      uint32_t x = 12345 + t;
+      char buf[600];
+      for (int i = 0; i < 5000; ++i) {
+        x = x * 1103515245 + 12345;
+        const TSK_OFF_T off = (TSK_OFF_T) (x >> 4) % (size - sizeof(buf));
+        const size_t len = 1 + (x >> 20) % sizeof(buf);
+        if (tsk_img_read(ci.img, off, buf, len) != (ssize_t) len || !matches(buf, off, len)) {
+          ++bad;
+        }
+      }
+    });
+  }
+  for (auto& th: threads) {
+    th.join();
+  }
+
+  CHECK(bad == 0);
+  const Stats s = ci.stats();
+  CHECK(s.hits + s.misses == 8 * 5000);
+}
+
+TEST_CASE("sharded cache reads ahead of sequential readers") {
+  const TSK_OFF_T size = 4 << 20;
+  auto cache = new ShardedCache(1 << 20, 4096, 4);
+  cache->set_readahead(64 * 1024);
+  CachedImg ci(size, cache);
+  char buf[512];
+
+  size_t bad = 0;
+  for (TSK_OFF_T off = 0; off < size; off += sizeof(buf)) {
+    if (tsk_img_read(ci.img, off, buf, sizeof(buf)) != (ssize_t) sizeof(buf)
+        || !matches(buf, off, sizeof(buf))) {
+      ++bad;
+    }
+  }
+  CHECK(bad == 0);
+
+  // 1024 lines in windows of up to 16 lines
+  CHECK(backend_reads < 1024 / 8);
+  CHECK(ci.stats().misses < 1024 / 8);
+}
+
+TEST_CASE("sharded cache reads ahead of strided readers") {
+  const TSK_OFF_T size = 4 << 20;
+  auto cache = new ShardedCache(1 << 20, 4096, 4);
+  cache->set_readahead(64 * 1024);
+  CachedImg ci(size, cache);
+  char buf[64];
+
+  // one small read every other line
+  for (TSK_OFF_T off = 100; off < size; off += 2 * 4096) {
+    REQUIRE(tsk_img_read(ci.img, off, buf, sizeof(buf)) == (ssize_t) sizeof(buf));
+    CHECK(matches(buf, off, sizeof(buf)));
+  }
+  CHECK(backend_reads < 512 / 4);
+}
+
+TEST_CASE("sharded cache does not read ahead of random readers") {
+  const TSK_OFF_T size = 64 << 20;
+  auto cache = new ShardedCache(1 << 20, 4096, 4);
+  cache->set_readahead(64 * 1024);
+  CachedImg ci(size, cache);
+  char buf[100];
+
+  uint32_t x = 777;
+  for (int i = 0; i < 2000; ++i) {
+    x = x * 1103515245 + 12345;
+    const TSK_OFF_T off = (TSK_OFF_T) x % (size - sizeof(buf));
+    REQUIRE(tsk_img_read(ci.img, off, buf, sizeof(buf)) == (ssize_t) sizeof(buf));
+    CHECK(matches(buf, off, sizeof(buf)));
+  }
+
+  const Stats s = ci.stats();
+  CHECK(backend_bytes < 2 * s.misses * 4096);
+}
+
+TEST_CASE("sharded cache read-ahead with concurrent sequential readers") {
+  const TSK_OFF_T size = 8 << 20;
+  auto cache = new ShardedCache(2 << 20, 4096, 8);
+  cache->set_readahead(128 * 1024);
+  CachedImg ci(size, cache);
+  std::atomic<size_t> bad{0};
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&ci, &bad, t, size]() {
+      char buf[1000];
+      const TSK_OFF_T start = t * (size / 4);
+      for (TSK_OFF_T off = start; off < start + size / 4; off += sizeof(buf)) {
+        const size_t len = (size_t) std::min((TSK_OFF_T) sizeof(buf), size - off);
+        if (tsk_img_read(ci.img, off, buf, len) != (ssize_t) len || !matches(buf, off, len)) {
+          ++bad;
+        }
+      }
+    });
+  }
+  for (auto& th: threads) {
+    th.join();
+  }
+
+  CHECK(bad == 0);
+  CHECK(backend_reads < 2048 / 4);
+}
+
+TEST_CASE("sharded cache does not reread lines at the end of a window") {
+  auto cache = new ShardedCache(1 << 20, 4096, 4);
+  CachedImg ci(1 << 20, cache);
+  char buf[100];
+
+  REQUIRE(tsk_img_read(ci.img, 3 * 4096, buf, sizeof(buf)) == (ssize_t) sizeof(buf));
+  REQUIRE(backend_bytes == 4096);
+
+  REQUIRE(cache->load(ci.img, 0, 4) > 0);
+  CHECK(backend_bytes == 4 * 4096);
+  CHECK(backend_reads == 2);
+}
+
+TEST_CASE("sharded cache readers do not reread what another loaded") {
+  const TSK_OFF_T size = 4 << 20;
+
+  // with and without the I/O lock
+  for (const bool parallel: {false, true}) {
+    auto cache = new ShardedCache(8 << 20, 4096, 8);
+    cache->set_readahead(128 * 1024);
+    CachedImg ci(size, cache);
+    reinterpret_cast<IMG_INFO*>(ci.img)->parallel_read = parallel;
+    std::atomic<size_t> bad{0};
+
+    // every thread reads the whole image; the cache holds all of it
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&ci, &bad, size]() {
+        char buf[4096];
+        for (TSK_OFF_T off = 0; off < size; off += sizeof(buf)) {
+          if (tsk_img_read(ci.img, off, buf, sizeof(buf)) != (ssize_t) sizeof(buf)
+              || !matches(buf, off, sizeof(buf))) {
+            ++bad;
+          }
+        }
+      });
+    }
+    for (auto& th: threads) {
+      th.join();
+    }
+
+    CHECK(bad == 0);
+    CHECK(backend_bytes == (size_t) size);
+  }
+}
+
+TEST_CASE("tsk_img_readv coalesces nearby requests") {
+  CachedImg ci(1 << 20, new ShardedCache(256 * 1024, 4096, 4));
+  std::vector<char> bufs(4 * 100);
+  TSK_IMG_READ_REQ reqs[4] = {
+    { 16384, &bufs[0], 100, 0 },
+    { 512 * 1024, &bufs[100], 100, 0 },
+    { 0, &bufs[200], 100, 0 },
+    { 8190, &bufs[300], 100, 0 },
+  };
+
+  REQUIRE(tsk_img_readv(ci.img, reqs, 4) == 0);
+  for (const auto& r : reqs) {
+    CHECK(r.result == 100);
+    CHECK(matches(r.buf, r.off, r.len));
+  }
+  // one read for the first 5 lines, one for the distant request
+  CHECK(backend_reads == 2);
+
+  // all of them are cached now
+  std::fill(bufs.begin(), bufs.end(), 0);
+  REQUIRE(tsk_img_readv(ci.img, reqs, 4) == 0);
+  for (const auto& r : reqs) {
+    CHECK(matches(r.buf, r.off, r.len));
+  }
+  CHECK(backend_reads == 2);
+  CHECK(ci.stats().hits == 4);
+}
+
+TEST_CASE("tsk_img_readv prefetches requests without a buffer") {
+  CachedImg ci(1 << 20, new ShardedCache(256 * 1024, 4096, 4));
+  TSK_IMG_READ_REQ reqs[2] = {
+    { 40960, nullptr, 4096, -1 },
+    { 49152, nullptr, 4096, -1 },
+  };
+
+  REQUIRE(tsk_img_readv(ci.img, reqs, 2) == 0);
+  CHECK(reqs[0].result == 0);
+  CHECK(reqs[1].result == 0);
+  CHECK(backend_reads == 1);
+
+  char buf[8192];
+  REQUIRE(tsk_img_read(ci.img, 40960, buf, 4096) == 4096);
+  REQUIRE(tsk_img_read(ci.img, 49152, buf + 4096, 4096) == 4096);
+  CHECK(matches(buf, 40960, sizeof(buf)));
+  CHECK(backend_reads == 1);
+}
+
+TEST_CASE("tsk_img_readv without the sharded cache") {
+  CachedImg ci(1 << 20, new ShardedCache(256 * 1024, 4096, 4));
+  reinterpret_cast<IMG_INFO*>(ci.img)->cache_read = tsk_img_read_no_cache;
+  std::vector<char> bufs(3 * 1000);
+  TSK_IMG_READ_REQ reqs[3] = {
+    { 2000, &bufs[0], 1000, 0 },
+    { 0, &bufs[1000], 1000, 0 },
+    { (1 << 20) - 500, &bufs[2000], 1000, 0 },
+  };
+
+  REQUIRE(tsk_img_readv(ci.img, reqs, 3) == 0);
+  CHECK(reqs[0].result == 1000);
+  CHECK(reqs[1].result == 1000);
+  // clipped at the end of the image
+  CHECK(reqs[2].result == 500);
+  for (const auto& r : reqs) {
+    CHECK(matches(r.buf, r.off, (size_t) r.result));
+  }
+  CHECK(backend_reads == 2);
+}
+
+TEST_CASE("tsk_img_readv reports bad requests") {
+  CachedImg ci(1 << 20, new ShardedCache(256 * 1024, 4096, 4));
+  char buf[16];
+  TSK_IMG_READ_REQ reqs[2] = {
+    { 1 << 20, buf, sizeof(buf), 0 },
+    { 0, buf, sizeof(buf), 0 },
+  };
+
+  CHECK(tsk_img_readv(ci.img, reqs, 2) == 1);
+  CHECK(reqs[0].result == -1);
+  CHECK(reqs[1].result == (ssize_t) sizeof(buf));
+  CHECK(matches(buf, 0, sizeof(buf)));
+}
+
+namespace {
+
+size_t path_reads(const Stats& s, TSK_IMG_READ_PATH_ENUM path) {
+  size_t n = 0;
+  for (size_t i = 0; i < TSK_IMG_STATS_BUCKETS; ++i) {
+    n += s.path_histogram[path][i];
+  }
+  return n;
+}
+
+}
+
+TEST_CASE("tsk_img_get_stats splits reads by cache path") {
+  CachedImg ci(1 << 20, new ShardedCache(256 * 1024, 4096, 4));
+  std::vector<char> buf(3 * 4096);
+
+  REQUIRE(tsk_img_read(ci.img, 100, buf.data(), 100) == 100);
+  REQUIRE(tsk_img_read(ci.img, 200, buf.data(), 100) == 100);
+  REQUIRE(tsk_img_read(ci.img, 300, buf.data(), 100) == 100);
+  REQUIRE(tsk_img_read(ci.img, 65536, buf.data(), buf.size()) == (ssize_t) buf.size());
+
+  Stats s;
+  REQUIRE(tsk_img_get_stats(ci.img, &s) == 0);
+  CHECK(s.hits == 2);
+  CHECK(s.misses == 2);
+  CHECK(s.hit_bytes == 200);
+  CHECK(s.miss_bytes == 100 + buf.size());
+  CHECK(path_reads(s, TSK_IMG_READ_PATH_HIT) == 2);
+  CHECK(path_reads(s, TSK_IMG_READ_PATH_MISS) == 1);
+  CHECK(path_reads(s, TSK_IMG_READ_PATH_UNCACHED) == 1);
+  size_t all = 0;
+  for (size_t i = 0; i < TSK_IMG_STATS_BUCKETS; ++i) {
+    all += s.histogram[i];
+  }
+  CHECK(all == 4);
+
+  // one line for the miss and the uncached read itself
+  CHECK(s.backend_reads == 2);
+  CHECK(s.backend_bytes == 4096 + buf.size());
+  CHECK(s.backend_reads == backend_reads);
+  CHECK(s.backend_bytes == backend_bytes);
+}
+
+TEST_CASE("tsk_img_get_stats with the legacy cache") {
+  CachedImg ci(1 << 20, new ShardedCache(256 * 1024, 4096, 4));
+  IMG_INFO* iif = reinterpret_cast<IMG_INFO*>(ci.img);
+  delete static_cast<ImgCache*>(iif->cache);
+  iif->cache = new LegacyCache();
+  iif->cache_read = tsk_img_read_legacy;
+  char buf[512];
+
+  REQUIRE(tsk_img_read(ci.img, 0, buf, sizeof(buf)) == (ssize_t) sizeof(buf));
+  REQUIRE(tsk_img_read(ci.img, 512, buf, sizeof(buf)) == (ssize_t) sizeof(buf));
+
+  Stats s;
+  REQUIRE(tsk_img_get_stats(ci.img, &s) == 0);
+  CHECK(s.hits == 1);
+  CHECK(s.misses == 1);
+  CHECK(path_reads(s, TSK_IMG_READ_PATH_HIT) == 1);
+  CHECK(path_reads(s, TSK_IMG_READ_PATH_MISS) == 1);
+  CHECK(s.backend_reads == 1);
+  CHECK(s.backend_bytes == TSK_IMG_INFO_CACHE_LEN);
+}
+
+TEST_CASE("Stats keeps the layout of its original fields") {
+  CHECK(offsetof(Stats, miss_bytes) == 5 * sizeof(size_t));
+  CHECK(offsetof(Stats, histogram) == 6 * sizeof(size_t));
+  CHECK(sizeof(((Stats*) nullptr)->histogram) == 64 * sizeof(size_t));
+  CHECK(offsetof(Stats, backend_reads) == 70 * sizeof(size_t));
+}
+
+TEST_CASE("tsk_img_get_stats null arguments") {
+  Stats s;
+  CHECK(tsk_img_get_stats(nullptr, &s) == 1);
+  CHECK(tsk_error_get_errno() == TSK_ERR_IMG_ARG);
+}
+
+TEST_CASE("tsk_img_print_stats") {
+  CachedImg ci(1 << 20, new ShardedCache(256 * 1024, 4096, 4));
+  char buf[100];
+  REQUIRE(tsk_img_read(ci.img, 0, buf, sizeof(buf)) == (ssize_t) sizeof(buf));
+  REQUIRE(tsk_img_read(ci.img, 0, buf, sizeof(buf)) == (ssize_t) sizeof(buf));
+
+  FILE* f = std::tmpfile();
+  REQUIRE(f);
+  tsk_img_print_stats(ci.img, f);
+  std::rewind(f);
+  std::string out;
+  char line[256];
+  while (std::fgets(line, sizeof(line), f)) {
+    out += line;
+  }
+  std::fclose(f);
+
+  CHECK(out.find("cache: sharded") != std::string::npos);
+  CHECK(out.find("Hit rate: 50.0%") != std::string::npos);
+  CHECK(out.find("Bytes read from image: 4096 in 1 reads") != std::string::npos);
+  CHECK(out.find("Read amplification: 20.48") != std::string::npos);
+  CHECK(out.find("Latency") != std::string::npos);
+}
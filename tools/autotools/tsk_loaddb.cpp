@@ -11,6 +11,7 @@
 
 #include "tsk/tsk_tools_i.h"
 #include "tsk/auto/tsk_case_db.h"
+#include "tools/util.h"
 #include <locale.h>
 
 static TSK_TCHAR *progname;
@@ -19,10 +20,11 @@ static void
 usage()
 {
     tsk_fprintf(stderr,
-        "usage: tsk_loaddb [-ahkvV] [-i imgtype] [-b dev_sector_size] [-d database] [-z ZONE] image [image]\n");
+        "usage: tsk_loaddb [-ahkvV] [--io-stats] [-i imgtype] [-b dev_sector_size] [-d database] [-t threads] [-z ZONE] image [image]\n");
     tsk_fprintf(stderr, "\t-a: Add image to existing database, instead of creating a new one (requires -d to specify database)\n");
     tsk_fprintf(stderr, "\t-k: Don't create block data table\n");
     tsk_fprintf(stderr, "\t-h: Calculate hash values for the files\n");
+    tsk_fprintf(stderr, "\t-t threads: Number of threads that hash and decompress the files (default 1)\n");
     tsk_fprintf(stderr,
         "\t-i imgtype: The format of the image file (use '-i list' for supported types)\n");
     tsk_fprintf(stderr,
@@ -31,6 +33,7 @@ usage()
     tsk_fprintf(stderr, "\t-v: verbose output to stderr\n");
     tsk_fprintf(stderr, "\t-V: Print version\n");
     tsk_fprintf(stderr, "\t-z: Time zone of original machine (i.e. EST5EDT or GMT)\n");
+    tsk_fprintf(stderr, "\t--io-stats: Print image I/O statistics to stderr when done\n");
 
     exit(1);
 }
@@ -38,7 +41,7 @@ usage()
 
 
 int
-main(int argc, [[maybe_unused]] char **argv1)
+main(int argc, char **argv1)
 {
     TSK_IMG_TYPE_ENUM imgtype = TSK_IMG_TYPE_DETECT;
 
@@ -51,6 +54,7 @@ main(int argc, [[maybe_unused]] char **argv1)
     bool blkMapFlag = true;   // true if we are going to write the block map
     bool createDbFlag = true; // true if we are going to create a new database
     bool calcHash = false;
+    unsigned int numThreads = 1;
 
 #ifdef TSK_WIN32
     // On Windows, get the wide arguments (mingw doesn't support wmain)
@@ -66,7 +70,9 @@ main(int argc, [[maybe_unused]] char **argv1)
     progname = argv[0];
     setlocale(LC_ALL, "");
 
-    while ((ch = GETOPT(argc, argv, _TSK_T("ab:d:hi:kvVz:"))) > 0) {
+    const bool io_stats = take_long_flag(argc, argv, argv1, _TSK_T("--io-stats"));
+
+    while ((ch = GETOPT(argc, argv, _TSK_T("ab:d:hi:kt:vVz:"))) > 0) {
         switch (ch) {
         case _TSK_T('?'):
         default:
@@ -115,6 +121,17 @@ main(int argc, [[maybe_unused]] char **argv1)
             database = OPTARG;
             break;
 
+        case _TSK_T('t'):
+            numThreads = (unsigned int) TSTRTOUL(OPTARG, &cp, 0);
+            if (*cp || *cp == *OPTARG || numThreads < 1) {
+                TFPRINTF(stderr,
+                    _TSK_T
+                    ("invalid argument: number of threads must be positive: %" PRIttocTSK "\n"),
+                    OPTARG);
+                usage();
+            }
+            break;
+
         case _TSK_T('v'):
             tsk_verbose++;
             break;
@@ -170,7 +187,10 @@ main(int argc, [[maybe_unused]] char **argv1)
     TskAutoDb *autoDb = tskCase->initAddImage();
     autoDb->createBlockMap(blkMapFlag);
     autoDb->hashFiles(calcHash);
+    autoDb->setNumThreads(numThreads);
     autoDb->setAddUnallocSpace(true);
+    const TSK_IMG_OPTIONS img_opts = env_img_options();
+    autoDb->setImageOptions(&img_opts);
 
     if (autoDb->startAddImage(argc - OPTIND, &argv[OPTIND], imgtype, ssize)) {
         std::vector<TskAuto::error_record> errors = autoDb->getErrorList();
@@ -179,6 +199,10 @@ main(int argc, [[maybe_unused]] char **argv1)
         }
     }
 
+    if (io_stats) {
+        autoDb->printImageStats(stderr);
+    }
+
     if (autoDb->commitAddImage() == -1) {
         tsk_error_print(stderr);
         exit(1);
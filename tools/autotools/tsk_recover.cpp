@@ -10,6 +10,7 @@
  */
 
 #include "tsk/tsk_tools_i.h"
+#include "tools/util.h"
 #include <locale.h>
 #include <sys/stat.h>
 #include <errno.h>
@@ -20,7 +21,7 @@ static void
 usage()
 {
     tsk_fprintf(stderr,
-        "usage: tsk_recover [-vVae] [-f fstype] [-i imgtype] [-b dev_sector_size] [-o sector_offset] [-P pooltype] [-B pool_volume_block] [-d dir_inum] image [image] output_dir\n");
+        "usage: tsk_recover [-vVae] [--io-stats] [-f fstype] [-i imgtype] [-b dev_sector_size] [-o sector_offset] [-P pooltype] [-B pool_volume_block] [-d dir_inum] image [image] output_dir\n");
     tsk_fprintf(stderr,
         "\t-i imgtype: The format of the image file (use '-i list' for supported types)\n");
     tsk_fprintf(stderr,
@@ -41,6 +42,7 @@ usage()
     tsk_fprintf(stderr,
         "\t-d dir_inum: Directory inum to recover from (must also specify a specific partition using -o or there must not be a volume system)\n");
     tsk_fprintf(stderr, "\t-k password: Decryption password for encrypted volumes\n");
+    tsk_fprintf(stderr, "\t--io-stats: Print image I/O statistics to stderr when done\n");
 
     exit(1);
 }
@@ -236,7 +238,7 @@ uint8_t TskRecover::writeFile(TSK_FS_FILE * a_fs_file, const char *a_path)
     }
 
     //try to write to the file
-    if (tsk_fs_file_walk(a_fs_file, (TSK_FS_FILE_WALK_FLAG_ENUM) 0,
+    if (tsk_fs_file_walk(a_fs_file, TSK_FS_FILE_WALK_FLAG_CHUNK,
             file_walk_cb, handle)) {
         fprintf(stderr, "Error writing file %ls\n", path16full);
         tsk_error_print(stderr);
@@ -312,7 +314,7 @@ uint8_t TskRecover::writeFile(TSK_FS_FILE * a_fs_file, const char *a_path)
         return 1;
     }
 
-    if (tsk_fs_file_walk(a_fs_file, (TSK_FS_FILE_WALK_FLAG_ENUM) 0,
+    if (tsk_fs_file_walk(a_fs_file, TSK_FS_FILE_WALK_FLAG_CHUNK,
             file_walk_cb, hFile)) {
         fprintf(stderr, "Error writing file: %s\n", fbuf);
         tsk_error_print(stderr);
@@ -446,6 +448,8 @@ main(int argc, char **argv1)
     progname = argv[0];
     setlocale(LC_ALL, "");
 
+    const bool io_stats = take_long_flag(argc, argv, argv1, _TSK_T("--io-stats"));
+
     while ((ch = GETOPT(argc, argv, _TSK_T("ab:B:d:ef:i:k:o:P:vV"))) > 0) {
         switch (ch) {
         case _TSK_T('?'):
@@ -564,6 +568,8 @@ main(int argc, char **argv1)
     tskRecover.setFileSystemPassword(password);
 
     tskRecover.setFileFilterFlags(walkflag);
+    const TSK_IMG_OPTIONS img_opts = env_img_options();
+    tskRecover.setImageOptions(&img_opts);
     if (tskRecover.openImage(argc - OPTIND - 1, &argv[OPTIND], imgtype,
             ssize)) {
         tsk_error_print(stderr);
@@ -575,7 +581,11 @@ main(int argc, char **argv1)
         exit(1);
     }
 
-    if (tskRecover.findFiles(dirInum)) {
+    const uint8_t retval = tskRecover.findFiles(dirInum);
+    if (io_stats) {
+        tskRecover.printImageStats(stderr);
+    }
+    if (retval) {
         // errors were already logged
         exit(1);
     }
@@ -113,6 +113,7 @@ struct fiwalk {
     bool opt_body_file;
     bool opt_get_fragments;
     bool opt_ignore_ntfs_system_files;
+    bool opt_io_stats;			// print image I/O statistics at the end?
     bool opt_magic;			// should we run libmagic?
     bool opt_md5;			// do we need md5s?
     bool opt_no_data;
@@ -184,6 +185,7 @@ struct fiwalk {
              opt_body_file(false),
              opt_get_fragments(false),
              opt_ignore_ntfs_system_files(false),
+             opt_io_stats(false),
              opt_magic(false),
              opt_md5(true),
              opt_no_data(false),
@@ -38,6 +38,7 @@
 #include <sstream>
 
 #include "fiwalk.h"
+#include "tools/util.h"
 
 void print_version()
 {
@@ -145,6 +146,7 @@ void usage(fiwalk &o)
     printf("Misc:\n");
     printf("    -d = debug this program\n");
     printf("    -v = Enable SleuthKit verbose flag\n");
+    printf("    --io-stats = Print image I/O statistics to stderr when done\n");
     printf("\n");
     print_version();
     exit(1);
@@ -172,6 +174,9 @@ extern "C" int main(int argc, char * const *argv1) {
     argv = (TSK_TCHAR * const*) argv1;
 #endif
 
+    o.opt_io_stats = take_long_flag(argc, const_cast<TSK_TCHAR **>(argv),
+        const_cast<char **>(argv1), _TSK_T("--io-stats"));
+
     while ((ch = GETOPT(argc, argv,
             _TSK_T("A:a:C:dfG:gmv125IMX:S:T:VZn:c:b:xOYzh?H:"))) > 0) {
         switch (ch) {
@@ -532,8 +532,11 @@ int fiwalk::process_image_file(int argc,char * const *argv,const char *audit_fil
 
     assert(argc != 0);
 
+    TSK_IMG_OPTIONS img_opts;
     std::unique_ptr<TSK_IMG_INFO, decltype(&tsk_img_close)> img_info{
-        tsk_img_open_utf8(argc, (const char **)argv, TSK_IMG_TYPE_DETECT, sector_size),
+        tsk_img_options_getenv(&img_opts) ? nullptr
+            : tsk_img_open_utf8_opt(argc, (const char **)argv,
+                TSK_IMG_TYPE_DETECT, sector_size, &img_opts),
         tsk_img_close
     };
 
@@ -551,6 +554,9 @@ int fiwalk::process_image_file(int argc,char * const *argv,const char *audit_fil
 	    }
 	    if (r > 0) count += r;
 	}
+	if (opt_io_stats) {
+	    tsk_img_print_stats(img_info.get(), stderr);
+	}
     }
     return count;
 }
@@ -36,7 +36,7 @@ void
 usage()
 {
     tsk_fprintf(stderr,
-        "usage: fls [-adDFlhpruvV] [-f fstype] [-i imgtype] [-b dev_sector_size] [-m dir/] [-o imgoffset] [-z ZONE] [-s seconds] image [images] [inode]\n");
+        "usage: fls [-adDFlhpruvV] [--io-stats] [-f fstype] [-i imgtype] [-b dev_sector_size] [-m dir/] [-o imgoffset] [-z ZONE] [-s seconds] image [images] [inode]\n");
     tsk_fprintf(stderr,
         "\tIf [inode] is not given, the root directory is used\n");
     tsk_fprintf(stderr, "\t-a: Display \".\" and \"..\" entries\n");
@@ -72,6 +72,7 @@ usage()
     tsk_fprintf(stderr,
         "\t-s seconds: Time skew of original machine (in seconds) (only useful with -l & -m)\n");
     tsk_fprintf(stderr, "\t-k password: Decryption password for encrypted volumes\n");
+    tsk_fprintf(stderr, "\t--io-stats: Print image I/O statistics to stderr when done\n");
 }
 
 struct Options {
@@ -88,11 +89,14 @@ struct Options {
     const char* password = "";
     std::optional<TSK_TSTRING> macpre;
     unsigned int verbose = 0;
+    bool io_stats = false;
 };
 
-std::variant<Options, int> parse_args(int argc, TSK_TCHAR** argv, char** argv1) {
+std::variant<Options, int> parse_args(int& argc, TSK_TCHAR** argv, char** argv1) {
     Options opts;
 
+    opts.io_stats = take_long_flag(argc, argv, argv1, _TSK_T("--io-stats"));
+
     TSK_TCHAR *cp;
     int ch;
 
@@ -291,7 +295,8 @@ open_handles(const Options& opts, const TSK_TCHAR* const* argv, size_t argc) {
       _sec_skew,
       password,
       _macpre,
-      _verbose
+      _verbose,
+      _io_stats
     ] = opts;
 
     std::unique_ptr<TSK_IMG_INFO, decltype(&tsk_img_close)> img_parent{
@@ -317,9 +322,10 @@ open_handles(const Options& opts, const TSK_TCHAR* const* argv, size_t argc) {
      *
      * Check the final argument and see if it is a number
      */
+    const TSK_IMG_OPTIONS img_opts = env_img_options();
     if (tsk_fs_parse_inum(argv[argc - 1], &inode, NULL, NULL, NULL, NULL)) {
         /* Not an inode at the end */
-        img.reset(tsk_img_open(argc, argv, imgtype, ssize));
+        img.reset(tsk_img_open_opt(argc, argv, imgtype, ssize, &img_opts));
     }
     else {
         // check that we have enough arguments
@@ -329,7 +335,7 @@ open_handles(const Options& opts, const TSK_TCHAR* const* argv, size_t argc) {
             return 1;
         }
 
-        img.reset(tsk_img_open(argc - 1, argv, imgtype, ssize));
+        img.reset(tsk_img_open_opt(argc - 1, argv, imgtype, ssize, &img_opts));
         had_inum_arg = true;
     }
 
@@ -433,7 +439,7 @@ main(int argc1, char **argv1)
     }
     auto& h = std::get<Holder>(r);
 
-    return do_it(
+    const int ret = do_it(
         h.fs.get(),
         opts.snap_id,
         opts.fls_flags,
@@ -442,4 +448,9 @@ main(int argc1, char **argv1)
         opts.macpre ? opts.macpre->c_str() : nullptr,
         opts.sec_skew
     );
+
+    if (opts.io_stats) {
+        tsk_img_print_stats(h.img_parent ? h.img_parent.get() : h.img.get(), stderr);
+    }
+    return ret;
 }
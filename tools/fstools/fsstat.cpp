@@ -23,7 +23,8 @@ static void
 usage()
 {
     tsk_fprintf(stderr,
-        "usage: fsstat [-tvV] [-f fstype] [-i imgtype] [-b dev_sector_size] [-o imgoffset] image\n");
+        "usage: fsstat [-ctvV] [-f fstype] [-i imgtype] [-b dev_sector_size] [-o imgoffset] image\n");
+    tsk_fprintf(stderr, "\t-c: also verify file system metadata (where supported)\n");
     tsk_fprintf(stderr, "\t-t: display type only\n");
     tsk_fprintf(stderr,
         "\t-i imgtype: The format of the image file (use '-i list' for supported types)\n");
@@ -59,6 +60,7 @@ main(int argc, char **argv1)
 
     int ch;
     uint8_t type = 0;
+    uint8_t check = 0;
     TSK_TCHAR **argv;
     unsigned int ssize = 0;
     TSK_TCHAR *cp;
@@ -77,7 +79,7 @@ main(int argc, char **argv1)
     progname = argv[0];
     setlocale(LC_ALL, "");
 
-    while ((ch = GETOPT(argc, argv, _TSK_T("b:f:i:o:tvVB:P:k:"))) > 0) {
+    while ((ch = GETOPT(argc, argv, _TSK_T("b:cf:i:o:tvVB:P:k:"))) > 0) {
         switch (ch) {
         case _TSK_T('?'):
         default:
@@ -152,6 +154,10 @@ main(int argc, char **argv1)
             }
             break;
 
+        case _TSK_T('c'):
+            check = 1;
+            break;
+
         case _TSK_T('t'):
             type = 1;
             break;
@@ -247,6 +253,10 @@ main(int argc, char **argv1)
             tsk_error_print(stderr);
             exit(1);
         }
+        if (check && fs->fscheck && fs->fscheck(fs.get(), stdout)) {
+            tsk_error_print(stderr);
+            exit(1);
+        }
     }
 
     exit(0);
@@ -23,6 +23,7 @@
 
 #include "tsk/tsk_tools_i.h"
 #include "tsk/fs/apfs_fs.h"
+#include "tools/util.h"
 #include <locale.h>
 
 #include <memory>
@@ -35,7 +36,7 @@ static void
 usage()
 {
     tsk_fprintf(stderr,
-        "usage: icat [-hrRsvV] [-f fstype] [-i imgtype] [-b dev_sector_size] [-o imgoffset] image [images] inum[-typ[-id]]\n");
+        "usage: icat [-hrRsvV] [--io-stats] [-f fstype] [-i imgtype] [-b dev_sector_size] [-o imgoffset] image [images] inum[-typ[-id]]\n");
     tsk_fprintf(stderr, "\t-h: Do not display holes in sparse files\n");
     tsk_fprintf(stderr, "\t-r: Recover deleted file\n");
     tsk_fprintf(stderr,
@@ -56,6 +57,7 @@ usage()
     tsk_fprintf(stderr, "\t-S snap_id: Snapshot ID (for APFS only)\n");
     tsk_fprintf(stderr, "\t-v: verbose to stderr\n");
     tsk_fprintf(stderr, "\t-V: Print version\n");
+    tsk_fprintf(stderr, "\t--io-stats: Print image I/O statistics to stderr when done\n");
     tsk_fprintf(stderr, "\t-k password: Decryption password for encrypted volumes\n");
 
     exit(1);
@@ -100,6 +102,8 @@ main(int argc, char **argv1)
     progname = argv[0];
     setlocale(LC_ALL, "");
 
+    const bool io_stats = take_long_flag(argc, argv, argv1, _TSK_T("--io-stats"));
+
     while ((ch = GETOPT(argc, argv, _TSK_T("b:f:hi:o:rRsvVP:B:k:S:"))) > 0) {
         switch (ch) {
         case _TSK_T('?'):
@@ -210,8 +214,10 @@ main(int argc, char **argv1)
         usage();
     }
 
+    const TSK_IMG_OPTIONS img_opts = env_img_options();
     std::unique_ptr<TSK_IMG_INFO, decltype(&tsk_img_close)> img{
-        tsk_img_open(argc - OPTIND - 1, &argv[OPTIND], imgtype, ssize),
+        tsk_img_open_opt(argc - OPTIND - 1, &argv[OPTIND], imgtype, ssize,
+            &img_opts),
         tsk_img_close
     };
 
@@ -297,6 +303,9 @@ main(int argc, char **argv1)
     retval =
         tsk_fs_icat(fs.get(), inum, type, type_used, id, id_used,
         (TSK_FS_FILE_WALK_FLAG_ENUM) fw_flags);
+    if (io_stats) {
+        tsk_img_print_stats(img.get(), stderr);
+    }
     if (retval) {
         if (suppress_recover_error == 1
             && tsk_error_get_errno() == TSK_ERR_FS_RECOVER) {
@@ -34,3 +34,38 @@ argv_to_tsk_tchar(int argc, char** argv) {
   };
 #endif
 }
+
+bool
+take_long_flag(int& argc, TSK_TCHAR** argv, char** argv1, const TSK_TCHAR* flag) {
+  // on other platforms, argv is argv1
+  const bool both = (void*) argv != (void*) argv1;
+  bool found = false;
+  bool done = false;
+  int out = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (!done && TSTRCMP(argv[i], _TSK_T("--")) == 0) {
+      done = true;
+    }
+    else if (!done && TSTRCMP(argv[i], flag) == 0) {
+      found = true;
+      continue;
+    }
+    argv[out] = argv[i];
+    if (both) {
+      argv1[out] = argv1[i];
+    }
+    ++out;
+  }
+  argc = out;
+  return found;
+}
+
+TSK_IMG_OPTIONS
+env_img_options() {
+  TSK_IMG_OPTIONS opts;
+  if (tsk_img_options_getenv(&opts)) {
+    tsk_error_print(stderr);
+    std::exit(1);
+  }
+  return opts;
+}
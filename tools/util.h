@@ -5,6 +5,7 @@
 #include <utility>
 
 #include "tsk/base/tsk_base_i.h"
+#include "tsk/img/tsk_img.h"
 
 std::pair<
   std::unique_ptr<TSK_TCHAR*[], void(*)(TSK_TCHAR**)>,
@@ -12,4 +13,21 @@ std::pair<
 >
 argv_to_tsk_tchar(int argc, char** argv);
 
+/*
+ * Remove a long flag such as "--io-stats" from argv (up to a "--"), so
+ * that GETOPT only sees short options.  argv1 is main()'s argv, which is
+ * kept in step on Windows for options read from it by index.  Returns
+ * true if the flag was given.
+ */
+bool
+take_long_flag(int& argc, TSK_TCHAR** argv, char** argv1, const TSK_TCHAR* flag);
+
+/*
+ * Image options from the TSK_IMG_OPTIONS environment variable (see
+ * tsk_img_options_getenv()).  Prints the error and exits if the variable
+ * is invalid.
+ */
+TSK_IMG_OPTIONS
+env_img_options();
+
 #endif
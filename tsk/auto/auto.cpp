@@ -18,6 +18,19 @@
 #include "tsk/img/img_writer.h"
 
 #include <memory>
+#include <new>
+
+#ifdef TSK_MULTITHREAD_LIB
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#endif
+
+/* Files that can wait in the pipeline for each worker thread before the
+ * walk stops to let processFile() catch up. */
+#define TSK_AUTO_QUEUE_PER_THREAD 8
 
 // @@@ Follow through some error paths for sanity check and update docs somewhere to reflect the new scheme
 
@@ -34,6 +47,11 @@ TskAuto::TskAuto()
     m_imageWriterEnabled = false;
     m_imageWriterPath = NULL;
     m_fileSystemPassword = "";
+    tsk_img_options_init(&m_imgOptions);
+    m_hasImgOptions = false;
+    m_numThreads = 1;
+    m_pipeline = NULL;
+    m_curFileResult = NULL;
 }
 
 
@@ -86,7 +104,8 @@ uint8_t
         closeImage();
 
     m_internalOpen = true;
-    m_img_info = tsk_img_open(a_numImg, a_images, a_imgType, a_sSize);
+    m_img_info = tsk_img_open_opt(a_numImg, a_images, a_imgType, a_sSize,
+        m_hasImgOptions ? &m_imgOptions : NULL);
     if (m_img_info)
         return 0;
     else
@@ -114,7 +133,8 @@ uint8_t
         closeImage();
 
     m_internalOpen = true;
-    m_img_info = tsk_img_open_utf8(a_numImg, a_images, a_imgType, a_sSize);
+    m_img_info = tsk_img_open_utf8_opt(a_numImg, a_images, a_imgType, a_sSize,
+        m_hasImgOptions ? &m_imgOptions : NULL);
 	if (m_img_info) {
 		return 0;
 	}
@@ -142,6 +162,38 @@ uint8_t TskAuto::openImageHandle(TSK_IMG_INFO * a_img_info)
 
 
 
+/**
+ * Sets the cache and I/O options used by later calls to openImage() and
+ * openImageUtf8().  Without this, images are opened with the library
+ * defaults (see tsk_img_options_getenv() to honor the TSK_IMG_OPTIONS
+ * environment variable).
+ * @param a_opts Options to use, or NULL to go back to the defaults
+ */
+void TskAuto::setImageOptions(const TSK_IMG_OPTIONS * a_opts)
+{
+    if (a_opts) {
+        m_imgOptions = *a_opts;
+        m_hasImgOptions = true;
+    }
+    else {
+        tsk_img_options_init(&m_imgOptions);
+        m_hasImgOptions = false;
+    }
+}
+
+/**
+ * Prints the I/O statistics of the open image (see tsk_img_print_stats()).
+ * Does nothing if no image is open.
+ * @param hFile Handle to print to
+ */
+void TskAuto::printImageStats(FILE * hFile) const
+{
+    if (m_img_info) {
+        tsk_img_print_stats(m_img_info, hFile);
+    }
+}
+
+
 /**
  * Closes the handles to the open disk image. Should be called after
  * you have completed analysis of the image.
@@ -197,6 +249,18 @@ TskAuto::setExternalFileSystemList(const std::list<TSK_FS_INFO *>& fsInfoList)
 	m_exteralFsInfoList.assign(fsInfoList.begin(), fsInfoList.end());
 }
 
+void
+TskAuto::setNumThreads(unsigned int a_numThreads)
+{
+    m_numThreads = a_numThreads;
+}
+
+unsigned int
+TskAuto::getNumThreads() const
+{
+    return m_numThreads;
+}
+
 /**
  * @return The size of the image in bytes or -1 if the
  * image is not open.
@@ -824,6 +888,223 @@ TskAuto::findFilesInFs(TSK_FS_INFO * a_fs_info, TSK_INUM_T inum)
     return m_errors.empty() ? 0 : 1;
 }
 
+#ifdef TSK_MULTITHREAD_LIB
+
+/** \internal
+ * A file that the walk found and that is waiting for preprocessFile() and
+ * processFile().
+ */
+struct TskAutoQueuedFile {
+    TSK_FS_FILE *fs_file;       ///< Copy of the walk's file (which it frees)
+    std::string path;
+    TskAutoFileResult *result;  ///< preprocessFile() result
+    bool done;                  ///< True once preprocessFile() returned (guarded by the pipeline lock)
+};
+
+static void
+tskAutoFreeQueuedFile(TskAutoQueuedFile * a_qf)
+{
+    tsk_fs_file_close(a_qf->fs_file);
+    delete a_qf->result;
+    delete a_qf;
+}
+
+/** \internal
+ * Take a file from the directory walk, which reuses its TSK_FS_FILE for
+ * the next entry when the callback returns.  The copy gets the walk's
+ * meta, which is already loaded, and the walk gets a meta with the same
+ * fields but no attributes or content, which is all that it looks at
+ * after the callback.  The attributes are loaded here so that the workers
+ * only read file content.
+ * @returns NULL on error
+ */
+static TSK_FS_FILE *
+tskAutoTakeFile(TSK_FS_FILE * a_fs_file)
+{
+    TSK_FS_INFO *fs = a_fs_file->fs_info;
+    TSK_FS_FILE *fs_file;
+
+    if ((fs_file = tsk_fs_file_alloc(fs)) == NULL)
+        return NULL;
+
+    if (a_fs_file->name) {
+        const TSK_FS_NAME *fs_name = a_fs_file->name;
+        if (((fs_file->name = tsk_fs_name_alloc(fs_name->name ?
+                            strlen(fs_name->name) + 1 : 0,
+                            fs_name->shrt_name ?
+                            strlen(fs_name->shrt_name) + 1 : 0)) == NULL)
+            || (tsk_fs_name_copy(fs_file->name, fs_name))) {
+            tsk_fs_file_close(fs_file);
+            return NULL;
+        }
+    }
+
+    if (a_fs_file->meta) {
+        TSK_FS_META *meta = a_fs_file->meta;
+        TSK_FS_META *left;
+        void *content;
+
+        if ((left = tsk_fs_meta_alloc(meta->content_len)) == NULL) {
+            tsk_fs_file_close(fs_file);
+            return NULL;
+        }
+        content = left->content_ptr;
+        *left = *meta;
+        left->content_ptr = content;
+        left->reset_content = NULL;
+        left->attr = NULL;
+        left->attr_state = TSK_FS_META_ATTR_EMPTY;
+        left->name2 = NULL;
+        left->link = NULL;
+
+        fs_file->meta = meta;
+        a_fs_file->meta = left;
+
+        // attributes that are already loaded point back to their file
+        if (meta->attr) {
+            for (TSK_FS_ATTR * fs_attr = meta->attr->head; fs_attr;
+                fs_attr = fs_attr->next)
+                fs_attr->fs_file = fs_file;
+        }
+
+        if (tsk_fs_file_attr_getsize(fs_file) < 0)
+            tsk_error_reset();
+    }
+    return fs_file;
+}
+
+/** \internal
+ * Worker threads that call TskAuto::preprocessFile() for the files that
+ * the directory walk queues.  Files leave the pipeline in the order that
+ * they were added.  Only the walk thread adds and removes files.
+ */
+class TskAutoPipeline {
+  public:
+    TskAutoPipeline(TskAuto * a_auto, unsigned int a_numThreads)
+        : m_auto(a_auto), m_quit(false), m_stopped(false) {
+        try {
+            m_threads.reserve(a_numThreads);
+            for (unsigned int i = 0; i < a_numThreads; i++)
+                m_threads.emplace_back(&TskAutoPipeline::work, this);
+        }
+        catch (const std::system_error &) {
+            // run with the threads that started
+        }
+        catch (const std::bad_alloc &) {
+        }
+    }
+
+    ~TskAutoPipeline() {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_quit = true;
+        }
+        m_todoCv.notify_all();
+        for (std::thread &t : m_threads)
+            t.join();
+        for (TskAutoQueuedFile *qf : m_files)
+            tskAutoFreeQueuedFile(qf);
+    }
+
+    size_t numWorkers() const { return m_threads.size(); }
+    size_t size() const { return m_files.size(); }
+    bool isStopped() const { return m_stopped; }
+    void setStopped() { m_stopped = true; }
+
+    void add(TskAutoQueuedFile * a_qf) {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_files.push_back(a_qf);
+            m_todo.push_back(a_qf);
+        }
+        m_todoCv.notify_one();
+    }
+
+    /**
+     * Remove the oldest file once preprocessFile() is done with it.
+     * @param a_wait True to wait for preprocessFile() and false to return
+     * NULL if it is still running
+     * @returns NULL if the pipeline is empty
+     */
+    TskAutoQueuedFile *next(bool a_wait) {
+        std::unique_lock<std::mutex> lock(m_lock);
+        if (m_files.empty())
+            return NULL;
+        if (a_wait)
+            m_doneCv.wait(lock, [this] { return m_files.front()->done; });
+        else if (m_files.front()->done == false)
+            return NULL;
+        TskAutoQueuedFile *qf = m_files.front();
+        m_files.pop_front();
+        return qf;
+    }
+
+  private:
+    void work() {
+        std::unique_lock<std::mutex> lock(m_lock);
+        while (true) {
+            m_todoCv.wait(lock, [this] { return m_quit || !m_todo.empty(); });
+            if (m_quit)
+                return;
+            TskAutoQueuedFile *qf = m_todo.front();
+            m_todo.pop_front();
+
+            lock.unlock();
+            TskAutoFileResult *result =
+                m_auto->preprocessFile(qf->fs_file, qf->path.c_str());
+            tsk_error_reset();
+            lock.lock();
+
+            qf->result = result;
+            qf->done = true;
+            m_doneCv.notify_all();
+        }
+    }
+
+    TskAuto *m_auto;
+    std::mutex m_lock;
+    std::condition_variable m_todoCv;   ///< Signaled when m_todo grows or m_quit is set
+    std::condition_variable m_doneCv;   ///< Signaled when a file is done
+    std::deque<TskAutoQueuedFile *> m_files;    ///< All files in the pipeline, in walk order
+    std::deque<TskAutoQueuedFile *> m_todo;     ///< Files waiting for a worker
+    bool m_quit;
+    bool m_stopped;     ///< True if processFile() asked to stop (walk thread only)
+    std::vector<std::thread> m_threads;
+};
+
+#endif
+
+/** \internal
+ * Call processFile() for the files in the pipeline whose preprocessFile()
+ * is done, in the order that they were found.
+ * @param a_all True to wait for and process every file in the pipeline.
+ * Otherwise, wait only while the pipeline is full.
+ * @returns STOP if processFile() asked to stop or OK.
+ */
+TSK_RETVAL_ENUM
+    TskAuto::processQueuedFiles(bool a_all)
+{
+#ifdef TSK_MULTITHREAD_LIB
+    const size_t limit = a_all ? 0 :
+        m_pipeline->numWorkers() * TSK_AUTO_QUEUE_PER_THREAD;
+    TskAutoQueuedFile *qf;
+
+    while ((qf = m_pipeline->next(m_pipeline->size() > limit)) != NULL) {
+        m_curFileResult = qf->result;
+        TSK_RETVAL_ENUM retval = processFile(qf->fs_file, qf->path.c_str());
+        m_curFileResult = NULL;
+        tskAutoFreeQueuedFile(qf);
+        if ((retval == TSK_STOP) || (m_stopAllProcessing)) {
+            m_pipeline->setStopped();
+            return TSK_STOP;
+        }
+    }
+#else
+    (void) a_all;
+#endif
+    return TSK_OK;
+}
+
 /** \internal
  * file name walk callback.  Walk the contents of each file
  * that is found.
@@ -841,7 +1122,32 @@ TSK_WALK_RET_ENUM
         // we have no way to register an error...
         return TSK_WALK_STOP;
     }
-    TSK_RETVAL_ENUM retval = tsk->processFile(a_fs_file, a_path);
+
+    TSK_RETVAL_ENUM retval;
+#ifdef TSK_MULTITHREAD_LIB
+    TSK_FS_FILE *fs_file;
+    if (tsk->m_pipeline == NULL) {
+        retval = tsk->processFile(a_fs_file, a_path);
+    }
+    else if ((fs_file = tskAutoTakeFile(a_fs_file)) != NULL) {
+        TskAutoQueuedFile *qf = new TskAutoQueuedFile;
+        qf->fs_file = fs_file;
+        qf->path = a_path;
+        qf->result = NULL;
+        qf->done = false;
+        tsk->m_pipeline->add(qf);
+        retval = tsk->processQueuedFiles(false);
+    }
+    else {
+        // process it here, after the files that were found before it
+        tsk_error_reset();
+        retval = tsk->processQueuedFiles(true);
+        if (retval != TSK_STOP)
+            retval = tsk->processFile(a_fs_file, a_path);
+    }
+#else
+    retval = tsk->processFile(a_fs_file, a_path);
+#endif
     if ((retval == TSK_STOP) || (tsk->getStopProcessing()))
         return TSK_WALK_STOP;
     else
@@ -864,7 +1170,23 @@ TSK_RETVAL_ENUM
     else if (retval == TSK_FILTER_SKIP)
         return TSK_OK;
 
+#ifdef TSK_MULTITHREAD_LIB
+    if (m_numThreads > 1) {
+        try {
+            m_pipeline = new TskAutoPipeline(this, m_numThreads);
+        }
+        catch (const std::bad_alloc &) {
+            m_pipeline = NULL;
+        }
+        if ((m_pipeline) && (m_pipeline->numWorkers() == 0)) {
+            delete m_pipeline;
+            m_pipeline = NULL;
+        }
+    }
+#endif
+
     /* Walk the files, starting at the given inum */
+    bool walkFailed = false;
     if (tsk_fs_dir_walk(a_fs_info, a_inum,
             (TSK_FS_DIR_WALK_FLAG_ENUM) (TSK_FS_DIR_WALK_FLAG_RECURSE |
                 m_fileFilterFlags), dirWalkCb, this)) {
@@ -872,9 +1194,22 @@ TSK_RETVAL_ENUM
         tsk_error_set_errstr2(
             "Error walking directory in file system at offset %" PRIdOFF, a_fs_info->offset);
         registerError();
-        return TSK_ERR;
+        walkFailed = true;
     }
 
+#ifdef TSK_MULTITHREAD_LIB
+    // process the files that are still queued
+    if (m_pipeline) {
+        if ((m_pipeline->isStopped() == false) && (m_stopAllProcessing == false))
+            processQueuedFiles(true);
+        delete m_pipeline;
+        m_pipeline = NULL;
+    }
+#endif
+
+    if (walkFailed)
+        return TSK_ERR;
+
     if (m_stopAllProcessing)
         return TSK_STOP;
 
@@ -917,6 +1252,21 @@ TskAuto::processAttribute(TSK_FS_FILE * /*fs_file*/,
 }
 
 
+TskAutoFileResult *
+TskAuto::preprocessFile(TSK_FS_FILE * /*fs_file*/,
+                        const char * /*path*/)
+{
+    return NULL;
+}
+
+
+TskAutoFileResult *
+TskAuto::getFileResult() const
+{
+    return m_curFileResult;
+}
+
+
 void TskAuto::setStopProcessing() {
     m_stopAllProcessing = true;
 }
@@ -504,6 +504,10 @@ TskAutoDb::filterFs(TSK_FS_INFO * fs_info)
         }
     }
 
+    // Compressed files are decompressed ahead of the reader by as many
+    // threads as hash them
+    tsk_fs_set_decomp_threads(fs_info, getNumThreads());
+
     // We won't hit the root directory on the walk, so open it now
     std::unique_ptr<TSK_FS_FILE, decltype(&tsk_fs_file_close)> file_root{
         tsk_fs_file_open(fs_info, NULL, "/"),
@@ -972,33 +976,36 @@ TskAutoDb::processAttribute(TSK_FS_FILE * fs_file,
         TSK_DB_FILES_KNOWN_ENUM file_known = TSK_DB_FILES_KNOWN_UNKNOWN;
 
         if (m_fileHashFlag && isFile(fs_file)) {
-            if (md5HashAttr(hash, fs_attr)) {
-                // error was registered
-                return TSK_OK;
-            }
-            md5 = hash;
-
-            if (m_NSRLDb != NULL) {
-                int8_t retval = tsk_hdb_lookup_raw(m_NSRLDb, hash, 16, TSK_HDB_FLAG_QUICK, NULL, NULL);
-                if (retval == -1) {
-                    registerError();
-                    return TSK_OK;
-                }
-                else if (retval) {
-                    file_known = TSK_DB_FILES_KNOWN_KNOWN;
+            const FileHashes *hashes = (const FileHashes *) getFileResult();
+            const AttrHash *attrHash = NULL;
+            if (hashes != NULL) {
+                for (const AttrHash &ah : hashes->attrs) {
+                    if (ah.fs_attr == fs_attr) {
+                        attrHash = &ah;
+                        break;
+                    }
                 }
             }
 
-            if (m_knownBadDb != NULL) {
-                int8_t retval = tsk_hdb_lookup_raw(m_knownBadDb, hash, 16, TSK_HDB_FLAG_QUICK, NULL, NULL);
-                if (retval == -1) {
+            if (attrHash != NULL) {
+                // hashed and looked up by preprocessFile()
+                if (attrHash->error.code) {
+                    tsk_error_reset();
+                    tsk_error_set_errno(attrHash->error.code);
+                    tsk_error_set_errstr("%s", attrHash->error.msg1.c_str());
+                    tsk_error_set_errstr2("%s", attrHash->error.msg2.c_str());
                     registerError();
                     return TSK_OK;
                 }
-                else if (retval) {
-                    file_known = TSK_DB_FILES_KNOWN_KNOWN_BAD;
-                }
+                memcpy(hash, attrHash->md5, 16);
+                file_known = attrHash->known;
             }
+            else if (md5HashAttr(hash, fs_attr)
+                || lookupHash(hash, file_known)) {
+                registerError();
+                return TSK_OK;
+            }
+            md5 = hash;
         }
 
         if (insertFileData(fs_attr->fs_file, fs_attr, path, md5, file_known) == TSK_ERR) {
@@ -1059,7 +1066,7 @@ TskAutoDb::md5HashCallback(TSK_FS_FILE * /*file*/, TSK_OFF_T /*offset*/,
  * MD5 hash an attribute and put the result in the given array
  * @param md5Hash array to write the hash to
  * @param fs_attr attribute to hash the data of
- * @return Returns 1 on error (message has been registered)
+ * @return Returns 1 on error (message has NOT been registered)
  */
 int
 TskAutoDb::md5HashAttr(unsigned char md5Hash[16], const TSK_FS_ATTR * fs_attr)
@@ -1068,9 +1075,8 @@ TskAutoDb::md5HashAttr(unsigned char md5Hash[16], const TSK_FS_ATTR * fs_attr)
 
     TSK_MD5_Init(&md);
 
-    if (tsk_fs_attr_walk(fs_attr, TSK_FS_FILE_WALK_FLAG_NONE,
+    if (tsk_fs_attr_walk(fs_attr, TSK_FS_FILE_WALK_FLAG_CHUNK,
             md5HashCallback, (void *) &md)) {
-        registerError();
         return 1;
     }
 
@@ -1078,6 +1084,71 @@ TskAutoDb::md5HashAttr(unsigned char md5Hash[16], const TSK_FS_ATTR * fs_attr)
     return 0;
 }
 
+/**
+ * Look up an MD5 hash in the NSRL and known bad hash databases.
+ * @param md5Hash hash to look up
+ * @param known set to the status of the hash (left alone if it is in
+ * neither database)
+ * @return Returns 1 on error (message has NOT been registered)
+ */
+int
+TskAutoDb::lookupHash(const unsigned char md5Hash[16],
+    TSK_DB_FILES_KNOWN_ENUM & known)
+{
+    if (m_NSRLDb != NULL) {
+        int8_t retval = tsk_hdb_lookup_raw(m_NSRLDb, (uint8_t *) md5Hash, 16, TSK_HDB_FLAG_QUICK, NULL, NULL);
+        if (retval == -1)
+            return 1;
+        else if (retval)
+            known = TSK_DB_FILES_KNOWN_KNOWN;
+    }
+
+    if (m_knownBadDb != NULL) {
+        int8_t retval = tsk_hdb_lookup_raw(m_knownBadDb, (uint8_t *) md5Hash, 16, TSK_HDB_FLAG_QUICK, NULL, NULL);
+        if (retval == -1)
+            return 1;
+        else if (retval)
+            known = TSK_DB_FILES_KNOWN_KNOWN_BAD;
+    }
+    return 0;
+}
+
+/**
+ * Hash the attributes of a file and look the hashes up on a worker thread,
+ * for processAttribute() to add to the database.
+ */
+TskAutoFileResult *
+TskAutoDb::preprocessFile(TSK_FS_FILE * fs_file, const char * /*path*/)
+{
+    if ((m_fileHashFlag == false) || (isFile(fs_file) == 0))
+        return NULL;
+
+    FileHashes *hashes = new FileHashes;
+    int count = tsk_fs_file_attr_getsize(fs_file);
+    for (int i = 0; i < count; i++) {
+        const TSK_FS_ATTR *fs_attr = tsk_fs_file_attr_get_idx(fs_file, i);
+        if ((fs_attr == NULL) || (isDefaultType(fs_file, fs_attr) == 0))
+            continue;
+
+        AttrHash ah;
+        ah.fs_attr = fs_attr;
+        memset(ah.md5, 0, 16);
+        ah.known = TSK_DB_FILES_KNOWN_UNKNOWN;
+        ah.error.code = 0;
+        if (md5HashAttr(ah.md5, fs_attr) || lookupHash(ah.md5, ah.known)) {
+            ah.error.code = tsk_error_get_errno();
+            ah.error.msg1 = tsk_error_get_errstr();
+            ah.error.msg2 = tsk_error_get_errstr2();
+            tsk_error_reset();
+        }
+        hashes->attrs.push_back(ah);
+
+        if (m_stopped)
+            break;
+    }
+    return hashes;
+}
+
 /**
 * Callback invoked per every unallocated block in the filesystem
 * Creates file ranges and file entries
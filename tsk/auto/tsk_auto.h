@@ -62,6 +62,18 @@ typedef enum {
  * differently, you must implement handleError().
  */
 
+/** \ingroup autolib
+ * Base class for what a TskAuto subclass computes for a file in
+ * TskAuto::preprocessFile().  TskAuto deletes it once processFile() has
+ * been called for the file.
+ */
+class TskAutoFileResult {
+  public:
+    virtual ~TskAutoFileResult() {}
+};
+
+class TskAutoPipeline;
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Woverloaded-virtual"
 
@@ -79,6 +91,8 @@ class TskAuto {
         TSK_IMG_TYPE_ENUM, unsigned int a_ssize);
     virtual uint8_t openImageHandle(TSK_IMG_INFO *);
     virtual void closeImage();
+    void setImageOptions(const TSK_IMG_OPTIONS * a_opts);
+    void printImageStats(FILE * hFile) const;
 
     TSK_OFF_T getImageSize() const;
     /**
@@ -106,6 +120,23 @@ class TskAuto {
     void setVolFilterFlags(TSK_VS_PART_FLAG_ENUM);
 	void setExternalFileSystemList(const std::list<TSK_FS_INFO *>& exteralFsInfoList);
 
+    /**
+     * Set the number of worker threads that call preprocessFile() while a
+     * file system is walked.  With more than one (and a multi-threaded
+     * library), each file is queued when it is found, preprocessFile() is
+     * called for it on a worker and processFile() is then called for it on
+     * the thread that called findFilesInXXX(), in the order that the files
+     * were found.  The default of 1 calls processFile() directly from the
+     * walk and never calls preprocessFile().
+     * @param a_numThreads Number of worker threads
+     */
+    void setNumThreads(unsigned int a_numThreads);
+
+    /**
+     * @returns The number of worker threads set with setNumThreads().
+     */
+    unsigned int getNumThreads() const;
+
     /**
     * Set a password that will be used when trying to open each file system
     */
@@ -270,6 +301,12 @@ class TskAuto {
 
     TSK_RETVAL_ENUM findFilesInFsInt(TSK_FS_INFO *, TSK_INUM_T inum);
 
+    unsigned int m_numThreads;      ///< Worker threads for preprocessFile() (see setNumThreads())
+    TskAutoPipeline *m_pipeline;    ///< Files queued for the workers during a walk, or NULL
+    TskAutoFileResult *m_curFileResult; ///< preprocessFile() result of the file in processFile()
+    TSK_RETVAL_ENUM processQueuedFiles(bool a_all);
+    friend class TskAutoPipeline;
+
     std::string m_curVsPartDescr; ///< description string of the current volume being processed
     TSK_VS_PART_FLAG_ENUM m_curVsPartFlag; ///< Flag of the current volume being processed
     bool m_curVsPartValid;         ///< True if we are inside of a volume system (and therefore m_CurVs are valid)
@@ -283,6 +320,8 @@ class TskAuto {
 	std::list<TSK_FS_INFO *> m_exteralFsInfoList; // Stores TSK_FS_INFO structures that were opened outside of TskAuto and passed in
 
     bool m_internalOpen;        ///< True if m_img_info was opened in TskAuto and false if passed in
+    TSK_IMG_OPTIONS m_imgOptions;   ///< Options for openImage() (if m_hasImgOptions)
+    bool m_hasImgOptions;       ///< True if setImageOptions() was called
     bool m_stopAllProcessing;   ///< True if no further processing should occur
 
     uint8_t isNtfsSystemFiles(TSK_FS_FILE * fs_file, const char *path);
@@ -315,6 +354,28 @@ class TskAuto {
     virtual TSK_RETVAL_ENUM processAttribute(TSK_FS_FILE * fs_file,
                                              const TSK_FS_ATTR * fs_attr, const char *path);
 
+    /**
+     * Method that is called on a worker thread for each file before
+     * processFile() is called for it, if setNumThreads() enabled worker
+     * threads.  Use it for work that only reads the file, such as hashing
+     * its content.  The file's attributes have already been loaded.  It
+     * must not call registerError() or change state that processFile()
+     * uses; keep errors in the result and register them in processFile().
+     * The default does nothing.
+     *
+     * @param fs_file File being analyzed.
+     * @param path full path of parent directory
+     * @returns Result that processFile() can get with getFileResult() or NULL.
+     */
+    virtual TskAutoFileResult *preprocessFile(TSK_FS_FILE * fs_file,
+                                              const char *path);
+
+    /**
+     * @returns The preprocessFile() result for the file that processFile() is
+     * being called for or NULL if there is none.
+     */
+    TskAutoFileResult *getFileResult() const;
+
     /**
      * When called, will cause TskAuto to not continue to recurse into directories and volumes.
      */
@@ -17,6 +17,7 @@
 #ifndef _TSK_AUTO_CASE_H
 #define _TSK_AUTO_CASE_H
 
+#include <atomic>
 #include <string>
 using std::string;
 
@@ -145,7 +146,7 @@ class TskAutoDb:public TskAuto {
     bool m_vsFound;
     bool m_volFound;
     bool m_poolFound;
-    bool m_stopped;
+    std::atomic<bool> m_stopped;    ///< Set by stopAddImage(), read by the preprocessFile() workers
     bool m_imgTransactionOpen;
     TSK_HDB_INFO * m_NSRLDb;
     TSK_HDB_INFO * m_knownBadDb;
@@ -197,10 +198,28 @@ class TskAutoDb:public TskAuto {
         const TSK_DB_FILES_KNOWN_ENUM known);
     virtual TSK_RETVAL_ENUM processAttribute(TSK_FS_FILE *,
         const TSK_FS_ATTR * fs_attr, const char *path) override;
+    virtual TskAutoFileResult *preprocessFile(TSK_FS_FILE * fs_file,
+        const char *path) override;
+
+    // MD5 and hash database status of the attributes of a file, from
+    // preprocessFile()
+    struct AttrHash {
+        const TSK_FS_ATTR *fs_attr;
+        unsigned char md5[16];
+        TSK_DB_FILES_KNOWN_ENUM known;
+        error_record error;     ///< error.code is 0 if there was no error
+    };
+    class FileHashes:public TskAutoFileResult {
+      public:
+        vector<AttrHash> attrs;
+    };
+
     static TSK_WALK_RET_ENUM md5HashCallback(TSK_FS_FILE * file,
         TSK_OFF_T offset, TSK_DADDR_T addr, char *buf, size_t size,
         TSK_FS_BLOCK_FLAG_ENUM a_flags, void *ptr);
     int md5HashAttr(unsigned char md5Hash[16], const TSK_FS_ATTR * fs_attr);
+    int lookupHash(const unsigned char md5Hash[16],
+        TSK_DB_FILES_KNOWN_ENUM & known);
     TSK_RETVAL_ENUM addUnallocatedPoolBlocksToDb(size_t & numPool);
     static TSK_WALK_RET_ENUM fsWalkUnallocBlocksCb(const TSK_FS_BLOCK *a_block, void *a_ptr);
     TSK_RETVAL_ENUM addFsInfoUnalloc(const TSK_IMG_INFO*  curImgInfo, const TSK_DB_FS_INFO & dbFsInfo);
@@ -13,6 +13,19 @@
 #include "tsk/img/pool.hpp"
 #include "tsk_fs_i.h"
 
+/**
+ * \internal
+ * Signature check for file system auto-detection.  APFS file systems are
+ * only opened from a pool image.
+ *
+ * @param a_probe Start of the volume
+ * @returns 0 if the volume cannot be opened as this type and 1 if it may
+ */
+uint8_t apfs_probe(const TSK_FS_PROBE * a_probe)
+{
+    return a_probe->img_info->itype == TSK_IMG_TYPE_POOL;
+}
+
 TSK_FS_INFO* apfs_open_auto_detect(
   TSK_IMG_INFO * img_info,
   [[maybe_unused]] TSK_OFF_T offset,
@@ -19,6 +19,7 @@
 #include "tsk_btrfs.h"
 
 #include <cassert>
+#include <cstddef>
 #include <memory>
 
 
@@ -4882,6 +4883,28 @@ btrfs_inodewalk_test_cb(TSK_FS_FILE * a_file, void *a_ptr)
 #endif
 
 
+/**
+ * \internal
+ * Signature check for file system auto-detection.
+ * btrfs_superblock_search() needs the magic value in the primary
+ * superblock or in one of its mirrors.
+ *
+ * @param a_probe Start of the volume
+ * @returns 0 if the volume cannot be opened as this type and 1 if it may
+ */
+uint8_t
+btrfs_probe(const TSK_FS_PROBE * a_probe)
+{
+    for (int i = 0; i < BTRFS_SUPERBLOCK_MIRRORS_MAX; i++) {
+        if (tsk_fs_probe_bytes(a_probe,
+                btrfs_superblock_address(i) + BTRFS_SUPERBLOCK_MAGIC_OFFSET,
+                BTRFS_SUPERBLOCK_MAGIC_VALUE,
+                strlen(BTRFS_SUPERBLOCK_MAGIC_VALUE)))
+            return 1;
+    }
+    return 0;
+}
+
 /**
  * Tries to open a Btrfs filesystem
  * @param img_info image info
@@ -3457,6 +3457,21 @@ ext2fs_close(TSK_FS_INFO * fs)
     tsk_fs_free(fs);
 }
 
+/**
+ * \internal
+ * Signature check for file system auto-detection.  ext2fs_open() needs the
+ * magic value of the primary superblock.
+ *
+ * @param a_probe Start of the volume
+ * @returns 0 if the volume cannot be opened as this type and 1 if it may
+ */
+uint8_t
+ext2fs_probe(const TSK_FS_PROBE * a_probe)
+{
+    return tsk_fs_probe_u16(a_probe,
+        EXT2FS_SBOFF + offsetof(ext2fs_sb, s_magic), EXT2FS_FS_MAGIC);
+}
+
 /**
  * \internal
  * Open part of a disk image as a Ext2/3 file system.
@@ -19,8 +19,34 @@
 #include "tsk_fatxxfs.h"
 #include "tsk_exfatfs.h"
 
+#include <cstddef>
+
 #include "encryptionHelper.h"
 
+/**
+ * \internal
+ * Signature check for file system auto-detection.  fatfs_open() needs the
+ * boot sector magic value in sector 0 or in one of the backup boot sectors
+ * (6 and 12).
+ *
+ * @param a_probe Start of the volume
+ * @returns 0 if the volume cannot be opened as this type and 1 if it may
+ */
+uint8_t
+fatfs_probe(const TSK_FS_PROBE * a_probe)
+{
+    const TSK_OFF_T ssize = a_probe->img_info->sector_size;
+    const TSK_OFF_T boot_sectors[] = { 0, 6 * ssize, 12 * ssize };
+
+    for (size_t i = 0; i < sizeof(boot_sectors) / sizeof(boot_sectors[0]); i++) {
+        if (tsk_fs_probe_u16(a_probe,
+                boot_sectors[i] + offsetof(FATFS_MASTER_BOOT_RECORD, magic),
+                FATFS_FS_MAGIC))
+            return 1;
+    }
+    return 0;
+}
+
 /**
  * \internal
  * Open part of a disk image as a FAT file system.
@@ -30,6 +30,7 @@
 #include "tsk_fs_i.h"
 #include "tsk_ffs.h"
 
+#include <cstddef>
 #include <memory>
 
 /* ffs_group_load - load cylinder group descriptor info into cache
@@ -1999,6 +2000,25 @@ ffs_close(TSK_FS_INFO * fs)
     tsk_fs_free(fs);
 }
 
+/**
+ * \internal
+ * Signature check for file system auto-detection.  ffs_open() needs a UFS2
+ * superblock at 64 KiB or 256 KiB or a UFS1 superblock at 8 KiB.
+ *
+ * @param a_probe Start of the volume
+ * @returns 0 if the volume cannot be opened as this type and 1 if it may
+ */
+uint8_t
+ffs_probe(const TSK_FS_PROBE * a_probe)
+{
+    return tsk_fs_probe_u32(a_probe,
+            UFS2_SBOFF + offsetof(ffs_sb2, magic), UFS2_FS_MAGIC)
+        || tsk_fs_probe_u32(a_probe,
+            UFS2_SBOFF2 + offsetof(ffs_sb2, magic), UFS2_FS_MAGIC)
+        || tsk_fs_probe_u32(a_probe,
+            UFS1_SBOFF + offsetof(ffs_sb1, magic), UFS1_FS_MAGIC);
+}
+
 /**
  * \internal
  * Open part of a disk image as a FFS/UFS file system.
@@ -35,6 +35,172 @@
 #include "tsk_fs_i.h"
 #include "tsk_logical_fs.h"
 
+#include <atomic>
+#include <new>
+
+/* Run lists shorter than this are searched linearly by tsk_fs_attr_read */
+#define TSK_FS_ATTR_RUN_INDEX_MIN 32
+
+/**
+ * \internal
+ * Flat copy of a non-resident run list used by tsk_fs_attr_read to find the
+ * run with a given offset by binary search.  end[i] is the block offset just
+ * past runs[i]; the arrays share one allocation.  A count of 0 means that the
+ * run list is not sorted by offset and cannot be indexed.
+ */
+typedef struct {
+    size_t count;
+    TSK_DADDR_T *end;
+    TSK_FS_ATTR_RUN **runs;
+} TSK_FS_ATTR_RUN_TABLE;
+
+/* Published in place of a table for run lists that are too short or not
+ * sorted, so that later reads do not try to index them again. */
+static TSK_FS_ATTR_RUN_TABLE run_table_none = { 0, NULL, NULL };
+
+/**
+ * \internal
+ * Holder for the run table of an attribute, allocated with the attribute.
+ * Shared attributes (the HFS catalog file, the NTFS $Secure stream) are
+ * read by several threads at once, so the table is published atomically.
+ */
+struct TSK_FS_ATTR_RUN_INDEX {
+    std::atomic<TSK_FS_ATTR_RUN_TABLE *> table{nullptr};
+};
+
+/**
+ * \internal
+ * Free the run table of an attribute.  Must be called whenever the run
+ * list is changed.
+ *
+ * @param a_fs_attr Attribute to reset
+ */
+static void
+tsk_fs_attr_run_index_free(TSK_FS_ATTR * a_fs_attr)
+{
+    if (a_fs_attr->run_index == NULL)
+        return;
+
+    TSK_FS_ATTR_RUN_TABLE *tbl =
+        a_fs_attr->run_index->table.exchange(nullptr);
+    if (tbl != &run_table_none)
+        free(tbl);
+}
+
+/**
+ * \internal
+ * Build the run table of an attribute.
+ *
+ * @param a_fs_attr Non-resident attribute to index
+ * @returns run_table_none if the run list is too short to need a table or
+ * is not sorted, or NULL if memory runs out
+ */
+static TSK_FS_ATTR_RUN_TABLE *
+tsk_fs_attr_run_index_build(const TSK_FS_ATTR * a_fs_attr)
+{
+    TSK_FS_ATTR_RUN_TABLE *tbl;
+    TSK_FS_ATTR_RUN *run;
+    size_t count = 0;
+
+    for (run = a_fs_attr->nrd.run; run; run = run->next)
+        if (++count == TSK_FS_ATTR_RUN_INDEX_MIN)
+            break;
+    if (count < TSK_FS_ATTR_RUN_INDEX_MIN)
+        return &run_table_none;
+
+    for (; run->next; run = run->next)
+        count++;
+
+    tbl = (TSK_FS_ATTR_RUN_TABLE *) malloc(sizeof(TSK_FS_ATTR_RUN_TABLE)
+        + count * (sizeof(TSK_DADDR_T) + sizeof(TSK_FS_ATTR_RUN *)));
+    if (tbl == NULL)
+        return NULL;
+    tbl->end = (TSK_DADDR_T *) (tbl + 1);
+    tbl->runs = (TSK_FS_ATTR_RUN **) (tbl->end + count);
+    tbl->count = count;
+
+    size_t i = 0;
+    for (run = a_fs_attr->nrd.run; run; run = run->next, i++) {
+        tbl->runs[i] = run;
+        tbl->end[i] = run->offset + run->len;
+        // the binary search needs runs in offset order
+        if ((i > 0) && ((run->offset < tbl->runs[i - 1]->offset)
+                || (tbl->end[i] < tbl->end[i - 1]))) {
+            free(tbl);
+            return &run_table_none;
+        }
+    }
+    return tbl;
+}
+
+/**
+ * \internal
+ * Find the first run of an attribute that ends after a given block offset,
+ * which is where tsk_fs_attr_read starts its walk of the run list.  The
+ * table is built on the first call.  Readers of the same attribute may
+ * race to build it; the first one to finish publishes its table and the
+ * others free theirs.
+ *
+ * @param a_fs_attr Non-resident attribute to search
+ * @param a_blkoff Block offset (relative to the start of the attribute)
+ * @returns Run to start the walk at (the head of the list if there is
+ * no table), or NULL if no run reaches the offset.
+ */
+static TSK_FS_ATTR_RUN *
+tsk_fs_attr_run_find(const TSK_FS_ATTR * a_fs_attr, TSK_DADDR_T a_blkoff)
+{
+    if (a_fs_attr->run_index == NULL)
+        return a_fs_attr->nrd.run;
+
+    std::atomic<TSK_FS_ATTR_RUN_TABLE *> &slot = a_fs_attr->run_index->table;
+    TSK_FS_ATTR_RUN_TABLE *tbl = slot.load(std::memory_order_acquire);
+
+    if (tbl == NULL) {
+        TSK_FS_ATTR_RUN_TABLE *built = tsk_fs_attr_run_index_build(a_fs_attr);
+        if (built == NULL)
+            return a_fs_attr->nrd.run;
+
+        if (slot.compare_exchange_strong(tbl, built,
+                std::memory_order_acq_rel, std::memory_order_acquire)) {
+            tbl = built;
+        }
+        else if (built != &run_table_none) {
+            free(built);
+        }
+    }
+
+    if (tbl->count == 0)
+        return a_fs_attr->nrd.run;
+
+    size_t lo = 0, hi = tbl->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tbl->end[mid] <= a_blkoff)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo < tbl->count) ? tbl->runs[lo] : NULL;
+}
+
+/**
+ * \internal
+ * Number of runs in the table that tsk_fs_attr_read built for an attribute.
+ *
+ * @param a_fs_attr Attribute to check
+ * @returns 0 if no table has been built or the run list is not indexed
+ */
+size_t
+tsk_fs_attr_run_index_count(const TSK_FS_ATTR * a_fs_attr)
+{
+    if (a_fs_attr->run_index == NULL)
+        return 0;
+
+    TSK_FS_ATTR_RUN_TABLE *tbl =
+        a_fs_attr->run_index->table.load(std::memory_order_acquire);
+    return tbl ? tbl->count : 0;
+}
+
 
 /**
  * \internal
@@ -114,6 +280,17 @@ tsk_fs_attr_alloc(TSK_FS_ATTR_FLAG_ENUM type)
         return NULL;
     }
 
+    fs_attr->run_index = new(std::nothrow) TSK_FS_ATTR_RUN_INDEX;
+    if (fs_attr->run_index == NULL) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_AUX_MALLOC);
+        tsk_error_set_errstr("tsk_fs_attr_alloc: run index");
+        free(fs_attr->rd.buf);
+        free(fs_attr->name);
+        free(fs_attr);
+        return NULL;
+    }
+
     return fs_attr;
 }
 
@@ -133,6 +310,9 @@ tsk_fs_attr_free(TSK_FS_ATTR * a_fs_attr)
     if (a_fs_attr->nrd.run)
         tsk_fs_attr_run_free(a_fs_attr->nrd.run);
     a_fs_attr->nrd.run = NULL;
+    tsk_fs_attr_run_index_free(a_fs_attr);
+    delete a_fs_attr->run_index;
+    a_fs_attr->run_index = NULL;
 
     free(a_fs_attr->rd.buf);
     a_fs_attr->rd.buf = NULL;
@@ -157,6 +337,7 @@ tsk_fs_attr_clear(TSK_FS_ATTR * a_fs_attr)
     a_fs_attr->type = TSK_FS_ATTR_TYPE_NOT_FOUND;
     a_fs_attr->id = 0;
     a_fs_attr->flags = TSK_FS_ATTR_FLAG_NONE;
+    tsk_fs_attr_run_index_free(a_fs_attr);
     if (a_fs_attr->nrd.run) {
         tsk_fs_attr_run_free(a_fs_attr->nrd.run);
         a_fs_attr->nrd.run = NULL;
@@ -300,6 +481,7 @@ tsk_fs_attr_set_run(TSK_FS_FILE * a_fs_file, TSK_FS_ATTR * a_fs_attr,
         return 1;
     }
 
+    tsk_fs_attr_run_index_free(a_fs_attr);
     a_fs_attr->fs_file = a_fs_file;
     a_fs_attr->flags = (TSK_FS_ATTR_FLAG_ENUM) (TSK_FS_ATTR_INUSE | TSK_FS_ATTR_NONRES | flags);
     a_fs_attr->type = type;
@@ -504,6 +686,8 @@ tsk_fs_attr_add_run(
         return 1;
     }
 
+    tsk_fs_attr_run_index_free(a_fs_attr);
+
     run_len = 0;
     data_run_cur = a_data_run_new;
     while (data_run_cur) {
@@ -722,6 +906,8 @@ tsk_fs_attr_append_run(
         return;
     }
 
+    tsk_fs_attr_run_index_free(a_fs_attr);
+
     if (a_fs_attr->nrd.run == NULL) {
         a_fs_attr->nrd.run = a_data_run;
         a_data_run->offset = 0;
@@ -844,7 +1030,11 @@ tsk_fs_attr_walk_res(const TSK_FS_ATTR * fs_attr,
 
 /** \internal
  * Processes a non-resident TSK_FS_ATTR structure and calls the callback with the associated
- * data.
+ * data.  With TSK_FS_FILE_WALK_FLAG_CHUNK, consecutive blocks of a run that
+ * are all read (or all sparse) and have the same block flags are read and
+ * returned together, up to TSK_FS_FILE_WALK_CHUNK_SIZE bytes at a time.
+ * Blocks that need special handling (skipped bytes, the end of the
+ * initialized data) are still returned one at a time.
  *
  * @param fs_attr Resident data structure to be walked
  * @param a_flags Flags for walking
@@ -865,6 +1055,7 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
     uint32_t skip_remain;
     TSK_FS_INFO *fs = fs_attr->fs_file->fs_info;
     uint8_t stop_loop = 0;
+    TSK_DADDR_T chunk_blocks = 1;
 
     if ((fs_attr->flags & TSK_FS_ATTR_NONRES) == 0) {
         tsk_error_set_errno(TSK_ERR_FS_ARG);
@@ -881,8 +1072,22 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
 
     skip_remain = fs_attr->nrd.skiplen;
 
+    // logical files are read one block at a time
+    if ((a_flags & TSK_FS_FILE_WALK_FLAG_CHUNK)
+        && ((a_flags & TSK_FS_FILE_WALK_FLAG_AONLY) == 0)
+        && (fs->ftype != TSK_FS_TYPE_LOGICAL)
+        && (fs->block_size < TSK_FS_FILE_WALK_CHUNK_SIZE)) {
+        chunk_blocks = TSK_FS_FILE_WALK_CHUNK_SIZE / fs->block_size;
+
+        // no bigger than the attribute needs
+        TSK_DADDR_T need = (TSK_DADDR_T) ((tot_size + skip_remain
+            + fs->block_size - 1) / fs->block_size);
+        if (need < chunk_blocks)
+            chunk_blocks = need ? need : 1;
+    }
+
     if ((a_flags & TSK_FS_FILE_WALK_FLAG_AONLY) == 0) {
-        if ((buf = (char *) tsk_malloc(fs->block_size)) == NULL) {
+        if ((buf = (char *) tsk_malloc((size_t) chunk_blocks * fs->block_size)) == NULL) {
             return 1;
         }
     }
@@ -891,14 +1096,15 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
     retval = TSK_WALK_CONT;
     for (fs_attr_run = fs_attr->nrd.run; fs_attr_run;
         fs_attr_run = fs_attr_run->next) {
-        TSK_DADDR_T addr, len_idx;
+        TSK_DADDR_T addr, len_idx, nblocks;
 
         addr = fs_attr_run->addr;
 
-        /* cycle through each block in the run */
-        for (len_idx = 0; len_idx < fs_attr_run->len; len_idx++) {
+        /* cycle through each block (or group of blocks) in the run */
+        for (len_idx = 0; len_idx < fs_attr_run->len; len_idx += nblocks) {
 
             TSK_FS_BLOCK_FLAG_ENUM myflags;
+            size_t buf_len;
 
             /* If the address is too large then give an error */
             if (addr + len_idx > fs->last_block) {
@@ -914,18 +1120,53 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
                 return 1;
             }
 
+            /* Group the blocks that are handled alike: all sparse, or all
+             * read, entirely before the end of the initialized data and
+             * with the same flags as the first (the callback gets one set
+             * of flags for the group). */
+            nblocks = 1;
+            if (chunk_blocks > 1 && skip_remain == 0) {
+                nblocks = fs_attr_run->len - len_idx;
+                if (nblocks > chunk_blocks)
+                    nblocks = chunk_blocks;
+                if (nblocks > fs->last_block - (addr + len_idx) + 1)
+                    nblocks = fs->last_block - (addr + len_idx) + 1;
+
+                if ((fs_attr_run->flags & (TSK_FS_ATTR_RUN_FLAG_SPARSE |
+                            TSK_FS_ATTR_RUN_FLAG_FILLER)) == 0) {
+                    if (off + fs->block_size > fs_attr->nrd.initsize)
+                        nblocks = 1;
+                    else if ((TSK_DADDR_T) ((fs_attr->nrd.initsize - off) /
+                            fs->block_size) < nblocks)
+                        nblocks = (fs_attr->nrd.initsize - off) / fs->block_size;
+
+                    if (nblocks > 1) {
+                        TSK_FS_BLOCK_FLAG_ENUM first =
+                            fs->block_getflags(fs, addr + len_idx);
+                        TSK_DADDR_T i;
+                        for (i = 1; i < nblocks; i++) {
+                            if (fs->block_getflags(fs, addr + len_idx + i) != first) {
+                                nblocks = i;
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+            buf_len = (size_t) nblocks * fs->block_size;
+
             // load the buffer if they want more than just the address
             if ((a_flags & TSK_FS_FILE_WALK_FLAG_AONLY) == 0) {
 
                 /* sparse files just get 0s */
                 if (fs_attr_run->flags & TSK_FS_ATTR_RUN_FLAG_SPARSE) {
-                    memset(buf, 0, fs->block_size);
+                    memset(buf, 0, buf_len);
                 }
                 /* FILLER entries exist when the source file system can store run
                  * info out of order and we did not get all of the run info.  We
                  * return 0s if data is read from this type of run. */
                 else if (fs_attr_run->flags & TSK_FS_ATTR_RUN_FLAG_FILLER) {
-                    memset(buf, 0, fs->block_size);
+                    memset(buf, 0, buf_len);
                     if (tsk_verbose)
                         fprintf(stderr,
                             "tsk_fs_attr_walk_nonres: File %" PRIuINUM
@@ -936,7 +1177,7 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
                 // we return 0s for reads past the initsize
                 else if (off >= fs_attr->nrd.initsize
                     && (a_flags & TSK_FS_FILE_WALK_FLAG_SLACK) == 0) {
-                    memset(buf, 0, fs->block_size);
+                    memset(buf, 0, buf_len);
                 }
                 else {
                     ssize_t cnt;
@@ -946,9 +1187,9 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
 					}
 					else {
 						cnt = tsk_fs_read_block_decrypt
-						(fs, addr + len_idx, buf, fs->block_size, fs_attr_run->crypto_id + len_idx);
+						(fs, addr + len_idx, buf, buf_len, fs_attr_run->crypto_id + len_idx);
 					}
-                    if (cnt != fs->block_size) {
+                    if (cnt != (ssize_t) buf_len) {
                         if (cnt >= 0) {
                             tsk_error_reset();
                             tsk_error_set_errno(TSK_ERR_FS_READ);
@@ -959,10 +1200,10 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
                         free(buf);
                         return 1;
                     }
-                    if (off + fs->block_size > fs_attr->nrd.initsize
+                    if (off + (TSK_OFF_T) buf_len > fs_attr->nrd.initsize
                         && (a_flags & TSK_FS_FILE_WALK_FLAG_SLACK) == 0) {
                         memset(&buf[fs_attr->nrd.initsize - off], 0,
-                            fs->block_size -
+                            buf_len -
                             (size_t) (fs_attr->nrd.initsize - off));
                     }
                 }
@@ -973,16 +1214,16 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
              * included in the overall length.  We will seek past those and not
              * return those in the action.  We just read a block size so check
              * if there is data to be returned in this buffer. */
-            if (skip_remain >= fs->block_size) {
-                skip_remain -= fs->block_size;
+            if (skip_remain >= buf_len) {
+                skip_remain -= (uint32_t) buf_len;
             }
             else {
                 size_t ret_len;
 
                 /* Do we want to return a full block, or just the end? */
-                if ((TSK_OFF_T) fs->block_size - skip_remain <
+                if ((TSK_OFF_T) buf_len - skip_remain <
                     tot_size - off)
-                    ret_len = fs->block_size - skip_remain;
+                    ret_len = buf_len - skip_remain;
                 else
                     ret_len = (size_t) (tot_size - off);
 
@@ -995,7 +1236,7 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
                     if ((a_flags & TSK_FS_FILE_WALK_FLAG_NOSPARSE) == 0) {
                         retval =
                             a_action(fs_attr->fs_file, off, 0,
-                            &buf[skip_remain], ret_len, myflags, a_ptr);
+                            buf ? &buf[skip_remain] : NULL, ret_len, myflags, a_ptr);
                     }
                 }
                 else {
@@ -1004,7 +1245,7 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
 
                     retval =
                         a_action(fs_attr->fs_file, off, addr + len_idx,
-                        &buf[skip_remain], ret_len, myflags, a_ptr);
+                        buf ? &buf[skip_remain] : NULL, ret_len, myflags, a_ptr);
                 }
                 off += ret_len;
                 skip_remain = 0;
@@ -1036,7 +1277,8 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
 /**
  * \ingroup fslib
  * Process an attribute and call a callback function with its contents. The callback will be
- * called with chunks of data that are fs->block_size or less.  The address given in the callback
+ * called with chunks of data that are fs->block_size or less (or up to TSK_FS_FILE_WALK_CHUNK_SIZE
+ * for non-resident attributes when TSK_FS_FILE_WALK_FLAG_CHUNK is given).  The address given in the callback
  * will be correct only for raw files (when the raw file contents were stored in the block).  For
  * compressed and sparse attributes, the address may be zero.
  *
@@ -1209,7 +1451,8 @@ tsk_fs_attr_read(const TSK_FS_ATTR * a_fs_attr, TSK_OFF_T a_offset,
         len_remain = len_toread;
 
         // cycle through the runs until we find the one where our offset starts
-        for (data_run_cur = a_fs_attr->nrd.run; data_run_cur && len_remain > 0;
+        for (data_run_cur = tsk_fs_attr_run_find(a_fs_attr, blkoffset_toread);
+            data_run_cur && len_remain > 0;
             data_run_cur = data_run_cur->next) {
 
             TSK_DADDR_T blkoffset_inrun;
@@ -0,0 +1,232 @@
+/*
+** fs_detect
+** The Sleuth Kit
+**
+** This software is distributed under the Common Public License 1.0
+*/
+
+/**
+ * \file fs_detect.cpp
+ * Support for file system auto-detection in tsk_fs_open_img: the shared
+ * probe buffer that the drivers' signature checks run against, and the
+ * (possibly parallel) opening of the drivers whose checks passed.
+ */
+
+#include "tsk_fs_i.h"
+
+#include <cstring>
+#include <new>
+#include <system_error>
+#include <vector>
+
+#ifdef TSK_MULTITHREAD_LIB
+#include <thread>
+#endif
+
+/**
+ * \internal
+ * Read the start of a volume for the drivers' probe functions.
+ *
+ * @param a_img_info Image to read from
+ * @param a_offset Byte offset of the volume in the image
+ * @returns NULL if the volume could not be read (auto-detection then
+ * tries every driver, as if no probe had passed or failed)
+ */
+TSK_FS_PROBE *
+tsk_fs_probe_load(TSK_IMG_INFO * a_img_info, TSK_OFF_T a_offset)
+{
+    TSK_FS_PROBE *probe;
+    size_t len = TSK_FS_PROBE_SIZE;
+    ssize_t cnt;
+
+    if ((a_offset < 0) || (a_offset >= a_img_info->size))
+        return NULL;
+    if (a_img_info->size - a_offset < (TSK_OFF_T) len)
+        len = (size_t) (a_img_info->size - a_offset);
+
+    if ((probe = (TSK_FS_PROBE *) tsk_malloc(sizeof(TSK_FS_PROBE))) == NULL) {
+        tsk_error_reset();
+        return NULL;
+    }
+    if ((probe->buf = (uint8_t *) tsk_malloc(len)) == NULL) {
+        tsk_error_reset();
+        free(probe);
+        return NULL;
+    }
+    probe->img_info = a_img_info;
+    probe->offset = a_offset;
+
+    cnt = tsk_img_read(a_img_info, a_offset, (char *) probe->buf, len);
+    if (cnt <= 0) {
+        tsk_error_reset();
+        tsk_fs_probe_free(probe);
+        return NULL;
+    }
+    probe->len = (size_t) cnt;
+    return probe;
+}
+
+/**
+ * \internal
+ * Free a probe buffer from tsk_fs_probe_load().
+ */
+void
+tsk_fs_probe_free(TSK_FS_PROBE * a_probe)
+{
+    if (a_probe == NULL)
+        return;
+    free(a_probe->buf);
+    free(a_probe);
+}
+
+/**
+ * \internal
+ * Get bytes of the volume for a probe function.  Bytes in the probe buffer
+ * are returned directly; others (such as backup superblocks) are read from
+ * the image into a_tmp.
+ *
+ * @returns NULL if the bytes are past the end of the image or cannot be read
+ */
+static const uint8_t *
+tsk_fs_probe_get(const TSK_FS_PROBE * a_probe, TSK_OFF_T a_off,
+    size_t a_len, uint8_t * a_tmp)
+{
+    if (a_off < 0)
+        return NULL;
+    if ((TSK_OFF_T) (a_off + a_len) <= (TSK_OFF_T) a_probe->len)
+        return &a_probe->buf[a_off];
+
+    // the buffer holds everything up to the end of the image
+    if (a_probe->len < TSK_FS_PROBE_SIZE)
+        return NULL;
+
+    ssize_t cnt = tsk_img_read(a_probe->img_info, a_probe->offset + a_off,
+        (char *) a_tmp, a_len);
+    if (cnt != (ssize_t) a_len) {
+        tsk_error_reset();
+        return NULL;
+    }
+    return a_tmp;
+}
+
+/**
+ * \internal
+ * Check for a byte string at an offset of the volume.
+ *
+ * @returns 1 if it is there and 0 if not
+ */
+uint8_t
+tsk_fs_probe_bytes(const TSK_FS_PROBE * a_probe, TSK_OFF_T a_off,
+    const void *a_val, size_t a_len)
+{
+    uint8_t tmp[64];
+    const uint8_t *p;
+
+    if (a_len > sizeof(tmp))
+        return 0;
+    p = tsk_fs_probe_get(a_probe, a_off, a_len, tmp);
+    return (p != NULL) && (memcmp(p, a_val, a_len) == 0);
+}
+
+/**
+ * \internal
+ * Check for a 16-bit magic value (in either byte order, like
+ * tsk_fs_guessu16) at an offset of the volume.
+ *
+ * @returns 1 if it is there and 0 if not
+ */
+uint8_t
+tsk_fs_probe_u16(const TSK_FS_PROBE * a_probe, TSK_OFF_T a_off,
+    uint16_t a_val)
+{
+    uint8_t tmp[2];
+    const uint8_t *p = tsk_fs_probe_get(a_probe, a_off, 2, tmp);
+
+    return (p != NULL) && ((tsk_getu16(TSK_LIT_ENDIAN, p) == a_val)
+        || (tsk_getu16(TSK_BIG_ENDIAN, p) == a_val));
+}
+
+/**
+ * \internal
+ * Check for a 32-bit magic value (in either byte order, like
+ * tsk_fs_guessu32) at an offset of the volume.
+ *
+ * @returns 1 if it is there and 0 if not
+ */
+uint8_t
+tsk_fs_probe_u32(const TSK_FS_PROBE * a_probe, TSK_OFF_T a_off,
+    uint32_t a_val)
+{
+    uint8_t tmp[4];
+    const uint8_t *p = tsk_fs_probe_get(a_probe, a_off, 4, tmp);
+
+    return (p != NULL) && ((tsk_getu32(TSK_LIT_ENDIAN, p) == a_val)
+        || (tsk_getu32(TSK_BIG_ENDIAN, p) == a_val));
+}
+
+/* Run one open and keep its error (which is per thread) in the job. */
+static void
+tsk_fs_open_job_run(TSK_IMG_INFO * a_img_info, TSK_OFF_T a_offset,
+    const char *a_pass, TSK_FS_OPEN_JOB * a_job)
+{
+    a_job->fs = a_job->open(a_img_info, a_offset, a_job->type, a_pass, 1);
+    if (a_job->fs == NULL) {
+        a_job->t_errno = tsk_error_get_errno();
+        strncpy(a_job->errstr, tsk_error_get_errstr(),
+            TSK_ERROR_STRING_MAX_LENGTH);
+        a_job->errstr[TSK_ERROR_STRING_MAX_LENGTH] = '\0';
+    }
+    else {
+        a_job->t_errno = 0;
+        a_job->errstr[0] = '\0';
+    }
+    tsk_error_reset();
+}
+
+/**
+ * \internal
+ * Try to open a volume with several drivers.  With a multi-threaded
+ * library, the drivers run in parallel (one thread each); otherwise, or if
+ * a thread cannot be started, they run one after another.  The error state
+ * of the calling thread is reset.
+ *
+ * @param a_img_info Image to open
+ * @param a_offset Byte offset of the volume in the image
+ * @param a_pass Password to pass to the drivers
+ * @param a_jobs Drivers to try; fs, t_errno and errstr are set for each
+ * @param a_njobs Number of entries in a_jobs
+ */
+void
+tsk_fs_open_jobs(TSK_IMG_INFO * a_img_info, TSK_OFF_T a_offset,
+    const char *a_pass, TSK_FS_OPEN_JOB * a_jobs, size_t a_njobs)
+{
+    size_t i = 1;
+
+    if (a_njobs == 0)
+        return;
+
+#ifdef TSK_MULTITHREAD_LIB
+    std::vector<std::thread> threads;
+    try {
+        threads.reserve(a_njobs - 1);
+        for (; i < a_njobs; ++i) {
+            threads.emplace_back(tsk_fs_open_job_run, a_img_info, a_offset,
+                a_pass, &a_jobs[i]);
+        }
+    }
+    catch (const std::system_error &) {
+        // the jobs without a thread run below
+    }
+    catch (const std::bad_alloc &) {
+    }
+#endif
+
+    tsk_fs_open_job_run(a_img_info, a_offset, a_pass, &a_jobs[0]);
+    for (size_t j = i; j < a_njobs; ++j)
+        tsk_fs_open_job_run(a_img_info, a_offset, a_pass, &a_jobs[j]);
+
+#ifdef TSK_MULTITHREAD_LIB
+    for (std::thread &t : threads)
+        t.join();
+#endif
+}
@@ -134,21 +134,25 @@ tsk_fs_open_img_decrypt(TSK_IMG_INFO * a_img_info, TSK_OFF_T a_offset,
         // This type should be the _DETECT version because it used
         // during autodetection
         TSK_FS_TYPE_ENUM type;
+        // Cheap signature check on the start of the volume (NULL if the
+        // driver has none and is always tried)
+        uint8_t (*probe)(const TSK_FS_PROBE *);
     } FS_OPENERS[] = {
-        { "NTFS",     ntfs_open,    TSK_FS_TYPE_NTFS_DETECT    },
-        { "FAT",      fatfs_open,   TSK_FS_TYPE_FAT_DETECT     },
-        { "EXT2/3/4", ext2fs_open,  TSK_FS_TYPE_EXT_DETECT     },
-        { "UFS",      ffs_open,     TSK_FS_TYPE_FFS_DETECT     },
-        { "YAFFS2",   yaffs2_open,  TSK_FS_TYPE_YAFFS2_DETECT  },
-        { "XFS",      xfs_open,     TSK_FS_TYPE_XFS_DETECT     },
-        { "QNX6",     qnx6fs_open,  TSK_FS_TYPE_QNX6_DETECT    },
+        { "NTFS",     ntfs_open,    TSK_FS_TYPE_NTFS_DETECT,    ntfs_probe    },
+        { "FAT",      fatfs_open,   TSK_FS_TYPE_FAT_DETECT,     fatfs_probe   },
+        { "EXT2/3/4", ext2fs_open,  TSK_FS_TYPE_EXT_DETECT,     ext2fs_probe  },
+        { "UFS",      ffs_open,     TSK_FS_TYPE_FFS_DETECT,     ffs_probe     },
+        { "YAFFS2",   yaffs2_open,  TSK_FS_TYPE_YAFFS2_DETECT,  NULL          },
+        { "XFS",      xfs_open,     TSK_FS_TYPE_XFS_DETECT,     xfs_probe     },
+        { "QNX6",     qnx6fs_open,  TSK_FS_TYPE_QNX6_DETECT,    qnx6fs_probe  },
 #if TSK_USE_HFS
-        { "HFS",      hfs_open,     TSK_FS_TYPE_HFS_DETECT     },
+        { "HFS",      hfs_open,     TSK_FS_TYPE_HFS_DETECT,     hfs_probe     },
 #endif
-        { "ISO9660",  iso9660_open, TSK_FS_TYPE_ISO9660_DETECT },
-        { "APFS",     apfs_open_auto_detect,    TSK_FS_TYPE_APFS_DETECT },
-        { "BTRFS",    btrfs_open,   TSK_FS_TYPE_BTRFS_DETECT },
+        { "ISO9660",  iso9660_open, TSK_FS_TYPE_ISO9660_DETECT, iso9660_probe },
+        { "APFS",     apfs_open_auto_detect,    TSK_FS_TYPE_APFS_DETECT, apfs_probe },
+        { "BTRFS",    btrfs_open,   TSK_FS_TYPE_BTRFS_DETECT,   btrfs_probe   },
     };
+#define FS_OPENERS_N (sizeof(FS_OPENERS)/sizeof(FS_OPENERS[0]))
     if (a_img_info == NULL) {
         tsk_error_reset();
         tsk_error_set_errno(TSK_ERR_FS_ARG);
@@ -172,12 +176,19 @@ tsk_fs_open_img_decrypt(TSK_IMG_INFO * a_img_info, TSK_OFF_T a_offset,
 	}
 
     /* We will try different file systems ...
-     * We need to try all of them in case more than one matches
+     * We need to try all of them in case more than one matches.  The
+     * drivers' signature checks first run against one shared read of the
+     * start of the volume, and only the drivers that pass are opened
+     * (in parallel when there are several).
      */
     if (a_ftype == TSK_FS_TYPE_DETECT) {
-        unsigned long i;
+        unsigned long i, j;
         const char *name_first = "";
         TSK_FS_INFO *fs_first = NULL;
+        TSK_FS_PROBE *probe;
+        TSK_FS_OPEN_JOB jobs[FS_OPENERS_N];
+        const char *job_names[FS_OPENERS_N];
+        size_t njobs = 0;
 
         if (tsk_verbose)
             tsk_fprintf(stderr,
@@ -188,24 +199,45 @@ tsk_fs_open_img_decrypt(TSK_IMG_INFO * a_img_info, TSK_OFF_T a_offset,
         uint32_t errorCodeToPreserve;
         char errorStrToPreserve[TSK_ERROR_STRING_MAX_LENGTH + 1];
 
-        for (i = 0; i < sizeof(FS_OPENERS)/sizeof(FS_OPENERS[0]); ++i) {
-            if ((fs_info = FS_OPENERS[i].open(
-                    a_img_info, a_offset, FS_OPENERS[i].type, a_pass, 1)) != NULL) {
+        // if the volume cannot be read, every driver is tried (and fails)
+        probe = tsk_fs_probe_load(a_img_info, a_offset);
+        for (i = 0; i < FS_OPENERS_N; ++i) {
+            if ((probe != NULL) && (FS_OPENERS[i].probe != NULL)
+                && (FS_OPENERS[i].probe(probe) == 0)) {
+                if (tsk_verbose)
+                    tsk_fprintf(stderr,
+                        "fsopen: No %s signature\n", FS_OPENERS[i].name);
+                continue;
+            }
+            jobs[njobs].open = FS_OPENERS[i].open;
+            jobs[njobs].type = FS_OPENERS[i].type;
+            job_names[njobs] = FS_OPENERS[i].name;
+            njobs++;
+        }
+        tsk_fs_probe_free(probe);
+
+        tsk_fs_open_jobs(a_img_info, a_offset, a_pass, jobs, njobs);
+
+        for (i = 0; i < njobs; ++i) {
+            if ((fs_info = jobs[i].fs) != NULL) {
                 // fs opens as type i
                 if (fs_first == NULL) {
                     // first success opening fs
-                    name_first = FS_OPENERS[i].name;
+                    name_first = job_names[i];
                     fs_first = fs_info;
                 }
                 else {
                     // second success opening fs, which means we
                     // cannot autodetect the fs type and must give up
                     fs_first->close(fs_first);
-                    fs_info->close(fs_info);
+                    for (j = i; j < njobs; ++j) {
+                        if (jobs[j].fs)
+                            jobs[j].fs->close(jobs[j].fs);
+                    }
                     tsk_error_reset();
                     tsk_error_set_errno(TSK_ERR_FS_MULTTYPE);
                     tsk_error_set_errstr(
-                        "%s or %s", FS_OPENERS[i].name, name_first);
+                        "%s or %s", job_names[i], name_first);
                     return NULL;
                 }
             }
@@ -216,14 +248,12 @@ tsk_fs_open_img_decrypt(TSK_IMG_INFO * a_img_info, TSK_OFF_T a_offset,
                 // need something different from the user or find something we can't currently parse. We need
                 // to keep trying file systems (we might have a FAT system so we don't want to return after
                 // failing to open as NTFS) but we also want to be able to get the error back to the user.
-                if (tsk_error_get_errno() == TSK_ERR_FS_BITLOCKER_ERROR) {
+                if (jobs[i].t_errno == TSK_ERR_FS_BITLOCKER_ERROR) {
                     haveErrorToPreserve = 1;
-                    errorCodeToPreserve = tsk_error_get_errno();
+                    errorCodeToPreserve = jobs[i].t_errno;
                     memset(errorStrToPreserve, 0, TSK_ERROR_STRING_MAX_LENGTH + 1);
-                    strncpy(errorStrToPreserve, tsk_error_get_errstr(), TSK_ERROR_STRING_MAX_LENGTH);
+                    strncpy(errorStrToPreserve, jobs[i].errstr, TSK_ERROR_STRING_MAX_LENGTH);
                 }
-
-                tsk_error_reset();
             }
         }
 
@@ -338,6 +368,26 @@ tsk_fs_close(TSK_FS_INFO * a_fs)
     a_fs->close(a_fs);
 }
 
+/**
+ * \ingroup fslib
+ * Set the number of worker threads that decompress file content ahead of
+ * the reader.  Currently only NTFS compressed attributes use them: file
+ * walks and large reads decompress several compression units at a time
+ * and still return the data in order.  Call this before reading files; the
+ * threads are started on first use and stay until the file system is
+ * closed.
+ * @param a_fs File system
+ * @param a_threads Number of threads (0 or 1 to decompress on the calling
+ * thread, which is the default).  Ignored without a multi-threaded library.
+ */
+void
+tsk_fs_set_decomp_threads(TSK_FS_INFO * a_fs, unsigned int a_threads)
+{
+    if ((a_fs == NULL) || (a_fs->tag != TSK_FS_INFO_TAG))
+        return;
+    a_fs->decomp_threads = a_threads;
+}
+
 /* tsk_fs_malloc - init lock after tsk_malloc
  * This is for fs module and all it's inheritances
  */
@@ -75,6 +75,7 @@
 #include "tsk_hfs.h"
 #include "decmpfs.h"
 
+#include <cstddef>
 #include <memory>
 #include <new>
 
@@ -6401,6 +6402,24 @@ hfs_close(TSK_FS_INFO * fs)
     tsk_fs_free((TSK_FS_INFO *)hfs);
 }
 
+/**
+ * \internal
+ * Signature check for file system auto-detection.  hfs_open() needs an
+ * HFS+, HFSX or HFS wrapper signature in the volume header.
+ *
+ * @param a_probe Start of the volume
+ * @returns 0 if the volume cannot be opened as this type and 1 if it may
+ */
+uint8_t
+hfs_probe(const TSK_FS_PROBE * a_probe)
+{
+    const TSK_OFF_T off = HFS_VH_OFF + offsetof(hfs_plus_vh, signature);
+
+    return tsk_fs_probe_u16(a_probe, off, HFS_VH_SIG_HFSPLUS)
+        || tsk_fs_probe_u16(a_probe, off, HFS_VH_SIG_HFSX)
+        || tsk_fs_probe_u16(a_probe, off, HFS_VH_SIG_HFS);
+}
+
 /* hfs_open - open an hfs file system
  *
  * Return NULL on error (or not an HFS or HFS+ file system)
@@ -83,6 +83,9 @@ tsk_fs_icat(TSK_FS_INFO * fs, TSK_INUM_T inum,
         return 1;
     }
 
+    // icat_action writes whatever it is given, so take the data in large chunks
+    flags = (TSK_FS_FILE_WALK_FLAG_ENUM) (flags | TSK_FS_FILE_WALK_FLAG_CHUNK);
+
     if (type_used) {
         if (id_used == 0) {
             flags = (TSK_FS_FILE_WALK_FLAG_ENUM) (flags | TSK_FS_FILE_WALK_FLAG_NOID);
@@ -230,128 +230,153 @@ tsk_fs_path2inum(TSK_FS_INFO * a_fs, const char *a_path,
     is_done = 0;
     while (is_done == 0) {
         size_t i;
+        const TSK_FS_NAME *fs_name_hit = NULL;
 
-        // open the next directory in the recursion
+        std::unique_ptr<TSK_FS_NAME, decltype(&tsk_fs_name_free)> fs_name_idx{
+            nullptr,  // set if the file system found the name on its own
+            tsk_fs_name_free
+        };
         std::unique_ptr<TSK_FS_DIR, decltype(&tsk_fs_dir_close)> fs_dir{
-           tsk_fs_dir_open_meta(a_fs, next_meta),
-           tsk_fs_dir_close
+            nullptr,
+            tsk_fs_dir_close
         };
-
-        if (!fs_dir) {
-            free(cpath);
-            return -1;
-        }
-
-        /* Verify this is indeed a directory.  We had one reported
-         * problem where a file was a disk image and opening it as
-         * a directory found the directory entries inside of the file
-         * and this caused problems... */
-        if (!TSK_FS_IS_DIR_META(fs_dir->fs_file->meta->type)) {
-            tsk_error_reset();
-            tsk_error_set_errno(TSK_ERR_FS_GENFS);
-            tsk_error_set_errstr("Address %" PRIuINUM
-                " is not for a directory\n", next_meta);
-            free(cpath);
-            return -1;
-        }
-
         std::unique_ptr<TSK_FS_FILE, decltype(&tsk_fs_file_close)> fs_file_alloc{
             nullptr,  // set to the allocated file that is our target
             tsk_fs_file_close
         };
-
         std::unique_ptr<TSK_FS_FILE, decltype(&tsk_fs_file_close)> fs_file_del{
             nullptr,  // set to an unallocated file that matches our criteria
             tsk_fs_file_close
         };
 
-        // cycle through each entry
-        for (i = 0; i < tsk_fs_dir_getsize(fs_dir.get()); i++) {
-
-            uint8_t found_name = 0;
-
-            std::unique_ptr<TSK_FS_FILE, decltype(&tsk_fs_file_close)> fs_file{
-                tsk_fs_dir_get(fs_dir.get(), i),
-                tsk_fs_file_close
-            };
+        /* Ask the file system to find the name without loading the
+         * whole directory.  It only knows allocated names, so we still
+         * search the full listing if it does not find it. */
+        if ((a_fs->dir_lookup) && (cur_attr == NULL)) {
+            TSK_FS_NAME *fs_name_tmp = NULL;
+            TSK_RETVAL_ENUM retval =
+                a_fs->dir_lookup(a_fs, next_meta, cur_dir, &fs_name_tmp);
 
-            if (!fs_file) {
+            if (retval == TSK_ERR) {
                 free(cpath);
                 return -1;
             }
+            else if (retval == TSK_OK) {
+                fs_name_idx.reset(fs_name_tmp);
+                fs_name_hit = fs_name_idx.get();
+            }
+            else {
+                tsk_error_reset();
+            }
+        }
 
-            /*
-             * Check if this is the name that we are currently looking for,
-             * as identified in 'cur_dir'
-             */
-            if ((fs_file->name->name)
-                && (a_fs->name_cmp(a_fs, fs_file->name->name,
-                        cur_dir) == 0)) {
-                found_name = 1;
+        if (fs_name_hit == NULL) {
+            // open the next directory in the recursion
+            fs_dir.reset(tsk_fs_dir_open_meta(a_fs, next_meta));
+            if (!fs_dir) {
+                free(cpath);
+                return -1;
             }
-            else if ((fs_file->name->shrt_name)
-                && (a_fs->name_cmp(a_fs, fs_file->name->shrt_name,
-                        cur_dir) == 0)) {
-                found_name = 1;
+
+            /* Verify this is indeed a directory.  We had one reported
+             * problem where a file was a disk image and opening it as
+             * a directory found the directory entries inside of the file
+             * and this caused problems... */
+            if (!TSK_FS_IS_DIR_META(fs_dir->fs_file->meta->type)) {
+                tsk_error_reset();
+                tsk_error_set_errno(TSK_ERR_FS_GENFS);
+                tsk_error_set_errstr("Address %" PRIuINUM
+                    " is not for a directory\n", next_meta);
+                free(cpath);
+                return -1;
             }
 
-            /* For NTFS, we have to check the attribute name. */
-            if ((found_name == 1) && (TSK_FS_TYPE_ISNTFS(a_fs->ftype))) {
-                /*  ensure we have the right attribute name */
-                if (cur_attr != NULL) {
-                    found_name = 0;
-                    if (fs_file->meta) {
-                        int cnt, i;
-
-                        // cycle through the attributes
-                        cnt = tsk_fs_file_attr_getsize(fs_file.get());
-                        for (i = 0; i < cnt; i++) {
-                            const TSK_FS_ATTR *fs_attr =
-                                tsk_fs_file_attr_get_idx(fs_file.get(), i);
-                            if (!fs_attr)
-                                continue;
-
-                            if ((fs_attr->name)
-                                && (a_fs->name_cmp(a_fs, fs_attr->name,
-                                        cur_attr) == 0)) {
-                                found_name = 1;
-                                break;
+            // cycle through each entry
+            for (i = 0; i < tsk_fs_dir_getsize(fs_dir.get()); i++) {
+
+                uint8_t found_name = 0;
+
+                std::unique_ptr<TSK_FS_FILE, decltype(&tsk_fs_file_close)> fs_file{
+                    tsk_fs_dir_get(fs_dir.get(), i),
+                    tsk_fs_file_close
+                };
+
+                if (!fs_file) {
+                    free(cpath);
+                    return -1;
+                }
+
+                /*
+                 * Check if this is the name that we are currently looking for,
+                 * as identified in 'cur_dir'
+                 */
+                if ((fs_file->name->name)
+                    && (a_fs->name_cmp(a_fs, fs_file->name->name,
+                            cur_dir) == 0)) {
+                    found_name = 1;
+                }
+                else if ((fs_file->name->shrt_name)
+                    && (a_fs->name_cmp(a_fs, fs_file->name->shrt_name,
+                            cur_dir) == 0)) {
+                    found_name = 1;
+                }
+
+                /* For NTFS, we have to check the attribute name. */
+                if ((found_name == 1) && (TSK_FS_TYPE_ISNTFS(a_fs->ftype))) {
+                    /*  ensure we have the right attribute name */
+                    if (cur_attr != NULL) {
+                        found_name = 0;
+                        if (fs_file->meta) {
+                            int cnt, i;
+
+                            // cycle through the attributes
+                            cnt = tsk_fs_file_attr_getsize(fs_file.get());
+                            for (i = 0; i < cnt; i++) {
+                                const TSK_FS_ATTR *fs_attr =
+                                    tsk_fs_file_attr_get_idx(fs_file.get(), i);
+                                if (!fs_attr)
+                                    continue;
+
+                                if ((fs_attr->name)
+                                    && (a_fs->name_cmp(a_fs, fs_attr->name,
+                                            cur_attr) == 0)) {
+                                    found_name = 1;
+                                    break;
+                                }
                             }
                         }
                     }
                 }
-            }
 
-            if (found_name) {
-                /* If we found our file and it is allocated, then stop. If
-                 * it is unallocated, keep on going to see if we can get
-                 * an allocated hit */
-                if (fs_file->name->flags & TSK_FS_NAME_FLAG_ALLOC) {
-                    fs_file_alloc = std::move(fs_file);
-                    break;
-                }
-                else {
-                    // if we already have an unalloc and its addr is 0, then use the new one
-                    if (fs_file_del
-                        && fs_file_del->name->meta_addr == 0) {
-                        fs_file_del.reset();
+                if (found_name) {
+                    /* If we found our file and it is allocated, then stop. If
+                     * it is unallocated, keep on going to see if we can get
+                     * an allocated hit */
+                    if (fs_file->name->flags & TSK_FS_NAME_FLAG_ALLOC) {
+                        fs_file_alloc = std::move(fs_file);
+                        break;
+                    }
+                    else {
+                        // if we already have an unalloc and its addr is 0, then use the new one
+                        if (fs_file_del
+                            && fs_file_del->name->meta_addr == 0) {
+                            fs_file_del.reset();
+                        }
+                        fs_file_del = std::move(fs_file);
                     }
-                    fs_file_del = std::move(fs_file);
                 }
             }
+
+            if (fs_file_alloc)
+                fs_name_hit = fs_file_alloc->name;
+            else if (fs_file_del)
+                fs_name_hit = fs_file_del->name;
         }
 
         // we found a directory, go into it
-        if (fs_file_alloc || fs_file_del) {
+        if (fs_name_hit) {
 
             const char *pname;
-            TSK_FS_FILE *fs_file_tmp;
-
-            // choose the alloc one first (if they both exist)
-            if (fs_file_alloc)
-                fs_file_tmp = fs_file_alloc.get();
-            else
-                fs_file_tmp = fs_file_del.get();
 
             pname = cur_dir;    // save a copy of the current name pointer
 
@@ -365,11 +390,11 @@ tsk_fs_path2inum(TSK_FS_INFO * a_fs, const char *a_path,
 
             /* That was the last name in the path -- we found the file! */
             if (cur_dir == NULL) {
-                *a_result = fs_file_tmp->name->meta_addr;
+                *a_result = fs_name_hit->meta_addr;
 
                 // make a copy if one was requested
                 if (a_fs_name) {
-                    tsk_fs_name_copy(a_fs_name, fs_file_tmp->name);
+                    tsk_fs_name_copy(a_fs_name, fs_name_hit);
                 }
 
                 free(cpath);
@@ -384,7 +409,7 @@ tsk_fs_path2inum(TSK_FS_INFO * a_fs, const char *a_path,
             }
 
             // update the value for the next directory to open
-            next_meta = fs_file_tmp->name->meta_addr;
+            next_meta = fs_name_hit->meta_addr;
         }
 
         // no hit in directory
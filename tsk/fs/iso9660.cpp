@@ -65,6 +65,7 @@
 #include "tsk_fs_i.h"
 #include "tsk_iso9660.h"
 #include <ctype.h>
+#include <stddef.h>
 
 #include <memory>
 
@@ -2564,6 +2565,31 @@ load_vol_desc(TSK_FS_INFO * fs)
 }
 
 
+/**
+ * \internal
+ * Signature check for file system auto-detection.  load_vol_desc() needs
+ * the magic value of the first volume descriptor, either in a plain image
+ * or in one with raw 2352-byte CD sectors.
+ *
+ * @param a_probe Start of the volume
+ * @returns 0 if the volume cannot be opened as this type and 1 if it may
+ */
+uint8_t
+iso9660_probe(const TSK_FS_PROBE * a_probe)
+{
+    // block pre and post sizes that load_vol_desc() tries
+    static const int prepost[][2] = { {0, 0}, {16, 288}, {24, 280} };
+
+    for (size_t i = 0; i < sizeof(prepost) / sizeof(prepost[0]); i++) {
+        TSK_OFF_T off = ISO9660_SBOFF + prepost[i][0] +
+            (ISO9660_SBOFF / ISO9660_SSIZE_B) * (prepost[i][0] + prepost[i][1]);
+        if (tsk_fs_probe_bytes(a_probe, off + offsetof(iso9660_gvd, magic),
+                ISO9660_MAGIC, 5))
+            return 1;
+    }
+    return 0;
+}
+
 /* iso9660_open -
  * opens an iso9660 filesystem.
  * Design note: This function doesn't read a superblock, since iso9660 doesnt
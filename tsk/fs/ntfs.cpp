@@ -20,8 +20,21 @@
 #include "tsk_ntfs.h"
 
 #include <ctype.h>
+#include <stddef.h>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <new>
+#include <vector>
+
+#ifdef TSK_MULTITHREAD_LIB
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#endif
 
 #include "encryptionHelper.h"
 
@@ -131,6 +144,125 @@ nt2nano(uint64_t ntdate)
 
 
 
+/**
+ * \internal
+ * Check the update sequence values of a raw MFT entry and put back the
+ * bytes that they replaced.
+ *
+ * @param a_ntfs File system that the entry is from
+ * @param a_buf Raw entry (NTFS_INFO.mft_rsize_b bytes)
+ * @returns TSK_OK or TSK_COR if the entry is corrupt
+ */
+static TSK_RETVAL_ENUM
+ntfs_mft_fixup(NTFS_INFO * a_ntfs, char *a_buf)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) & a_ntfs->fs_info;
+    ntfs_mft *mft;
+    ntfs_upd *upd;
+    uint16_t sig_seq;
+    int i;
+
+    /* The MFT entries have error and integrity checks in them
+     * called update sequences.  They must be checked and removed
+     * so that later functions can process the data as normal.
+     * They are located in the last 2 bytes of each 512-bytes of data.
+     *
+     * We first verify that the the 2-byte value is a give value and
+     * then replace it with what should be there
+     */
+    /* sanity check so we don't run over in the next loop */
+    mft = (ntfs_mft *) a_buf;
+    if ((tsk_getu16(fs->endian, mft->upd_cnt) > 0) &&
+        (((uint32_t) (tsk_getu16(fs->endian,
+                        mft->upd_cnt) - 1) * NTFS_UPDATE_SEQ_STRIDE) >
+            a_ntfs->mft_rsize_b)) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_FS_INODE_COR);
+        tsk_error_set_errstr
+            ("mft_fixup: More Update Sequence Entries than MFT size");
+        return TSK_COR;
+    }
+    uint16_t upd_cnt = tsk_getu16(fs->endian, mft->upd_cnt);
+    uint16_t upd_off = tsk_getu16(fs->endian, mft->upd_off);
+
+    // Make sure upd_cnt > 0 to prevent an integer wrap around.
+    // NOTE: There is a bug here because upd_cnt can be for unused entries.
+    // They are now skipped (as of July 2021). We shoudl refactor this code
+    // to allow upd_cnt = 0.
+    if ((upd_cnt == 0) || (upd_cnt > (((a_ntfs->mft_rsize_b) / 2) + 1))) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_FS_INODE_COR);
+        tsk_error_set_errstr
+            ("mft_fixup: Invalid update count value out of bounds");
+        return TSK_COR;
+    }
+    size_t mft_rsize_b = ((size_t) upd_cnt - 1) * 2;
+
+    if ((size_t) upd_off + sizeof(ntfs_upd) > (a_ntfs->mft_rsize_b - mft_rsize_b)) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_FS_INODE_COR);
+        tsk_error_set_errstr
+            ("mft_fixup: Update sequence would read past MFT size");
+        return TSK_COR;
+    }
+
+    /* Apply the update sequence structure template */
+
+    upd = (ntfs_upd *) ((uintptr_t) a_buf + upd_off);
+    /* Get the sequence value that each 16-bit value should be */
+    sig_seq = tsk_getu16(fs->endian, upd->upd_val);
+    /* cycle through each sector */
+    for (i = 1; i < tsk_getu16(fs->endian, mft->upd_cnt); i++) {
+        uint8_t *new_val, *old_val;
+        /* The offset into the buffer of the value to analyze */
+        size_t offset = i * NTFS_UPDATE_SEQ_STRIDE - 2;
+
+        /* Check that there is room in the buffer to read the current sequence value */
+        if (offset + 2 > a_ntfs->mft_rsize_b) {
+            tsk_error_reset();
+            tsk_error_set_errno(TSK_ERR_FS_INODE_COR);
+            tsk_error_set_errstr
+            ("mft_fixup: Ran out of data while parsing update sequence values");
+            return TSK_COR;
+        }
+
+        /* get the current sequence value */
+        uint16_t cur_seq =
+            tsk_getu16(fs->endian, (uintptr_t) a_buf + offset);
+        if (cur_seq != sig_seq) {
+            /* get the replacement value */
+            uint16_t cur_repl =
+                tsk_getu16(fs->endian, &upd->upd_seq + (i - 1) * 2);
+            tsk_error_reset();
+            tsk_error_set_errno(TSK_ERR_FS_GENFS);
+
+            tsk_error_set_errstr
+                ("Incorrect update sequence value in MFT entry\nSignature Value: 0x%"
+                PRIx16 " Actual Value: 0x%" PRIx16
+                " Replacement Value: 0x%" PRIx16
+                "\nThis is typically because of a corrupted entry",
+                sig_seq, cur_seq, cur_repl);
+            return TSK_COR;
+        }
+
+        new_val = &upd->upd_seq + (i - 1) * 2;
+        old_val = (uint8_t *) ((uintptr_t) a_buf + offset);
+        /*
+           if (tsk_verbose)
+           tsk_fprintf(stderr,
+           "ntfs_mft_fixup: upd_seq %i   Replacing: %.4"
+           PRIx16 "   With: %.4" PRIx16 "\n", i,
+           tsk_getu16(fs->endian, old_val), tsk_getu16(fs->endian,
+           new_val));
+         */
+        *old_val++ = *new_val++;
+        *old_val = *new_val;
+    }
+
+    return TSK_OK;
+}
+
+
 /**
  * Read an MFT entry and save it in raw form in the given buffer.
  * NOTE: This will remove the update sequence integrity checks in the
@@ -148,12 +280,8 @@ ntfs_dinode_lookup(NTFS_INFO * a_ntfs, char *a_buf, TSK_INUM_T a_mftnum, TSK_OFF
 {
     TSK_OFF_T mftaddr_b, mftaddr2_b, offset;
     size_t mftaddr_len = 0;
-    int i;
     TSK_FS_INFO *fs = (TSK_FS_INFO *) & a_ntfs->fs_info;
     TSK_FS_ATTR_RUN *data_run;
-    ntfs_upd *upd;
-    uint16_t sig_seq;
-    ntfs_mft *mft;
 
 
     /* sanity checks */
@@ -375,155 +503,118 @@ ntfs_dinode_lookup(NTFS_INFO * a_ntfs, char *a_buf, TSK_INUM_T a_mftnum, TSK_OFF
         return 1;
     }
 #endif
-    /* The MFT entries have error and integrity checks in them
-     * called update sequences.  They must be checked and removed
-     * so that later functions can process the data as normal.
-     * They are located in the last 2 bytes of each 512-bytes of data.
-     *
-     * We first verify that the the 2-byte value is a give value and
-     * then replace it with what should be there
-     */
-    /* sanity check so we don't run over in the next loop */
-    mft = (ntfs_mft *) a_buf;
-    if ((tsk_getu16(fs->endian, mft->upd_cnt) > 0) &&
-        (((uint32_t) (tsk_getu16(fs->endian,
-                        mft->upd_cnt) - 1) * NTFS_UPDATE_SEQ_STRIDE) >
-            a_ntfs->mft_rsize_b)) {
-        tsk_error_reset();
-        tsk_error_set_errno(TSK_ERR_FS_INODE_COR);
-        tsk_error_set_errstr
-            ("dinode_lookup: More Update Sequence Entries than MFT size");
-        return TSK_COR;
-    }
-    uint16_t upd_cnt = tsk_getu16(fs->endian, mft->upd_cnt);
-    uint16_t upd_off = tsk_getu16(fs->endian, mft->upd_off);
-
-    // Make sure upd_cnt > 0 to prevent an integer wrap around.
-    // NOTE: There is a bug here because upd_cnt can be for unused entries.
-    // They are now skipped (as of July 2021). We shoudl refactor this code
-    // to allow upd_cnt = 0.
-    if ((upd_cnt == 0) || (upd_cnt > (((a_ntfs->mft_rsize_b) / 2) + 1))) {
-        tsk_error_reset();
-        tsk_error_set_errno(TSK_ERR_FS_INODE_COR);
-        tsk_error_set_errstr
-            ("dinode_lookup: Invalid update count value out of bounds");
-        return TSK_COR;
-    }
-    size_t mft_rsize_b = ((size_t) upd_cnt - 1) * 2;
-
-    if ((size_t) upd_off + sizeof(ntfs_upd) > (a_ntfs->mft_rsize_b - mft_rsize_b)) {
-        tsk_error_reset();
-        tsk_error_set_errno(TSK_ERR_FS_INODE_COR);
-        tsk_error_set_errstr
-            ("dinode_lookup: Update sequence would read past MFT size");
-        return TSK_COR;
-    }
-
-    /* Apply the update sequence structure template */
+    return ntfs_mft_fixup(a_ntfs, a_buf);
+}
 
-    upd = (ntfs_upd *) ((uintptr_t) a_buf + upd_off);
-    /* Get the sequence value that each 16-bit value should be */
-    sig_seq = tsk_getu16(fs->endian, upd->upd_val);
-    /* cycle through each sector */
-    for (i = 1; i < tsk_getu16(fs->endian, mft->upd_cnt); i++) {
-        uint8_t *new_val, *old_val;
-        /* The offset into the buffer of the value to analyze */
-        size_t offset = i * NTFS_UPDATE_SEQ_STRIDE - 2;
 
-        /* Check that there is room in the buffer to read the current sequence value */
-        if (offset + 2 > a_ntfs->mft_rsize_b) {
-            tsk_error_reset();
-            tsk_error_set_errno(TSK_ERR_FS_INODE_COR);
-            tsk_error_set_errstr
-            ("dinode_lookup: Ran out of data while parsing update sequence values");
-            return TSK_COR;
-        }
 
-        /* get the current sequence value */
-        uint16_t cur_seq =
-            tsk_getu16(fs->endian, (uintptr_t) a_buf + offset);
-        if (cur_seq != sig_seq) {
-            /* get the replacement value */
-            uint16_t cur_repl =
-                tsk_getu16(fs->endian, &upd->upd_seq + (i - 1) * 2);
-            tsk_error_reset();
-            tsk_error_set_errno(TSK_ERR_FS_GENFS);
+/* Bytes of $Bitmap in each page of the cluster bitmap cache */
+#define NTFS_BMAP_PAGE_SIZE (64 * 1024)
+#define NTFS_BMAP_PAGE_BITS ((TSK_DADDR_T) NTFS_BMAP_PAGE_SIZE * 8)
 
-            tsk_error_set_errstr
-                ("Incorrect update sequence value in MFT entry\nSignature Value: 0x%"
-                PRIx16 " Actual Value: 0x%" PRIx16
-                " Replacement Value: 0x%" PRIx16
-                "\nThis is typically because of a corrupted entry",
-                sig_seq, cur_seq, cur_repl);
-            return TSK_COR;
-        }
+/** \internal
+ * Cache of the cluster bitmap ($Bitmap).  Pages of NTFS_BMAP_PAGE_SIZE bytes
+ * are read the first time that one of their clusters is looked up and are
+ * never changed after that, so lookups only take ntfs->lock to load a page.
+ */
+typedef struct {
+    TSK_DADDR_T nbits;          ///< Number of clusters covered by the bitmap
+    size_t npages;
+    std::atomic<uint8_t *> *pages;      ///< NULL until the page has been read
+} NTFS_BMAP_CACHE;
 
-        new_val = &upd->upd_seq + (i - 1) * 2;
-        old_val = (uint8_t *) ((uintptr_t) a_buf + offset);
-        /*
-           if (tsk_verbose)
-           tsk_fprintf(stderr,
-           "ntfs_dinode_lookup: upd_seq %i   Replacing: %.4"
-           PRIx16 "   With: %.4" PRIx16 "\n", i,
-           tsk_getu16(fs->endian, old_val), tsk_getu16(fs->endian,
-           new_val));
-         */
-        *old_val++ = *new_val++;
-        *old_val = *new_val;
+/* Index of the lowest set bit; w must not be 0. */
+static int
+ntfs_ctz64(uint64_t w)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(w);
+#else
+    int n = 0;
+    while ((w & 1) == 0) {
+        w >>= 1;
+        n++;
     }
-
-    return TSK_OK;
+    return n;
+#endif
 }
 
+static void
+ntfs_bmap_cache_free(NTFS_INFO * ntfs)
+{
+    NTFS_BMAP_CACHE *cache = (NTFS_BMAP_CACHE *) ntfs->bmap_cache;
 
+    if (cache == NULL)
+        return;
+    for (size_t i = 0; i < cache->npages; i++)
+        free(cache->pages[i].load());
+    delete[] cache->pages;
+    free(cache);
+    ntfs->bmap_cache = NULL;
+}
 
 /*
- * given a cluster, return the allocation status or
- * -1 if an error occurs
+ * Set up the (empty) bitmap cache for the runs in ntfs->bmap.
+ *
+ * return 1 on error and 0 on success
  */
-static int
-is_clustalloc(NTFS_INFO * ntfs, TSK_DADDR_T addr)
+static uint8_t
+ntfs_bmap_cache_init(NTFS_INFO * ntfs)
 {
-    int bits_p_clust, b;
-    TSK_DADDR_T base;
-    int8_t ret;
-    bits_p_clust = 8 * ntfs->fs_info.block_size;
+    TSK_FS_INFO *fs = &ntfs->fs_info;
+    NTFS_BMAP_CACHE *cache;
+    TSK_DADDR_T nclust = 0;
 
-    /* While we are loading the MFT, assume that everything
-     * is allocated.  This should only be needed when we are
-     * dealing with an attribute list ...
-     */
-    if (ntfs->loading_the_MFT == 1) {
+    for (TSK_FS_ATTR_RUN * run = ntfs->bmap; run; run = run->next)
+        nclust += run->len;
+
+    if ((cache = (NTFS_BMAP_CACHE *) tsk_malloc(sizeof(NTFS_BMAP_CACHE)))
+        == NULL)
         return 1;
-    }
-    else if (ntfs->bmap == NULL) {
+    /* clusters past the end of $Bitmap are reported as errors */
+    cache->nbits = fs->last_block + 1;
+    if (nclust < (cache->nbits + fs->block_size * 8 - 1)
+        / (fs->block_size * 8))
+        cache->nbits = nclust * fs->block_size * 8;
+    cache->npages = (size_t) ((cache->nbits + NTFS_BMAP_PAGE_BITS - 1)
+        / NTFS_BMAP_PAGE_BITS);
+    cache->pages = new(std::nothrow) std::atomic<uint8_t *>[cache->npages];
+    if (cache->pages == NULL) {
+        free(cache);
         tsk_error_reset();
-        tsk_error_set_errno(TSK_ERR_FS_ARG);
-
-        tsk_error_set_errstr("is_clustalloc: Bitmap pointer is null: %"
-            PRIuDADDR "\n", addr);
-        return -1;
+        tsk_error_set_errno(TSK_ERR_AUX_MALLOC);
+        tsk_error_set_errstr("ntfs_bmap_cache_init: out of memory");
+        return 1;
     }
+    for (size_t i = 0; i < cache->npages; i++)
+        cache->pages[i].store(NULL);
 
-    /* Is the cluster too big? */
-    if (addr > ntfs->fs_info.last_block) {
-        tsk_error_reset();
-        tsk_error_set_errno(TSK_ERR_FS_INODE_COR);
-        tsk_error_set_errstr("is_clustalloc: cluster too large");
-        return -1;
-    }
+    ntfs->bmap_cache = cache;
+    return 0;
+}
 
-    /* identify the base cluster in the bitmap file */
-    base = addr / bits_p_clust;
-    b = (int) (addr % bits_p_clust);
+/*
+ * Read a page of $Bitmap into buf, following the runs in ntfs->bmap.
+ *
+ * return 1 on error and 0 on success
+ */
+static uint8_t
+ntfs_bmap_read_page(NTFS_INFO * ntfs, size_t a_page, uint8_t * buf)
+{
+    NTFS_BMAP_CACHE *cache = (NTFS_BMAP_CACHE *) ntfs->bmap_cache;
+    TSK_FS_INFO *fs = &ntfs->fs_info;
+    TSK_OFF_T off = (TSK_OFF_T) a_page * NTFS_BMAP_PAGE_SIZE;
+    TSK_OFF_T end = (TSK_OFF_T) ((cache->nbits + 7) / 8);
 
-    tsk_take_lock(&ntfs->lock);
+    if (end > off + NTFS_BMAP_PAGE_SIZE)
+        end = off + NTFS_BMAP_PAGE_SIZE;
 
-    /* is this the same as in the cached buffer? */
-    if (base != ntfs->bmap_buf_off) {
-        TSK_DADDR_T c = base;
-        TSK_FS_ATTR_RUN *run;
+    while (off < end) {
+        TSK_DADDR_T c = (TSK_DADDR_T) off / fs->block_size;
+        TSK_DADDR_T in_run = 0;
         TSK_DADDR_T fsaddr = 0;
+        TSK_FS_ATTR_RUN *run;
+        size_t len;
         ssize_t cnt;
 
         /* get the file system address of the bitmap cluster */
@@ -533,34 +624,41 @@ is_clustalloc(NTFS_INFO * ntfs, TSK_DADDR_T addr)
             }
             else {
                 fsaddr = run->addr + c;
+                in_run = run->len - c;
                 break;
             }
         }
 
         if (fsaddr == 0) {
-            tsk_release_lock(&ntfs->lock);
             tsk_error_reset();
             tsk_error_set_errno(TSK_ERR_FS_BLK_NUM);
             tsk_error_set_errstr
                 ("is_clustalloc: cluster not found in bitmap: %" PRIuDADDR
                 "", c);
-            return -1;
+            return 1;
         }
-        if (fsaddr > ntfs->fs_info.last_block) {
-            tsk_release_lock(&ntfs->lock);
+
+        len = (size_t) (end - off);
+        if ((TSK_OFF_T) len > (TSK_OFF_T) (in_run * fs->block_size
+                - (TSK_DADDR_T) off % fs->block_size))
+            len = (size_t) (in_run * fs->block_size
+                - (TSK_DADDR_T) off % fs->block_size);
+
+        if (fsaddr + ((TSK_DADDR_T) off % fs->block_size + len - 1)
+            / fs->block_size > fs->last_block) {
             tsk_error_reset();
             tsk_error_set_errno(TSK_ERR_FS_BLK_NUM);
             tsk_error_set_errstr
                 ("is_clustalloc: Cluster in bitmap too large for image: %"
                 PRIuDADDR, fsaddr);
-            return -1;
+            return 1;
         }
-        ntfs->bmap_buf_off = base;
-        cnt = tsk_fs_read_block
-            (&ntfs->fs_info, fsaddr, ntfs->bmap_buf,
-            ntfs->fs_info.block_size);
-        if (cnt != ntfs->fs_info.block_size) {
-            tsk_release_lock(&ntfs->lock);
+
+        cnt = tsk_fs_read(fs, (TSK_OFF_T) fsaddr * fs->block_size
+            + off % fs->block_size,
+            (char *) &buf[off - (TSK_OFF_T) a_page * NTFS_BMAP_PAGE_SIZE],
+            len);
+        if (cnt != (ssize_t) len) {
             if (cnt >= 0) {
                 tsk_error_reset();
                 tsk_error_set_errno(TSK_ERR_FS_READ);
@@ -568,15 +666,145 @@ is_clustalloc(NTFS_INFO * ntfs, TSK_DADDR_T addr)
             tsk_error_set_errstr2
                 ("is_clustalloc: Error reading bitmap at %" PRIuDADDR,
                 fsaddr);
-            return -1;
+            return 1;
         }
+        off += len;
     }
+    return 0;
+}
 
-    /* identify if the cluster is allocated or not */
-    ret = (isset(ntfs->bmap_buf, b)) ? 1 : 0;
+/*
+ * Get a page of the cluster bitmap, reading it if this is the first
+ * time that it is used.
+ *
+ * return NULL on error
+ */
+static const uint8_t *
+ntfs_bmap_page(NTFS_INFO * ntfs, size_t a_page)
+{
+    NTFS_BMAP_CACHE *cache = (NTFS_BMAP_CACHE *) ntfs->bmap_cache;
+    uint8_t *page = cache->pages[a_page].load(std::memory_order_acquire);
 
+    if (page != NULL)
+        return page;
+
+    tsk_take_lock(&ntfs->lock);
+    page = cache->pages[a_page].load(std::memory_order_relaxed);
+    if (page == NULL) {
+        // a whole page, so that the word scans never run off the end
+        if ((page = (uint8_t *) tsk_malloc(NTFS_BMAP_PAGE_SIZE)) != NULL) {
+            if (ntfs_bmap_read_page(ntfs, a_page, page)) {
+                free(page);
+                page = NULL;
+            }
+            else {
+                cache->pages[a_page].store(page, std::memory_order_release);
+            }
+        }
+    }
     tsk_release_lock(&ntfs->lock);
-    return ret;
+    return page;
+}
+
+/*
+ * given a cluster, return the allocation status or
+ * -1 if an error occurs
+ */
+static int
+is_clustalloc(NTFS_INFO * ntfs, TSK_DADDR_T addr)
+{
+    NTFS_BMAP_CACHE *cache;
+    const uint8_t *page;
+
+    /* While we are loading the MFT, assume that everything
+     * is allocated.  This should only be needed when we are
+     * dealing with an attribute list ...
+     */
+    if (ntfs->loading_the_MFT == 1) {
+        return 1;
+    }
+    else if (ntfs->bmap_cache == NULL) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_FS_ARG);
+
+        tsk_error_set_errstr("is_clustalloc: Bitmap pointer is null: %"
+            PRIuDADDR "\n", addr);
+        return -1;
+    }
+
+    /* Is the cluster too big? */
+    if (addr > ntfs->fs_info.last_block) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_FS_INODE_COR);
+        tsk_error_set_errstr("is_clustalloc: cluster too large");
+        return -1;
+    }
+
+    cache = (NTFS_BMAP_CACHE *) ntfs->bmap_cache;
+    if (addr >= cache->nbits) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_FS_BLK_NUM);
+        tsk_error_set_errstr
+            ("is_clustalloc: cluster not found in bitmap: %" PRIuDADDR
+            "", addr);
+        return -1;
+    }
+
+    if ((page = ntfs_bmap_page(ntfs,
+                (size_t) (addr / NTFS_BMAP_PAGE_BITS))) == NULL)
+        return -1;
+
+    /* identify if the cluster is allocated or not */
+    return (isset(page, addr % NTFS_BMAP_PAGE_BITS)) ? 1 : 0;
+}
+
+/*
+ * Find the end of the run of clusters starting at addr that all have the
+ * same allocation status as addr (which is a_alloc, from is_clustalloc()).
+ * The bitmap is scanned a 64-bit word at a time.
+ *
+ * @param a_last Last cluster to scan
+ * @param a_end Set to the last cluster of the run (at most a_last)
+ * return 1 on error and 0 on success
+ */
+static uint8_t
+ntfs_bmap_run_end(NTFS_INFO * ntfs, TSK_DADDR_T addr, TSK_DADDR_T a_last,
+    int a_alloc, TSK_DADDR_T * a_end)
+{
+    NTFS_BMAP_CACHE *cache = (NTFS_BMAP_CACHE *) ntfs->bmap_cache;
+
+    if (a_last >= cache->nbits)
+        a_last = cache->nbits - 1;
+
+    while (addr <= a_last) {
+        size_t pg = (size_t) (addr / NTFS_BMAP_PAGE_BITS);
+        TSK_DADDR_T base = (TSK_DADDR_T) pg * NTFS_BMAP_PAGE_BITS;
+        const uint8_t *page;
+        size_t bit;
+
+        if ((page = ntfs_bmap_page(ntfs, pg)) == NULL)
+            return 1;
+
+        for (bit = (size_t) (addr - base); bit < NTFS_BMAP_PAGE_BITS;
+            bit = (bit / 64 + 1) * 64) {
+            uint64_t w = tsk_getu64(TSK_LIT_ENDIAN, &page[bit / 64 * 8]);
+
+            // look for the first bit that differs from a_alloc
+            if (a_alloc)
+                w = ~w;
+            w &= ~(uint64_t) 0 << (bit % 64);
+            if (w) {
+                TSK_DADDR_T next = base + bit / 64 * 64 + ntfs_ctz64(w);
+                *a_end = (next - 1 < a_last) ? next - 1 : a_last;
+                return 0;
+            }
+            if (base + (bit / 64 + 1) * 64 > a_last)
+                break;
+        }
+        addr = base + NTFS_BMAP_PAGE_BITS;
+    }
+    *a_end = a_last;
+    return 0;
 }
 
 
@@ -923,6 +1151,34 @@ ntfs_uncompress_done(NTFS_COMP_INFO * comp)
 }
 
 
+/**
+ * Copy a phrase token's back-reference: a_len bytes that start a_offset
+ * bytes before a_idx in a_buf.  When the ranges overlap, the copy repeats
+ * the a_offset bytes before a_idx, so it is done in pieces that do not
+ * overlap, each one twice as long as the one before.
+ */
+static void
+ntfs_uncompress_copy(char *a_buf, size_t a_idx, size_t a_offset,
+    size_t a_len)
+{
+    char *dst = a_buf + a_idx;
+    const char *src = dst - a_offset;
+    size_t done = 0;
+
+    if (a_offset == 1) {
+        memset(dst, *src, a_len);
+        return;
+    }
+    while (done < a_len) {
+        // src[0 .. a_offset + done) is in place and repeats every a_offset bytes
+        size_t piece = a_offset + done;
+        if (piece > a_len - done)
+            piece = a_len - done;
+        memcpy(dst + done, src, piece);
+        done += piece;
+    }
+}
+
  /**
   * Uncompress the block of data in comp->comp_buf.
   * Store the result in the comp->uncomp_buf.
@@ -1125,15 +1381,12 @@ ntfs_uncompress_compunit(NTFS_COMP_INFO * comp)
                             return 1;
                         }
 
-                        for (;
-                            start_position_index <= end_position_index
-                            && comp->uncomp_idx < comp->buf_size_b;
-                            start_position_index++) {
-
-                            // Copy the previous data to the current position
-                            comp->uncomp_buf[comp->uncomp_idx++]
-                                = comp->uncomp_buf[start_position_index];
-                        }
+                        // Copy the previous data to the current position
+                        ntfs_uncompress_copy(comp->uncomp_buf,
+                            comp->uncomp_idx, offset,
+                            end_position_index - start_position_index + 1);
+                        comp->uncomp_idx +=
+                            end_position_index - start_position_index + 1;
                     }
                     header >>= 1;
                 }               // end of loop inside of token group
@@ -1290,6 +1543,525 @@ ntfs_proc_compunit(NTFS_INFO * ntfs, NTFS_COMP_INFO * comp,
     return 0;
 }
 
+/* Compression units that a reader keeps in flight for each worker thread */
+#define NTFS_COMP_AHEAD_PER_THREAD 2
+
+/** \internal
+ * Steps through the compression units of a compressed attribute.
+ */
+typedef struct {
+    const TSK_FS_ATTR *fs_attr;
+    const TSK_FS_ATTR_RUN *run; ///< Run of the next cluster (NULL at the end)
+    TSK_DADDR_T run_idx;        ///< Index of the next cluster in run
+    TSK_OFF_T off;              ///< File offset of the next cluster
+    uint8_t walk;               ///< 1 to skip FILLER runs and check addresses (for ntfs_attr_walk_special())
+} NTFS_COMP_ITER;
+
+/** \internal
+ * A compression unit and its uncompressed data.
+ */
+typedef struct {
+    TSK_DADDR_T *addrs;         ///< Cluster addresses (0 for sparse clusters)
+    uint32_t cnt;               ///< Number of addresses (less than compsize only at the end)
+    TSK_OFF_T off;              ///< File offset of the unit
+    NTFS_COMP_INFO comp;        ///< Uncompressed data
+    uint8_t queued;             ///< 1 if a worker thread processes the unit
+    uint8_t done;               ///< 1 once comp has the data (guarded by the pool lock)
+    uint8_t failed;             ///< 1 if the unit could not be found or read; error has the details
+    TSK_ERROR_INFO error;
+} NTFS_COMP_UNIT;
+
+/** \internal
+ * Reads the compression units of an attribute in order.  With worker
+ * threads, the units after the one being returned are read and
+ * decompressed ahead of time.
+ */
+typedef struct {
+    NTFS_INFO *ntfs;
+    NTFS_COMP_ITER iter;
+    TSK_OFF_T initsize;         ///< Units are zero after this offset
+    TSK_OFF_T ahead_end;        ///< Units that start at or after this are not read ahead
+    NTFS_COMP_UNIT *units;      ///< Ring of units in flight
+    size_t nunits;
+    size_t head;                ///< Oldest unit in flight
+    size_t count;               ///< Number of units in flight
+    uint8_t iter_done;          ///< 1 once the iterator ended or failed
+    uint8_t returned;           ///< 1 if the unit at head was returned to the caller
+    void *pool;                 ///< ntfs->comp_pool or NULL
+} NTFS_COMP_READER;
+
+static void
+ntfs_comp_iter_init(NTFS_COMP_ITER * a_iter, const TSK_FS_ATTR * a_fs_attr,
+    TSK_DADDR_T a_start_vcn, uint8_t a_walk)
+{
+    const TSK_FS_ATTR_RUN *run;
+
+    // find the run with the starting cluster
+    for (run = a_fs_attr->nrd.run; run; run = run->next) {
+        if (run->offset + run->len >= a_start_vcn)
+            break;
+    }
+    a_iter->fs_attr = a_fs_attr;
+    a_iter->run = run;
+    a_iter->run_idx = 0;
+    if ((run) && (run->offset < a_start_vcn))
+        a_iter->run_idx = a_start_vcn - run->offset;
+    a_iter->off =
+        (TSK_OFF_T) a_start_vcn * a_fs_attr->fs_file->fs_info->block_size;
+    a_iter->walk = a_walk;
+}
+
+/**
+ * Get the cluster addresses of the next compression unit.
+ *
+ * @param a_iter Iterator
+ * @param a_unit Unit to fill in (addrs, cnt and off)
+ * @returns 1 if a unit was found, 0 at the end of the runs and -1 on error
+ */
+static int
+ntfs_comp_iter_next(NTFS_COMP_ITER * a_iter, NTFS_COMP_UNIT * a_unit)
+{
+    const TSK_FS_ATTR *fs_attr = a_iter->fs_attr;
+    TSK_FS_INFO *fs = fs_attr->fs_file->fs_info;
+
+    a_unit->cnt = 0;
+    a_unit->off = a_iter->off;
+    while (a_iter->run) {
+        const TSK_FS_ATTR_RUN *run = a_iter->run;
+        TSK_DADDR_T addr;
+
+        if (a_iter->run_idx >= run->len) {
+            a_iter->run = run->next;
+            a_iter->run_idx = 0;
+            continue;
+        }
+
+        /* We may get a FILLER entry at the beginning of the run
+         * if we are processing a non-base file record since
+         * this $DATA attribute could not be the first sequence in the
+         * attribute. Therefore, do not error if it starts at 0 */
+        if ((a_iter->walk) && (run->flags & TSK_FS_ATTR_RUN_FLAG_FILLER)) {
+            if (run->addr != 0) {
+                tsk_error_reset();
+
+                if (fs_attr->fs_file->meta->flags & TSK_FS_META_FLAG_UNALLOC)
+                    tsk_error_set_errno(TSK_ERR_FS_RECOVER);
+                else
+                    tsk_error_set_errno(TSK_ERR_FS_GENFS);
+                tsk_error_set_errstr
+                    ("ntfs_attr_walk_special: Filler Entry exists in fs_attr_run %"
+                    PRIuDADDR "@%" PRIuDADDR " - type: %" PRIu32
+                    "  id: %d Meta: %" PRIuINUM " Status: %s",
+                    run->len, run->addr, fs_attr->type,
+                    fs_attr->id, fs_attr->fs_file->meta->addr,
+                    (fs_attr->fs_file->meta->
+                        flags & TSK_FS_META_FLAG_ALLOC) ? "Allocated" :
+                    "Deleted");
+                return -1;
+            }
+            if ((run->len > LLONG_MAX)
+                || (LLONG_MAX / run->len < fs->block_size)) {
+                if (fs_attr->fs_file->meta->flags & TSK_FS_META_FLAG_UNALLOC)
+                    tsk_error_set_errno(TSK_ERR_FS_RECOVER);
+                else
+                    tsk_error_set_errno(TSK_ERR_FS_GENFS);
+                tsk_error_set_errstr
+                    ("ntfs_attr_walk_special: Attribute run length is too large %"
+                    PRIuDADDR "@%" PRIuDADDR " - type: %" PRIu32
+                    "  id: %d Meta: %" PRIuINUM " Status: %s",
+                    run->len, run->addr, fs_attr->type,
+                    fs_attr->id, fs_attr->fs_file->meta->addr,
+                    (fs_attr->fs_file->meta->
+                        flags & TSK_FS_META_FLAG_ALLOC) ? "Allocated" :
+                    "Deleted");
+                return -1;
+            }
+            a_iter->off += (run->len * fs->block_size);
+            a_iter->run = run->next;
+            a_iter->run_idx = 0;
+            continue;
+        }
+
+        /* If it is a sparse run, don't increment the addr so that
+         * it remains 0 */
+        addr = run->addr;
+        if (((run->flags & TSK_FS_ATTR_RUN_FLAG_SPARSE) == 0)
+            && ((run->flags & TSK_FS_ATTR_RUN_FLAG_FILLER) == 0))
+            addr += a_iter->run_idx;
+
+        if ((a_iter->walk) && (addr > fs->last_block)) {
+            tsk_error_reset();
+
+            if (fs_attr->fs_file->meta->flags & TSK_FS_META_FLAG_UNALLOC)
+                tsk_error_set_errno(TSK_ERR_FS_RECOVER);
+            else
+                tsk_error_set_errno(TSK_ERR_FS_BLK_NUM);
+            tsk_error_set_errstr
+                ("ntfs_attr_walk_special: Invalid address in run (too large): %"
+                PRIuDADDR " Meta: %" PRIuINUM " Status: %s", addr,
+                fs_attr->fs_file->meta->addr,
+                (fs_attr->fs_file->meta->
+                    flags & TSK_FS_META_FLAG_ALLOC) ? "Allocated" :
+                "Deleted");
+            return -1;
+        }
+
+        // queue up the addresses until we get a full unit
+        if (a_unit->cnt == 0)
+            a_unit->off = a_iter->off;
+        a_unit->addrs[a_unit->cnt++] = addr;
+        a_iter->off += fs->block_size;
+        a_iter->run_idx++;
+
+        // the unit is full or this is the last block
+        if ((a_unit->cnt == fs_attr->nrd.compsize)
+            || ((a_iter->run_idx == run->len) && (run->next == NULL)))
+            return 1;
+    }
+    return (a_unit->cnt > 0) ? 1 : 0;
+}
+
+/**
+ * Read and decompress a unit whose addresses were found by
+ * ntfs_comp_iter_next().  Data after the initialized size reads as 0s.
+ *
+ * @returns 1 on error and 0 on success
+ */
+static uint8_t
+ntfs_comp_unit_proc(NTFS_INFO * ntfs, const TSK_FS_ATTR * a_fs_attr,
+    TSK_OFF_T a_initsize, NTFS_COMP_UNIT * a_unit)
+{
+    NTFS_COMP_INFO *comp = &a_unit->comp;
+
+    // set the buffers to 0s if we are past initsize
+    if (a_unit->off >= a_initsize) {
+        ntfs_uncompress_reset(comp);
+        comp->uncomp_idx = comp->buf_size_b;
+        return 0;
+    }
+
+    if (tsk_verbose)
+        tsk_fprintf(stderr,
+            "ntfs_proc_compunit: Decompressing at file offset %" PRIdOFF
+            "\n", a_unit->off);
+
+    if (ntfs_proc_compunit(ntfs, comp, a_unit->addrs, a_unit->cnt)) {
+        tsk_error_set_errstr2("%" PRIuINUM " - type: %"
+            PRIu32 "  id: %d Status: %s",
+            a_fs_attr->fs_file->meta->addr, a_fs_attr->type,
+            a_fs_attr->id,
+            (a_fs_attr->fs_file->meta->
+                flags & TSK_FS_META_FLAG_ALLOC) ? "Allocated" : "Deleted");
+        return 1;
+    }
+
+    /* if we've passed the initialized size while reading this block,
+     * zero out the buffer beyond the initialized size. */
+    if (a_initsize - a_unit->off < (TSK_OFF_T) comp->buf_size_b) {
+        size_t init_len = (size_t) (a_initsize - a_unit->off);
+        memset(&comp->uncomp_buf[init_len], 0,
+            comp->buf_size_b - init_len);
+    }
+    return 0;
+}
+
+#ifdef TSK_MULTITHREAD_LIB
+
+/** \internal
+ * Worker threads that read and decompress compression units for the
+ * NTFS_COMP_READERs of a file system.
+ */
+class NtfsCompPool {
+  public:
+    NtfsCompPool(NTFS_INFO * a_ntfs, unsigned int a_numThreads)
+        : m_ntfs(a_ntfs), m_quit(false) {
+        try {
+            m_threads.reserve(a_numThreads);
+            for (unsigned int i = 0; i < a_numThreads; i++)
+                m_threads.emplace_back(&NtfsCompPool::work, this);
+        }
+        catch (const std::system_error &) {
+            // run with the threads that started
+        }
+        catch (const std::bad_alloc &) {
+        }
+    }
+
+    ~NtfsCompPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_quit = true;
+        }
+        m_todoCv.notify_all();
+        for (std::thread &t : m_threads)
+            t.join();
+    }
+
+    size_t numWorkers() const { return m_threads.size(); }
+
+    void add(const TSK_FS_ATTR * a_fs_attr, TSK_OFF_T a_initsize,
+        NTFS_COMP_UNIT * a_unit) {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            a_unit->queued = 1;
+            a_unit->done = 0;
+            m_todo.push_back({ a_fs_attr, a_initsize, a_unit });
+        }
+        m_todoCv.notify_one();
+    }
+
+    /** Wait for a worker to finish a unit given to add(). */
+    void wait(NTFS_COMP_UNIT * a_unit) {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_doneCv.wait(lock, [a_unit] { return a_unit->done != 0; });
+    }
+
+  private:
+    struct Job {
+        const TSK_FS_ATTR *fs_attr;
+        TSK_OFF_T initsize;
+        NTFS_COMP_UNIT *unit;
+    };
+
+    void work() {
+        std::unique_lock<std::mutex> lock(m_lock);
+        while (true) {
+            m_todoCv.wait(lock, [this] { return m_quit || !m_todo.empty(); });
+            if (m_quit)
+                return;
+            Job job = m_todo.front();
+            m_todo.pop_front();
+
+            lock.unlock();
+            // errors are per thread, so keep this one for the reader
+            job.unit->failed = ntfs_comp_unit_proc(m_ntfs, job.fs_attr,
+                job.initsize, job.unit);
+            if (job.unit->failed)
+                job.unit->error = *tsk_error_get_info();
+            tsk_error_reset();
+            lock.lock();
+
+            job.unit->done = 1;
+            m_doneCv.notify_all();
+        }
+    }
+
+    NTFS_INFO *m_ntfs;
+    std::mutex m_lock;
+    std::condition_variable m_todoCv;   ///< Signaled when m_todo grows or m_quit is set
+    std::condition_variable m_doneCv;   ///< Signaled when a unit is done
+    std::deque<Job> m_todo;
+    bool m_quit;
+    std::vector<std::thread> m_threads;
+};
+
+/**
+ * Get the worker threads of a file system, starting them if this is the
+ * first time that they are needed.
+ *
+ * @returns NULL if decompression is to be done on the calling thread
+ */
+static NtfsCompPool *
+ntfs_comp_pool(NTFS_INFO * ntfs)
+{
+    NtfsCompPool *pool;
+
+    if (ntfs->fs_info.decomp_threads <= 1)
+        return NULL;
+
+    tsk_take_lock(&ntfs->lock);
+    if (ntfs->comp_pool == NULL) {
+        ntfs->comp_pool = new(std::nothrow) NtfsCompPool(ntfs,
+            ntfs->fs_info.decomp_threads);
+    }
+    pool = (NtfsCompPool *) ntfs->comp_pool;
+    tsk_release_lock(&ntfs->lock);
+
+    if ((pool == NULL) || (pool->numWorkers() == 0))
+        return NULL;
+    return pool;
+}
+
+#endif
+
+static void
+ntfs_comp_reader_free(NTFS_COMP_READER * a_reader)
+{
+    if (a_reader->units == NULL)
+        return;
+
+#ifdef TSK_MULTITHREAD_LIB
+    // the workers may still be using the units
+    for (size_t i = 0; i < a_reader->count; i++) {
+        NTFS_COMP_UNIT *unit =
+            &a_reader->units[(a_reader->head + i) % a_reader->nunits];
+        if (unit->queued)
+            ((NtfsCompPool *) a_reader->pool)->wait(unit);
+    }
+#endif
+
+    for (size_t i = 0; i < a_reader->nunits; i++) {
+        ntfs_uncompress_done(&a_reader->units[i].comp);
+        free(a_reader->units[i].addrs);
+    }
+    free(a_reader->units);
+    a_reader->units = NULL;
+}
+
+/**
+ * Set up a reader for the compression units of an attribute.
+ *
+ * @param a_reader Reader to set up (free with ntfs_comp_reader_free())
+ * @param ntfs File system
+ * @param a_fs_attr Compressed attribute
+ * @param a_start_vcn First cluster of the first unit to read
+ * @param a_ahead_end Offset in the file after which units are not read
+ * ahead of time (they are still returned)
+ * @param a_walk 1 for ntfs_attr_walk_special() (see NTFS_COMP_ITER)
+ * @returns 1 on error and 0 on success
+ */
+static uint8_t
+ntfs_comp_reader_init(NTFS_COMP_READER * a_reader, NTFS_INFO * ntfs,
+    const TSK_FS_ATTR * a_fs_attr, TSK_DADDR_T a_start_vcn,
+    TSK_OFF_T a_ahead_end, uint8_t a_walk)
+{
+    TSK_FS_INFO *fs = &ntfs->fs_info;
+
+    memset(a_reader, 0, sizeof(NTFS_COMP_READER));
+    a_reader->ntfs = ntfs;
+    ntfs_comp_iter_init(&a_reader->iter, a_fs_attr, a_start_vcn, a_walk);
+    a_reader->ahead_end = a_ahead_end;
+    if (a_fs_attr->nrd.initsize != a_fs_attr->fs_file->meta->size)
+        a_reader->initsize = a_fs_attr->nrd.initsize;
+    else
+        a_reader->initsize = LLONG_MAX;
+
+    a_reader->nunits = 1;
+#ifdef TSK_MULTITHREAD_LIB
+    // no more units than [a_start_vcn, a_ahead_end) covers, and none of
+    // the worker threads for a single unit
+    TSK_OFF_T unit_size = (TSK_OFF_T) a_fs_attr->nrd.compsize * fs->block_size;
+    TSK_OFF_T start = (TSK_OFF_T) a_start_vcn * fs->block_size;
+    TSK_OFF_T nunits = 1;
+    if ((unit_size > 0) && (a_ahead_end > start))
+        nunits = (a_ahead_end - start + unit_size - 1) / unit_size;
+
+    NtfsCompPool *pool = (nunits > 1) ? ntfs_comp_pool(ntfs) : NULL;
+    if (pool) {
+        a_reader->pool = pool;
+        a_reader->nunits = pool->numWorkers() * NTFS_COMP_AHEAD_PER_THREAD;
+        if ((TSK_OFF_T) a_reader->nunits > nunits)
+            a_reader->nunits = (size_t) nunits;
+    }
+#endif
+
+    if ((a_reader->units = (NTFS_COMP_UNIT *) tsk_malloc(a_reader->nunits *
+                sizeof(NTFS_COMP_UNIT))) == NULL)
+        return 1;
+    for (size_t i = 0; i < a_reader->nunits; i++) {
+        NTFS_COMP_UNIT *unit = &a_reader->units[i];
+        if ((ntfs_uncompress_setup(fs, &unit->comp, a_fs_attr->nrd.compsize))
+            || ((unit->addrs = (TSK_DADDR_T *)
+                    tsk_malloc(a_fs_attr->nrd.compsize *
+                        sizeof(TSK_DADDR_T))) == NULL)) {
+            ntfs_comp_reader_free(a_reader);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Find the addresses of units until the ring of units is full, and give
+ * them to the worker threads.
+ */
+static void
+ntfs_comp_reader_fill(NTFS_COMP_READER * a_reader)
+{
+    while ((a_reader->count < a_reader->nunits) && (!a_reader->iter_done)) {
+        NTFS_COMP_UNIT *unit = &a_reader->units[(a_reader->head +
+                a_reader->count) % a_reader->nunits];
+        int ret;
+
+        unit->queued = 0;
+        unit->failed = 0;
+        ret = ntfs_comp_iter_next(&a_reader->iter, unit);
+        if (ret == 0) {
+            a_reader->iter_done = 1;
+            break;
+        }
+        a_reader->count++;
+        if (ret == -1) {
+            // return the error after the units before it
+            a_reader->iter_done = 1;
+            unit->failed = 1;
+            unit->error = *tsk_error_get_info();
+            tsk_error_reset();
+            break;
+        }
+
+#ifdef TSK_MULTITHREAD_LIB
+        if ((a_reader->pool) && (unit->off < a_reader->ahead_end)) {
+            ((NtfsCompPool *) a_reader->pool)->add(a_reader->iter.fs_attr,
+                a_reader->initsize, unit);
+        }
+        else
+#endif
+        if (unit->off >= a_reader->ahead_end) {
+            // not needed yet, and maybe never
+            break;
+        }
+    }
+}
+
+/**
+ * Get the next compression unit of the attribute.  The unit stays valid
+ * until the next call.
+ *
+ * @param a_reader Reader
+ * @param a_unit Set to the unit
+ * @returns 1 if a unit was returned, 0 at the end of the attribute and
+ * -1 on error
+ */
+static int
+ntfs_comp_reader_next(NTFS_COMP_READER * a_reader, NTFS_COMP_UNIT ** a_unit)
+{
+    NTFS_COMP_UNIT *unit;
+
+    if (a_reader->returned) {
+        a_reader->head = (a_reader->head + 1) % a_reader->nunits;
+        a_reader->count--;
+        a_reader->returned = 0;
+    }
+
+    ntfs_comp_reader_fill(a_reader);
+    if (a_reader->count == 0)
+        return 0;
+
+    unit = &a_reader->units[a_reader->head];
+    a_reader->returned = 1;
+#ifdef TSK_MULTITHREAD_LIB
+    if (unit->queued) {
+        ((NtfsCompPool *) a_reader->pool)->wait(unit);
+        unit->queued = 0;
+    }
+    else
+#endif
+    if (unit->failed == 0) {
+        unit->failed = ntfs_comp_unit_proc(a_reader->ntfs,
+            a_reader->iter.fs_attr, a_reader->initsize, unit);
+        if (unit->failed)
+            return -1;
+    }
+
+    if (unit->failed) {
+        *tsk_error_get_info() = unit->error;
+        return -1;
+    }
+    *a_unit = unit;
+    return 1;
+}
+
 
 
 /**
@@ -1331,16 +2103,12 @@ ntfs_attr_walk_special(
      * dump the compressed data instead of giving an error.
      */
     if (fs_attr->flags & TSK_FS_ATTR_COMP) {
-        TSK_DADDR_T addr;
-        TSK_FS_ATTR_RUN *fs_attr_run;
-        TSK_DADDR_T *comp_unit;
-        uint32_t comp_unit_idx = 0;
-        NTFS_COMP_INFO comp;
+        NTFS_COMP_READER reader;
+        NTFS_COMP_UNIT *unit;
         TSK_OFF_T off = 0;
         int retval;
+        int ret;
         uint8_t stop_loop = 0;
-        uint8_t init_size_reached = 0;
-        uint8_t has_init_size = 0;
 
         if (fs_attr->nrd.compsize <= 0) {
             tsk_error_set_errno(TSK_ERR_FS_FWALK);
@@ -1351,241 +2119,93 @@ ntfs_attr_walk_special(
         }
 
         /* Allocate the buffers and state structure */
-        if (ntfs_uncompress_setup(fs, &comp, fs_attr->nrd.compsize)) {
-            return 1;
-        }
-
-        comp_unit =
-            (TSK_DADDR_T *) tsk_malloc(fs_attr->nrd.compsize *
-            sizeof(TSK_DADDR_T));
-        if (comp_unit == NULL) {
-            ntfs_uncompress_done(&comp);
+        if (ntfs_comp_reader_init(&reader, ntfs, fs_attr, 0, fs_attr->size,
+                1)) {
             return 1;
         }
         retval = TSK_WALK_CONT;
 
-        if (fs_attr->nrd.initsize != fs_attr->fs_file->meta->size)
-            has_init_size = 1;
+        /* cycle through the compression units */
+        while ((ret = ntfs_comp_reader_next(&reader, &unit)) == 1) {
+            NTFS_COMP_INFO *comp = &unit->comp;
+            size_t i;
 
-        /* cycle through the number of runs we have */
-        for (fs_attr_run = fs_attr->nrd.run; fs_attr_run;
-            fs_attr_run = fs_attr_run->next) {
-            size_t len_idx;
+            off = unit->off;
 
-            /* We may get a FILLER entry at the beginning of the run
-             * if we are processing a non-base file record since
-             * this $DATA attribute could not be the first sequence in the
-             * attribute. Therefore, do not error if it starts at 0 */
-            if (fs_attr_run->flags & TSK_FS_ATTR_RUN_FLAG_FILLER) {
-                if (fs_attr_run->addr != 0) {
-                    tsk_error_reset();
+            // now call the callback with the uncompressed data
+            for (i = 0; i < unit->cnt; i++) {
+                int myflags;
+                size_t read_len;
 
+                myflags =
+                    TSK_FS_BLOCK_FLAG_CONT | TSK_FS_BLOCK_FLAG_COMP;
+                retval = is_clustalloc(ntfs, unit->addrs[i]);
+                if (retval == -1) {
                     if (fs_attr->fs_file->meta->
                         flags & TSK_FS_META_FLAG_UNALLOC)
                         tsk_error_set_errno(TSK_ERR_FS_RECOVER);
-                    else
-                        tsk_error_set_errno(TSK_ERR_FS_GENFS);
-                    tsk_error_set_errstr
-                        ("ntfs_attr_walk_special: Filler Entry exists in fs_attr_run %"
-                        PRIuDADDR "@%" PRIuDADDR " - type: %" PRIu32
-                        "  id: %d Meta: %" PRIuINUM " Status: %s",
-                        fs_attr_run->len, fs_attr_run->addr, fs_attr->type,
-                        fs_attr->id, fs_attr->fs_file->meta->addr,
-                        (fs_attr->fs_file->meta->
-                            flags & TSK_FS_META_FLAG_ALLOC) ? "Allocated" :
-                        "Deleted");
-                    free(comp_unit);
-                    ntfs_uncompress_done(&comp);
+                    ntfs_comp_reader_free(&reader);
                     return 1;
                 }
-                else {
-                    if ((fs_attr_run->len > LLONG_MAX)
-                        || (LLONG_MAX / fs_attr_run->len < fs->block_size)) {
-                        if (fs_attr->fs_file->meta->
-                            flags & TSK_FS_META_FLAG_UNALLOC)
-                            tsk_error_set_errno(TSK_ERR_FS_RECOVER);
-                        else
-                            tsk_error_set_errno(TSK_ERR_FS_GENFS);
-                        tsk_error_set_errstr
-                            ("ntfs_attr_walk_special: Attribute run length is too large %"
-                            PRIuDADDR "@%" PRIuDADDR " - type: %" PRIu32
-                            "  id: %d Meta: %" PRIuINUM " Status: %s",
-                            fs_attr_run->len, fs_attr_run->addr, fs_attr->type,
-                            fs_attr->id, fs_attr->fs_file->meta->addr,
-                            (fs_attr->fs_file->meta->
-                                flags & TSK_FS_META_FLAG_ALLOC) ? "Allocated" :
-                            "Deleted");
-                        free(comp_unit);
-                        ntfs_uncompress_done(&comp);
-                        return 1;
-                    }
-                    off += (fs_attr_run->len * fs->block_size);
-                    continue;
+                else if (retval == 1) {
+                    myflags |= TSK_FS_BLOCK_FLAG_ALLOC;
+                }
+                else if (retval == 0) {
+                    myflags |= TSK_FS_BLOCK_FLAG_UNALLOC;
                 }
-            }
-            addr = fs_attr_run->addr;
-
-            /* cycle through each cluster in the run */
-            for (len_idx = 0; len_idx < fs_attr_run->len; len_idx++) {
 
-                if (addr > fs->last_block) {
-                    tsk_error_reset();
+                // Unclear what the behavior should be here
+                // assuming POSIX like behavior is likely the required approach
+                if (off >= fs_attr->size)
+                    read_len = 0;
+                else if (fs_attr->size - off > fs->block_size)
+                    read_len = fs->block_size;
+                else
+                    read_len = (size_t) (fs_attr->size - off);
 
-                    if (fs_attr->fs_file->meta->
-                        flags & TSK_FS_META_FLAG_UNALLOC)
-                        tsk_error_set_errno(TSK_ERR_FS_RECOVER);
-                    else
-                        tsk_error_set_errno(TSK_ERR_FS_BLK_NUM);
+                if (i * fs->block_size + read_len > comp->uncomp_idx) {
+                    tsk_error_set_errno(TSK_ERR_FS_FWALK);
                     tsk_error_set_errstr
-                        ("ntfs_attr_walk_special: Invalid address in run (too large): %"
-                        PRIuDADDR " Meta: %" PRIuINUM " Status: %s", addr,
+                        ("ntfs_attrwalk_special: Trying to read past end of uncompressed buffer: %"
+                        PRIuSIZE " %" PRIuSIZE " Meta: %" PRIuINUM
+                        " Status: %s",
+                        i * fs->block_size + read_len,
+                        comp->uncomp_idx,
                         fs_attr->fs_file->meta->addr,
                         (fs_attr->fs_file->meta->
-                            flags & TSK_FS_META_FLAG_ALLOC) ? "Allocated" :
-                        "Deleted");
-
-                    free(comp_unit);
-                    ntfs_uncompress_done(&comp);
+                            flags & TSK_FS_META_FLAG_ALLOC) ?
+                        "Allocated" : "Deleted");
+                    ntfs_comp_reader_free(&reader);
                     return 1;
                 }
 
-                // queue up the addresses until we get a full unit
-                comp_unit[comp_unit_idx++] = addr;
-
-                // time to decompress (if queue is full or this is the last block)
-                if ((comp_unit_idx == fs_attr->nrd.compsize)
-                    || ((len_idx == fs_attr_run->len - 1)
-                        && (fs_attr_run->next == NULL))) {
-                    size_t i;
+                // call the callback
+                retval =
+                    a_action(fs_attr->fs_file, off, unit->addrs[i],
+                    &comp->uncomp_buf[i * fs->block_size], read_len,
+                    (TSK_FS_BLOCK_FLAG_ENUM) myflags, ptr);
 
+                off += read_len;
 
-                    if (tsk_verbose)
-                        tsk_fprintf(stderr,
-                            "ntfs_proc_compunit: Decompressing at file offset %" PRIdOFF "\n", off);
-
-                    // decompress the unit if we have not passed initsize yet.
-                    if (!init_size_reached) {
-                        if (ntfs_proc_compunit(ntfs, &comp, comp_unit,
-                            comp_unit_idx)) {
-                            tsk_error_set_errstr2("%" PRIuINUM " - type: %"
-                                PRIu32 "  id: %d Status: %s",
-                                fs_attr->fs_file->meta->addr, fs_attr->type,
-                                fs_attr->id,
-                                (fs_attr->fs_file->meta->
-                                    flags & TSK_FS_META_FLAG_ALLOC) ?
-                                "Allocated" : "Deleted");
-                            free(comp_unit);
-                            ntfs_uncompress_done(&comp);
-                            return 1;
-                        }
-
-                        /* if we've passed the initialized size while reading this block,
-                         * zero out the buffer beyond the initialized size. */
-                        if (has_init_size && (off < fs_attr->nrd.initsize)) {
-                            const int64_t prev_remanining_init_size = fs_attr->nrd.initsize - off;
-                            if (prev_remanining_init_size < (int64_t)comp.buf_size_b) {
-                                memset(&comp.uncomp_buf[prev_remanining_init_size], 0, comp.buf_size_b - prev_remanining_init_size);
-                                init_size_reached = 1;
-                            }
-                        }
-                    }
-                    // set the buffers to 0s if we are past initsize
-                    else {
-                        ntfs_uncompress_reset(&comp);
-                        comp.uncomp_idx = comp.buf_size_b;
-                    }
-
-                    // now call the callback with the uncompressed data
-                    for (i = 0; i < comp_unit_idx; i++) {
-                        int myflags;
-                        size_t read_len;
-
-                        myflags =
-                            TSK_FS_BLOCK_FLAG_CONT |
-                            TSK_FS_BLOCK_FLAG_COMP;
-                        retval = is_clustalloc(ntfs, comp_unit[i]);
-                        if (retval == -1) {
-                            if (fs_attr->fs_file->meta->
-                                flags & TSK_FS_META_FLAG_UNALLOC)
-                                tsk_error_set_errno(TSK_ERR_FS_RECOVER);
-                            free(comp_unit);
-                            ntfs_uncompress_done(&comp);
-                            return 1;
-                        }
-                        else if (retval == 1) {
-                            myflags |= TSK_FS_BLOCK_FLAG_ALLOC;
-                        }
-                        else if (retval == 0) {
-                            myflags |= TSK_FS_BLOCK_FLAG_UNALLOC;
-                        }
-
-                        // Unclear what the behavior should be here
-                        // assuming POSIX like behavior is likely the required approach
-                        if (off >= fs_attr->size)
-                            read_len = 0;
-                        else if (fs_attr->size - off > fs->block_size)
-                            read_len = fs->block_size;
-                        else
-                            read_len = (size_t) (fs_attr->size - off);
-
-                        if (i * fs->block_size + read_len >
-                            comp.uncomp_idx) {
-                            tsk_error_set_errno(TSK_ERR_FS_FWALK);
-                            tsk_error_set_errstr
-                                ("ntfs_attrwalk_special: Trying to read past end of uncompressed buffer: %"
-                                PRIuSIZE " %" PRIuSIZE " Meta: %" PRIuINUM
-                                " Status: %s",
-                                i * fs->block_size + read_len,
-                                comp.uncomp_idx,
-                                fs_attr->fs_file->meta->addr,
-                                (fs_attr->fs_file->meta->
-                                    flags & TSK_FS_META_FLAG_ALLOC) ?
-                                "Allocated" : "Deleted");
-                            free(comp_unit);
-                            ntfs_uncompress_done(&comp);
-                            return 1;
-                        }
-
-                        // call the callback
-                        retval =
-                            a_action(fs_attr->fs_file, off, comp_unit[i],
-                            &comp.uncomp_buf[i * fs->block_size], read_len,
-                            (TSK_FS_BLOCK_FLAG_ENUM) myflags, ptr);
-
-                        off += read_len;
-
-                        if (off >= fs_attr->size) {
-                            stop_loop = 1;
-                            break;
-                        }
-                        if (retval != TSK_WALK_CONT) {
-                            stop_loop = 1;
-                            break;
-                        }
-                    }
-                    comp_unit_idx = 0;
+                if (off >= fs_attr->size) {
+                    stop_loop = 1;
+                    break;
                 }
-
-                if (stop_loop)
+                if (retval != TSK_WALK_CONT) {
+                    stop_loop = 1;
                     break;
-
-                /* If it is a sparse run, don't increment the addr so that
-                 * it remains 0 */
-                if (((fs_attr_run->flags & TSK_FS_ATTR_RUN_FLAG_SPARSE) ==
-                        0)
-                    && ((fs_attr_run->flags & TSK_FS_ATTR_RUN_FLAG_FILLER)
-                        == 0))
-                    addr++;
+                }
             }
 
             if (stop_loop)
                 break;
         }
 
-        ntfs_uncompress_done(&comp);
-        free(comp_unit);
+        ntfs_comp_reader_free(&reader);
 
-        if (retval == TSK_WALK_ERROR)
+        if (ret == -1)
+            return 1;
+        else if (retval == TSK_WALK_ERROR)
             return 1;
         else
             return 0;
@@ -1624,15 +2244,12 @@ ntfs_file_read_special(const TSK_FS_ATTR * a_fs_attr,
     ntfs = (NTFS_INFO *) fs;
 
     if (a_fs_attr->flags & TSK_FS_ATTR_COMP) {
-        TSK_FS_ATTR_RUN *data_run_cur;
         TSK_OFF_T cu_blkoffset; // block offset of starting compression unit to start reading from
         size_t byteoffset;      // byte offset in compression unit of where we want to start reading from
-        TSK_DADDR_T *comp_unit;
-        uint32_t comp_unit_idx = 0;
-        NTFS_COMP_INFO comp;
+        NTFS_COMP_READER reader;
+        NTFS_COMP_UNIT *unit;
         size_t buf_idx = 0;
-        uint8_t init_size_reached = 0;
-        uint8_t has_init_size = 0;
+        int ret = 0;
 
         if (a_fs_attr->nrd.compsize <= 0) {
             tsk_error_set_errno(TSK_ERR_FS_FWALK);
@@ -1659,30 +2276,14 @@ ntfs_file_read_special(const TSK_FS_ATTR * a_fs_attr,
                     "ntfs_file_read_special: Returning 0s for read past end of initsize (%"
                     PRIuINUM ")\n", a_fs_attr->fs_file->meta->addr);
 
-            if (a_offset + (TSK_OFF_T)a_len > a_fs_attr->nrd.allocsize)
-                len = (ssize_t) (a_fs_attr->nrd.allocsize - a_offset);
+            if (a_offset + (TSK_OFF_T)a_len > a_fs_attr->size)
+                len = (ssize_t) (a_fs_attr->size - a_offset);
             else
                 len = (ssize_t) a_len;
-            memset(a_buf, 0, a_len);
+            memset(a_buf, 0, len);
             return len;
         }
 
-        if (a_fs_attr->nrd.initsize	!= a_fs_attr->fs_file->meta->size)
-            has_init_size = 1;
-
-        /* Allocate the buffers and state structure */
-        if (ntfs_uncompress_setup(fs, &comp, a_fs_attr->nrd.compsize)) {
-            return -1;
-        }
-
-        comp_unit =
-            (TSK_DADDR_T *) tsk_malloc(a_fs_attr->nrd.compsize *
-            sizeof(TSK_DADDR_T));
-        if (comp_unit == NULL) {
-            ntfs_uncompress_done(&comp);
-            return -1;
-        }
-
         // figure out the needed offsets
         cu_blkoffset = a_offset / fs->block_size;
         if (cu_blkoffset) {
@@ -1692,117 +2293,47 @@ ntfs_file_read_special(const TSK_FS_ATTR * a_fs_attr,
 
         byteoffset = (size_t) (a_offset - cu_blkoffset * fs->block_size);
 
-        // cycle through the run until we find where we can start to process the clusters
-        for (data_run_cur = a_fs_attr->nrd.run;
-            (data_run_cur) && (buf_idx < a_len);
-            data_run_cur = data_run_cur->next) {
-
-            TSK_DADDR_T addr;
-            size_t a;
-
-            // See if this run contains the starting offset they requested
-            if (data_run_cur->offset + data_run_cur->len <
-                (TSK_DADDR_T) cu_blkoffset)
-                continue;
-
-
-            // seek to the start of where we want to read (we may need to read several runs)
-            if (data_run_cur->offset > (TSK_DADDR_T) cu_blkoffset)
-                a = 0;
-            else
-                a = (size_t) (cu_blkoffset - data_run_cur->offset);
-
-            addr = data_run_cur->addr;
-            // don't increment addr if it is 0 -- sparse
-            if (addr)
-                addr += a;
-
-            /* cycle through the relevant in the run */
-            for (; a < data_run_cur->len && buf_idx < a_len; a++) {
-
-                // queue up the addresses until we get a full unit
-                comp_unit[comp_unit_idx++] = addr;
-
-                // time to decompress (if queue is full or this is the last block)
-                if ((comp_unit_idx == a_fs_attr->nrd.compsize)
-                    || ((a == data_run_cur->len - 1)
-                        && (data_run_cur->next == NULL))) {
-                    size_t cpylen;
-
-                    // decompress the unit if we are still in initsize
-                    if (!init_size_reached) {
-                        if (ntfs_proc_compunit(ntfs, &comp, comp_unit,
-                            comp_unit_idx)) {
-                            tsk_error_set_errstr2("%" PRIuINUM " - type: %"
-                                PRIu32 "  id: %d  Status: %s",
-                                a_fs_attr->fs_file->meta->addr,
-                                a_fs_attr->type, a_fs_attr->id,
-                                (a_fs_attr->fs_file->meta->
-                                    flags & TSK_FS_META_FLAG_ALLOC) ?
-                                "Allocated" : "Deleted");
-                            free(comp_unit);
-                            ntfs_uncompress_done(&comp);
-                            return -1;
-                        }
-
-                        /* if we've passed the initialized size while reading this block,
-                         * zero out the buffer beyond the initialized size
-                         */
-                        if (has_init_size) {
-                            const int64_t remanining_init_size = a_fs_attr->nrd.initsize - buf_idx - a_offset;
-                            if (remanining_init_size < (int64_t)comp.buf_size_b) {
-                                memset(comp.uncomp_buf + remanining_init_size, 0, comp.buf_size_b - remanining_init_size);
-                                init_size_reached = 1;
-                            }
-                        }
-                    }
-                    else {
-                        ntfs_uncompress_reset(&comp);
-                        comp.uncomp_idx = comp.buf_size_b;
-                    }
-
-                    // copy uncompressed data to the output buffer
-                    if (comp.uncomp_idx < byteoffset) {
-
-                        // @@ ERROR
-                        free(comp_unit);
-                        ntfs_uncompress_done(&comp);
-                        return -1;
-                    }
-                    else if (comp.uncomp_idx - byteoffset <
-                        a_len - buf_idx) {
-                        cpylen = comp.uncomp_idx - byteoffset;
-                    }
-                    else {
-                        cpylen = a_len - buf_idx;
-                    }
-                    // Make sure not to return more bytes than are in the file
-                    if (cpylen > (a_fs_attr->size - (a_offset + buf_idx)))
-                        cpylen =
-                            (size_t) (a_fs_attr->size - (a_offset +
-                                buf_idx));
+        /* Allocate the buffers and state structure */
+        if (ntfs_comp_reader_init(&reader, ntfs, a_fs_attr,
+                (TSK_DADDR_T) cu_blkoffset, a_offset + (TSK_OFF_T) a_len,
+                0)) {
+            return -1;
+        }
 
-                    memcpy(&a_buf[buf_idx], &comp.uncomp_buf[byteoffset],
-                        cpylen);
+        // cycle through the units until we have what was asked for
+        while ((buf_idx < a_len)
+            && ((ret = ntfs_comp_reader_next(&reader, &unit)) == 1)) {
+            NTFS_COMP_INFO *comp = &unit->comp;
+            size_t cpylen;
 
-                    // reset this in case we need to also read from the next run
-                    byteoffset = 0;
-                    buf_idx += cpylen;
-                    comp_unit_idx = 0;
+            // copy uncompressed data to the output buffer
+            if (comp->uncomp_idx < byteoffset) {
 
-                }
-                /* If it is a sparse run, don't increment the addr so that
-                 * it remains 0 */
-                if (((data_run_cur->flags & TSK_FS_ATTR_RUN_FLAG_SPARSE) ==
-                        0)
-                    && ((data_run_cur->flags & TSK_FS_ATTR_RUN_FLAG_FILLER)
-                        == 0))
-                    addr++;
+                // @@ ERROR
+                ntfs_comp_reader_free(&reader);
+                return -1;
             }
+            else if (comp->uncomp_idx - byteoffset < a_len - buf_idx) {
+                cpylen = comp->uncomp_idx - byteoffset;
+            }
+            else {
+                cpylen = a_len - buf_idx;
+            }
+            // Make sure not to return more bytes than are in the file
+            if (cpylen > (a_fs_attr->size - (a_offset + buf_idx)))
+                cpylen =
+                    (size_t) (a_fs_attr->size - (a_offset + buf_idx));
+
+            memcpy(&a_buf[buf_idx], &comp->uncomp_buf[byteoffset], cpylen);
+
+            // reset this in case we need to also read from the next unit
+            byteoffset = 0;
+            buf_idx += cpylen;
         }
 
-        free(comp_unit);
-        ntfs_uncompress_done(&comp);
+        ntfs_comp_reader_free(&reader);
+        if (ret == -1)
+            return -1;
         return (ssize_t) buf_idx;
     }
     else {
@@ -3259,14 +3790,13 @@ ntfs_attrname_lookup(TSK_FS_INFO * fs, uint16_t type, char *name, int len)
 }
 
 
-/* Load the block bitmap $Data run  and allocate a buffer for a cache
+/* Load the block bitmap $Data run and set up the cache of its pages
  *
  * return 1 on error and 0 on success
  * */
 static uint8_t
 ntfs_load_bmap(NTFS_INFO * ntfs)
 {
-    ssize_t cnt = 0;
     ntfs_attr *attr = NULL;
     ntfs_attr *data_attr = NULL;
     TSK_FS_INFO *fs = NULL;
@@ -3346,14 +3876,6 @@ ntfs_load_bmap(NTFS_INFO * ntfs)
                 &(ntfs->bmap), NULL, NTFS_MFT_BMAP)) != TSK_OK) {
         goto on_error;
     }
-    ntfs->bmap_buf = (char *) tsk_malloc(fs->block_size);
-    if (ntfs->bmap_buf == NULL) {
-        goto on_error;
-    }
-
-    /* Load the first cluster so that we have something there */
-    ntfs->bmap_buf_off = 0;
-
     // Check ntfs->bmap before it is accessed.
     if (ntfs->bmap == NULL) {
         goto on_error;
@@ -3366,15 +3888,19 @@ ntfs_load_bmap(NTFS_INFO * ntfs)
             "", ntfs->bmap->addr);
         goto on_error;
     }
-    cnt =
-        tsk_fs_read_block(fs,
-        ntfs->bmap->addr, ntfs->bmap_buf, fs->block_size);
-    if (cnt != fs->block_size) {
-        if (cnt >= 0) {
-            tsk_error_reset();
-            tsk_error_set_errno(TSK_ERR_FS_READ);
-        }
-        tsk_error_set_errstr2("ntfs_load_bmap: Error reading block at %"
+    if (ntfs_bmap_cache_init(ntfs)) {
+        goto on_error;
+    }
+
+    /* Load the first page so that we have something there */
+    if (((NTFS_BMAP_CACHE *) ntfs->bmap_cache)->npages == 0) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_FS_INODE_COR);
+        tsk_error_set_errstr("ntfs_load_bmap: Bitmap is empty");
+        goto on_error;
+    }
+    if (ntfs_bmap_page(ntfs, 0) == NULL) {
+        tsk_error_set_errstr2("ntfs_load_bmap: Error reading bitmap at %"
             PRIuDADDR, ntfs->bmap->addr);
         goto on_error;
     }
@@ -3499,6 +4025,18 @@ ntfs_sds_to_str(TSK_FS_INFO * a_fs, const ntfs_attr_sds * a_sds,
         (ntfs_sid *) ((uint8_t *) & a_sds->self_rel_sec_desc +
         owner_offset);
 
+    if (((uintptr_t) sid + offsetof(ntfs_sid, sub_auth) >
+            (uintptr_t) a_sds + tsk_getu32(a_fs->endian, a_sds->ent_size))
+        || ((uintptr_t) sid + offsetof(ntfs_sid, sub_auth) +
+            4 * (size_t) sid->sub_auth_count >
+            (uintptr_t) a_sds + tsk_getu32(a_fs->endian, a_sds->ent_size))) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_FS_INODE_COR);
+        tsk_error_set_errstr
+            ("ntfs_sds_to_str: owner SID larger than a_sds length");
+        return 1;
+    }
+
     //tsk_fprintf(stderr, "Revision: %i\n", sid->revision);
 
     // This check helps not process invalid data, which was noticed while testing
@@ -3548,30 +4086,54 @@ ntfs_sds_to_str(TSK_FS_INFO * a_fs, const ntfs_attr_sds * a_sds,
 
 
 
+/* One $SII entry: where the security descriptor of a security id is */
+struct NtfsSecIndexEntry {
+    uint32_t sec_id;
+    uint32_t hash;              // hash of the security descriptor
+    uint64_t sds_off;           // offset of the $SDS entry
+    uint32_t size;              // size of the $SDS entry
+};
+
+/* The $SII entries of $Secure, sorted by security id (entries with the
+ * same id stay in $SII order), and the $SDS stream to read the
+ * descriptors from.  Built by ntfs_load_secure() on first use. */
+struct NtfsSecIndex {
+    TSK_FS_FILE *secure = NULL;
+    const TSK_FS_ATTR *fs_attr_sds = NULL;      // owned by secure
+    std::vector<NtfsSecIndexEntry> entries;
+
+    ~NtfsSecIndex() {
+        tsk_fs_file_close(secure);
+    }
+};
+
+static uint8_t ntfs_load_secure(NTFS_INFO * ntfs);
+
+/* Largest $SDS entry that we read: a security descriptor is at most
+ * 64 KiB. */
+#define NTFS_SDS_ENT_MAX    (64 * 1024 + sizeof(ntfs_attr_sds))
+
 /** \internal
- * Maps a security id value from a file to its SDS structure
- *
- * Note: This routine assumes &ntfs->sid_lock is locked by the caller.
+ * Maps a security id value from a file to its SDS structure.  $Secure
+ * is indexed on the first call; after that, only the $SDS entry is
+ * read.
  *
  * @param fs File system
  * @param secid Security Id to find SDS for.
- * @returns NULL on error
+ * @param a_buf Buffer that the SDS entry is read into
+ * @returns NULL on error, else a pointer into a_buf
  */
 static const ntfs_attr_sds *
-ntfs_get_sds(TSK_FS_INFO * fs, uint32_t secid)
+ntfs_get_sds(TSK_FS_INFO * fs, uint32_t secid, std::vector<uint8_t> &a_buf)
 {
-    uint32_t i = 0;
     NTFS_INFO *ntfs = (NTFS_INFO *) fs;
-    ntfs_attr_sii *sii = NULL;
+    const NtfsSecIndex *index;
+    const NtfsSecIndexEntry *sii = NULL;
     ntfs_attr_sds *sds = NULL;
-    uint32_t sii_secid = 0;
     uint32_t sds_secid = 0;
-    uint32_t sii_sechash = 0;
     uint32_t sds_sechash = 0;
     uint64_t sds_file_off = 0;
-    //uint32_t sds_ent_size = 0;
-    uint64_t sii_sds_file_off = 0;
-    uint32_t sii_sds_ent_size = 0;
+    uint32_t sds_ent_size = 0;
 
     if ((fs == NULL) || (secid == 0)) {
         tsk_error_reset();
@@ -3580,67 +4142,95 @@ ntfs_get_sds(TSK_FS_INFO * fs, uint32_t secid)
         return NULL;
     }
 
-    // Loop through all the SII entries looking for the security id matching that found in the file.
-    // This lookup is obviously O(n^2) for all n files. However, since so many files have the exact
-    // same security identifier, it is not really that bad. In reality, 100,000 files may only map to
-    // 10,000 security identifiers. Since SII entries are 0x28 bytes each and security identifiers
-    // increase incrementally, we could go directly to the entry in question ((secid * 0x28) + 256).
-    // SII entries started at 256 on Vista; however, I did not look at the starting secid for other
-    // versions of NTFS.
-	//
+    // The index does not change once it is built
+    tsk_take_lock(&ntfs->sid_lock);
+    if (ntfs->sec_index_loaded == 0) {
+        if (ntfs_load_secure(ntfs)) {
+            tsk_release_lock(&ntfs->sid_lock);
+            return NULL;
+        }
+    }
+    index = (const NtfsSecIndex *) ntfs->sec_index;
+    tsk_release_lock(&ntfs->sid_lock);
+
 	// It appears that the file format may have changed since this was first written. There now appear to
 	// be multiple entries for each security ID. Some may no longer be valid, so we loop over all of them
 	// until we find one that looks valid.
-	for (i = 0; i < ntfs->sii_data.used; i++) {
-		if (! (tsk_getu32(fs->endian,
-			((ntfs_attr_sii *)(ntfs->sii_data.buffer))[i].key_sec_id) == secid)) {
-			continue;
-		}
-
-		// We found a potentially good SII entry
-		sii = &((ntfs_attr_sii *)(ntfs->sii_data.buffer))[i];
-		sii_secid = tsk_getu32(fs->endian, sii->key_sec_id);
-		sii_sechash = tsk_getu32(fs->endian, sii->data_hash_sec_desc);
-		sii_sds_file_off = tsk_getu64(fs->endian, sii->sec_desc_off);
-		sii_sds_ent_size = tsk_getu32(fs->endian, sii->sec_desc_size);
-
-		// Check that we do not go out of bounds.
-		if (sii_sds_file_off > ntfs->sds_data.size) {
-			tsk_error_reset();
-			tsk_error_set_errno(TSK_ERR_FS_GENFS);
-			tsk_error_set_errstr("ntfs_get_sds: SII offset too large (%" PRIu64
-				")", sii_sds_file_off);
-			continue;
-		}
-		else if (!sii_sds_ent_size) {
-			tsk_error_reset();
-			tsk_error_set_errno(TSK_ERR_FS_GENFS);
-			tsk_error_set_errstr("ntfs_get_sds: SII entry size is invalid (%"
-				PRIu32 ")", sii_sds_ent_size);
-			continue;
-		}
-
-		sds =
-			(ntfs_attr_sds *)((uint8_t *)ntfs->sds_data.buffer +
-				sii_sds_file_off);
-		sds_secid = tsk_getu32(fs->endian, sds->sec_id);
-		sds_sechash = tsk_getu32(fs->endian, sds->hash_sec_desc);
-		sds_file_off = tsk_getu64(fs->endian, sds->file_off);
-
-		// Sanity check to make sure the $SII entry points to
-		// the correct $SDS entry.
-		if ((sds_secid == sii_secid) &&
-			(sds_sechash == sii_sechash) && (sds_file_off == sii_sds_file_off)
-			//&& (sds_ent_size == sii_sds_ent_size)
-			) {
-			// Clear any previous errors
-			tsk_error_reset();
-			return sds;
-		}
-		tsk_error_reset();
-		tsk_error_set_errno(TSK_ERR_FS_GENFS);
-		tsk_error_set_errstr("ntfs_get_sds: SII entry %" PRIu32 " not found", sii_secid);
-	}
+    if (index) {
+        NtfsSecIndexEntry key = { secid, 0, 0, 0 };
+        auto range = std::equal_range(index->entries.begin(),
+            index->entries.end(), key,
+            [](const NtfsSecIndexEntry &a, const NtfsSecIndexEntry &b) {
+                return a.sec_id < b.sec_id;
+            });
+        const uint64_t sds_size = (uint64_t) index->fs_attr_sds->size;
+
+        for (auto it = range.first; it != range.second; ++it) {
+            size_t len;
+
+            // We found a potentially good SII entry
+            sii = &*it;
+
+            // Check that we do not go out of bounds.
+            if ((sii->sds_off >= sds_size)
+                || (sds_size - sii->sds_off < sizeof(ntfs_attr_sds))) {
+                tsk_error_reset();
+                tsk_error_set_errno(TSK_ERR_FS_GENFS);
+                tsk_error_set_errstr("ntfs_get_sds: SII offset too large (%"
+                    PRIu64 ")", sii->sds_off);
+                continue;
+            }
+            else if ((sii->size == 0) || (sii->size > NTFS_SDS_ENT_MAX)) {
+                tsk_error_reset();
+                tsk_error_set_errno(TSK_ERR_FS_GENFS);
+                tsk_error_set_errstr("ntfs_get_sds: SII entry size is invalid (%"
+                    PRIu32 ")", sii->size);
+                continue;
+            }
+
+            // read the entry, and again if $SDS says that it is larger
+            len = (size_t) std::min<uint64_t>(std::max<size_t>(sii->size,
+                    sizeof(ntfs_attr_sds)), sds_size - sii->sds_off);
+            for (int pass = 0; pass < 2; pass++) {
+                a_buf.assign(len, 0);
+                if (tsk_fs_attr_read(index->fs_attr_sds, sii->sds_off,
+                        (char *) a_buf.data(), len,
+                        TSK_FS_FILE_READ_FLAG_NONE) != (ssize_t) len) {
+                    len = 0;
+                    break;
+                }
+                sds = (ntfs_attr_sds *) a_buf.data();
+                sds_ent_size = tsk_getu32(fs->endian, sds->ent_size);
+                if ((sds_ent_size <= len) || (sds_ent_size > NTFS_SDS_ENT_MAX)
+                    || (sds_ent_size > sds_size - sii->sds_off))
+                    break;
+                len = sds_ent_size;
+            }
+            if ((len == 0) || (sds_ent_size > len)) {
+                tsk_error_reset();
+                tsk_error_set_errno(TSK_ERR_FS_GENFS);
+                tsk_error_set_errstr("ntfs_get_sds: error reading SDS entry for SII entry %"
+                    PRIu32, sii->sec_id);
+                continue;
+            }
+
+            sds_secid = tsk_getu32(fs->endian, sds->sec_id);
+            sds_sechash = tsk_getu32(fs->endian, sds->hash_sec_desc);
+            sds_file_off = tsk_getu64(fs->endian, sds->file_off);
+
+            // Sanity check to make sure the $SII entry points to
+            // the correct $SDS entry.
+            if ((sds_secid == sii->sec_id) &&
+                (sds_sechash == sii->hash) && (sds_file_off == sii->sds_off)) {
+                // Clear any previous errors
+                tsk_error_reset();
+                return sds;
+            }
+            tsk_error_reset();
+            tsk_error_set_errno(TSK_ERR_FS_GENFS);
+            tsk_error_set_errstr("ntfs_get_sds: SII entry %" PRIu32 " not found", sii->sec_id);
+        }
+    }
 
 	// If we never even found an SII entry that matched our secid, update the error state.
 	// Otherwise leave it as the last error recorded.
@@ -3674,7 +4264,6 @@ ntfs_file_get_sidstr(TSK_FS_FILE * a_fs_file, char **sid_str)
     const TSK_FS_ATTR *fs_data;
     ntfs_attr_si *si;
     const ntfs_attr_sds *sds;
-    NTFS_INFO *ntfs = (NTFS_INFO *) a_fs_file->fs_info;
 
     *sid_str = NULL;
 
@@ -3702,22 +4291,19 @@ ntfs_file_get_sidstr(TSK_FS_FILE * a_fs_file, char **sid_str)
         return 1;
     }
 
-    tsk_take_lock(&ntfs->sid_lock);
-    // sds points inside ntfs->sds_data, which we've just locked
+    // sds points inside sds_buf
+    std::vector<uint8_t> sds_buf;
     sds =
         ntfs_get_sds(a_fs_file->fs_info,
-        tsk_getu32(a_fs_file->fs_info->endian, si->sec_id));
+        tsk_getu32(a_fs_file->fs_info->endian, si->sec_id), sds_buf);
     if (!sds) {
-        tsk_release_lock(&ntfs->sid_lock);
         tsk_error_set_errstr2("- ntfs_file_get_sidstr:SI attribute");
         return 1;
     }
     if (ntfs_sds_to_str(a_fs_file->fs_info, sds, sid_str)) {
-        tsk_release_lock(&ntfs->sid_lock);
         tsk_error_set_errstr2("- ntfs_file_get_sidstr:SI attribute");
         return 1;
     }
-    tsk_release_lock(&ntfs->sid_lock);
     return 0;
 #else
     *sid_str = NULL;
@@ -3731,126 +4317,96 @@ ntfs_file_get_sidstr(TSK_FS_FILE * a_fs_file, char **sid_str)
 
 #if TSK_USE_SID
 /** \internal
- * Process all the $SII entries into a single array by removing all the Attribute Headers.
- * Note: This routine assumes &ntfs->sid_lock is locked by the caller.
- * @param fs File system structure to store results into
- * @param sii_buffer Buffer of raw $SII entries to parse
+ * Add the $SII entries of an index record to a $Secure index.
+ * @param fs File system
+ * @param idxrec Index record (with the update sequence fixed)
+ * @param a_entries Entries to add to
  */
 static void
-ntfs_proc_sii(TSK_FS_INFO * fs, NTFS_SXX_BUFFER * sii_buffer)
+ntfs_proc_sii(TSK_FS_INFO * fs, ntfs_idxrec * idxrec,
+    std::vector<NtfsSecIndexEntry> &a_entries)
 {
-    unsigned int sii_buffer_offset = 0;
     NTFS_INFO *ntfs = (NTFS_INFO *) fs;
     ntfs_attr_sii *sii;
+    uint8_t *idx_buffer_end;
+    // the entry list may not go past the end of the record
+    const uint32_t list_max =
+        ntfs->idx_rsize_b - (uint32_t) offsetof(ntfs_idxrec, list);
 
-    if ((fs == NULL) || (sii_buffer == NULL)
-        || (ntfs->sii_data.buffer == NULL))
+    // stop processing if we hit corrupt data
+    if (tsk_getu32(fs->endian, idxrec->list.begin_off) > list_max) {
+        if (tsk_verbose)
+            tsk_fprintf(stderr, "ntfs_proc_sii: corrupt offset\n");
         return;
+    }
+    else if (tsk_getu32(fs->endian, idxrec->list.bufend_off) > list_max) {
+        if (tsk_verbose)
+            tsk_fprintf(stderr, "ntfs_proc_sii: corrupt offset\n");
+        return;
+    }
+    else if (tsk_getu32(fs->endian, idxrec->list.begin_off) > tsk_getu32(fs->endian, idxrec->list.bufend_off)) {
+        if (tsk_verbose)
+            tsk_fprintf(stderr, "ntfs_proc_sii: corrupt offset\n");
+        return;
+    }
 
-    /* Loop by cluster size */
-    for (sii_buffer_offset = 0; sii_buffer_offset < sii_buffer->size;
-        sii_buffer_offset += ntfs->idx_rsize_b) {
-
-        uint8_t* idx_buffer_end = 0;
-
-        ntfs_idxrec *idxrec =
-            (ntfs_idxrec *) & sii_buffer->buffer[sii_buffer_offset];
-
-        // stop processing if we hit corrupt data
-        if (tsk_getu32(fs->endian, idxrec->list.begin_off) > ntfs->idx_rsize_b) {
-            if (tsk_verbose)
-                tsk_fprintf(stderr, "ntfs_proc_sii: corrupt offset\n");
-            break;
-        }
-        else if (tsk_getu32(fs->endian, idxrec->list.bufend_off) > ntfs->idx_rsize_b) {
-            if (tsk_verbose)
-                tsk_fprintf(stderr, "ntfs_proc_sii: corrupt offset\n");
-            break;
-        }
-        else if (tsk_getu32(fs->endian, idxrec->list.begin_off) > tsk_getu32(fs->endian, idxrec->list.bufend_off)) {
-            if (tsk_verbose)
-                tsk_fprintf(stderr, "ntfs_proc_sii: corrupt offset\n");
-            break;
+    // get pointer to first record
+    uint8_t* sii_data_ptr = ((uint8_t*)& idxrec->list +
+        tsk_getu32(fs->endian, idxrec->list.begin_off));
+
+    // where last record ends
+    idx_buffer_end = (uint8_t*) & idxrec->list +
+        tsk_getu32(fs->endian, idxrec->list.bufend_off);
+
+    // keep where each record points to in $SDS
+    while (sii_data_ptr + sizeof(ntfs_attr_sii) <= idx_buffer_end) {
+        // It appears that perhaps older versions of NTFS always had entries of length 0x28. Now it appears we also can
+        // have entries of length 0x30. And there are also some entries that take up 0x28 bytes but have their length set to 0x10.
+
+        // 1400140000000000280004000000000002110000f233505302110000a026320000000000ec000000  // Normal entry of length 0x28
+        // 0000000000000000100000000200000003110000a65c02000311000090273200000000005c010000  // Possibly deleted? entry of length 0x28 but reporting length 0x10
+        // 140014000000000030000400010000001d150000abb032671d150000805a3a0000000000e80000006800000000000000  // Entry of length 0x30. Unclear what the eight final bytes are
+        // 00000000000000001800000003001b00540000000000000067110000a0823200000000003c0100005400000000000000  // I think this is the possibly deleted form of a long entry
+        //
+        // I haven't been able to find any documentation of what's going on - it's all old and says the entry length will be 0x28. The flags
+        // are also different across these three types but I also can't find any documentation on what they mean. So this is a best guess on
+        // how we should handle things:
+        // - If the length field is 0x30 or the first two fields are null and the length is 0x18, save the entry and advance 0x30 bytes.
+        //         The last eight bytes on the long entries will be ignored.
+        // - Otherwise save the entry and advance by 0x28 bytes.
+        //
+        sii = (ntfs_attr_sii*)sii_data_ptr;
+        int data_off = tsk_getu16(fs->endian, sii->data_off);
+        int data_size = tsk_getu16(fs->endian, sii->size);
+        int ent_size = tsk_getu16(fs->endian, sii->ent_size);
+
+        // Keep the entry. It seems like we could have a check here that the first two fields are 0x14
+        // but we don't know for sure that not having those indicates an invalid entry.
+        NtfsSecIndexEntry entry;
+        entry.sec_id = tsk_getu32(fs->endian, sii->key_sec_id);
+        entry.hash = tsk_getu32(fs->endian, sii->data_hash_sec_desc);
+        entry.sds_off = tsk_getu64(fs->endian, sii->sec_desc_off);
+        entry.size = tsk_getu32(fs->endian, sii->sec_desc_size);
+        a_entries.push_back(entry);
+
+        // Advance the pointer
+        if (ent_size == 0x30 || (data_off == 0 && data_size == 0 && ent_size == 0x18)) {
+            sii_data_ptr += 0x30;
         }
-
-        // get pointer to first record
-		uint8_t* sii_data_ptr = ((uint8_t*)& idxrec->list +
-			tsk_getu32(fs->endian, idxrec->list.begin_off));
-
-        // where last record ends
-        idx_buffer_end = (uint8_t*) & idxrec->list +
-            tsk_getu32(fs->endian, idxrec->list.bufend_off);
-
-
-        // copy records into NTFS_INFO
-		while (sii_data_ptr + sizeof(ntfs_attr_sii) <= idx_buffer_end) {
-			/* make sure we don't go over bounds of ntfs->sii_data.buffer */
-			if ((ntfs->sii_data.used + 1) * sizeof(ntfs_attr_sii) > ntfs->sii_data.size) {
-				if (tsk_verbose)
-					tsk_fprintf(stderr, "ntfs_proc_sii: data buffer too small\n");
-				return; // reached end of ntfs->sii_data.buffer
-			}
-
-			// It appears that perhaps older versions of NTFS always had entries of length 0x28. Now it appears we also can
-			// have entries of length 0x30. And there are also some entries that take up 0x28 bytes but have their length set to 0x10.
-
-			// 1400140000000000280004000000000002110000f233505302110000a026320000000000ec000000  // Normal entry of length 0x28
-			// 0000000000000000100000000200000003110000a65c02000311000090273200000000005c010000  // Possibly deleted? entry of length 0x28 but reporting length 0x10
-			// 140014000000000030000400010000001d150000abb032671d150000805a3a0000000000e80000006800000000000000  // Entry of length 0x30. Unclear what the eight final bytes are
-			// 00000000000000001800000003001b00540000000000000067110000a0823200000000003c0100005400000000000000  // I think this is the possibly deleted form of a long entry
-			//
-			// I haven't been able to find any documentation of what's going on - it's all old and says the entry length will be 0x28. The flags
-			// are also different across these three types but I also can't find any documentation on what they mean. So this is a best guess on
-			// how we should handle things:
-			// - If the length field is 0x30 or the first two fields are null and the length is 0x18, save the entry and advance 0x30 bytes.
-			//         The last eight bytes on the long entries will be ignored.
-			// - Otherwise save the entry and advance by 0x28 bytes.
-			//
-			sii = (ntfs_attr_sii*)sii_data_ptr;
-			int data_off = tsk_getu16(fs->endian, sii->data_off);
-			int data_size = tsk_getu16(fs->endian, sii->size);
-			int ent_size = tsk_getu16(fs->endian, sii->ent_size);
-
-			// Copy the entry. It seems like we could have a check here that the first two fields are 0x14
-			// but we don't know for sure that not having those indicates an invalid entry.
-			memcpy(ntfs->sii_data.buffer +
-				(ntfs->sii_data.used * sizeof(ntfs_attr_sii)), sii_data_ptr,
-				sizeof(ntfs_attr_sii));
-			ntfs->sii_data.used++;
-
-			// Advance the pointer
-			if (ent_size == 0x30 || (data_off == 0 && data_size == 0 && ent_size == 0x18)) {
-				sii_data_ptr += 0x30;
-			}
-			else {
-				sii_data_ptr += 0x28;
-			}
-
-/*
-				printf("Security id %d is at offset 0x%I64x for 0x%x bytes\n", tsk_getu32(fs->endian,sii->key_sec_id),
-																		   tsk_getu64(fs->endian,sii->sec_desc_off),
-																		   tsk_getu32(fs->endian,sii->sec_desc_size));
-			}
-			else
-			{
-				printf("\n\tOffset to data %x Size of data %x Size of Index entry %x\n", tsk_getu16(fs->endian,sii->data_off),
-																					 tsk_getu16(fs->endian,sii->size),
-																					 tsk_getu16(fs->endian,sii->ent_size));
-				printf("\tSecurity id %d is at offset 0x%I64x for 0x%x bytes\n\n", tsk_getu32(fs->endian,sii->key_sec_id),
-																		   tsk_getu64(fs->endian,sii->sec_desc_off),
-																		   tsk_getu32(fs->endian,sii->sec_desc_size));
-			}
-*/
+        else {
+            sii_data_ptr += 0x28;
         }
     }
 }
 
 
 /*
- * Load the $Secure attributes so that we can identify the user.
+ * Index the $Secure attributes so that we can identify the user.  Only
+ * the $SII entries are kept (in ntfs->sec_index); the security
+ * descriptors in $SDS are read by ntfs_get_sds() when they are needed.
+ * ntfs->sec_index stays NULL if the volume has no usable $Secure.
  *
- * Note: This routine is called only from ntfs_open and therefore does
- * not need to lock ntfs->sid_lock.
+ * Note: This routine assumes &ntfs->sid_lock is locked by the caller.
  *
  * @returns 1 on error (which occurs only if malloc or other system error).
  */
@@ -3861,16 +4417,9 @@ ntfs_load_secure(NTFS_INFO * ntfs)
     TSK_FS_META *fs_meta = NULL;
     const TSK_FS_ATTR *fs_attr_sds = NULL;
     const TSK_FS_ATTR *fs_attr_sii = NULL;
-    NTFS_SXX_BUFFER sii_buffer;
     ssize_t cnt;
 
-    ntfs->sii_data.buffer = NULL;
-    ntfs->sii_data.size = 0;
-    ntfs->sii_data.used = 0;
-    ntfs->sds_data.buffer = NULL;
-    ntfs->sds_data.size = 0;
-    ntfs->sds_data.used = 0;
-
+    ntfs->sec_index_loaded = 1;
 
     // Open $Secure. The $SDS stream contains all the security descriptors
     // and is indexed by $SII and $SDH.
@@ -3922,103 +4471,78 @@ ntfs_load_secure(NTFS_INFO * ntfs)
         return 0;
     }
 
-    /* First we read in $SII to a local buffer adn then process it into NTFS_INFO */
-
-    // Allocate local space for the entire $SII stream.
-    sii_buffer.size = (size_t) roundup(fs_attr_sii->size, fs->block_size);
-    sii_buffer.used = 0;
-
     // arbitrary check because we had problems before with alloc too much memory
-    if (sii_buffer.size > 64000000) {
+    if ((fs_attr_sii->size > 64000000)
+        || (ntfs->idx_rsize_b < sizeof(ntfs_idxrec))) {
         if (tsk_verbose)
             tsk_fprintf(stderr,
-                "ntfs_load_secure: sii_buffer.size is too large: %z\n",
-                sii_buffer.size);
+                "ntfs_load_secure: $SII size is invalid: %" PRIdOFF "\n",
+                fs_attr_sii->size);
         return 0;
     }
-    if ((sii_buffer.buffer = (char*) tsk_malloc(sii_buffer.size)) == NULL) {
-        return 1;
-    }
 
-    // Read in the raw $SII stream.
-    cnt =
-        tsk_fs_attr_read(fs_attr_sii, 0, sii_buffer.buffer,
-        sii_buffer.size, TSK_FS_FILE_READ_FLAG_NONE);
-    if (cnt != (ssize_t)sii_buffer.size) {
-        if (tsk_verbose)
-            tsk_fprintf(stderr,
-                "ntfs_load_secure: error reading $Secure:$SII attribute: %s\n",
-                tsk_error_get_errstr());
+    std::unique_ptr<NtfsSecIndex> index(new(std::nothrow) NtfsSecIndex);
+    if (!index) {
         tsk_error_reset();
-
-        free(sii_buffer.buffer);
-        return 0;
-    }
-
-    // allocate the structure for the processed version of the data
-    ntfs->sii_data.used = 0;    // use this to count the number of $SII entries
-    if ((ntfs->sii_data.buffer =
-            (char *) tsk_malloc(sii_buffer.size)) == NULL) {
-        free(sii_buffer.buffer);
+        tsk_error_set_errno(TSK_ERR_AUX_MALLOC);
+        tsk_error_set_errstr("ntfs_load_secure: error allocating index");
         return 1;
     }
-    ntfs->sii_data.size = sii_buffer.size;
 
-    // parse sii_buffer into ntfs->sii_data.
-    ntfs_proc_sii(fs, &sii_buffer);
-    free(sii_buffer.buffer);
+    // Read $SII one index record at a time and keep only its entries
+    try {
+        std::vector<uint8_t> rec(ntfs->idx_rsize_b);
 
-    /* Now we copy $SDS into NTFS_INFO. We do not do any processing in this step. */
+        for (TSK_OFF_T off = 0; off < fs_attr_sii->size;
+            off += ntfs->idx_rsize_b) {
+            ntfs_idxrec *idxrec = (ntfs_idxrec *) rec.data();
 
-    // Allocate space for the entire $SDS stream with all the security
-    // descriptors. We should be able to use the $SII offset to index
-    // into the $SDS stream.
-    ntfs->sds_data.size = (size_t) fs_attr_sds->size;
-    // arbitrary check because we had problems before with alloc too much memory
-    if (ntfs->sds_data.size > 64000000) {
-        if (tsk_verbose)
-            tsk_fprintf(stderr,
-                "ntfs_load_secure: ntfs->sds_data.size is too large: %z\n",
-                ntfs->sds_data.size);
-        free(ntfs->sii_data.buffer);
-        ntfs->sii_data.buffer = NULL;
-        ntfs->sii_data.used = 0;
-        ntfs->sii_data.size = 0;
-        return 0;
+            std::fill(rec.begin(), rec.end(), 0);
+            cnt = tsk_fs_attr_read(fs_attr_sii, off, (char *) rec.data(),
+                rec.size(), TSK_FS_FILE_READ_FLAG_NONE);
+            if (cnt <= 0) {
+                if (tsk_verbose)
+                    tsk_fprintf(stderr,
+                        "ntfs_load_secure: error reading $Secure:$SII attribute: %s\n",
+                        tsk_error_get_errstr());
+                tsk_error_reset();
+                return 0;
+            }
+
+            // skip unused records and remove the update sequence
+            if (tsk_getu32(fs->endian, idxrec->magic) != NTFS_IDXREC_MAGIC)
+                continue;
+            if (ntfs_fix_idxrec(ntfs, idxrec, (uint32_t) rec.size())) {
+                if (tsk_verbose)
+                    tsk_fprintf(stderr,
+                        "ntfs_load_secure: $SII record at %" PRIdOFF
+                        ": %s\n", off, tsk_error_get_errstr());
+                tsk_error_reset();
+            }
+            ntfs_proc_sii(fs, idxrec, index->entries);
+        }
+
+        std::stable_sort(index->entries.begin(), index->entries.end(),
+            [](const NtfsSecIndexEntry &a, const NtfsSecIndexEntry &b) {
+                return a.sec_id < b.sec_id;
+            });
+        index->entries.shrink_to_fit();
     }
-    ntfs->sds_data.used = 0;
-    if ((ntfs->sds_data.buffer =
-            (char *) tsk_malloc(ntfs->sds_data.size)) == NULL) {
-        free(ntfs->sii_data.buffer);
-        ntfs->sii_data.buffer = NULL;
-        ntfs->sii_data.used = 0;
-        ntfs->sii_data.size = 0;
+    catch (const std::bad_alloc &) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_AUX_MALLOC);
+        tsk_error_set_errstr("ntfs_load_secure: error allocating index");
         return 1;
     }
 
-    // Read in the raw $SDS ($DATA) stream.
-    cnt =
-        tsk_fs_attr_read(fs_attr_sds, 0,
-        ntfs->sds_data.buffer, ntfs->sds_data.size,
-        TSK_FS_FILE_READ_FLAG_NONE);
-    if (cnt != (ssize_t)ntfs->sds_data.size) {
-        if (tsk_verbose)
-            tsk_fprintf(stderr,
-                "ntfs_load_secure: error reading $Secure:$SDS attribute: %s\n",
-                tsk_error_get_errstr());
-        tsk_error_reset();
-
-        free(ntfs->sii_data.buffer);
-        ntfs->sii_data.buffer = NULL;
-        ntfs->sii_data.used = 0;
-        ntfs->sii_data.size = 0;
-        free(ntfs->sds_data.buffer);
-        ntfs->sds_data.buffer = NULL;
-        ntfs->sds_data.used = 0;
-        ntfs->sds_data.size = 0;
-        return 0;
-    }
+    if (tsk_verbose)
+        tsk_fprintf(stderr,
+            "ntfs_load_secure: %" PRIuSIZE " $SII entries\n", index->entries.size());
 
+    // $SDS stays open for ntfs_get_sds()
+    index->fs_attr_sds = fs_attr_sds;
+    index->secure = secure.release();
+    ntfs->sec_index = index.release();
     return 0;
 }
 
@@ -4065,6 +4589,7 @@ ntfs_block_walk(TSK_FS_INFO * fs,
     const char *myname = "ntfs_block_walk";
     NTFS_INFO *ntfs = (NTFS_INFO *) fs;
     TSK_DADDR_T addr;
+    TSK_DADDR_T run_end;
     TSK_FS_BLOCK *fs_block;
 
     // clean up any error messages that are lying around
@@ -4106,8 +4631,9 @@ ntfs_block_walk(TSK_FS_INFO * fs,
         return 1;
     }
 
-    /* Cycle through the blocks */
-    for (addr = a_start_blk; addr <= a_end_blk; addr++) {
+    /* Cycle through the blocks a run of equal allocation status at a
+     * time, skipping the runs that are not wanted */
+    for (addr = a_start_blk; addr <= a_end_blk; addr = run_end + 1) {
         int retval;
         int myflags;
 
@@ -4125,7 +4651,15 @@ ntfs_block_walk(TSK_FS_INFO * fs,
             myflags = TSK_FS_BLOCK_FLAG_UNALLOC;
         }
 
-        // test if we should call the callback with this one
+        if (ntfs->loading_the_MFT == 1) {
+            run_end = addr;
+        }
+        else if (ntfs_bmap_run_end(ntfs, addr, a_end_blk, retval, &run_end)) {
+            tsk_fs_block_free(fs_block);
+            return 1;
+        }
+
+        // test if we should call the callback with this run
         if ((myflags & TSK_FS_BLOCK_FLAG_ALLOC)
             && (!(a_flags & TSK_FS_BLOCK_WALK_FLAG_ALLOC)))
             continue;
@@ -4136,22 +4670,25 @@ ntfs_block_walk(TSK_FS_INFO * fs,
         if (a_flags & TSK_FS_BLOCK_WALK_FLAG_AONLY)
             myflags |= TSK_FS_BLOCK_FLAG_AONLY;
 
-        if (tsk_fs_block_get_flag(fs, fs_block, addr,
-                (TSK_FS_BLOCK_FLAG_ENUM) myflags) == NULL) {
-            tsk_error_set_errstr2
-                ("ntfs_block_walk: Error reading block at %" PRIuDADDR,
-                addr);
-            tsk_fs_block_free(fs_block);
-            return 1;
-        }
+        for (TSK_DADDR_T blk = addr; blk <= run_end; blk++) {
+            if (tsk_fs_block_get_flag(fs, fs_block, blk,
+                    (TSK_FS_BLOCK_FLAG_ENUM) myflags) == NULL) {
+                tsk_error_set_errstr2
+                    ("ntfs_block_walk: Error reading block at %" PRIuDADDR,
+                    blk);
+                tsk_fs_block_free(fs_block);
+                return 1;
+            }
 
-        retval = a_action(fs_block, a_ptr);
-        if (retval == TSK_WALK_STOP) {
-            break;
-        }
-        else if (retval == TSK_WALK_ERROR) {
-            tsk_fs_block_free(fs_block);
-            return 1;
+            retval = a_action(fs_block, a_ptr);
+            if (retval == TSK_WALK_STOP) {
+                tsk_fs_block_free(fs_block);
+                return 0;
+            }
+            else if (retval == TSK_WALK_ERROR) {
+                tsk_fs_block_free(fs_block);
+                return 1;
+            }
         }
     }
 
@@ -4161,6 +4698,180 @@ ntfs_block_walk(TSK_FS_INFO * fs,
 
 
 
+/* Most bytes of $MFT that ntfs_inode_walk() reads at a time */
+#define NTFS_MFT_SCAN_SIZE (4 * 1024 * 1024)
+
+/** \internal
+ * Reads consecutive MFT entries for ntfs_inode_walk().  Entries are read
+ * in large chunks straight from the runs of $MFT and fixed up a chunk at a
+ * time, instead of looking up and reading each entry on its own.  Entries
+ * that cannot be read this way (such as those that cross a run) go through
+ * ntfs_dinode_lookup().
+ */
+typedef struct {
+    NTFS_INFO *ntfs;
+    const TSK_FS_ATTR_RUN *run; ///< $MFT run that the last chunk came from
+    TSK_OFF_T run_off;          ///< Byte offset of run in $MFT
+    char *buf;                  ///< Fixed-up entries of the current chunk
+    TSK_RETVAL_ENUM *buf_ret;   ///< ntfs_mft_fixup() result for each entry in buf
+    size_t buf_max;             ///< Number of entries that fit in buf
+    size_t buf_cnt;             ///< Number of entries in buf
+    TSK_INUM_T buf_first;       ///< Address of the first entry in buf
+    TSK_OFF_T buf_addr;         ///< Byte address of buf in the file system
+    char *one;                  ///< Entry read with ntfs_dinode_lookup()
+} NTFS_MFT_SCAN;
+
+static void
+ntfs_mft_scan_free(NTFS_MFT_SCAN * a_scan)
+{
+    free(a_scan->buf);
+    free(a_scan->buf_ret);
+    free(a_scan->one);
+    a_scan->buf = NULL;
+    a_scan->buf_ret = NULL;
+    a_scan->one = NULL;
+}
+
+/**
+ * \internal
+ * Set up a scan of MFT entries a_start to a_end.
+ * @returns 1 on error
+ */
+static uint8_t
+ntfs_mft_scan_init(NTFS_MFT_SCAN * a_scan, NTFS_INFO * a_ntfs,
+    TSK_INUM_T a_start, TSK_INUM_T a_end)
+{
+    memset(a_scan, 0, sizeof(NTFS_MFT_SCAN));
+    a_scan->ntfs = a_ntfs;
+
+    a_scan->buf_max = NTFS_MFT_SCAN_SIZE / a_ntfs->mft_rsize_b;
+    if (a_scan->buf_max == 0)
+        a_scan->buf_max = 1;
+    if ((a_end >= a_start) && (a_end - a_start < a_scan->buf_max))
+        a_scan->buf_max = (size_t) (a_end - a_start + 1);
+
+    if (((a_scan->buf =
+                (char *) tsk_malloc(a_scan->buf_max *
+                    a_ntfs->mft_rsize_b)) == NULL)
+        || ((a_scan->buf_ret =
+                (TSK_RETVAL_ENUM *) tsk_malloc(a_scan->buf_max *
+                    sizeof(TSK_RETVAL_ENUM))) == NULL)
+        || ((a_scan->one =
+                (char *) tsk_malloc(a_ntfs->mft_rsize_b)) == NULL)) {
+        ntfs_mft_scan_free(a_scan);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * \internal
+ * Read the chunk of entries that starts at a_mftnum and ends at a_last or
+ * the end of the $MFT run that a_mftnum is in (whichever comes first).
+ * @returns 1 if the entry must be read with ntfs_dinode_lookup() instead
+ */
+static uint8_t
+ntfs_mft_scan_load(NTFS_MFT_SCAN * a_scan, TSK_INUM_T a_mftnum,
+    TSK_INUM_T a_last)
+{
+    NTFS_INFO *ntfs = a_scan->ntfs;
+    const TSK_OFF_T offset = a_mftnum * ntfs->mft_rsize_b;
+    const TSK_FS_ATTR_RUN *run = a_scan->run;
+    TSK_OFF_T run_off = a_scan->run_off;
+    TSK_OFF_T run_len = 0;
+
+    if (ntfs->mft_data == NULL)
+        return 1;
+
+    // entries are usually asked for in order, so start from the last run
+    if ((run == NULL) || (offset < run_off)) {
+        run = ntfs->mft_data->nrd.run;
+        run_off = 0;
+    }
+    for (; run != NULL; run = run->next) {
+        if (run->len >= (TSK_DADDR_T) (LLONG_MAX / ntfs->csize_b))
+            return 1;
+        run_len = run->len * ntfs->csize_b;
+        if (offset < run_off + run_len)
+            break;
+        run_off += run_len;
+    }
+    if (run == NULL)
+        return 1;
+    a_scan->run = run;
+    a_scan->run_off = run_off;
+
+    if (run->flags & (TSK_FS_ATTR_RUN_FLAG_SPARSE | TSK_FS_ATTR_RUN_FLAG_FILLER))
+        return 1;
+
+    // only whole entries (an entry can cross into the next run)
+    size_t cnt = (size_t) ((run_off + run_len - offset) / ntfs->mft_rsize_b);
+    if (cnt > a_scan->buf_max)
+        cnt = a_scan->buf_max;
+    if ((a_last >= a_mftnum) && (a_last - a_mftnum + 1 < cnt))
+        cnt = (size_t) (a_last - a_mftnum + 1);
+    if (cnt == 0)
+        return 1;
+
+    TSK_OFF_T addr = run->addr * ntfs->csize_b + (offset - run_off);
+    size_t len = cnt * ntfs->mft_rsize_b;
+    ssize_t rcnt = tsk_fs_read(&ntfs->fs_info, addr, a_scan->buf, len);
+    if (rcnt != (ssize_t) len) {
+        tsk_error_reset();
+        a_scan->buf_cnt = 0;
+        return 1;
+    }
+
+    for (size_t i = 0; i < cnt; i++) {
+        a_scan->buf_ret[i] = ntfs_mft_fixup(ntfs,
+            &a_scan->buf[i * ntfs->mft_rsize_b]);
+        if (a_scan->buf_ret[i] != TSK_OK) {
+            if (tsk_verbose) {
+                tsk_fprintf(stderr, "ntfs_mft_scan_load: MFT entry %"
+                    PRIuINUM ": ", a_mftnum + i);
+                tsk_error_print(stderr);
+            }
+            tsk_error_reset();
+        }
+    }
+    a_scan->buf_first = a_mftnum;
+    a_scan->buf_cnt = cnt;
+    a_scan->buf_addr = addr;
+    return 0;
+}
+
+/**
+ * \internal
+ * Get a fixed-up MFT entry.  Entries up to a_last may be read ahead.
+ *
+ * @param a_scan Scan to get the entry from
+ * @param a_mftnum Address of the entry
+ * @param a_last Last entry that the caller will ask for
+ * @param a_mft Set to the entry, which is valid until the next call
+ * @param a_addr Set to the within-file-system byte address of the entry
+ * @returns TSK_OK, TSK_COR if the entry is corrupt (with no error set if
+ * it was reported in verbose output when its chunk was read) or TSK_ERR
+ */
+static TSK_RETVAL_ENUM
+ntfs_mft_scan_get(NTFS_MFT_SCAN * a_scan, TSK_INUM_T a_mftnum,
+    TSK_INUM_T a_last, ntfs_mft ** a_mft, TSK_OFF_T * a_addr)
+{
+    NTFS_INFO *ntfs = a_scan->ntfs;
+
+    if (((a_mftnum < a_scan->buf_first)
+            || (a_mftnum - a_scan->buf_first >= a_scan->buf_cnt))
+        && (ntfs_mft_scan_load(a_scan, a_mftnum, a_last))) {
+        *a_mft = (ntfs_mft *) a_scan->one;
+        return ntfs_dinode_lookup(ntfs, a_scan->one, a_mftnum, a_addr);
+    }
+
+    size_t i = (size_t) (a_mftnum - a_scan->buf_first);
+    *a_mft = (ntfs_mft *) & a_scan->buf[i * ntfs->mft_rsize_b];
+    *a_addr = a_scan->buf_addr + i * ntfs->mft_rsize_b;
+    return a_scan->buf_ret[i];
+}
+
+
 /*
  * inode_walk
  *
@@ -4181,6 +4892,7 @@ ntfs_inode_walk(TSK_FS_INFO * fs, TSK_INUM_T start_inum,
     TSK_INUM_T mftnum;
     TSK_INUM_T end_inum_tmp;
     ntfs_mft *mft;
+    NTFS_MFT_SCAN scan;
     /*
      * Sanity checks.
      */
@@ -4266,9 +4978,6 @@ ntfs_inode_walk(TSK_FS_INFO * fs, TSK_INUM_T start_inum,
         return 1;
     }
 
-    if ((mft = (ntfs_mft *) tsk_malloc(ntfs->mft_rsize_b)) == NULL) {
-        return 1;
-    }
     // we need to handle fs->last_inum specially because it is for the
     // virtual ORPHANS directory.  Handle it outside of the loop.
     if (end_inum == TSK_FS_ORPHANDIR_INUM(fs))
@@ -4276,15 +4985,19 @@ ntfs_inode_walk(TSK_FS_INFO * fs, TSK_INUM_T start_inum,
     else
         end_inum_tmp = end_inum;
 
+    if (ntfs_mft_scan_init(&scan, ntfs, start_inum, end_inum_tmp)) {
+        return 1;
+    }
+
 
     for (mftnum = start_inum; mftnum <= end_inum_tmp; mftnum++) {
         int retval;
         TSK_RETVAL_ENUM retval2;
 
-        /* read MFT entry in to NTFS_INFO */
+        /* get the fixed-up MFT entry */
         if ((retval2 =
-                ntfs_dinode_lookup(ntfs, (char *) mft,
-                    mftnum, & (fs_file->meta->start_of_inode))) != TSK_OK) {
+                ntfs_mft_scan_get(&scan, mftnum, end_inum_tmp, &mft,
+                    & (fs_file->meta->start_of_inode))) != TSK_OK) {
             // if the entry is corrupt, then skip to the next one
             if (retval2 == TSK_COR) {
                 if (tsk_verbose)
@@ -4292,7 +5005,7 @@ ntfs_inode_walk(TSK_FS_INFO * fs, TSK_INUM_T start_inum,
                 tsk_error_reset();
                 continue;
             }
-            free(mft);
+            ntfs_mft_scan_free(&scan);
             return 1;
         }
 
@@ -4331,7 +5044,7 @@ ntfs_inode_walk(TSK_FS_INFO * fs, TSK_INUM_T start_inum,
                 tsk_error_reset();
                 continue;
             }
-            free(mft);
+            ntfs_mft_scan_free(&scan);
             return 1;
         }
 
@@ -4344,11 +5057,11 @@ ntfs_inode_walk(TSK_FS_INFO * fs, TSK_INUM_T start_inum,
         /* call action */
         retval = a_action(fs_file.get(), ptr);
         if (retval == TSK_WALK_STOP) {
-            free(mft);
+            ntfs_mft_scan_free(&scan);
             return 0;
         }
         else if (retval == TSK_WALK_ERROR) {
-            free(mft);
+            ntfs_mft_scan_free(&scan);
             return 1;
         }
     }
@@ -4360,22 +5073,22 @@ ntfs_inode_walk(TSK_FS_INFO * fs, TSK_INUM_T start_inum,
         int retval;
 
         if (tsk_fs_dir_make_orphan_dir_meta(fs, fs_file->meta)) {
-            free(mft);
+            ntfs_mft_scan_free(&scan);
             return 1;
         }
         /* call action */
         retval = a_action(fs_file.get(), ptr);
         if (retval == TSK_WALK_STOP) {
-            free(mft);
+            ntfs_mft_scan_free(&scan);
             return 0;
         }
         else if (retval == TSK_WALK_ERROR) {
-            free(mft);
+            ntfs_mft_scan_free(&scan);
             return 1;
         }
     }
 
-    free(mft);
+    ntfs_mft_scan_free(&scan);
     return 0;
 }
 
@@ -5184,18 +5897,19 @@ ntfs_close(TSK_FS_INFO * fs)
         return;
 
 #if TSK_USE_SID
-    free(ntfs->sii_data.buffer);
-    ntfs->sii_data.buffer = NULL;
-
-    free(ntfs->sds_data.buffer);
-    ntfs->sds_data.buffer = NULL;
-
+    delete (NtfsSecIndex *) ntfs->sec_index;
+    ntfs->sec_index = NULL;
 #endif
 
     fs->tag = 0;
+#ifdef TSK_MULTITHREAD_LIB
+    delete (NtfsCompPool *) ntfs->comp_pool;
+    ntfs->comp_pool = NULL;
+#endif
     free(ntfs->fs);
     tsk_fs_attr_run_free(ntfs->bmap);
-    free(ntfs->bmap_buf);
+    ntfs_bmap_cache_free(ntfs);
+    free(ntfs->upcase);
     tsk_fs_file_close(ntfs->mft_file);
 
     if (ntfs->orphan_map)
@@ -5246,6 +5960,23 @@ process_kape_boot_format(NTFS_INFO* ntfs_info) {
     return 1;
 }
 
+/**
+ * \internal
+ * Signature check for file system auto-detection.  ntfs_open() needs the
+ * boot sector magic value, the "NTFS" OEM name (KAPE VHDs) or a BitLocker
+ * signature.
+ *
+ * @param a_probe Start of the volume
+ * @returns 0 if the volume cannot be opened as this type and 1 if it may
+ */
+uint8_t
+ntfs_probe(const TSK_FS_PROBE * a_probe)
+{
+    return tsk_fs_probe_bytes(a_probe, offsetof(ntfs_sb, oemname), "-FVE-FS-", 8)
+        || tsk_fs_probe_bytes(a_probe, offsetof(ntfs_sb, oemname), "NTFS    ", 8)
+        || tsk_fs_probe_u16(a_probe, offsetof(ntfs_sb, magic), NTFS_FS_MAGIC);
+}
+
 /**
  * Open part of a disk image as an NTFS file system.
  *
@@ -5304,7 +6035,10 @@ ntfs_open(
 
     ntfs->loading_the_MFT = 0;
     ntfs->bmap = NULL;
-    ntfs->bmap_buf = NULL;
+    ntfs->bmap_cache = NULL;
+    ntfs->comp_pool = NULL;
+    ntfs->upcase = NULL;
+    ntfs->upcase_loaded = 0;
 
     // Check for any volume encryption and initialize if found.
     // A non-zero value will only be returned if we are very confident encryption was found
@@ -5483,6 +6217,7 @@ ntfs_open(
 
     fs->file_add_meta = ntfs_inode_lookup;
     fs->dir_open_meta = ntfs_dir_open_meta;
+    fs->dir_lookup = ntfs_dir_lookup;
     fs->fsstat = ntfs_fsstat;
     fs->fscheck = ntfs_fscheck;
     fs->istat = ntfs_istat;
@@ -5568,16 +6303,11 @@ ntfs_open(
         goto on_error;
     }
 
-    /* load the SID data into ntfs_info ($Secure - $SDS, $SDH, $SII */
-
-
+    /* the SID data ($Secure - $SDS, $SII) is indexed when it is first
+     * needed, see ntfs_get_sds() */
 #if TSK_USE_SID
-    if (ntfs_load_secure(ntfs)) {
-        if (tsk_verbose)
-            fprintf(stderr, "ntfs_open: Error loading Secure Info (%s)\n",
-                tsk_error_get());
-        goto on_error;
-    }
+    ntfs->sec_index = NULL;
+    ntfs->sec_index_loaded = 0;
 #endif
 
     // initialize the caches
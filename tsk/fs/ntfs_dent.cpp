@@ -25,6 +25,7 @@
  * NTFS file name processing internal functions.
  */
 
+#include <cstddef>
 #include <memory>
 #include <unordered_map>
 #include <vector>
@@ -658,7 +659,7 @@ ntfs_proc_idxentry(NTFS_INFO * a_ntfs, TSK_FS_DIR * a_fs_dir,
  *
  * return 1 on error and 0 on success
  */
-static uint8_t
+uint8_t
 ntfs_fix_idxrec(NTFS_INFO * ntfs, ntfs_idxrec * idxrec, uint32_t len)
 {
     int i;
@@ -1394,6 +1395,325 @@ ntfs_dir_open_meta(
 }
 
 
+/* number of entries in the $UpCase table (one for each UTF-16 code unit) */
+#define NTFS_UPCASE_LEN     65536
+
+/* deepest $I30 tree that ntfs_dir_lookup() descends */
+#define NTFS_IDX_MAX_DEPTH  32
+
+/** \internal
+ * Get the $UpCase table of the file system, which is read on first use.
+ *
+ * @param ntfs File system
+ * @returns NULL if the volume does not have a usable table
+ */
+static const uint16_t *
+ntfs_upcase_table(NTFS_INFO * ntfs)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) & ntfs->fs_info;
+    const uint16_t *table;
+    uint16_t *upcase = NULL;
+    uint8_t loaded;
+
+    tsk_take_lock(&ntfs->lock);
+    loaded = ntfs->upcase_loaded;
+    table = ntfs->upcase;
+    tsk_release_lock(&ntfs->lock);
+    if (loaded)
+        return table;
+
+    /* Read it without the lock, which the file reading code takes too.
+     * If two threads get here, the second copy is thrown away. */
+    std::unique_ptr<TSK_FS_FILE, decltype(&tsk_fs_file_close)> fs_file{
+        tsk_fs_file_open_meta(fs, NULL, NTFS_MFT_UPCASE),
+        tsk_fs_file_close
+    };
+    if (fs_file && fs_file->meta
+        && fs_file->meta->size == NTFS_UPCASE_LEN * 2) {
+        std::vector<uint8_t> buf(NTFS_UPCASE_LEN * 2);
+
+        if ((tsk_fs_file_read(fs_file.get(), 0, (char *) buf.data(),
+                    buf.size(), TSK_FS_FILE_READ_FLAG_NONE)
+                == (ssize_t) buf.size())
+            && ((upcase = (uint16_t *) tsk_malloc(buf.size())) != NULL)) {
+            for (size_t i = 0; i < NTFS_UPCASE_LEN; i++)
+                upcase[i] = tsk_getu16(fs->endian, &buf[2 * i]);
+        }
+    }
+    if (upcase == NULL) {
+        if (tsk_verbose)
+            tsk_fprintf(stderr,
+                "ntfs_upcase_table: No usable $UpCase, folding ASCII only\n");
+        tsk_error_reset();
+    }
+
+    tsk_take_lock(&ntfs->lock);
+    if (ntfs->upcase_loaded == 0) {
+        ntfs->upcase = upcase;
+        ntfs->upcase_loaded = 1;
+        upcase = NULL;
+    }
+    table = ntfs->upcase;
+    tsk_release_lock(&ntfs->lock);
+    free(upcase);
+    return table;
+}
+
+/* Compare a name with an on-disk $FILE_NAME name the way $I30 indexes are
+ * sorted: by upper case code units, then by length. */
+static int
+ntfs_idx_name_cmp(TSK_FS_INFO * fs, const uint16_t * upcase,
+    const UTF16 * name, size_t nlen, const ntfs_attr_fname * fname)
+{
+    size_t len = nlen < fname->nlen ? nlen : fname->nlen;
+
+    for (size_t i = 0; i < len; i++) {
+        uint16_t c1 = name[i];
+        uint16_t c2 = tsk_getu16(fs->endian, (uint8_t *) & fname->name + 2 * i);
+
+        if (upcase) {
+            c1 = upcase[c1];
+            c2 = upcase[c2];
+        }
+        else {
+            if ((c1 >= 'a') && (c1 <= 'z'))
+                c1 -= 'a' - 'A';
+            if ((c2 >= 'a') && (c2 <= 'z'))
+                c2 -= 'a' - 'A';
+        }
+        if (c1 != c2)
+            return c1 < c2 ? -1 : 1;
+    }
+    if (nlen != fname->nlen)
+        return nlen < fname->nlen ? -1 : 1;
+    return 0;
+}
+
+/* Check that an index entry is inside [idxe, endaddr) and that a key that
+ * is not the end marker holds a whole $FILE_NAME.
+ * @returns 1 if it is not valid */
+static uint8_t
+ntfs_idxentry_check(TSK_FS_INFO * fs, const ntfs_idxentry * idxe,
+    uintptr_t endaddr)
+{
+    uint16_t idxlen, str_len;
+
+    if ((uintptr_t) idxe + 16 > endaddr)
+        return 1;
+    idxlen = tsk_getu16(fs->endian, idxe->idxlen);
+    if ((idxlen < 16) || (idxlen % 4) || ((uintptr_t) idxe + idxlen > endaddr))
+        return 1;
+    if (idxe->flags & NTFS_IDX_SUB) {
+        if (idxlen < 24)
+            return 1;
+    }
+    if (idxe->flags & NTFS_IDX_LAST)
+        return 0;
+
+    str_len = tsk_getu16(fs->endian, idxe->strlen);
+    if ((str_len < offsetof(ntfs_attr_fname, name)) || (16 + str_len > idxlen))
+        return 1;
+    const ntfs_attr_fname *fname = (const ntfs_attr_fname *) & idxe->stream;
+    if (offsetof(ntfs_attr_fname, name) + 2 * (size_t) fname->nlen > str_len)
+        return 1;
+    return 0;
+}
+
+/** \internal
+ * Look up a name in a directory by descending its $I30 B-tree, which
+ * reads only the index records on the way from the root to the entry
+ * instead of the whole index.  Deleted names are not in the tree, so a
+ * caller that wants them too must still search the full listing from
+ * ntfs_dir_open_meta() when this does not find the name.
+ *
+ * @param a_fs File system to analyze
+ * @param a_addr Address of the directory
+ * @param a_name UTF-8 name to look for (matched with ntfs_name_cmp())
+ * @param [out] a_fs_name Set to a new name structure for the entry if it
+ * is found (free with tsk_fs_name_free())
+ * @returns TSK_OK if found, TSK_COR if the name is not in the tree or the
+ * tree cannot be used, and TSK_ERR on error
+ */
+TSK_RETVAL_ENUM
+ntfs_dir_lookup(TSK_FS_INFO * a_fs, TSK_INUM_T a_addr, const char *a_name,
+    TSK_FS_NAME ** a_fs_name)
+{
+    NTFS_INFO *ntfs = (NTFS_INFO *) a_fs;
+    const TSK_FS_ATTR *fs_attr_root;
+    const TSK_FS_ATTR *fs_attr_idx = NULL;
+    ntfs_idxroot *idxroot;
+    ntfs_idxelist *idxelist;
+    UTF16 name16[NTFS_MAXNAMLEN];
+    size_t nlen;
+    uint32_t rec_len, vcn_size;
+    uintptr_t endaddr;
+    std::vector<uint8_t> rec;
+
+    *a_fs_name = NULL;
+    if ((a_addr < a_fs->first_inum) || (a_addr > a_fs->last_inum)
+        || (a_addr == TSK_FS_ORPHANDIR_INUM(a_fs)))
+        return TSK_COR;
+
+    /* the index keys are UTF-16 */
+    {
+        const UTF8 *src = (const UTF8 *) a_name;
+        UTF16 *dst = name16;
+
+        if (tsk_UTF8toUTF16(&src, (const UTF8 *) &a_name[strlen(a_name)],
+                &dst, &name16[NTFS_MAXNAMLEN],
+                TSKstrictConversion) != TSKconversionOK)
+            return TSK_COR;
+        nlen = dst - name16;
+        if (nlen == 0)
+            return TSK_COR;
+    }
+
+    std::unique_ptr<TSK_FS_FILE, decltype(&tsk_fs_file_close)> fs_file{
+        tsk_fs_file_open_meta(a_fs, NULL, a_addr),
+        tsk_fs_file_close
+    };
+    if (!fs_file || !fs_file->meta || !fs_file->meta->attr) {
+        tsk_error_reset();
+        return TSK_COR;
+    }
+    if (!TSK_FS_IS_DIR_META(fs_file->meta->type)
+        || (fs_file->meta->flags & TSK_FS_META_FLAG_UNALLOC))
+        return TSK_COR;
+
+    fs_attr_root = tsk_fs_attrlist_get(fs_file->meta->attr,
+        TSK_FS_ATTR_TYPE_NTFS_IDXROOT);
+    if ((fs_attr_root == NULL) || (fs_attr_root->flags & TSK_FS_ATTR_NONRES)
+        || (fs_attr_root->rd.buf_size < sizeof(ntfs_idxroot))) {
+        tsk_error_reset();
+        return TSK_COR;
+    }
+    idxroot = (ntfs_idxroot *) fs_attr_root->rd.buf;
+    if (tsk_getu32(a_fs->endian, idxroot->type) != NTFS_ATYPE_FNAME)
+        return TSK_COR;
+
+    /* index records are addressed in clusters, or in 512-byte blocks if
+     * they are smaller than a cluster */
+    rec_len = tsk_getu32(a_fs->endian, idxroot->idxalloc_size_b);
+    vcn_size = (rec_len >= ntfs->csize_b) ? ntfs->csize_b : 512;
+
+    const uint16_t *upcase = ntfs_upcase_table(ntfs);
+
+    idxelist = &idxroot->list;
+    endaddr = (uintptr_t) fs_attr_root->rd.buf + fs_attr_root->rd.buf_size;
+    for (int depth = 0; depth < NTFS_IDX_MAX_DEPTH; depth++) {
+        ntfs_idxentry *idxe;
+        uint64_t vcn;
+        int cmp;
+
+        /* Verify the offset pointers */
+        if ((tsk_getu32(a_fs->endian, idxelist->seqend_off) <
+                tsk_getu32(a_fs->endian, idxelist->begin_off))
+            || ((uintptr_t) idxelist + tsk_getu32(a_fs->endian,
+                    idxelist->seqend_off) > endaddr))
+            return TSK_COR;
+        endaddr = (uintptr_t) idxelist +
+            tsk_getu32(a_fs->endian, idxelist->seqend_off);
+        idxe = (ntfs_idxentry *) ((uintptr_t) idxelist +
+            tsk_getu32(a_fs->endian, idxelist->begin_off));
+
+        /* find the first entry that does not sort before the name */
+        cmp = -1;
+        while (1) {
+            if (ntfs_idxentry_check(a_fs, idxe, endaddr))
+                return TSK_COR;
+            if (idxe->flags & NTFS_IDX_LAST)
+                break;
+            cmp = ntfs_idx_name_cmp(a_fs, upcase, name16, nlen,
+                (ntfs_attr_fname *) & idxe->stream);
+            if (cmp <= 0)
+                break;
+            idxe = (ntfs_idxentry *) ((uintptr_t) idxe +
+                tsk_getu16(a_fs->endian, idxe->idxlen));
+        }
+
+        if (cmp == 0) {
+            ntfs_attr_fname *fname = (ntfs_attr_fname *) & idxe->stream;
+            ntfs_idxentry *next;
+            TSK_FS_NAME *fs_name;
+
+            /* Leave short names and anything odd to the full listing,
+             * which pairs DOS names with their long names */
+            if ((fname->nspace == NTFS_FNAME_DOS)
+                || (tsk_getu48(a_fs->endian, fname->par_ref) != a_addr)
+                || (tsk_getu48(a_fs->endian, idxe->file_ref) < a_fs->first_inum)
+                || (tsk_getu48(a_fs->endian, idxe->file_ref) > a_fs->last_inum))
+                return TSK_COR;
+
+            if ((fs_name = tsk_fs_name_alloc(NTFS_MAXNAMLEN_UTF8, 16)) == NULL)
+                return TSK_ERR;
+            if (ntfs_dent_copy(ntfs, idxe, endaddr, fs_name)
+                || a_fs->name_cmp(a_fs, fs_name->name, a_name)) {
+                tsk_fs_name_free(fs_name);
+                return TSK_COR;
+            }
+
+            // the DOS name of a long name follows it
+            next = (ntfs_idxentry *) ((uintptr_t) idxe +
+                tsk_getu16(a_fs->endian, idxe->idxlen));
+            if ((fname->nspace != NTFS_FNAME_WINDOS)
+                && (ntfs_idxentry_check(a_fs, next, endaddr) == 0)
+                && ((next->flags & NTFS_IDX_LAST) == 0)
+                && (((ntfs_attr_fname *) & next->stream)->nspace ==
+                    NTFS_FNAME_DOS)
+                && (tsk_getu48(a_fs->endian, next->file_ref) ==
+                    fs_name->meta_addr)) {
+                ntfs_dent_copy_short_only(ntfs, next, fs_name);
+            }
+
+            fs_name->flags = TSK_FS_NAME_FLAG_ALLOC;
+            fs_name->par_addr = a_addr;
+            fs_name->par_seq = fs_file->meta->seq;
+            *a_fs_name = fs_name;
+            return TSK_OK;
+        }
+
+        /* not in this node: go down to the child before idxe */
+        if ((idxe->flags & NTFS_IDX_SUB) == 0)
+            return TSK_COR;
+        vcn = tsk_getu64(a_fs->endian, (uint8_t *) idxe +
+            tsk_getu16(a_fs->endian, idxe->idxlen) - 8);
+
+        if (fs_attr_idx == NULL) {
+            fs_attr_idx = tsk_fs_attrlist_get(fs_file->meta->attr,
+                TSK_FS_ATTR_TYPE_NTFS_IDXALLOC);
+            if ((fs_attr_idx == NULL) || (fs_attr_idx->flags & TSK_FS_ATTR_RES)
+                || (rec_len < sizeof(ntfs_idxrec)) || (rec_len % 512)
+                || (rec_len > 64 * 1024)) {
+                tsk_error_reset();
+                return TSK_COR;
+            }
+            rec.resize(rec_len);
+        }
+        if ((vcn > (uint64_t) fs_attr_idx->nrd.allocsize / vcn_size)
+            || (vcn * vcn_size + rec_len > (uint64_t) fs_attr_idx->nrd.allocsize))
+            return TSK_COR;
+
+        if (tsk_fs_attr_read(fs_attr_idx, (TSK_OFF_T) (vcn * vcn_size),
+                (char *) rec.data(), rec_len, TSK_FS_FILE_READ_FLAG_SLACK)
+            != (ssize_t) rec_len) {
+            tsk_error_reset();
+            return TSK_COR;
+        }
+
+        ntfs_idxrec *idxrec = (ntfs_idxrec *) rec.data();
+        if ((tsk_getu32(a_fs->endian, idxrec->magic) != NTFS_IDXREC_MAGIC)
+            || ntfs_fix_idxrec(ntfs, idxrec, rec_len)) {
+            tsk_error_reset();
+            return TSK_COR;
+        }
+        idxelist = &idxrec->list;
+        endaddr = (uintptr_t) rec.data() + rec_len;
+    }
+
+    return TSK_COR;
+}
+
+
 
 /****************************************************************************
  * FIND_FILE ROUTINES
@@ -104,6 +104,85 @@ typedef struct {
 
 #pragma pack(pop)
 
+#define QNX6_UNUSED_PTR 0xFFFFFFFFu
+
+/* Deepest pointer tree the driver will follow (same limit as the Linux driver). */
+#define QNX6_PTR_MAX_LEVELS 5
+
+/*
+ * Decoded indirect-block cache
+ *
+ * Indirect blocks are decoded once into host-order pointer arrays and kept
+ * in a small LRU cache, so resolving the pointer tree of a large file (or
+ * looking up many offsets of the same file) does not re-read them.
+ *
+ * TTL is 0 if the entry has not been used.  TTL of 1 means it was the
+ * most recently used, and TTL of QNX6_IBLK_CACHE_N means it was the least
+ * recently used.
+ */
+#define QNX6_IBLK_CACHE_N 32
+
+typedef struct {
+    tsk_lock_t lock;        /* protects everything below */
+    uint32_t refs;          /* views sharing the cache (see tsk_qnx6_open_snapshot) */
+    uint32_t fanout;        /* pointers per block (block_size / 4) */
+    uint32_t *ptrs;         /* QNX6_IBLK_CACHE_N * fanout decoded pointers */
+    uint32_t addr[QNX6_IBLK_CACHE_N];
+    uint8_t ttl[QNX6_IBLK_CACHE_N];
+} QNX6_IBLK_CACHE;
+
+/*
+ * A contiguous range of file blocks as resolved from an inode's pointer
+ * tree.  addr is a QNX6 block pointer (relative to data_start) or
+ * QNX6_UNUSED_PTR for a sparse range.
+ */
+typedef struct {
+    uint64_t offset;    /* first file block covered by the run */
+    uint64_t len;       /* number of blocks in the run */
+    uint32_t addr;
+} QNX6_RUN;
+
+typedef struct {
+    QNX6_RUN *runs;
+    size_t count;
+    size_t alloc;
+} QNX6_RUNLIST;
+
+/* Location of one long file name in QNX6FS_INFO::longname_arena. */
+typedef struct {
+    uint32_t off;
+    uint16_t len;
+} QNX6_LONGNAME;
+
+/*
+ * Block allocation bitmap
+ *
+ * The bitmap is split into chunks of QNX6_BMAP_CHUNK_BITS bits that are
+ * read on first use.  For every loaded chunk the number of set bits is
+ * kept, together with the number of set bits in front of each group of
+ * QNX6_BMAP_GROUP_BITS bits, so counting and searching for the next
+ * allocated or free block skip whole groups and chunks.  Chunks that turn
+ * out to be all free or all allocated keep no bitmap memory at all.
+ */
+#define QNX6_BMAP_CHUNK_BITS (512 * 1024)
+#define QNX6_BMAP_GROUP_BITS 512
+#define QNX6_BMAP_WORDS (QNX6_BMAP_CHUNK_BITS / 64)
+#define QNX6_BMAP_GROUPS (QNX6_BMAP_CHUNK_BITS / QNX6_BMAP_GROUP_BITS)
+
+typedef enum {
+    QNX6_BMAP_UNLOADED = 0,
+    QNX6_BMAP_MIXED,        /* words and rank are valid */
+    QNX6_BMAP_EMPTY,        /* no bit set */
+    QNX6_BMAP_FULL,         /* every bit set */
+} QNX6_BMAP_STATE;
+
+typedef struct {
+    uint64_t *words;        /* QNX6_BMAP_WORDS words, bit i is block i */
+    uint32_t *rank;         /* set bits in front of each group */
+    uint32_t count;         /* set bits in the chunk */
+    uint8_t state;          /* QNX6_BMAP_STATE */
+} QNX6_BMAP_CHUNK;
+
 typedef struct {
     TSK_FS_INFO fs_info;
     uint64_t data_start;
@@ -115,70 +194,454 @@ typedef struct {
     /* Which superblock copy was selected as active (0 = sb0, 1 = sb1). */
     uint8_t active_sb;
 
-    /* Block allocation bitmap cache (for forensically-correct ALLOC/UNALLOC). */
-    uint8_t *blkmap;          /* bitmap bytes for fs->block_count bits */
-    uint64_t blkmap_bits;     /* number of valid bits (== fs->block_count) */
-    uint64_t blkmap_bytes;    /* number of bytes (ceil(bits/8)) */
-    uint8_t  blkmap_loaded;
+    /* Image offsets of both superblock copies (sb_found[i] == 0 if absent). */
+    TSK_OFF_T sb_off[2];
+    uint8_t sb_found[2];
+
+    /* Block allocation bitmap, loaded chunk by chunk (bmap_lock). */
+    tsk_lock_t bmap_lock;
+    uint8_t bmap_init;          /* bmap_runs/bmap_base set up */
+    uint8_t bmap_missing;       /* bitmap unusable: all blocks read as allocated */
+    uint64_t bmap_bits;         /* number of valid bits (== fs->block_count) */
+    uint64_t bmap_base;         /* byte offset of our half in the bitmap file */
+    QNX6_RUNLIST bmap_runs;     /* resolved run list of the bitmap file */
+    QNX6_BMAP_CHUNK *bmap_chunks;
+    uint32_t bmap_nchunks;
+
+    /* Decoded indirect blocks of all pointer trees on this file system. */
+    QNX6_IBLK_CACHE *iblk_cache;
+
+    /* Resolved run list of the inode file (rn_inodes). */
+    QNX6_RUNLIST inode_runs;
+
+    /* Long file name table, built on first use (longname_lock). */
+    tsk_lock_t longname_lock;
+    uint8_t longname_loaded;
+    uint8_t longname_failed;    /* do not retry a load that failed */
+    QNX6_LONGNAME *longnames;   /* one entry per longfile block */
+    uint32_t longname_count;
+    char *longname_arena;       /* all names, each NUL-terminated */
 } QNX6FS_INFO;
 
-#define QNX6_UNUSED_PTR 0xFFFFFFFFu
+static int qnx6_read_img(TSK_IMG_INFO *img, TSK_OFF_T off, void *buf, size_t len) {
+    ssize_t r = tsk_img_read(img, off, (char*)buf, len);
+    return (r != (ssize_t)len);
+}
+
+static int qnx6_read_block(QNX6FS_INFO *qfs, uint32_t blk, uint8_t *out) {
+    TSK_OFF_T off = qfs->fs_info.offset + (TSK_OFF_T)qfs->data_start + (TSK_OFF_T)blk * qfs->fs_info.block_size;
+    return qnx6_read_img(qfs->fs_info.img_info, off, out, qfs->fs_info.block_size);
+}
+
+static QNX6_IBLK_CACHE *
+qnx6_iblk_cache_alloc(uint32_t block_size)
+{
+    QNX6_IBLK_CACHE *cache = (QNX6_IBLK_CACHE*)tsk_malloc(sizeof(QNX6_IBLK_CACHE));
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->fanout = block_size / 4;
+    cache->ptrs = (uint32_t*)tsk_malloc((size_t)QNX6_IBLK_CACHE_N * cache->fanout * sizeof(uint32_t));
+    if (cache->ptrs == NULL) {
+        free(cache);
+        return NULL;
+    }
+    tsk_init_lock(&cache->lock);
+    cache->refs = 1;
+    return cache;
+}
+
+static QNX6_IBLK_CACHE *
+qnx6_iblk_cache_ref(QNX6_IBLK_CACHE *cache)
+{
+    tsk_take_lock(&cache->lock);
+    cache->refs++;
+    tsk_release_lock(&cache->lock);
+    return cache;
+}
+
+static void
+qnx6_iblk_cache_free(QNX6_IBLK_CACHE *cache)
+{
+    uint32_t refs;
+
+    if (cache == NULL) {
+        return;
+    }
+    tsk_take_lock(&cache->lock);
+    refs = --cache->refs;
+    tsk_release_lock(&cache->lock);
+    if (refs) {
+        return;
+    }
+    tsk_deinit_lock(&cache->lock);
+    free(cache->ptrs);
+    free(cache);
+}
+
+/* Make entry cidx the most recently used one. */
+static void
+qnx6_iblk_cache_touch(QNX6_IBLK_CACHE *cache, int cidx)
+{
+    for (int i = 0; i < QNX6_IBLK_CACHE_N; i++) {
+        if (cache->ttl[i] == 0)
+            continue;
+        if (cache->ttl[i] < cache->ttl[cidx])
+            cache->ttl[i]++;
+    }
+    cache->ttl[cidx] = 1;
+}
+
+/*
+ * Return the cache index of the decoded indirect block blk, reading and
+ * decoding it on a miss.  Returns -1 on error.
+ *
+ * Note: This routine assumes cache->lock is locked by the caller.
+ */
+static int
+qnx6_iblk_cache_idx(QNX6FS_INFO *qfs, uint32_t blk)
+{
+    QNX6_IBLK_CACHE *cache = qfs->iblk_cache;
+    int cidx = 0;
+
+    for (int i = 0; i < QNX6_IBLK_CACHE_N; i++) {
+        if ((cache->ttl[i] > 0) && (cache->addr[i] == blk)) {
+            qnx6_iblk_cache_touch(cache, i);
+            return i;
+        }
+    }
+
+    if ((TSK_DADDR_T)blk >= qfs->fs_info.block_count) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_FS_BLK_NUM);
+        tsk_error_set_errstr("qnx6_iblk_cache_idx: indirect block %" PRIu32 " out of range", blk);
+        return -1;
+    }
+
+    // Look for an unused entry or the least recently used one
+    for (int i = 0; i < QNX6_IBLK_CACHE_N; i++) {
+        if ((cache->ttl[i] == 0) || (cache->ttl[i] >= QNX6_IBLK_CACHE_N)) {
+            cidx = i;
+        }
+    }
+
+    uint32_t *ptrs = &cache->ptrs[(size_t)cidx * cache->fanout];
+    if (qnx6_read_block(qfs, blk, (uint8_t*)ptrs)) {
+        cache->ttl[cidx] = 0;
+        tsk_error_set_errstr2("qnx6_iblk_cache_idx: indirect block %" PRIu32, blk);
+        return -1;
+    }
+    for (uint32_t i = 0; i < cache->fanout; i++) {
+        ptrs[i] = tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&ptrs[i]);
+    }
 
-#include "tsk_fs_i.h"   // fr TSK_FS_BLOCK, tsk_fs_block_alloc, tsk_fs_block_set
+    if (cache->ttl[cidx] == 0)     // special case for unused entry
+        cache->ttl[cidx] = QNX6_IBLK_CACHE_N + 1;
+    qnx6_iblk_cache_touch(cache, cidx);
+    cache->addr[cidx] = blk;
 
-static uint8_t* qnx6_read_file_bytes(QNX6FS_INFO* qfs, const uint32_t ptr0[16], uint8_t level,
-    uint64_t fsize, uint64_t offset, uint32_t size, uint32_t* out_len)
+    return cidx;
+}
+
+/* Copy the decoded pointers of indirect block blk into out (fanout entries).
+ * Returns 1 on error. */
+static uint8_t
+qnx6_iblk_get(QNX6FS_INFO *qfs, uint32_t blk, uint32_t *out)
+{
+    QNX6_IBLK_CACHE *cache = qfs->iblk_cache;
+
+    tsk_take_lock(&cache->lock);
+    int cidx = qnx6_iblk_cache_idx(qfs, blk);
+    if (cidx >= 0) {
+        memcpy(out, &cache->ptrs[(size_t)cidx * cache->fanout], cache->fanout * sizeof(uint32_t));
+    }
+    tsk_release_lock(&cache->lock);
+    return (cidx < 0) ? 1 : 0;
+}
+
+/*
+ * Ask the image layer to load the indirect blocks ptrs[0..n) in as few
+ * reads as it can before the walk visits them one at a time.  Failures are
+ * ignored; the walk reads and reports them itself.
+ */
+static void
+qnx6_prefetch_blocks(QNX6FS_INFO *qfs, const uint32_t *ptrs, uint32_t n)
+{
+    TSK_IMG_READ_REQ reqs[64];
+    size_t count = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        if (ptrs[i] == QNX6_UNUSED_PTR || (TSK_DADDR_T)ptrs[i] >= qfs->fs_info.block_count) {
+            continue;
+        }
+        reqs[count].off = qfs->fs_info.offset + (TSK_OFF_T)qfs->data_start
+            + (TSK_OFF_T)ptrs[i] * qfs->fs_info.block_size;
+        reqs[count].buf = NULL;
+        reqs[count].len = qfs->fs_info.block_size;
+        if (++count == sizeof(reqs) / sizeof(reqs[0])) {
+            if (tsk_img_readv(qfs->fs_info.img_info, reqs, count)) {
+                tsk_error_reset();
+            }
+            count = 0;
+        }
+    }
+    if (count && tsk_img_readv(qfs->fs_info.img_info, reqs, count)) {
+        tsk_error_reset();
+    }
+}
+
+/*
+ * Number of file blocks addressed by one pointer at the given depth, or 0
+ * if the 16 root pointers of such a tree would address more than 2^64
+ * blocks.
+ */
+static uint64_t qnx6_level_span(uint32_t fanout, uint8_t depth) {
+    uint64_t span = 1;
+    for (uint8_t i = 0; i < depth; i++) {
+        if (span > UINT64_MAX / 16 / fanout) return 0;
+        span *= fanout;
+    }
+    return span;
+}
+
+static void
+qnx6_runlist_free(QNX6_RUNLIST *rl)
+{
+    free(rl->runs);
+    rl->runs = NULL;
+    rl->count = 0;
+    rl->alloc = 0;
+}
+
+/* Append a run, merging it into the previous one when both are contiguous. */
+static uint8_t
+qnx6_runlist_add(QNX6_RUNLIST *rl, uint64_t offset, uint32_t addr, uint64_t len)
+{
+    if (rl->count > 0) {
+        QNX6_RUN *last = &rl->runs[rl->count - 1];
+        if (last->offset + last->len == offset) {
+            if (addr == QNX6_UNUSED_PTR && last->addr == QNX6_UNUSED_PTR) {
+                last->len += len;
+                return 0;
+            }
+            if (addr != QNX6_UNUSED_PTR && last->addr != QNX6_UNUSED_PTR
+                && (uint64_t)last->addr + last->len == addr) {
+                last->len += len;
+                return 0;
+            }
+        }
+    }
+
+    if (rl->count == rl->alloc) {
+        size_t n = rl->alloc ? rl->alloc * 2 : 16;
+        QNX6_RUN *runs = (QNX6_RUN*)tsk_realloc(rl->runs, n * sizeof(QNX6_RUN));
+        if (runs == NULL) {
+            return 1;
+        }
+        rl->runs = runs;
+        rl->alloc = n;
+    }
+
+    QNX6_RUN *r = &rl->runs[rl->count++];
+    r->offset = offset;
+    r->len = len;
+    r->addr = addr;
+    return 0;
+}
+
+typedef struct {
+    QNX6FS_INFO *qfs;
+    QNX6_RUNLIST *rl;
+    uint64_t nblocks;   /* number of file blocks to resolve */
+    uint32_t *scratch;  /* one decoded indirect block per tree level */
+} QNX6_TREE_WALK;
+
+/*
+ * Depth-first walk of the subtree below ptr, which addresses span file
+ * blocks starting at file block first.  Unused pointers produce one sparse
+ * run for their whole subtree without any I/O.
+ */
+static uint8_t
+qnx6_walk_tree(QNX6_TREE_WALK *w, uint32_t ptr, uint8_t depth, uint64_t first, uint64_t span)
+{
+    uint64_t len = w->nblocks - first;
+    if (len > span) len = span;
+
+    if (ptr == QNX6_UNUSED_PTR) {
+        return qnx6_runlist_add(w->rl, first, QNX6_UNUSED_PTR, len);
+    }
+    if (depth == 0) {
+        return qnx6_runlist_add(w->rl, first, ptr, 1);
+    }
+
+    uint32_t fanout = w->qfs->iblk_cache->fanout;
+    uint32_t *kids = &w->scratch[(size_t)(depth - 1) * fanout];
+    if (qnx6_iblk_get(w->qfs, ptr, kids)) {
+        /* Unreadable indirect blocks read back as holes, as they always have. */
+        tsk_error_reset();
+        return qnx6_runlist_add(w->rl, first, QNX6_UNUSED_PTR, len);
+    }
+
+    uint64_t child_span = span / fanout;
+    if (depth >= 2) {
+        uint64_t used = (w->nblocks - first + child_span - 1) / child_span;
+        qnx6_prefetch_blocks(w->qfs, kids, used < fanout ? (uint32_t)used : fanout);
+    }
+    for (uint32_t i = 0; i < fanout; i++) {
+        uint64_t child_first = first + (uint64_t)i * child_span;
+        if (child_first >= w->nblocks) break;
+        if (qnx6_walk_tree(w, kids[i], (uint8_t)(depth - 1), child_first, child_span)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Resolve the complete pointer tree of a file (root pointers ptr0 at the
+ * given level) into a run list covering fsize bytes.  Each indirect block
+ * is visited once.  Returns 1 on error.
+ */
+static uint8_t
+qnx6_load_runs(QNX6FS_INFO *qfs, const uint32_t ptr0[16], uint8_t level,
+    uint64_t fsize, QNX6_RUNLIST *rl)
 {
     uint32_t bs = (uint32_t)qfs->fs_info.block_size;
-    if (offset >= fsize) { *out_len = 0; return NULL; }
-    uint64_t max = fsize - offset;
-    if ((uint64_t)size > max) size = (uint32_t)max;
+    uint32_t fanout = qfs->iblk_cache->fanout;
 
-    uint8_t* buf = (uint8_t*)tsk_malloc(size);
-    if (!buf) return NULL;
+    rl->count = 0;
+    if (level > QNX6_PTR_MAX_LEVELS) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_FS_CORRUPT);
+        tsk_error_set_errstr("qnx6_load_runs: invalid pointer tree level %u", (unsigned)level);
+        return 1;
+    }
 
-    uint8_t* blkbuf = (uint8_t*)tsk_malloc(bs);
-    if (!blkbuf) { free(buf); return NULL; }
+    uint64_t nblocks = (fsize + bs - 1) / bs;
+    if (nblocks == 0) {
+        return 0;
+    }
 
-    uint64_t cur = offset;
-    uint32_t written = 0;
-    while (written < size) {
-        uint64_t blk_off = (cur / bs) * bs;
-        uint32_t ptr = qnx6_ptr_at_offset(qfs, ptr0, level, blk_off);
+    uint64_t span = qnx6_level_span(fanout, level);
+    if (span == 0) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_FS_CORRUPT);
+        tsk_error_set_errstr("qnx6_load_runs: level %u pointer tree too large for %" PRIu32 "-byte blocks",
+            (unsigned)level, bs);
+        return 1;
+    }
+
+    QNX6_TREE_WALK w;
+    w.qfs = qfs;
+    w.rl = rl;
+    w.nblocks = nblocks;
+    if (span * 16 < nblocks) {
+        w.nblocks = span * 16;
+    }
+    w.scratch = NULL;
+    if (level > 0) {
+        w.scratch = (uint32_t*)tsk_malloc((size_t)level * fanout * sizeof(uint32_t));
+        if (w.scratch == NULL) {
+            return 1;
+        }
+    }
 
-        if (ptr == QNX6_UNUSED_PTR) {
-            memset(blkbuf, 0, bs);
+    uint8_t retval = 0;
+    if (level > 0) {
+        uint32_t roots[16];
+        uint32_t n = 0;
+        for (; n < 16 && (uint64_t)n * span < w.nblocks; n++) {
+            roots[n] = tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&ptr0[n]);
         }
-        else {
-            if (qnx6_read_block(qfs, ptr, blkbuf)) { free(blkbuf); free(buf); return NULL; }
+        qnx6_prefetch_blocks(qfs, roots, n);
+    }
+    for (uint32_t i = 0; i < 16 && (uint64_t)i * span < w.nblocks; i++) {
+        uint32_t ptr = tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&ptr0[i]);
+        if (qnx6_walk_tree(&w, ptr, level, (uint64_t)i * span, span)) {
+            retval = 1;
+            break;
         }
+    }
+    free(w.scratch);
+
+    /* Blocks beyond what the root pointers can address read back as holes. */
+    if (retval == 0 && w.nblocks < nblocks) {
+        retval = qnx6_runlist_add(rl, w.nblocks, QNX6_UNUSED_PTR, nblocks - w.nblocks);
+    }
+    if (retval) {
+        qnx6_runlist_free(rl);
+    }
+    return retval;
+}
 
-        uint32_t in_blk = (uint32_t)(cur % bs);
-        uint32_t take = bs - in_blk;
-        if (take > (size - written)) take = size - written;
-        memcpy(buf + written, blkbuf + in_blk, take);
-        written += take;
-        cur += take;
+/*
+ * Read size bytes starting at byte offset of the file described by rl
+ * straight into buf.  Each run of physically contiguous blocks is fetched
+ * with a single image read and sparse ranges are zero-filled without any
+ * I/O.  Bytes past the last run read back as zeros.  Returns 1 on error.
+ */
+static uint8_t
+qnx6_read_runs(QNX6FS_INFO *qfs, const QNX6_RUNLIST *rl, uint64_t offset,
+    size_t size, uint8_t *buf)
+{
+    const uint64_t bs = qfs->fs_info.block_size;
+    uint64_t blk = offset / bs;
+
+    /* Binary search for the first run ending after blk. */
+    size_t lo = 0, hi = rl->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (rl->runs[mid].offset + rl->runs[mid].len <= blk) lo = mid + 1;
+        else hi = mid;
     }
 
-    free(blkbuf);
-    *out_len = written;
-    return buf;
+    while (size > 0) {
+        if (lo >= rl->count || rl->runs[lo].offset > offset / bs) {
+            /* Not covered by any run; the next run (if any) starts later. */
+            uint64_t hole_end = (lo < rl->count) ? rl->runs[lo].offset * bs : offset + size;
+            size_t take = (size_t)((hole_end - offset < size) ? hole_end - offset : size);
+            memset(buf, 0, take);
+            buf += take;
+            offset += take;
+            size -= take;
+            continue;
+        }
+
+        const QNX6_RUN *run = &rl->runs[lo];
+        uint64_t in_run = offset - run->offset * bs;
+        uint64_t avail = run->len * bs - in_run;
+        size_t take = (size_t)((avail < size) ? avail : size);
+
+        if (run->addr == QNX6_UNUSED_PTR) {
+            memset(buf, 0, take);
+        }
+        else {
+            TSK_OFF_T off = qfs->fs_info.offset + (TSK_OFF_T)qfs->data_start
+                + (TSK_OFF_T)run->addr * (TSK_OFF_T)bs + (TSK_OFF_T)in_run;
+            if (qnx6_read_img(qfs->fs_info.img_info, off, buf, take)) {
+                tsk_error_reset();
+                tsk_error_set_errno(TSK_ERR_FS_READ);
+                tsk_error_set_errstr("qnx6_read_runs: cannot read %" PRIuSIZE " bytes at block %" PRIu32,
+                    take, run->addr);
+                return 1;
+            }
+        }
+
+        buf += take;
+        offset += take;
+        size -= take;
+        lo++;
+    }
+    return 0;
 }
 
 static int qnx6_read_inode(QNX6FS_INFO* qfs, TSK_INUM_T inum, QNX6_INODE* out) {
     if (inum < 1 || inum > qfs->fs_info.inum_count) return 1;
     uint64_t off = (uint64_t)(inum - 1) * 128u;
-    uint32_t got = 0;
-    uint8_t* raw = qnx6_read_file_bytes(qfs, qfs->rn_inodes.ptr, qfs->rn_inodes.level, qfs->rn_inodes.size,
-        off, 128u, &got);
-    if (!raw || got != 128u) { if (raw) free(raw); return 1; }
-    memcpy(out, raw, sizeof(QNX6_INODE));
-    free(raw);
-    return 0;
+    if (off + 128u > tsk_getu64(TSK_LIT_ENDIAN, (const uint8_t*)&qfs->rn_inodes.size)) return 1;
+    return qnx6_read_runs(qfs, &qfs->inode_runs, off, sizeof(QNX6_INODE), (uint8_t*)out);
 }
 
-
 /*
  * QNX6 block allocation bitmap
  *
@@ -187,75 +650,300 @@ static int qnx6_read_inode(QNX6FS_INFO* qfs, TSK_INUM_T inum, QNX6_INODE* out) {
  *  - Bitmap may contain two halves (one per superblock/system-area generation).
  *    If present, we select the half corresponding to the active superblock.
  *  - Bit value: 1 = allocated, 0 = free (per QNX6 documentation).
+ *  - Blocks whose bitmap chunk cannot be read are reported as allocated.
  */
-static uint8_t
-qnx6fs_load_blkmap(QNX6FS_INFO* qfs)
+
+static int
+qnx6_popcount64(uint64_t w)
 {
-    if (qfs == NULL) {
-        return 1;
-    }
-    if (qfs->blkmap_loaded) {
-        return 0;
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(w);
+#else
+    w = w - ((w >> 1) & 0x5555555555555555ULL);
+    w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+    w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((w * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/* Index of the lowest set bit; w must not be 0. */
+static int
+qnx6_ctz64(uint64_t w)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(w);
+#else
+    int n = 0;
+    while ((w & 1) == 0) {
+        w >>= 1;
+        n++;
     }
+    return n;
+#endif
+}
 
-    TSK_FS_INFO* fs = &qfs->fs_info;
-    qfs->blkmap_bits = (uint64_t)fs->block_count;
-    qfs->blkmap_bytes = (qfs->blkmap_bits + 7ULL) / 8ULL;
+/*
+ * Resolve the bitmap file and size the chunk table.  Any problem leaves
+ * bmap_missing set, which makes every block read as allocated.
+ *
+ * Note: This routine assumes qfs->bmap_lock is locked by the caller.
+ */
+static void
+qnx6_bmap_setup(QNX6FS_INFO *qfs)
+{
+    TSK_FS_INFO *fs = &qfs->fs_info;
 
-    if (qfs->blkmap_bytes == 0) {
-        /* Degenerate image. Treat as loaded empty bitmap. */
-        qfs->blkmap_loaded = 1;
-        return 0;
+    qfs->bmap_init = 1;
+    qfs->bmap_bits = (uint64_t)fs->block_count;
+    qfs->bmap_nchunks = (uint32_t)((qfs->bmap_bits + QNX6_BMAP_CHUNK_BITS - 1) / QNX6_BMAP_CHUNK_BITS);
+    if (qfs->bmap_nchunks == 0) {
+        return;
     }
 
-    /* Read bitmap file bytes via the bitmap root node. */
-    uint64_t want = qfs->blkmap_bytes;
+    qfs->bmap_chunks = (QNX6_BMAP_CHUNK*)tsk_malloc(qfs->bmap_nchunks * sizeof(QNX6_BMAP_CHUNK));
+    if (qfs->bmap_chunks == NULL) {
+        qfs->bmap_nchunks = 0;
+        qfs->bmap_missing = 1;
+        return;
+    }
 
-    /* Some QNX6 images store two bitmap halves (one per superblock copy). */
-    uint64_t want2 = want * 2ULL;
+    /* Some QNX6 images store two bitmap halves (one per superblock copy);
+     * with two halves present, select ours: upper = sb0, lower = sb1. */
+    uint64_t want = (qfs->bmap_bits + 7) / 8;
     uint64_t fsize = tsk_getu64(TSK_LIT_ENDIAN, (const uint8_t*)&qfs->rn_bitmap.size);
+    if (fsize < want) {
+        if (tsk_verbose)
+            tsk_fprintf(stderr, "qnx6_bmap_setup: bitmap file smaller than expected\n");
+        qfs->bmap_missing = 1;
+        return;
+    }
+    qfs->bmap_base = (fsize >= want * 2 && qfs->active_sb != 0) ? want : 0;
 
-    uint64_t read_len = (fsize >= want2) ? want2 : ((fsize >= want) ? want : 0);
-    if (read_len == 0) {
+    if (qnx6_load_runs(qfs, qfs->rn_bitmap.ptr, qfs->rn_bitmap.level, fsize,
+            &qfs->bmap_runs)) {
+        if (tsk_verbose)
+            tsk_error_print(stderr);
         tsk_error_reset();
-        tsk_error_set_errno(TSK_ERR_FS_CORRUPT);
-        tsk_error_set_errstr("qnx6fs_load_blkmap: bitmap file smaller than expected");
-        return 1;
+        qfs->bmap_missing = 1;
+    }
+}
+
+/*
+ * Return bitmap chunk c, reading it and building its counts on first use.
+ *
+ * Note: This routine assumes qfs->bmap_lock is locked by the caller.
+ */
+static const QNX6_BMAP_CHUNK *
+qnx6_bmap_chunk(QNX6FS_INFO *qfs, uint32_t c)
+{
+    QNX6_BMAP_CHUNK *ch = &qfs->bmap_chunks[c];
+    if (ch->state != QNX6_BMAP_UNLOADED) {
+        return ch;
     }
 
-    uint32_t got = 0;
-    uint8_t* raw = qnx6_read_file_bytes(qfs, qfs->rn_bitmap.ptr, qfs->rn_bitmap.level,
-        fsize, 0, (uint32_t)read_len, &got);
-    if (raw == NULL || got != (uint32_t)read_len) {
-        if (raw) free(raw);
+    uint64_t first = (uint64_t)c * QNX6_BMAP_CHUNK_BITS;
+    uint32_t nbits = (uint32_t)((qfs->bmap_bits - first < QNX6_BMAP_CHUNK_BITS) ?
+        qfs->bmap_bits - first : QNX6_BMAP_CHUNK_BITS);
+    size_t nbytes = (nbits + 7) / 8;
+
+    ch->state = QNX6_BMAP_FULL;
+    ch->count = nbits;
+    if (qfs->bmap_missing) {
+        return ch;
+    }
+
+    uint64_t *words = (uint64_t*)tsk_malloc(QNX6_BMAP_WORDS * sizeof(uint64_t));
+    if (words == NULL ||
+        qnx6_read_runs(qfs, &qfs->bmap_runs, qfs->bmap_base + first / 8, nbytes, (uint8_t*)words)) {
+        if (tsk_verbose)
+            tsk_fprintf(stderr, "qnx6_bmap_chunk: cannot load bitmap chunk %" PRIu32 "\n", c);
         tsk_error_reset();
-        tsk_error_set_errno(TSK_ERR_FS_READ);
-        tsk_error_set_errstr("qnx6fs_load_blkmap: cannot read bitmap file");
-        return 1;
+        free(words);
+        return ch;
     }
 
-    qfs->blkmap = (uint8_t*)tsk_malloc((size_t)want);
-    if (qfs->blkmap == NULL) {
-        free(raw);
+    /* Bitmap bytes are little endian: bit i of the chunk is bit i % 64 of word i / 64. */
+    uint32_t nwords = (nbits + 63) / 64;
+    for (uint32_t i = 0; i < nwords; i++) {
+        words[i] = tsk_getu64(TSK_LIT_ENDIAN, (const uint8_t*)&words[i]);
+    }
+    if (nbits % 64) {
+        words[nwords - 1] &= (1ULL << (nbits % 64)) - 1;
+    }
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < nwords; i++) {
+        count += (uint32_t)qnx6_popcount64(words[i]);
+    }
+    ch->count = count;
+    if (count == 0 || count == nbits) {
+        ch->state = count ? QNX6_BMAP_FULL : QNX6_BMAP_EMPTY;
+        free(words);
+        return ch;
+    }
+
+    uint32_t *rank = (uint32_t*)tsk_malloc(QNX6_BMAP_GROUPS * sizeof(uint32_t));
+    if (rank == NULL) {
         tsk_error_reset();
-        tsk_error_set_errno(TSK_ERR_AUX_MALLOC);
-        tsk_error_set_errstr("qnx6fs_load_blkmap: cannot allocate bitmap cache");
-        return 1;
+        ch->count = nbits;
+        free(words);
+        return ch;
+    }
+    count = 0;
+    for (uint32_t i = 0; i < QNX6_BMAP_WORDS; i++) {
+        if (i % (QNX6_BMAP_GROUP_BITS / 64) == 0) {
+            rank[i / (QNX6_BMAP_GROUP_BITS / 64)] = count;
+        }
+        count += (uint32_t)qnx6_popcount64(words[i]);
     }
+    ch->words = words;
+    ch->rank = rank;
+    ch->state = QNX6_BMAP_MIXED;
+    return ch;
+}
 
-    if (read_len == want2) {
-        /* Select half: upper = sb0, lower = sb1. */
-        uint64_t off = (qfs->active_sb == 0) ? 0 : want;
-        memcpy(qfs->blkmap, raw + off, (size_t)want);
+/* Number of set bits in [0, i) of a loaded chunk. */
+static uint32_t
+qnx6_bmap_chunk_rank(const QNX6_BMAP_CHUNK *ch, uint32_t i)
+{
+    if (ch->state != QNX6_BMAP_MIXED) {
+        return (ch->state == QNX6_BMAP_FULL) ? i : 0;
     }
-    else {
-        /* Single bitmap present. */
-        memcpy(qfs->blkmap, raw, (size_t)want);
+    uint32_t w = i / 64;
+    uint32_t r = ch->rank[i / QNX6_BMAP_GROUP_BITS];
+    for (uint32_t k = w - w % (QNX6_BMAP_GROUP_BITS / 64); k < w; k++) {
+        r += (uint32_t)qnx6_popcount64(ch->words[k]);
+    }
+    if (i % 64) {
+        r += (uint32_t)qnx6_popcount64(ch->words[w] & ((1ULL << (i % 64)) - 1));
     }
+    return r;
+}
 
-    free(raw);
-    qfs->blkmap_loaded = 1;
-    return 0;
+/*
+ * First bit in [from, to] of a loaded chunk that equals value, or -1.
+ * Groups that hold only the other value are skipped using the rank table.
+ */
+static int64_t
+qnx6_bmap_chunk_find(const QNX6_BMAP_CHUNK *ch, uint32_t from, uint32_t to, int value)
+{
+    if (ch->state != QNX6_BMAP_MIXED) {
+        return ((ch->state == QNX6_BMAP_FULL) == (value != 0)) ? (int64_t)from : -1;
+    }
+
+    const uint32_t group_words = QNX6_BMAP_GROUP_BITS / 64;
+    const uint64_t flip = value ? 0 : UINT64_MAX;
+    uint32_t k = from / 64;
+    uint64_t w = (ch->words[k] ^ flip) & (UINT64_MAX << (from % 64));
+
+    while (1) {
+        if (w) {
+            uint32_t i = k * 64 + (uint32_t)qnx6_ctz64(w);
+            return (i <= to) ? (int64_t)i : -1;
+        }
+        if (++k > to / 64) {
+            return -1;
+        }
+        if (k % group_words == 0) {
+            /* Skip groups that cannot contain a match. */
+            while (k + group_words <= to / 64) {
+                uint32_t g = k / group_words;
+                uint32_t next = (g + 1 < QNX6_BMAP_GROUPS) ? ch->rank[g + 1] : ch->count;
+                uint32_t set = next - ch->rank[g];
+                if (set != (value ? 0 : QNX6_BMAP_GROUP_BITS)) {
+                    break;
+                }
+                k += group_words;
+            }
+        }
+        w = ch->words[k] ^ flip;
+    }
+}
+
+/* Set up the bitmap on first use; the caller holds qfs->bmap_lock. */
+#define QNX6_BMAP_ENSURE(qfs) \
+    do { if (!(qfs)->bmap_init) qnx6_bmap_setup(qfs); } while (0)
+
+/* Value of bitmap bit bit; bits past the end read as allocated. */
+static uint8_t
+qnx6_bmap_test(QNX6FS_INFO *qfs, uint64_t bit)
+{
+    uint8_t ret = 1;
+
+    tsk_take_lock(&qfs->bmap_lock);
+    QNX6_BMAP_ENSURE(qfs);
+    if (bit < qfs->bmap_bits) {
+        const QNX6_BMAP_CHUNK *ch = qnx6_bmap_chunk(qfs, (uint32_t)(bit / QNX6_BMAP_CHUNK_BITS));
+        uint32_t i = (uint32_t)(bit % QNX6_BMAP_CHUNK_BITS);
+        if (ch->state == QNX6_BMAP_MIXED)
+            ret = (uint8_t)((ch->words[i / 64] >> (i % 64)) & 1);
+        else
+            ret = (ch->state == QNX6_BMAP_FULL);
+    }
+    tsk_release_lock(&qfs->bmap_lock);
+    return ret;
+}
+
+/* Number of set (allocated) bits among bitmap bits [0, bit). */
+static uint64_t
+qnx6_bmap_rank(QNX6FS_INFO *qfs, uint64_t bit)
+{
+    uint64_t r = 0;
+
+    tsk_take_lock(&qfs->bmap_lock);
+    QNX6_BMAP_ENSURE(qfs);
+    if (bit > qfs->bmap_bits) {
+        bit = qfs->bmap_bits;
+    }
+    uint32_t c_end = (uint32_t)(bit / QNX6_BMAP_CHUNK_BITS);
+    for (uint32_t c = 0; c < c_end; c++) {
+        r += qnx6_bmap_chunk(qfs, c)->count;
+    }
+    if (bit % QNX6_BMAP_CHUNK_BITS) {
+        r += qnx6_bmap_chunk_rank(qnx6_bmap_chunk(qfs, c_end),
+            (uint32_t)(bit % QNX6_BMAP_CHUNK_BITS));
+    }
+    tsk_release_lock(&qfs->bmap_lock);
+    return r;
+}
+
+/*
+ * First bitmap bit in [bit, last] that equals value, or UINT64_MAX if there
+ * is none.  Chunks holding only the other value are skipped by their count.
+ */
+static uint64_t
+qnx6_bmap_find(QNX6FS_INFO *qfs, uint64_t bit, uint64_t last, int value)
+{
+    uint64_t ret = UINT64_MAX;
+
+    tsk_take_lock(&qfs->bmap_lock);
+    QNX6_BMAP_ENSURE(qfs);
+    if (last >= qfs->bmap_bits) {
+        last = qfs->bmap_bits - 1;
+    }
+    while (qfs->bmap_bits && bit <= last) {
+        uint32_t c = (uint32_t)(bit / QNX6_BMAP_CHUNK_BITS);
+        uint64_t first = (uint64_t)c * QNX6_BMAP_CHUNK_BITS;
+        uint64_t chunk_last = first + QNX6_BMAP_CHUNK_BITS - 1;
+        if (chunk_last > last) {
+            chunk_last = last;
+        }
+        int64_t i = qnx6_bmap_chunk_find(qnx6_bmap_chunk(qfs, c),
+            (uint32_t)(bit - first), (uint32_t)(chunk_last - first), value);
+        if (i >= 0) {
+            ret = first + (uint64_t)i;
+            break;
+        }
+        bit = chunk_last + 1;
+    }
+    tsk_release_lock(&qfs->bmap_lock);
+    return ret;
+}
+
+static TSK_DADDR_T
+qnx6_data_start_blk(QNX6FS_INFO* qfs)
+{
+    return (TSK_DADDR_T)(qfs->data_start / (uint64_t)qfs->fs_info.block_size);
 }
 
 static uint8_t
@@ -264,27 +952,46 @@ qnx6fs_blk_is_alloc(QNX6FS_INFO* qfs, TSK_DADDR_T blk)
     if (qfs == NULL) {
         return 1;
     }
-    if (blk < 0 || (uint64_t)blk >= qfs->blkmap_bits) {
-        /* Out of range bits are treated as allocated per QNX6 spec (stuffed with ones). */
+    TSK_DADDR_T data_start_blk = qnx6_data_start_blk(qfs);
+    if (blk < data_start_blk) {
         return 1;
     }
+    return qnx6_bmap_test(qfs, (uint64_t)(blk - data_start_blk));
+}
 
-    if (!qfs->blkmap_loaded) {
-        if (qnx6fs_load_blkmap(qfs)) {
-            /* Conservative fallback: treat as allocated if bitmap can't be loaded. */
-            return 1;
-        }
+/*
+ * Return the last block in [blk, end] whose allocation state equals that of
+ * blk.  Uses qnx6_bmap_find(), so uniform groups and chunks are skipped.
+ */
+static TSK_DADDR_T
+qnx6fs_blk_alloc_run_end(QNX6FS_INFO* qfs, TSK_DADDR_T blk, TSK_DADDR_T end)
+{
+    TSK_DADDR_T data_start_blk = qnx6_data_start_blk(qfs);
+
+    if (blk < data_start_blk) {
+        /* The area in front of the data area has no bitmap bits. */
+        return (end < data_start_blk) ? end : data_start_blk - 1;
     }
 
-    uint64_t bit = (uint64_t)blk;
-    uint64_t byte_idx = bit / 8ULL;
-    uint8_t mask = (uint8_t)(1u << (uint8_t)(bit % 8ULL));
+    uint8_t alloc = qnx6fs_blk_is_alloc(qfs, blk);
+    uint64_t bit = (uint64_t)(blk - data_start_blk);
+    uint64_t last = (uint64_t)(end - data_start_blk);
 
-    if (byte_idx >= qfs->blkmap_bytes) {
-        return 1;
+    if (bit >= qfs->bmap_bits) {
+        /* Past the bitmap everything is allocated. */
+        return end;
+    }
+    uint64_t other = qnx6_bmap_find(qfs, bit, last, !alloc);
+    if (other != UINT64_MAX) {
+        return (TSK_DADDR_T)(other - 1) + data_start_blk;
+    }
+    if (!alloc && last >= qfs->bmap_bits) {
+        /* Free run stops where the always-allocated tail begins. */
+        return (TSK_DADDR_T)(qfs->bmap_bits - 1) + data_start_blk;
     }
-    return (qfs->blkmap[byte_idx] & mask) ? 1 : 0;
+    return end;
 }
+
 static TSK_FS_BLOCK_FLAG_ENUM
 qnx6fs_block_getflags(TSK_FS_INFO* fs, TSK_DADDR_T addr)
 {
@@ -304,8 +1011,7 @@ qnx6fs_block_getflags(TSK_FS_INFO* fs, TSK_DADDR_T addr)
     }
 
     /* META vs CONT classification (heuristic but stable): everything before data_start is META. */
-    TSK_DADDR_T data_start_blk = (TSK_DADDR_T)(qfs->data_start / (uint64_t)fs->block_size);
-    if (addr < data_start_blk) {
+    if (addr < qnx6_data_start_blk(qfs)) {
         out = (TSK_FS_BLOCK_FLAG_ENUM)(out | TSK_FS_BLOCK_FLAG_META);
     } else {
         out = (TSK_FS_BLOCK_FLAG_ENUM)(out | TSK_FS_BLOCK_FLAG_CONT);
@@ -385,26 +1091,99 @@ qnx6fs_istat(TSK_FS_INFO* fs, TSK_FS_ISTAT_FLAG_ENUM flags,
 }
 
 
-static int qnx6_read_img(TSK_IMG_INFO *img, TSK_OFF_T off, void *buf, size_t len) {
-    ssize_t r = tsk_img_read(img, off, (char*)buf, len);
-    return (r != (ssize_t)len);
-}
+/*
+ * Superblock checksum: CRC32 with polynomial 0x04C11DB7, MSB first (not
+ * reflected), initial value 0 and no final XOR.
+ *
+ * qnx6_crc32_table[0] is the classic byte-at-a-time table; table k holds
+ * the CRC of a byte followed by k zero bytes, so qnx6_crc32() can fold
+ * eight input bytes per step ("slice-by-8").  The tables are built from
+ * the polynomial on first use.
+ */
+#define QNX6_CRC32_POLY 0x04C11DB7u
+
+static uint32_t qnx6_crc32_table[8][256];
 
-static uint32_t qnx6_crc32_noreflect(const uint8_t *buf, size_t len) {
-    uint32_t crc = 0;
-    for (size_t i = 0; i < len; i++) {
-        crc ^= ((uint32_t)buf[i] << 24);
-        for (int b = 0; b < 8; b++) {
-            if (crc & 0x80000000u) crc = (crc << 1) ^ 0x04C11DB7u;
-            else crc <<= 1;
+static void
+qnx6_crc32_build_tables(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i << 24;
+        for (int b = 0; b < 8; b++)
+            c = (c & 0x80000000u) ? (c << 1) ^ QNX6_CRC32_POLY : (c << 1);
+        qnx6_crc32_table[0][i] = c;
+    }
+    for (int k = 1; k < 8; k++) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = qnx6_crc32_table[k - 1][i];
+            qnx6_crc32_table[k][i] = (c << 8) ^ qnx6_crc32_table[0][c >> 24];
         }
     }
+}
+
+#ifdef TSK_MULTITHREAD_LIB
+#ifdef TSK_WIN32
+static INIT_ONCE qnx6_crc32_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK
+qnx6_crc32_build_once(PINIT_ONCE once, PVOID param, PVOID *ctx)
+{
+    (void)once; (void)param; (void)ctx;
+    qnx6_crc32_build_tables();
+    return TRUE;
+}
+
+static void
+qnx6_crc32_init(void)
+{
+    (void) InitOnceExecuteOnce(&qnx6_crc32_once, qnx6_crc32_build_once,
+        NULL, NULL);
+}
+#else
+static pthread_once_t qnx6_crc32_once = PTHREAD_ONCE_INIT;
+
+static void
+qnx6_crc32_init(void)
+{
+    (void) pthread_once(&qnx6_crc32_once, qnx6_crc32_build_tables);
+}
+#endif
+#else
+static void
+qnx6_crc32_init(void)
+{
+    static uint8_t built = 0;
+
+    if (!built) {
+        qnx6_crc32_build_tables();
+        built = 1;
+    }
+}
+#endif
+
+static uint32_t
+qnx6_crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    const uint32_t (*t)[256] = qnx6_crc32_table;
+
+    qnx6_crc32_init();
+    while (len >= 8) {
+        crc ^= ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
+            ((uint32_t)buf[2] << 8) | (uint32_t)buf[3];
+        crc = t[7][crc >> 24] ^ t[6][(crc >> 16) & 0xff] ^
+            t[5][(crc >> 8) & 0xff] ^ t[4][crc & 0xff] ^
+            t[3][buf[4]] ^ t[2][buf[5]] ^ t[1][buf[6]] ^ t[0][buf[7]];
+        buf += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = (crc << 8) ^ t[0][(crc >> 24) ^ *buf++];
     return crc;
 }
 
 static int qnx6_check_superblock_512(const uint8_t raw[512], uint64_t *serial_out) {
     uint32_t stored_crc = tsk_getu32(TSK_LIT_ENDIAN, &raw[4]);
-    uint32_t calc_crc = qnx6_crc32_noreflect(&raw[8], 512 - 8);
+    uint32_t calc_crc = qnx6_crc32(0, &raw[8], 512 - 8);
     uint64_t serial = tsk_getu64(TSK_LIT_ENDIAN, &raw[8]);
     if (serial_out) *serial_out = serial;
     return stored_crc == calc_crc;
@@ -416,71 +1195,122 @@ static uint64_t qnx6_data_start(uint32_t bs) {
     return (uint64_t)(0x6000 - bs);                /* 0x3000 + (0x3000-bs) */
 }
 
-static int qnx6_read_block(QNX6FS_INFO *qfs, uint32_t blk, uint8_t *out) {
-    TSK_OFF_T off = qfs->fs_info.offset + (TSK_OFF_T)qfs->data_start + (TSK_OFF_T)blk * qfs->fs_info.block_size;
-    return qnx6_read_img(qfs->fs_info.img_info, off, out, qfs->fs_info.block_size);
-}
+/* Bytes of the longfile read per pass in qnx6_longnames_load(). */
+#define QNX6_LONGNAME_CHUNK (256 * 1024)
 
-static uint64_t qnx6_bytes_in_unit(uint32_t bs, uint8_t inode_level, uint8_t level) {
-    uint64_t mul = 1;
-    uint32_t fanout = bs / 4;
-    for (int i = 0; i < (int)(inode_level - level); i++) mul *= fanout;
-    return (uint64_t)bs * mul;
-}
+/*
+ * Build the long file name table.  Each longfile block holds one name as
+ * a 16-bit length followed by the bytes; the longfile is read sequentially
+ * and every name is copied into a single arena.
+ *
+ * Note: This routine assumes qfs->longname_lock is locked by the caller.
+ */
+static uint8_t
+qnx6_longnames_load(QNX6FS_INFO *qfs)
+{
+    const uint32_t bs = (uint32_t)qfs->fs_info.block_size;
+    uint64_t lsize = tsk_getu64(TSK_LIT_ENDIAN, (const uint8_t*)&qfs->rn_longfile.size);
+    uint64_t count = lsize / bs;
 
-static uint32_t qnx6_ptr_at_offset(QNX6FS_INFO *qfs, const uint32_t ptr0[16], uint8_t inode_level, uint64_t off_bytes) {
-    uint32_t bs = (uint32_t)qfs->fs_info.block_size;
+    if (count > UINT32_MAX || count * bs > ((uint64_t)qfs->fs_info.block_count) * bs) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_FS_CORRUPT);
+        tsk_error_set_errstr("qnx6_longnames_load: invalid longfile size %" PRIu64, lsize);
+        return 1;
+    }
+    if (count == 0) {
+        qfs->longname_loaded = 1;
+        return 0;
+    }
 
-    uint64_t unit0 = qnx6_bytes_in_unit(bs, inode_level, 0);
-    uint32_t idx = (uint32_t)(off_bytes / unit0);
-    if (idx >= 16) return QNX6_UNUSED_PTR;
+    QNX6_RUNLIST rl;
+    memset(&rl, 0, sizeof(rl));
+    if (qnx6_load_runs(qfs, qfs->rn_longfile.ptr, qfs->rn_longfile.level, lsize, &rl)) {
+        return 1;
+    }
 
-    uint32_t ptr = tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&ptr0[idx]);
-    if (ptr == QNX6_UNUSED_PTR) return QNX6_UNUSED_PTR;
+    size_t chunk = (QNX6_LONGNAME_CHUNK / bs) * bs;
+    if (chunk < bs) chunk = bs;
 
-    if (inode_level == 0) return ptr;
+    QNX6_LONGNAME *names = (QNX6_LONGNAME*)tsk_malloc((size_t)count * sizeof(QNX6_LONGNAME));
+    uint8_t *buf = (uint8_t*)tsk_malloc(chunk);
+    size_t arena_alloc = 0, arena_len = 0;
+    char *arena = NULL;
+    if (names == NULL || buf == NULL) {
+        goto on_error;
+    }
 
-    uint8_t *tmp = (uint8_t*)tsk_malloc(bs);
-    if (!tmp) return QNX6_UNUSED_PTR;
+    for (uint64_t idx = 0; idx < count; ) {
+        size_t nblk = chunk / bs;
+        if (nblk > count - idx) nblk = (size_t)(count - idx);
 
-    for (uint8_t lvl = 0; lvl < inode_level; lvl++) {
-        uint64_t cur_unit = qnx6_bytes_in_unit(bs, inode_level, lvl);
-        uint64_t next_unit = qnx6_bytes_in_unit(bs, inode_level, (uint8_t)(lvl + 1));
-        uint64_t rem = off_bytes % cur_unit;
-        uint32_t idx2 = (uint32_t)(rem / next_unit);
+        if (qnx6_read_runs(qfs, &rl, idx * bs, nblk * bs, buf)) {
+            goto on_error;
+        }
 
-        if (qnx6_read_block(qfs, ptr, tmp)) { free(tmp); return QNX6_UNUSED_PTR; }
-        uint32_t *arr = (uint32_t*)tmp;
-        ptr = tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&arr[idx2]);
-        if (ptr == QNX6_UNUSED_PTR) { free(tmp); return QNX6_UNUSED_PTR; }
+        for (size_t i = 0; i < nblk; i++, idx++) {
+            const uint8_t *blk = buf + i * bs;
+            uint16_t nlen = tsk_getu16(TSK_LIT_ENDIAN, blk);
+            if (nlen > bs - 2) nlen = (uint16_t)(bs - 2);
+
+            if (arena_len + nlen + 1 > arena_alloc) {
+                size_t n = arena_alloc ? arena_alloc * 2 : 4096;
+                while (n < arena_len + nlen + 1) n *= 2;
+                char *tmp = (char*)tsk_realloc(arena, n);
+                if (tmp == NULL) {
+                    goto on_error;
+                }
+                arena = tmp;
+                arena_alloc = n;
+            }
 
-        off_bytes = rem;
+            names[idx].off = (uint32_t)arena_len;
+            names[idx].len = nlen;
+            memcpy(arena + arena_len, blk + 2, nlen);
+            arena[arena_len + nlen] = '\0';
+            arena_len += (size_t)nlen + 1;
+        }
     }
 
-    free(tmp);
-    return ptr;
-}
-
-
-static char *qnx6_get_longname(QNX6FS_INFO *qfs, uint32_t index, uint16_t *out_len) {
-    uint32_t bs = (uint32_t)qfs->fs_info.block_size;
-    uint32_t got = 0;
-    uint8_t *blk = qnx6_read_file_bytes(qfs, qfs->rn_longfile.ptr, qfs->rn_longfile.level, qfs->rn_longfile.size,
-        (uint64_t)index * bs, bs, &got);
-    if (!blk || got < 2) { if (blk) free(blk); return NULL; }
-
-    uint16_t nlen = tsk_getu16(TSK_LIT_ENDIAN, blk);
-    if (nlen > bs - 2) nlen = (uint16_t)(bs - 2);
+    free(buf);
+    qnx6_runlist_free(&rl);
+    qfs->longnames = names;
+    qfs->longname_count = (uint32_t)count;
+    qfs->longname_arena = arena;
+    qfs->longname_loaded = 1;
+    return 0;
 
-    char *name = (char*)tsk_malloc((size_t)nlen + 1);
-    if (!name) { free(blk); return NULL; }
+on_error:
+    free(arena);
+    free(buf);
+    free(names);
+    qnx6_runlist_free(&rl);
+    return 1;
+}
 
-    memcpy(name, blk + 2, nlen);
-    name[nlen] = '\0';
+/*
+ * Return long file name number index (and its length), or NULL if it does
+ * not exist.  The name points into the long name arena; do not free it.
+ */
+static const char *
+qnx6_get_longname(QNX6FS_INFO *qfs, uint32_t index, uint16_t *out_len)
+{
+    tsk_take_lock(&qfs->longname_lock);
+    if (!qfs->longname_loaded
+        && (qfs->longname_failed || qnx6_longnames_load(qfs))) {
+        /* A corrupt longfile would otherwise be read again for every
+         * long name. */
+        qfs->longname_failed = 1;
+        tsk_release_lock(&qfs->longname_lock);
+        return NULL;
+    }
+    tsk_release_lock(&qfs->longname_lock);
 
-    free(blk);
-    if (out_len) *out_len = nlen;
-    return name;
+    if (index >= qfs->longname_count) {
+        return NULL;
+    }
+    if (out_len) *out_len = qfs->longnames[index].len;
+    return qfs->longname_arena + qfs->longnames[index].off;
 }
 
 static uint8_t
@@ -491,17 +1321,25 @@ qnx6fs_load_attrs(TSK_FS_FILE* fs_file)
     }
 
     QNX6FS_INFO* qfs = (QNX6FS_INFO*)fs_file->fs_info;
+    TSK_FS_META* meta = fs_file->meta;
 
+    /* The raw inode was saved in content_ptr by qnx6_dinode_copy(). */
     QNX6_INODE ino;
-    if (qnx6_read_inode(qfs, fs_file->meta->addr, &ino)) {
+    if (meta->content_ptr && meta->content_len >= sizeof(QNX6_INODE)) {
+        memcpy(&ino, meta->content_ptr, sizeof(QNX6_INODE));
+    }
+    else if (qnx6_read_inode(qfs, meta->addr, &ino)) {
         return 1;
     }
 
     uint32_t bs = (uint32_t)qfs->fs_info.block_size;
     uint64_t fsize = tsk_getu64(TSK_LIT_ENDIAN, (const uint8_t*)&ino.size);
 
+    if (fs_file->meta->attr != NULL) {
+        tsk_fs_attrlist_markunused(fs_file->meta->attr);
+    }
     /* Allocate attrlist lazily (icat expects this to be done here). */
-    if (fs_file->meta->attr == NULL) {
+    else {
         fs_file->meta->attr = tsk_fs_attrlist_alloc();
         if (fs_file->meta->attr == NULL) {
             tsk_error_reset();
@@ -517,54 +1355,43 @@ qnx6fs_load_attrs(TSK_FS_FILE* fs_file)
         return 1;
     }
 
+    QNX6_RUNLIST rl;
+    memset(&rl, 0, sizeof(rl));
+    if (qnx6_load_runs(qfs, ino.ptr, ino.level, fsize, &rl)) {
+        meta->attr_state = TSK_FS_META_ATTR_ERROR;
+        return 1;
+    }
+
     TSK_FS_ATTR_RUN* head = NULL;
     TSK_FS_ATTR_RUN* tail = NULL;
 
     const TSK_DADDR_T data_start_blk = (TSK_DADDR_T)(qfs->data_start / (uint64_t)bs);
 
-    uint64_t off = 0;
-    int have_last = 0;
-    TSK_DADDR_T last_addr = 0;
-    TSK_DADDR_T last_off_blk = 0;
-
-    while (off < fsize) {
-        uint32_t ptr = qnx6_ptr_at_offset(qfs, ino.ptr, ino.level, off);
-        TSK_DADDR_T off_blk = (TSK_DADDR_T)(off / bs);
-
-        if (ptr != QNX6_UNUSED_PTR) {
-            TSK_DADDR_T addr = (TSK_DADDR_T)ptr + data_start_blk;
-
-            if (have_last && tail && (addr == last_addr + 1) && (off_blk == last_off_blk + 1)) {
-                tail->len++;
-            }
-            else {
-                TSK_FS_ATTR_RUN* r = tsk_fs_attr_run_alloc();
-                if (r == NULL) {
-                    tsk_fs_attr_run_free(head);
-                    return 1;
-                }
-
-                /* IMPORTANT: initialize fully */
-                memset(r, 0, sizeof(*r));
-                r->addr = addr;
-                r->offset = off_blk;
-                r->len = 1;
-                r->flags = TSK_FS_ATTR_RUN_FLAG_NONE;
-                r->crypto_id = 0;
-                r->next = NULL;
-
-                if (head == NULL) head = r;
-                else tail->next = r;
-                tail = r;
-            }
+    for (size_t i = 0; i < rl.count; i++) {
+        TSK_FS_ATTR_RUN* r = tsk_fs_attr_run_alloc();
+        if (r == NULL) {
+            tsk_fs_attr_run_free(head);
+            qnx6_runlist_free(&rl);
+            meta->attr_state = TSK_FS_META_ATTR_ERROR;
+            return 1;
+        }
 
-            have_last = 1;
-            last_addr = addr;
-            last_off_blk = off_blk;
+        r->offset = (TSK_DADDR_T)rl.runs[i].offset;
+        r->len = (TSK_DADDR_T)rl.runs[i].len;
+        if (rl.runs[i].addr == QNX6_UNUSED_PTR) {
+            r->addr = 0;
+            r->flags = TSK_FS_ATTR_RUN_FLAG_SPARSE;
+        }
+        else {
+            r->addr = (TSK_DADDR_T)rl.runs[i].addr + data_start_blk;
+            r->flags = TSK_FS_ATTR_RUN_FLAG_NONE;
         }
 
-        off += bs;
+        if (head == NULL) head = r;
+        else tail->next = r;
+        tail = r;
     }
+    qnx6_runlist_free(&rl);
 
     TSK_OFF_T size = (TSK_OFF_T)fsize;
     TSK_OFF_T allocsize = (TSK_OFF_T)(((fsize + bs - 1) / bs) * bs);
@@ -580,47 +1407,42 @@ qnx6fs_load_attrs(TSK_FS_FILE* fs_file)
         TSK_FS_ATTR_NONRES, 0)) {
         /* on failure, avoid leaking runlist */
         tsk_fs_attr_run_free(head);
+        meta->attr_state = TSK_FS_META_ATTR_ERROR;
         return 1;
     }
 
+    meta->attr_state = TSK_FS_META_ATTR_STUDIED;
     return 0;
 }
 
 
-static uint8_t
-qnx6fs_file_add_meta(TSK_FS_INFO* fs, TSK_FS_FILE* fs_file, TSK_INUM_T inum)
+/*
+ * Fill in a file system-independent meta structure from an on-disk inode.
+ * The raw inode is kept in content_ptr so load_attrs does not re-read it;
+ * fs_meta must have been allocated with room for a QNX6_INODE.
+ */
+static void
+qnx6_dinode_copy(TSK_FS_META* meta, TSK_INUM_T inum, const QNX6_INODE* ino)
 {
-    QNX6FS_INFO* qfs = (QNX6FS_INFO*)fs;
-    QNX6_INODE ino;
-
-    if (!fs || !fs_file)
-        return 1;
-
-    if (qnx6_read_inode(qfs, inum, &ino))
-        return 1;
-
-    if (fs_file->meta == NULL) {
-        fs_file->meta = tsk_fs_meta_alloc(TSK_FS_META_TAG);
-        if (fs_file->meta == NULL)
-            return 1;
-    }
-
-    TSK_FS_META* meta = fs_file->meta;
     tsk_fs_meta_reset(meta);
+    if (meta->attr) {
+        tsk_fs_attrlist_markunused(meta->attr);
+    }
 
     meta->addr = inum;
+    memcpy(meta->content_ptr, ino, sizeof(QNX6_INODE));
 
     /* Basic fields */
-    meta->mode = tsk_getu16(TSK_LIT_ENDIAN, (const uint8_t*)&ino.mode);
-    meta->uid = tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&ino.uid);
-    meta->gid = tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&ino.gid);
-    meta->size = (TSK_OFF_T)tsk_getu64(TSK_LIT_ENDIAN, (const uint8_t*)&ino.size);
+    meta->mode = (TSK_FS_META_MODE_ENUM)tsk_getu16(TSK_LIT_ENDIAN, (const uint8_t*)&ino->mode);
+    meta->uid = tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&ino->uid);
+    meta->gid = tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&ino->gid);
+    meta->size = (TSK_OFF_T)tsk_getu64(TSK_LIT_ENDIAN, (const uint8_t*)&ino->size);
 
     /* Times */
-    meta->mtime = (time_t)tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&ino.mtime);
-    meta->atime = (time_t)tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&ino.atime);
-    meta->ctime = (time_t)tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&ino.ctime);
-    meta->crtime = (time_t)tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&ino.ftime); /* QNX */
+    meta->mtime = (time_t)tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&ino->mtime);
+    meta->atime = (time_t)tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&ino->atime);
+    meta->ctime = (time_t)tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&ino->ctime);
+    meta->crtime = (time_t)tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&ino->ftime); /* QNX */
 
     /* Allocation state */
     if (meta->mode == 0) {
@@ -642,25 +1464,86 @@ qnx6fs_file_add_meta(TSK_FS_INFO* fs, TSK_FS_FILE* fs_file, TSK_INUM_T inum)
         else                     meta->type = TSK_FS_META_TYPE_UNDEF;
     }
 
-    /*
-     * VERY IMPORTANT:
-     * Leave attr NULL so load_attrs() is triggered later.
-     */
-    meta->attr = NULL;
+    /* Runs are resolved lazily by load_attrs(). */
+    meta->attr_state = TSK_FS_META_ATTR_EMPTY;
+}
+
+static uint8_t
+qnx6fs_file_add_meta(TSK_FS_INFO* fs, TSK_FS_FILE* fs_file, TSK_INUM_T inum)
+{
+    QNX6FS_INFO* qfs = (QNX6FS_INFO*)fs;
+    QNX6_INODE ino;
 
+    if (!fs || !fs_file)
+        return 1;
+
+    if (qnx6_read_inode(qfs, inum, &ino))
+        return 1;
+
+    if (fs_file->meta == NULL) {
+        fs_file->meta = tsk_fs_meta_alloc(sizeof(QNX6_INODE));
+        if (fs_file->meta == NULL)
+            return 1;
+    }
+    else if (tsk_fs_meta_realloc(fs_file->meta, sizeof(QNX6_INODE)) == NULL) {
+        return 1;
+    }
+
+    qnx6_dinode_copy(fs_file->meta, inum, &ino);
     return 0;
 }
 
 
 
+/* Directory bytes decoded per pass in qnx6fs_dir_open_meta(); a multiple of the dirent size. */
+#define QNX6_DIR_CHUNK (64 * 1024)
+
+/*
+ * Append a_fs_name to a_fs_dir.  Unlike tsk_fs_dir_add(), this does not
+ * scan the directory for an existing entry first, which is quadratic in
+ * the directory size; a QNX6 directory holds each name only once.  Name
+ * buffers kept in the slots by tsk_fs_dir_reset() are reused.
+ */
+static uint8_t
+qnx6_dir_add(TSK_FS_DIR *a_fs_dir, const TSK_FS_NAME *a_fs_name)
+{
+    if (a_fs_dir->names_used >= a_fs_dir->names_alloc) {
+        if (a_fs_dir->names_used >= MAX_DIR_SIZE_TO_PROCESS) {
+            tsk_error_reset();
+            tsk_error_set_errno(TSK_ERR_FS_LARGE_DIR_ERROR);
+            tsk_error_set_errstr("qnx6_dir_add: Directory too large to process (addr: %" PRIuINUM ")",
+                a_fs_dir->addr);
+            return 1;
+        }
+        if (tsk_fs_dir_realloc(a_fs_dir, a_fs_dir->names_used + 512))
+            return 1;
+    }
+
+    TSK_FS_NAME *fs_name_dest = &a_fs_dir->names[a_fs_dir->names_used];
+    if (tsk_fs_name_copy(fs_name_dest, a_fs_name))
+        return 1;
+    fs_name_dest->par_addr = a_fs_dir->addr;
+    a_fs_dir->names_used++;
+    return 0;
+}
+
+/*
+ * Directory entries are decoded QNX6_DIR_CHUNK bytes at a time through the
+ * directory's resolved run list.  Each entry is built in one scratch
+ * TSK_FS_NAME and copied into the directory with qnx6_dir_add().
+ */
 static TSK_RETVAL_ENUM qnx6fs_dir_open_meta(TSK_FS_INFO *fs, TSK_FS_DIR **a_fs_dir, TSK_INUM_T inum, int recursion_depth) {
     (void)recursion_depth;
 
     QNX6FS_INFO *qfs = (QNX6FS_INFO*)fs;
     QNX6_INODE ino;
 
-    if (a_fs_dir == NULL) return TSK_ERR;
-    *a_fs_dir = NULL;
+    if (a_fs_dir == NULL) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_FS_ARG);
+        tsk_error_set_errstr("qnx6fs_dir_open_meta: NULL fs_dir argument given");
+        return TSK_ERR;
+    }
 
     if (qnx6_read_inode(qfs, inum, &ino)) {
         return TSK_ERR;
@@ -675,62 +1558,137 @@ static TSK_RETVAL_ENUM qnx6fs_dir_open_meta(TSK_FS_INFO *fs, TSK_FS_DIR **a_fs_d
     }
 
     uint64_t fsize = tsk_getu64(TSK_LIT_ENDIAN, (const uint8_t*)&ino.size);
-    if (fsize == 0) {
-        *a_fs_dir = tsk_fs_dir_alloc(fs, inum, 4);
-        return (*a_fs_dir) ? TSK_OK : TSK_ERR;
+    uint64_t nents = fsize / sizeof(QNX6_DIRENT);
+    if (nents > MAX_DIR_SIZE_TO_PROCESS) {
+        nents = MAX_DIR_SIZE_TO_PROCESS;
+    }
+
+    TSK_FS_DIR *fs_dir = *a_fs_dir;
+    if (fs_dir) {
+        tsk_fs_dir_reset(fs_dir);
+        fs_dir->addr = inum;
+        if (tsk_fs_dir_realloc(fs_dir, (size_t)nents + 4)) {
+            return TSK_ERR;
+        }
+    }
+    else if ((*a_fs_dir = fs_dir = tsk_fs_dir_alloc(fs, inum, (size_t)nents + 4)) == NULL) {
+        return TSK_ERR;
+    }
+    if (nents == 0) {
+        return TSK_OK;
+    }
+
+    QNX6_RUNLIST rl;
+    memset(&rl, 0, sizeof(rl));
+    if (qnx6_load_runs(qfs, ino.ptr, ino.level, fsize, &rl)) {
+        return TSK_ERR;
+    }
+
+    TSK_RETVAL_ENUM retval = TSK_OK;
+    size_t buf_len = (fsize < QNX6_DIR_CHUNK) ? (size_t)fsize : QNX6_DIR_CHUNK;
+    uint8_t *buf = (uint8_t*)tsk_malloc(buf_len);
+    /* Long names are at most a block (less the length field) long. */
+    TSK_FS_NAME *fs_name = tsk_fs_name_alloc(fs->block_size, 0);
+    if (buf == NULL || fs_name == NULL) {
+        retval = TSK_ERR;
+        goto done;
     }
+    fs_name->flags = TSK_FS_NAME_FLAG_ALLOC;
 
-    uint32_t got = 0;
-    uint8_t *raw = qnx6_read_file_bytes(qfs, ino.ptr, ino.level, fsize, 0, (uint32_t)fsize, &got);
-    if (!raw) return TSK_ERR;
+    for (uint64_t off = 0; off < fsize; off += buf_len) {
+        size_t len = (fsize - off < buf_len) ? (size_t)(fsize - off) : buf_len;
+        if (qnx6_read_runs(qfs, &rl, off, len, buf)) {
+            retval = TSK_ERR;
+            goto done;
+        }
 
-    TSK_FS_DIR *dir = tsk_fs_dir_alloc(fs, inum, (size_t)(got / sizeof(QNX6_DIRENT) + 4));
-    if (!dir) { free(raw); return TSK_ERR; }
+        for (size_t pos = 0; pos + sizeof(QNX6_DIRENT) <= len; pos += sizeof(QNX6_DIRENT)) {
+            const QNX6_DIRENT *de = (const QNX6_DIRENT*)(buf + pos);
+            uint32_t child = tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&de->inum);
+            if (child == 0) continue;
+
+            if (de->length == 0xFF) {
+                uint16_t nlen = 0;
+                const char *name = qnx6_get_longname(qfs,
+                    tsk_getu32(TSK_LIT_ENDIAN, &de->payload[3]), &nlen);
+                if (name == NULL) continue;
+                if (nlen >= fs_name->name_size) {
+                    nlen = (uint16_t)(fs_name->name_size - 1);
+                }
+                memcpy(fs_name->name, name, nlen);
+                fs_name->name[nlen] = '\0';
+            } else {
+                memcpy(fs_name->name, de->payload, sizeof(de->payload));
+                fs_name->name[sizeof(de->payload)] = '\0';
+            }
+            fs_name->meta_addr = (TSK_INUM_T)child;
 
-    for (uint64_t off = 0; off + sizeof(QNX6_DIRENT) <= got; off += sizeof(QNX6_DIRENT)) {
-        QNX6_DIRENT de;
-        memcpy(&de, raw + off, sizeof(de));
+            if (qnx6_dir_add(fs_dir, fs_name)) {
+                retval = TSK_ERR;
+                goto done;
+            }
+        }
+    }
 
-        uint32_t child = tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&de.inum);
-        if (child == 0) continue;
+done:
+    tsk_fs_name_free(fs_name);
+    free(buf);
+    qnx6_runlist_free(&rl);
+    return retval;
+}
 
-        char *name = NULL;
-        uint16_t nlen = 0;
+/*
+ * Re-read superblock copy idx from the image.  Returns 1 if the copy is
+ * absent or cannot be read; otherwise fills raw and reports whether the
+ * magic and checksum are intact.
+ */
+static int
+qnx6_read_sb_copy(QNX6FS_INFO *qfs, int idx, uint8_t raw[512],
+    int *magic_ok, int *crc_ok)
+{
+    if (!qfs->sb_found[idx] ||
+        qnx6_read_img(qfs->fs_info.img_info, qfs->sb_off[idx], raw, 512))
+        return 1;
+    *magic_ok = (raw[0] == 0x22 && raw[1] == 0x11 && raw[2] == 0x19 && raw[3] == 0x68);
+    *crc_ok = qnx6_check_superblock_512(raw, NULL);
+    return 0;
+}
 
-        if (de.length == 0xFF) {
-            uint32_t index = tsk_getu32(TSK_LIT_ENDIAN, &de.payload[3]);
-            name = qnx6_get_longname(qfs, index, &nlen);
-            if (!name) continue;
-        } else {
-            char shortname[28];
-            memset(shortname, 0, sizeof(shortname));
-            memcpy(shortname, de.payload, 27);
-            nlen = (uint16_t)strlen(shortname);
-#ifdef _MSC_VER
-            name = _strdup(shortname);
-#else
-            name = strdup(shortname);
- #endif
+/*
+ * Check one root node of a snapshot: tree depth, that every top-level
+ * pointer lies inside the data area and that the tree can hold its size.
+ * Prints one line per problem; returns the number of problems.
+ */
+static int
+qnx6_check_rootnode(const QNX6_ROOTNODE *rn, const char *name,
+    uint32_t bs, uint32_t num_blocks, FILE *hFile)
+{
+    uint64_t size = tsk_getu64(TSK_LIT_ENDIAN, (const uint8_t*)&rn->size);
+    uint64_t nblocks = (size + bs - 1) / bs;
+    int problems = 0;
 
-            if (!name) continue;
+    if (rn->level > QNX6_PTR_MAX_LEVELS) {
+        tsk_fprintf(hFile, "    %s: invalid tree level %u\n", name, rn->level);
+        return 1;
+    }
+    /* capacity of the tree, stopping early so it cannot overflow */
+    uint64_t cap = 16;
+    for (uint8_t l = 0; l < rn->level && cap < nblocks; l++)
+        cap *= bs / 4;
+    if (nblocks > cap) {
+        tsk_fprintf(hFile, "    %s: size %" PRIu64 " does not fit a level %u tree\n",
+            name, size, rn->level);
+        problems++;
+    }
+    for (int i = 0; i < 16; i++) {
+        uint32_t p = tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&rn->ptr[i]);
+        if (p != QNX6_UNUSED_PTR && p >= num_blocks) {
+            tsk_fprintf(hFile, "    %s: pointer %d (%" PRIu32 ") outside data area\n",
+                name, i, p);
+            problems++;
         }
-
-        TSK_FS_NAME *fs_name = tsk_fs_name_alloc(nlen + 1, 0);
-        if (!fs_name) { free(name); continue; }
-
-        tsk_fs_name_reset(fs_name);
-        strncpy(fs_name->name, name, fs_name->name_size - 1);
-        fs_name->meta_addr = (TSK_INUM_T)child;
-        fs_name->flags = TSK_FS_NAME_FLAG_ALLOC;
-
-        tsk_fs_dir_add(dir, fs_name);
-        tsk_fs_name_free(fs_name);
-        free(name);
     }
-
-    free(raw);
-    *a_fs_dir = dir;
-    return TSK_OK;
+    return problems;
 }
 
 static uint8_t qnx6fs_fsstat(TSK_FS_INFO *fs, FILE *hFile) {
@@ -742,11 +1700,110 @@ static uint8_t qnx6fs_fsstat(TSK_FS_INFO *fs, FILE *hFile) {
     tsk_fprintf(hFile, "Block Count: %" PRIuDADDR "\n", fs->block_count);
     tsk_fprintf(hFile, "Inode Count: %" PRIuINUM "\n", fs->inum_count);
     tsk_fprintf(hFile, "Superblock Serial: %" PRIu64 "\n", (uint64_t)tsk_getu64(TSK_LIT_ENDIAN, (const uint8_t*)&qfs->sb.serial));
+    tsk_fprintf(hFile, "Free Blocks (superblock): %" PRIu32 "\n",
+        tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&qfs->sb.free_blocks));
+    uint64_t used = qnx6_bmap_rank(qfs, fs->block_count);
+    tsk_fprintf(hFile, "Allocated Blocks (bitmap): %" PRIu64 "\n", used);
+    tsk_fprintf(hFile, "Free Blocks (bitmap): %" PRIu64 "\n",
+        (uint64_t)fs->block_count - used);
+
+    for (int i = 0; i < 2; i++) {
+        uint8_t raw[512];
+        int magic_ok = 0, crc_ok = 0;
+
+        if (qnx6_read_sb_copy(qfs, i, raw, &magic_ok, &crc_ok)) {
+            tsk_fprintf(hFile, "Superblock %d: not found\n", i);
+            continue;
+        }
+        tsk_fprintf(hFile, "Superblock %d: offset %" PRIdOFF ", serial %" PRIu64
+            ", %s%s\n", i, qfs->sb_off[i] - fs->offset,
+            (uint64_t)tsk_getu64(TSK_LIT_ENDIAN, &raw[8]),
+            !magic_ok ? "bad magic" : (crc_ok ? "CRC valid" : "CRC mismatch"),
+            (i == qfs->active_sb) ? " (active)" : "");
+    }
     return 0;
 }
 
-#include "tsk/fs/tsk_fs_i.h"   // f�r tsk_fs_block_alloc/free + tsk_malloc (je nach Layout)
+/*
+ * Verify every superblock copy and the snapshot each one describes:
+ * magic, checksum, geometry against the active copy and the root nodes.
+ * Returns 1 with TSK_ERR_FS_CORRUPT if any problem was found.
+ */
+static uint8_t
+qnx6fs_fscheck(TSK_FS_INFO *fs, FILE *hFile)
+{
+    QNX6FS_INFO *qfs = (QNX6FS_INFO*)fs;
+    uint32_t num_blocks = tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&qfs->sb.num_blocks);
+    int problems = 0;
+
+    tsk_fprintf(hFile, "\nSUPERBLOCK CHECK\n");
+    tsk_fprintf(hFile, "--------------------------------------------\n");
+
+    for (int i = 0; i < 2; i++) {
+        uint8_t raw[512];
+        QNX6_SUPER sb;
+        int magic_ok = 0, crc_ok = 0;
+
+        if (qnx6_read_sb_copy(qfs, i, raw, &magic_ok, &crc_ok)) {
+            tsk_fprintf(hFile, "Superblock %d: not found or unreadable\n", i);
+            problems++;
+            continue;
+        }
+        memcpy(&sb, raw, sizeof(sb));
+
+        tsk_fprintf(hFile, "Superblock %d: offset %" PRIdOFF "%s\n", i,
+            qfs->sb_off[i] - fs->offset, (i == qfs->active_sb) ? " (active)" : "");
+        if (!magic_ok) {
+            tsk_fprintf(hFile, "    bad magic\n");
+            problems++;
+            continue;
+        }
+        tsk_fprintf(hFile, "    Serial: %" PRIu64 "\n",
+            (uint64_t)tsk_getu64(TSK_LIT_ENDIAN, (const uint8_t*)&sb.serial));
+        tsk_fprintf(hFile, "    CRC: stored 0x%08" PRIx32 ", computed 0x%08" PRIx32 "\n",
+            tsk_getu32(TSK_LIT_ENDIAN, &raw[4]), qnx6_crc32(0, &raw[8], 512 - 8));
+        if (!crc_ok) {
+            tsk_fprintf(hFile, "    CRC mismatch\n");
+            problems++;
+            continue;
+        }
+
+        if (tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&sb.blocksize) != fs->block_size) {
+            tsk_fprintf(hFile, "    block size differs from active superblock\n");
+            problems++;
+            continue;
+        }
+        if (tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&sb.num_blocks) != num_blocks) {
+            tsk_fprintf(hFile, "    block count differs from active superblock\n");
+            problems++;
+        }
+        if (tsk_getu64(TSK_LIT_ENDIAN, (const uint8_t*)&sb.bitmap.size) * 8 < num_blocks) {
+            tsk_fprintf(hFile, "    bitmap: too small for %" PRIu32 " blocks\n", num_blocks);
+            problems++;
+        }
+        if (tsk_getu64(TSK_LIT_ENDIAN, (const uint8_t*)&sb.inodes.size) % sizeof(QNX6_INODE)) {
+            tsk_fprintf(hFile, "    inodes: size is not a multiple of the inode size\n");
+            problems++;
+        }
+        problems += qnx6_check_rootnode(&sb.inodes, "inodes", fs->block_size, num_blocks, hFile);
+        problems += qnx6_check_rootnode(&sb.bitmap, "bitmap", fs->block_size, num_blocks, hFile);
+        problems += qnx6_check_rootnode(&sb.longfile, "longfile", fs->block_size, num_blocks, hFile);
+        problems += qnx6_check_rootnode(&sb.iclaim, "iclaim", fs->block_size, num_blocks, hFile);
+        problems += qnx6_check_rootnode(&sb.iextra, "iextra", fs->block_size, num_blocks, hFile);
+    }
+
+    tsk_fprintf(hFile, "Problems found: %d\n", problems);
+    if (problems) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_FS_CORRUPT);
+        tsk_error_set_errstr("qnx6fs_fscheck: %d problem(s) found", problems);
+        return 1;
+    }
+    return 0;
+}
 
+/* Bytes of consecutive blocks read at once in qnx6fs_block_walk(). */
+#define QNX6_BLOCK_WALK_CHUNK (1024 * 1024)
 
 static uint8_t
 qnx6fs_block_walk(TSK_FS_INFO* fs, TSK_DADDR_T start, TSK_DADDR_T end,
@@ -759,74 +1816,123 @@ qnx6fs_block_walk(TSK_FS_INFO* fs, TSK_DADDR_T start, TSK_DADDR_T end,
         return 1;
     }
 
+    QNX6FS_INFO* qfs = (QNX6FS_INFO*)fs;
+
     /* clamp range */
     if (start < fs->first_block) start = fs->first_block;
     if (end > fs->last_block) end = fs->last_block;
     if (start > end) return 0;
 
+    /* Sanity check on flags -- make sure at least one ALLOC is set */
+    if (((flags & TSK_FS_BLOCK_WALK_FLAG_ALLOC) == 0) &&
+        ((flags & TSK_FS_BLOCK_WALK_FLAG_UNALLOC) == 0)) {
+        flags = (TSK_FS_BLOCK_WALK_FLAG_ENUM)
+            (flags | TSK_FS_BLOCK_WALK_FLAG_ALLOC | TSK_FS_BLOCK_WALK_FLAG_UNALLOC);
+    }
+    if (((flags & TSK_FS_BLOCK_WALK_FLAG_META) == 0) &&
+        ((flags & TSK_FS_BLOCK_WALK_FLAG_CONT) == 0)) {
+        flags = (TSK_FS_BLOCK_WALK_FLAG_ENUM)
+            (flags | TSK_FS_BLOCK_WALK_FLAG_CONT | TSK_FS_BLOCK_WALK_FLAG_META);
+    }
+
     TSK_FS_BLOCK* fs_block = tsk_fs_block_alloc(fs);
     if (fs_block == NULL) {
         return 1;
     }
 
-    for (TSK_DADDR_T addr = start; addr <= end; addr++) {
-
-        /* flags for this block */
-        TSK_FS_BLOCK_FLAG_ENUM blk_flags = (TSK_FS_BLOCK_FLAG_ENUM)0;
-        if (fs->block_getflags) {
-            blk_flags = fs->block_getflags(fs, addr);
+    /* Blocks are read in aligned chunks and handed out one slice at a time. */
+    const TSK_DADDR_T chunk_blks = (QNX6_BLOCK_WALK_CHUNK > fs->block_size)
+        ? QNX6_BLOCK_WALK_CHUNK / fs->block_size : 1;
+    char* chunk = NULL;
+    if ((flags & TSK_FS_BLOCK_WALK_FLAG_AONLY) == 0) {
+        chunk = (char*)tsk_malloc((size_t)(chunk_blks * fs->block_size));
+        if (chunk == NULL) {
+            tsk_fs_block_free(fs_block);
+            return 1;
         }
-        else {
-            /* fallback */
-            blk_flags = (TSK_FS_BLOCK_FLAG_ENUM)(TSK_FS_BLOCK_FLAG_ALLOC | TSK_FS_BLOCK_FLAG_CONT);
+    }
+
+    uint8_t retval = 0;
+    TSK_DADDR_T addr = start;
+
+    while (addr <= end) {
+        /* Find the range of blocks sharing addr's flags. */
+        TSK_FS_BLOCK_FLAG_ENUM blk_flags = qnx6fs_block_getflags(fs, addr);
+        TSK_DADDR_T range_end = qnx6fs_blk_alloc_run_end(qfs, addr, end);
+
+        /* Skip the whole range if the caller does not want it. */
+        if (((blk_flags & TSK_FS_BLOCK_FLAG_META) && !(flags & TSK_FS_BLOCK_WALK_FLAG_META))
+            || ((blk_flags & TSK_FS_BLOCK_FLAG_CONT) && !(flags & TSK_FS_BLOCK_WALK_FLAG_CONT))
+            || ((blk_flags & TSK_FS_BLOCK_FLAG_ALLOC) && !(flags & TSK_FS_BLOCK_WALK_FLAG_ALLOC))
+            || ((blk_flags & TSK_FS_BLOCK_FLAG_UNALLOC) && !(flags & TSK_FS_BLOCK_WALK_FLAG_UNALLOC))) {
+            if (range_end == end) break;
+            addr = range_end + 1;
+            continue;
         }
 
-        /* AONLY: don't read bytes */
         if (flags & TSK_FS_BLOCK_WALK_FLAG_AONLY) {
-            TSK_FS_BLOCK_FLAG_ENUM out_flags =
-                (TSK_FS_BLOCK_FLAG_ENUM)(blk_flags | TSK_FS_BLOCK_FLAG_AONLY);
+            blk_flags = (TSK_FS_BLOCK_FLAG_ENUM)(blk_flags | TSK_FS_BLOCK_FLAG_AONLY);
+        }
+        else {
+            blk_flags = (TSK_FS_BLOCK_FLAG_ENUM)(blk_flags | TSK_FS_BLOCK_FLAG_RAW);
+        }
 
-            tsk_fs_block_set(fs, fs_block, addr, out_flags, NULL);
+        while (addr <= range_end) {
+            TSK_DADDR_T n = chunk_blks - (addr % chunk_blks);
+            if (n > range_end - addr + 1) n = range_end - addr + 1;
+
+            if (chunk) {
+                /* Blocks past the end of a partial image cannot be read. */
+                if (addr + n - 1 > fs->last_block_act) {
+                    if (addr > fs->last_block_act) {
+                        tsk_error_reset();
+                        tsk_error_set_errno(TSK_ERR_FS_READ);
+                        tsk_error_set_errstr("qnx6fs_block_walk: Address missing in partial image: %"
+                            PRIuDADDR, addr);
+                        retval = 1;
+                        goto done;
+                    }
+                    n = fs->last_block_act - addr + 1;
+                }
 
-            TSK_WALK_RET_ENUM r = cb(fs_block, ptr);
-            if (r == TSK_WALK_STOP) break;
-            if (r == TSK_WALK_ERROR) {
-                tsk_fs_block_free(fs_block);
-                return 1;
+                TSK_OFF_T off = fs->offset + (TSK_OFF_T)addr * (TSK_OFF_T)fs->block_size;
+                size_t len = (size_t)(n * fs->block_size);
+                ssize_t rd = tsk_img_read(fs->img_info, off, chunk, len);
+                if (rd != (ssize_t)len) {
+                    tsk_error_reset();
+                    tsk_error_set_errno(TSK_ERR_FS_READ);
+                    tsk_error_set_errstr("qnx6fs_block_walk: cannot read blocks");
+                    tsk_error_set_errstr2("block=%" PRIuDADDR " off=%" PRIdOFF, addr, off);
+                    retval = 1;
+                    goto done;
+                }
             }
-            continue;
-        }
-
-        /* read raw block bytes */
-        TSK_OFF_T off = fs->offset + (TSK_OFF_T)addr * (TSK_OFF_T)fs->block_size;
-        ssize_t rd = tsk_img_read(fs->img_info, off, (char*)fs_block->buf, fs->block_size);
-        if (rd != (ssize_t)fs->block_size) {
-            tsk_error_reset();
-            tsk_error_set_errno(TSK_ERR_FS_READ);
-            tsk_error_set_errstr("qnx6fs_block_walk: cannot read block");
-            /* PRIuOFF macht bei dir immer wieder Stress -> cast + %llu */
-            tsk_error_set_errstr2("block=%" PRIuDADDR " off=%llu", addr, (unsigned long long)off);
-            tsk_fs_block_free(fs_block);
-            return 1;
-        }
 
-        /* RAW => buf valid */
-        tsk_fs_block_set(fs, fs_block, addr,
-            (TSK_FS_BLOCK_FLAG_ENUM)(blk_flags | TSK_FS_BLOCK_FLAG_RAW),
-            (char*)fs_block->buf);
+            for (TSK_DADDR_T i = 0; i < n; i++) {
+                tsk_fs_block_set(fs, fs_block, addr + i, blk_flags,
+                    chunk ? chunk + i * fs->block_size : NULL);
 
-        TSK_WALK_RET_ENUM r = cb(fs_block, ptr);
-        if (r == TSK_WALK_STOP) break;
-        if (r == TSK_WALK_ERROR) {
-            tsk_fs_block_free(fs_block);
-            return 1;
+                TSK_WALK_RET_ENUM r = cb(fs_block, ptr);
+                if (r == TSK_WALK_STOP) goto done;
+                if (r == TSK_WALK_ERROR) {
+                    retval = 1;
+                    goto done;
+                }
+            }
+            addr += n;
         }
+        if (range_end == end) break;
     }
 
+done:
+    free(chunk);
     tsk_fs_block_free(fs_block);
-    return 0;
+    return retval;
 }
 
+/* Bytes of the inode file decoded per read in qnx6fs_inode_walk(). */
+#define QNX6_INODE_WALK_CHUNK (256 * 1024)
+
 static uint8_t
 qnx6fs_inode_walk(TSK_FS_INFO* fs, TSK_INUM_T start, TSK_INUM_T end,
     TSK_FS_META_FLAG_ENUM flags, TSK_FS_META_WALK_CB cb, void* ptr)
@@ -838,49 +1944,85 @@ qnx6fs_inode_walk(TSK_FS_INFO* fs, TSK_INUM_T start, TSK_INUM_T end,
         return 1;
     }
 
+    QNX6FS_INFO* qfs = (QNX6FS_INFO*)fs;
+
     /* TSK convention: flags==0 => both */
     if (flags == 0) {
         flags = (TSK_FS_META_FLAG_ENUM)(TSK_FS_META_FLAG_ALLOC | TSK_FS_META_FLAG_UNALLOC);
     }
 
-    /* clamp */
+    /* clamp, also to what the inode file actually holds */
+    TSK_INUM_T in_file = (TSK_INUM_T)(tsk_getu64(TSK_LIT_ENDIAN,
+        (const uint8_t*)&qfs->rn_inodes.size) / sizeof(QNX6_INODE));
     if (start < fs->first_inum) start = fs->first_inum;
     if (end > fs->last_inum) end = fs->last_inum;
+    if (end > in_file) end = in_file;
     if (start > end) return 0;
 
-    for (TSK_INUM_T inum = start; inum <= end; inum++) {
+    /* One file and meta structure is reused for the whole walk. */
+    TSK_FS_FILE* fs_file = tsk_fs_file_alloc(fs);
+    if (fs_file == NULL) {
+        return 1;
+    }
+    fs_file->meta = tsk_fs_meta_alloc(sizeof(QNX6_INODE));
+    if (fs_file->meta == NULL) {
+        tsk_fs_file_close(fs_file);
+        return 1;
+    }
+
+    const size_t per_chunk = QNX6_INODE_WALK_CHUNK / sizeof(QNX6_INODE);
+    uint8_t* buf = (uint8_t*)tsk_malloc(QNX6_INODE_WALK_CHUNK);
+    if (buf == NULL) {
+        tsk_fs_file_close(fs_file);
+        return 1;
+    }
 
-        TSK_FS_FILE* fs_file = tsk_fs_file_open_meta(fs, NULL, inum);
-        if (fs_file == NULL || fs_file->meta == NULL) {
-            if (fs_file) tsk_fs_file_close(fs_file);
-            continue; /* nicht hart failen, ils will "weiter" */
+    uint8_t retval = 0;
+    TSK_INUM_T inum = start;
+    while (inum <= end) {
+        size_t count = per_chunk;
+        if ((TSK_INUM_T)count > end - inum + 1) {
+            count = (size_t)(end - inum + 1);
         }
 
-        /* Filter by alloc/unalloc */
-        const TSK_FS_META* m = fs_file->meta;
-        int is_alloc = (m->flags & TSK_FS_META_FLAG_ALLOC) ? 1 : 0;
-        if (is_alloc) {
-            if ((flags & TSK_FS_META_FLAG_ALLOC) == 0) {
-                tsk_fs_file_close(fs_file);
-                continue;
-            }
+        /* Stream the inode file: contiguous blocks come in one read. */
+        if (qnx6_read_runs(qfs, &qfs->inode_runs, (uint64_t)(inum - 1) * sizeof(QNX6_INODE),
+                count * sizeof(QNX6_INODE), buf)) {
+            /* nicht hart failen, ils will "weiter" */
+            if (tsk_verbose)
+                tsk_fprintf(stderr, "qnx6fs_inode_walk: skipping inodes %" PRIuINUM
+                    " to %" PRIuINUM ": %s\n", inum, inum + count - 1, tsk_error_get());
+            tsk_error_reset();
+            inum += count;
+            continue;
         }
-        else {
-            if ((flags & TSK_FS_META_FLAG_UNALLOC) == 0) {
-                tsk_fs_file_close(fs_file);
+
+        for (size_t i = 0; i < count; i++, inum++) {
+            const QNX6_INODE* ino = (const QNX6_INODE*)(buf + i * sizeof(QNX6_INODE));
+
+            /* Filter by alloc/unalloc before decoding anything else. */
+            int is_alloc = tsk_getu16(TSK_LIT_ENDIAN, (const uint8_t*)&ino->mode) != 0;
+            if ((flags & (is_alloc ? TSK_FS_META_FLAG_ALLOC : TSK_FS_META_FLAG_UNALLOC)) == 0) {
                 continue;
             }
-        }
-
-        TSK_WALK_RET_ENUM r = cb(fs_file, ptr);
 
-        tsk_fs_file_close(fs_file);
+            qnx6_dinode_copy(fs_file->meta, inum, ino);
 
-        if (r == TSK_WALK_STOP) break;
-        if (r == TSK_WALK_ERROR) return 1;
+            TSK_WALK_RET_ENUM r = cb(fs_file, ptr);
+            if (r == TSK_WALK_STOP) {
+                goto done;
+            }
+            if (r == TSK_WALK_ERROR) {
+                retval = 1;
+                goto done;
+            }
+        }
     }
 
-    return 0;
+done:
+    free(buf);
+    tsk_fs_file_close(fs_file);
+    return retval;
 }
 
 
@@ -889,17 +2031,21 @@ static void qnx6fs_close(TSK_FS_INFO *fs) {
     /* fs points to the start of QNX6FS_INFO because fs_info is the first field */
     QNX6FS_INFO *qfs = (QNX6FS_INFO*)fs;
 
-    tsk_deinit_lock(&qfs->fs_info.list_inum_named_lock);
-    tsk_deinit_lock(&qfs->fs_info.orphan_dir_lock);
-
-    /* Free bitmap cache (if loaded) before freeing the FS object. */
-    if (qfs->blkmap) {
-        free(qfs->blkmap);
-        qfs->blkmap = NULL;
+    /* Free the bitmap chunks before freeing the FS object. */
+    for (uint32_t c = 0; c < qfs->bmap_nchunks; c++) {
+        free(qfs->bmap_chunks[c].words);
+        free(qfs->bmap_chunks[c].rank);
     }
-    qfs->blkmap_loaded = 0;
-    qfs->blkmap_bits = 0;
-    qfs->blkmap_bytes = 0;
+    free(qfs->bmap_chunks);
+    qnx6_runlist_free(&qfs->bmap_runs);
+    tsk_deinit_lock(&qfs->bmap_lock);
+
+    qnx6_runlist_free(&qfs->inode_runs);
+    free(qfs->longnames);
+    free(qfs->longname_arena);
+    tsk_deinit_lock(&qfs->longname_lock);
+    qnx6_iblk_cache_free(qfs->iblk_cache);
+    qfs->iblk_cache = NULL;
 
     /* tsk_fs_free() will free the structure it is passed (which is qfs). */
     tsk_fs_free(fs);
@@ -909,6 +2055,129 @@ static uint8_t qnx6fs_istat(TSK_FS_INFO* fs, TSK_FS_ISTAT_FLAG_ENUM flags,
     FILE* hFile, TSK_INUM_T inum, TSK_DADDR_T numblock, int32_t sec_skew);
 
 
+/*
+ * Build a file system view on one superblock copy (raw, which passed the
+ * magic and CRC checks).  cache is the indirect-block cache of another
+ * view of the same file system to share, or NULL to create one.
+ */
+static TSK_FS_INFO *
+qnx6fs_open_view(TSK_IMG_INFO *img_info, TSK_OFF_T offset,
+    const uint8_t *raw, uint8_t sb_idx, const TSK_OFF_T sb_off[2],
+    const uint8_t sb_found[2], QNX6_IBLK_CACHE *cache, uint8_t test)
+{
+    QNX6FS_INFO* qfs = (QNX6FS_INFO*)tsk_fs_malloc(sizeof(QNX6FS_INFO));
+    if (qfs == NULL) {
+        if (test) return NULL;
+        tsk_error_reset();
+        // Older/newer TSK branches use different error codes for allocation
+        // failures. TSK_ERR_AUX_MALLOC is widely supported.
+        tsk_error_set_errno(TSK_ERR_AUX_MALLOC);
+        tsk_error_set_errstr("qnx6fs_open: Cannot allocate QNX6FS_INFO");
+        return NULL;
+    }
+
+    memcpy(&qfs->sb, raw, sizeof(QNX6_SUPER));
+    qfs->active_sb = sb_idx;
+    qfs->sb_found[0] = sb_found[0];
+    qfs->sb_found[1] = sb_found[1];
+    qfs->sb_off[0] = sb_off[0];
+    qfs->sb_off[1] = sb_off[1];
+
+    uint32_t bs = tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&qfs->sb.blocksize);
+    if (bs == 0 || (bs % 512) != 0) {
+        tsk_fs_free(&qfs->fs_info);
+        if (test) return NULL;
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_FS_CORRUPT);
+        tsk_error_set_errstr("qnx6fs_open: Invalid block size");
+        return NULL;
+    }
+
+    qfs->iblk_cache = cache ? qnx6_iblk_cache_ref(cache) : qnx6_iblk_cache_alloc(bs);
+    if (qfs->iblk_cache == NULL) {
+        tsk_fs_free(&qfs->fs_info);
+        return NULL;
+    }
+
+    qfs->data_start = qnx6_data_start(bs);
+    qfs->rn_inodes = qfs->sb.inodes;
+    qfs->rn_longfile = qfs->sb.longfile;
+    qfs->rn_bitmap = qfs->sb.bitmap;
+
+    // Initialize embedded fs_info
+    qfs->fs_info.tag = TSK_FS_INFO_TAG;
+    qfs->fs_info.img_info = img_info;
+    qfs->fs_info.offset = offset;
+    qfs->fs_info.ftype = TSK_FS_TYPE_QNX6;
+    qfs->fs_info.duname = "Block";
+    qfs->fs_info.flags = TSK_FS_INFO_FLAG_NONE;
+    qfs->fs_info.endian = TSK_LIT_ENDIAN;
+
+    qfs->fs_info.block_size = bs;
+    qfs->fs_info.dev_bsize = 512;
+    qfs->fs_info.block_count = (TSK_DADDR_T)tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&qfs->sb.num_blocks);
+    qfs->fs_info.first_block = 0;
+    /* num_blocks counts the data area; TSK addresses start at the boot block. */
+    qfs->fs_info.last_block = qfs->fs_info.block_count + qfs->data_start / bs - 1;
+    qfs->fs_info.last_block_act = qfs->fs_info.last_block;
+
+    // determine the last block we have in this image
+    if ((TSK_DADDR_T) ((img_info->size - offset) / bs) <= qfs->fs_info.last_block)
+        qfs->fs_info.last_block_act = (img_info->size - offset) / bs - 1;
+
+    qfs->fs_info.inum_count = (TSK_INUM_T)tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&qfs->sb.num_inodes);
+    qfs->fs_info.root_inum = 1;
+    qfs->fs_info.first_inum = 1;
+    qfs->fs_info.last_inum = qfs->fs_info.inum_count;
+
+    /* Resolve the inode file once; every inode lookup goes through it. */
+    if (qnx6_load_runs(qfs, qfs->rn_inodes.ptr, qfs->rn_inodes.level,
+            tsk_getu64(TSK_LIT_ENDIAN, (const uint8_t*)&qfs->rn_inodes.size),
+            &qfs->inode_runs)) {
+        qnx6_iblk_cache_free(qfs->iblk_cache);
+        tsk_fs_free(&qfs->fs_info);
+        if (test) return NULL;
+        tsk_error_set_errstr2("qnx6fs_open: cannot resolve inode file");
+        return NULL;
+    }
+
+    // Set function pointers
+    qfs->fs_info.block_walk = qnx6fs_block_walk;
+    qfs->fs_info.block_getflags = qnx6fs_block_getflags;
+    qfs->fs_info.inode_walk = qnx6fs_inode_walk;
+    qfs->fs_info.file_add_meta = qnx6fs_file_add_meta;
+    qfs->fs_info.load_attrs = qnx6fs_load_attrs;
+    qfs->fs_info.dir_open_meta = qnx6fs_dir_open_meta;
+    qfs->fs_info.fsstat = qnx6fs_fsstat;
+    qfs->fs_info.fscheck = qnx6fs_fscheck;
+    qfs->fs_info.get_default_attr_type = qnx6fs_get_default_attr_type;
+    qfs->fs_info.istat = qnx6fs_istat;
+    qfs->fs_info.close = qnx6fs_close;
+
+    tsk_init_lock(&qfs->longname_lock);
+    tsk_init_lock(&qfs->bmap_lock);
+
+    return (TSK_FS_INFO*)qfs;
+}
+
+
+/**
+ * \internal
+ * Signature check for file system auto-detection.  qnx6fs_open() needs the
+ * boot block magic value.
+ *
+ * @param a_probe Start of the volume
+ * @returns 0 if the volume cannot be opened as this type and 1 if it may
+ */
+uint8_t
+qnx6fs_probe(const TSK_FS_PROBE *a_probe)
+{
+    static const uint8_t magic[4] = { 0xEB, 0x10, 0x90, 0x00 };
+
+    return tsk_fs_probe_bytes(a_probe, offsetof(QNX6_BOOT, magic), magic,
+        sizeof(magic));
+}
+
 TSK_FS_INFO*
 qnx6fs_open(TSK_IMG_INFO* img_info, TSK_OFF_T offset, TSK_FS_TYPE_ENUM fstype, const char* pass, uint8_t test)
 {
@@ -1043,70 +2312,64 @@ qnx6fs_open(TSK_IMG_INFO* img_info, TSK_OFF_T offset, TSK_FS_TYPE_ENUM fstype, c
 
     const uint8_t* raw = (ok0 && (!ok1 || serial0 >= serial1)) ? raw0 : raw1;
 
-    QNX6FS_INFO* qfs = (QNX6FS_INFO*)tsk_fs_malloc(sizeof(QNX6FS_INFO));
-    if (qfs == NULL) {
-        if (test) return NULL;
+    TSK_OFF_T sb_off[2] = { sb0_off, sb1_off };
+    uint8_t sb_found[2] = { (uint8_t)valid0, (uint8_t)valid1 };
+
+    return qnx6fs_open_view(img_info, offset, raw, (raw == raw0) ? 0 : 1,
+        sb_off, sb_found, NULL, test);
+}
+
+/**
+ * \ingroup fslib
+ * Open the other superblock copy of an open QNX6 file system as a second,
+ * independent file system view.  QNX6 keeps two superblocks and writes the
+ * new generation into the older one; tsk_fs_open_img() uses the newer
+ * copy, so the view returned here is normally the previous generation.
+ *
+ * The view has its own root nodes and bitmap half and shares the decoded
+ * indirect-block cache with a_fs.  Close it with tsk_fs_close(); either
+ * file system may be closed first.
+ *
+ * @param a_fs Open QNX6 file system
+ * @returns The view of the other generation or NULL on error
+ */
+TSK_FS_INFO *
+tsk_qnx6_open_snapshot(TSK_FS_INFO * a_fs)
+{
+    QNX6FS_INFO *qfs = (QNX6FS_INFO *) a_fs;
+    uint8_t raw[512];
+    int magic_ok = 0, crc_ok = 0;
+
+    if (a_fs == NULL || a_fs->tag != TSK_FS_INFO_TAG
+        || a_fs->ftype != TSK_FS_TYPE_QNX6) {
         tsk_error_reset();
-        // Older/newer TSK branches use different error codes for allocation
-        // failures. TSK_ERR_AUX_MALLOC is widely supported.
-        tsk_error_set_errno(TSK_ERR_AUX_MALLOC);
-        tsk_error_set_errstr("qnx6fs_open: Cannot allocate QNX6FS_INFO");
+        tsk_error_set_errno(TSK_ERR_FS_ARG);
+        tsk_error_set_errstr("tsk_qnx6_open_snapshot: not a QNX6 file system");
         return NULL;
     }
-    memset(qfs, 0, sizeof(*qfs));
 
-    memcpy(&qfs->sb, raw, sizeof(QNX6_SUPER));
-
-    uint32_t bs = tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&qfs->sb.blocksize);
-    if (bs == 0 || (bs % 512) != 0) {
-        if (test) { free(qfs); return NULL; }
+    uint8_t other = qfs->active_sb ? 0 : 1;
+    if (qnx6_read_sb_copy(qfs, other, raw, &magic_ok, &crc_ok)) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_FS_READ);
+        tsk_error_set_errstr("tsk_qnx6_open_snapshot: superblock %d not found", other);
+        return NULL;
+    }
+    if (!magic_ok || !crc_ok) {
         tsk_error_reset();
         tsk_error_set_errno(TSK_ERR_FS_CORRUPT);
-        tsk_error_set_errstr("qnx6fs_open: Invalid block size");
-        free(qfs);
+        tsk_error_set_errstr("tsk_qnx6_open_snapshot: superblock %d is %s",
+            other, magic_ok ? "damaged (CRC mismatch)" : "invalid");
+        return NULL;
+    }
+    if (tsk_getu32(TSK_LIT_ENDIAN, &raw[offsetof(QNX6_SUPER, blocksize)]) != a_fs->block_size) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_FS_CORRUPT);
+        tsk_error_set_errstr("tsk_qnx6_open_snapshot: superblock %d has a different block size",
+            other);
         return NULL;
     }
 
-    qfs->data_start = qnx6_data_start(bs);
-    qfs->rn_inodes = qfs->sb.inodes;
-    qfs->rn_longfile = qfs->sb.longfile;
-    qfs->rn_bitmap = qfs->sb.bitmap;
-
-    // Initialize embedded fs_info
-    qfs->fs_info.tag = TSK_FS_INFO_TAG;
-    qfs->fs_info.img_info = img_info;
-    qfs->fs_info.offset = offset;
-    qfs->fs_info.ftype = TSK_FS_TYPE_QNX6;
-    qfs->fs_info.duname = "Block";
-    qfs->fs_info.flags = TSK_FS_INFO_FLAG_NONE;
-    qfs->fs_info.endian = TSK_LIT_ENDIAN;
-
-    qfs->fs_info.block_size = bs;
-    qfs->fs_info.dev_bsize = 512;
-    qfs->fs_info.block_count = (TSK_DADDR_T)tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&qfs->sb.num_blocks);
-    qfs->fs_info.first_block = 0;
-    qfs->fs_info.last_block = qfs->fs_info.block_count ? (qfs->fs_info.block_count - 1) : 0;
-    qfs->fs_info.last_block_act = qfs->fs_info.last_block;
-
-    qfs->fs_info.inum_count = (TSK_INUM_T)tsk_getu32(TSK_LIT_ENDIAN, (const uint8_t*)&qfs->sb.num_inodes);
-    qfs->fs_info.root_inum = 1;
-    qfs->fs_info.first_inum = 1;
-    qfs->fs_info.last_inum = qfs->fs_info.inum_count;
-
-    // Set function pointers
-    qfs->fs_info.block_walk = qnx6fs_block_walk;
-    qfs->fs_info.block_getflags = qnx6fs_block_getflags;
-    qfs->fs_info.inode_walk = qnx6fs_inode_walk;
-    qfs->fs_info.file_add_meta = qnx6fs_file_add_meta;
-    qfs->fs_info.load_attrs = qnx6fs_load_attrs;
-    qfs->fs_info.dir_open_meta = qnx6fs_dir_open_meta;
-    qfs->fs_info.fsstat = qnx6fs_fsstat;
-    qfs->fs_info.get_default_attr_type = qnx6fs_get_default_attr_type;
-    qfs->fs_info.istat = qnx6fs_istat;
-    qfs->fs_info.close = qnx6fs_close;
-
-    tsk_init_lock(&qfs->fs_info.list_inum_named_lock);
-    tsk_init_lock(&qfs->fs_info.orphan_dir_lock);
-
-    return (TSK_FS_INFO*)qfs;
+    return qnx6fs_open_view(a_fs->img_info, a_fs->offset, raw, other,
+        qfs->sb_off, qfs->sb_found, qfs->iblk_cache, 0);
 }
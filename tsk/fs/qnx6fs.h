@@ -16,6 +16,10 @@ typedef struct TSK_IMG_INFO TSK_IMG_INFO;
 TSK_FS_INFO *qnx6fs_open(TSK_IMG_INFO *img_info, TSK_OFF_T offset,
     TSK_FS_TYPE_ENUM fstype, const char *pass, uint8_t test);
 
+// Open the other (normally previous-generation) superblock copy of an
+// open QNX6 file system as a second view; close it with tsk_fs_close().
+TSK_FS_INFO *tsk_qnx6_open_snapshot(TSK_FS_INFO *fs_info);
+
 #ifdef __cplusplus
 }
 #endif
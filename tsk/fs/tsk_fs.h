@@ -194,7 +194,7 @@ extern "C" {
     * @param a_off Byte offset in file that this data is for
     * @param a_addr Address of data being passed (valid only if a_flags have RAW set)
     * @param a_buf Pointer to buffer with file content
-    * @param a_len Size of data in buffer (in bytes)
+    * @param a_len Size of data in buffer (in bytes), at most one block unless TSK_FS_FILE_WALK_FLAG_CHUNK was given
     * @param a_flags Flags about the file content
     * @param a_ptr Pointer that was specified by caller to inode_walk
     * @returns Value that tells file walk to continue or stop
@@ -212,8 +212,12 @@ extern "C" {
         TSK_FS_FILE_WALK_FLAG_NOID = 0x02,      ///< Ignore the Id argument given in the API (use only the type)
         TSK_FS_FILE_WALK_FLAG_AONLY = 0x04,     ///< Provide callback with only addresses and no file content.
         TSK_FS_FILE_WALK_FLAG_NOSPARSE = 0x08,  ///< Do not include sparse blocks in the callback.
+        TSK_FS_FILE_WALK_FLAG_CHUNK = 0x10,     ///< Allow callbacks with up to TSK_FS_FILE_WALK_CHUNK_SIZE bytes of consecutive blocks (the address is that of the first block; all blocks in a callback have the same flags).
     } TSK_FS_FILE_WALK_FLAG_ENUM;
 
+/** Largest buffer passed to a file walk callback with TSK_FS_FILE_WALK_FLAG_CHUNK */
+#define TSK_FS_FILE_WALK_CHUNK_SIZE (4 * 1024 * 1024)
+
 
     /**
     * These are based on the NTFS type values.
@@ -263,6 +267,7 @@ extern "C" {
 #define TSK_FS_ATTR_ID_DEFAULT  0       ///< Default Data ID used if file system does not assign one.
 
     typedef struct TSK_FS_ATTR TSK_FS_ATTR;
+    typedef struct TSK_FS_ATTR_RUN_INDEX TSK_FS_ATTR_RUN_INDEX;
     /**
     * Holds information about the location of file content (or a file attribute). For most file systems, a file
     * has only a single attribute that stores the file content.
@@ -321,6 +326,8 @@ extern "C" {
             TSK_OFF_T a_offset, char *a_buf, size_t a_len);
          uint8_t(*w) (const TSK_FS_ATTR * fs_attr,
             int flags, TSK_FS_FILE_WALK_CB, void *);
+
+        TSK_FS_ATTR_RUN_INDEX *run_index;       ///< \internal Sorted copy of the non-resident runs, built by tsk_fs_attr_read() for long run lists
     };
 
 
@@ -1083,6 +1090,10 @@ extern "C" {
          uint8_t(*fread_owner_sid) (TSK_FS_FILE *, char **);    // FS-specific function. Call tsk_fs_file_get_owner_sid() instead.
 
          void * impl; ///< \internal pointer to specific implementation
+
+        unsigned int decomp_threads;    ///< Worker threads that decompress file content ahead of the reader (0 or 1 to decompress on the calling thread), see tsk_fs_set_decomp_threads()
+
+         TSK_RETVAL_ENUM(*dir_lookup) (TSK_FS_INFO * fs, TSK_INUM_T dir, const char *name, TSK_FS_NAME ** fs_name);  ///< \internal Optional: find an allocated name in a directory without loading all of it (TSK_COR if not found), used by tsk_fs_path2inum().
     };
 
 
@@ -1100,6 +1111,8 @@ extern "C" {
     extern TSK_FS_INFO *tsk_fs_open_pool_decrypt(const TSK_POOL_INFO *,
         TSK_DADDR_T, TSK_FS_TYPE_ENUM, const char * password);
     extern void tsk_fs_close(TSK_FS_INFO *);
+    extern void tsk_fs_set_decomp_threads(TSK_FS_INFO * a_fs,
+        unsigned int a_threads);
 
     extern TSK_FS_TYPE_ENUM tsk_fs_type_toid_utf8(const char *);
     extern TSK_FS_TYPE_ENUM tsk_fs_type_toid(const TSK_TCHAR *);
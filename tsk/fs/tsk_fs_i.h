@@ -127,6 +127,7 @@ extern "C" {
 
     /* FS_DATA_RUN */
     extern TSK_FS_ATTR_RUN *tsk_fs_attr_run_alloc();
+    extern size_t tsk_fs_attr_run_index_count(const TSK_FS_ATTR *);
 
     /* FS_META */
     extern TSK_FS_META *tsk_fs_meta_alloc(size_t);
@@ -220,6 +221,57 @@ extern "C" {
     extern TSK_FS_INFO *btrfs_open(TSK_IMG_INFO*, TSK_OFF_T,
         TSK_FS_TYPE_ENUM, const char *, uint8_t);
 
+    /* File system auto-detection (fs_detect.cpp) */
+
+/* Bytes read from the start of a volume for the probe functions.  Enough
+ * for every signature that is not in a backup copy (the furthest is the
+ * UFS2 backup superblock at 256 KiB); others are read on demand. */
+#define TSK_FS_PROBE_SIZE (512 * 1024)
+
+    /**
+     * Start of a volume, shared by the drivers' probe functions.  A probe
+     * function does a cheap signature check and returns 0 only if the
+     * driver's open function would certainly fail.
+     */
+    typedef struct {
+        TSK_IMG_INFO *img_info; ///< Image the volume is in
+        TSK_OFF_T offset;       ///< Byte offset of the volume in the image
+        uint8_t *buf;           ///< First bytes of the volume
+        size_t len;             ///< Number of bytes in buf (less than TSK_FS_PROBE_SIZE only at the end of the image)
+    } TSK_FS_PROBE;
+
+    /** One driver tried by tsk_fs_open_jobs() */
+    typedef struct {
+        TSK_FS_INFO *(*open) (TSK_IMG_INFO *, TSK_OFF_T,
+            TSK_FS_TYPE_ENUM, const char *, uint8_t);
+        TSK_FS_TYPE_ENUM type;  ///< Type to pass to open (a _DETECT type)
+        TSK_FS_INFO *fs;        ///< Opened file system (NULL on failure)
+        uint32_t t_errno;       ///< Error code of a failed open
+        char errstr[TSK_ERROR_STRING_MAX_LENGTH + 1];   ///< Error string of a failed open
+    } TSK_FS_OPEN_JOB;
+
+    extern TSK_FS_PROBE *tsk_fs_probe_load(TSK_IMG_INFO *, TSK_OFF_T);
+    extern void tsk_fs_probe_free(TSK_FS_PROBE *);
+    extern uint8_t tsk_fs_probe_bytes(const TSK_FS_PROBE *, TSK_OFF_T,
+        const void *, size_t);
+    extern uint8_t tsk_fs_probe_u16(const TSK_FS_PROBE *, TSK_OFF_T,
+        uint16_t);
+    extern uint8_t tsk_fs_probe_u32(const TSK_FS_PROBE *, TSK_OFF_T,
+        uint32_t);
+    extern void tsk_fs_open_jobs(TSK_IMG_INFO *, TSK_OFF_T, const char *,
+        TSK_FS_OPEN_JOB *, size_t);
+
+    extern uint8_t ext2fs_probe(const TSK_FS_PROBE *);
+    extern uint8_t fatfs_probe(const TSK_FS_PROBE *);
+    extern uint8_t ffs_probe(const TSK_FS_PROBE *);
+    extern uint8_t ntfs_probe(const TSK_FS_PROBE *);
+    extern uint8_t iso9660_probe(const TSK_FS_PROBE *);
+    extern uint8_t hfs_probe(const TSK_FS_PROBE *);
+    extern uint8_t xfs_probe(const TSK_FS_PROBE *);
+    extern uint8_t qnx6fs_probe(const TSK_FS_PROBE *);
+    extern uint8_t apfs_probe(const TSK_FS_PROBE *);
+    extern uint8_t btrfs_probe(const TSK_FS_PROBE *);
+
     /* Generic functions for swap and raw -- many say "not supported" */
     extern uint8_t tsk_fs_nofs_fsstat(TSK_FS_INFO * fs, FILE * hFile);
     extern void tsk_fs_nofs_close(TSK_FS_INFO * fs);
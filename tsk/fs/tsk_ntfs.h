@@ -527,17 +527,6 @@ extern "C" {
 
 
 
-/************************************************************************
- * Structure used in Security Descriptor lookups
- */
-    typedef struct {
-        char *buffer;           ///< Buffer to store data in
-        size_t size;            ///< Number of bytes in buffer
-        size_t used;            ///< Number of records used in the buffer (size depends on type of data stored)
-    } NTFS_SXX_BUFFER;
-
-
-
 /************************************************************************
  * SID attribute
  */
@@ -716,10 +705,13 @@ extern "C" {
 
         TSK_FS_ATTR_RUN *bmap;  /* Run of bitmap for clusters (linked list) */
 
-        /* lock protects bmap_buf, bmap_buf_off */
+        /* lock protects loading the pages of bmap_cache, starting comp_pool
+         * and loading upcase */
         tsk_lock_t lock;
-        char *bmap_buf;         /* buffer to hold cached copy of bitmap (r/w shared - lock)  */
-        TSK_DADDR_T bmap_buf_off;       /* offset cluster in cached bitmap  (r/w shared - lock) */
+        void *bmap_cache;       /* pages of the bitmap that have been read, see ntfs_bmap_page() (r/w shared - lock) */
+        void *comp_pool;        /* threads that decompress compression units, see ntfs_comp_pool() (r/w shared - lock) */
+        uint16_t *upcase;       /* $UpCase table for collating $I30 names, or NULL, see ntfs_upcase_table() (r/w shared - lock) */
+        uint8_t upcase_loaded;  /* set to 1 once loading upcase was tried (r/w shared - lock) */
 
         ntfs_attrdef *attrdef;  // buffer of attrdef file contents
         size_t attrdef_len;     // length of addrdef buffer
@@ -729,10 +721,10 @@ extern "C" {
         void *orphan_map;       // map that lists par directory to its orphans. (r/w shared - lock)
 
 #if TSK_USE_SID
-        /* sid_lock protects sii_data, sds_data */
+        /* sid_lock protects loading sec_index */
         tsk_lock_t sid_lock;
-        NTFS_SXX_BUFFER sii_data;       // (r/w shared - lock)
-        NTFS_SXX_BUFFER sds_data;       // (r/w shared - lock)
+        void *sec_index;        // $SII entries and the open $Secure, built on first use, see ntfs_get_sds() (r/w shared - lock)
+        uint8_t sec_index_loaded;       // set to 1 once building sec_index was tried (r/w shared - lock)
 #endif
 
         /* Number of allocated regular files. 0 until a directory is
@@ -751,8 +743,12 @@ extern "C" {
         TSK_INUM_T, TSK_OFF_T *);
     extern TSK_RETVAL_ENUM ntfs_dir_open_meta(TSK_FS_INFO * a_fs,
         TSK_FS_DIR ** a_fs_dir, TSK_INUM_T a_addr, int recursion_depth);
+    extern TSK_RETVAL_ENUM ntfs_dir_lookup(TSK_FS_INFO * a_fs,
+        TSK_INUM_T a_addr, const char *a_name, TSK_FS_NAME ** a_fs_name);
 
     extern void ntfs_orphan_map_free(NTFS_INFO * a_ntfs);
+    extern uint8_t ntfs_fix_idxrec(NTFS_INFO * ntfs, ntfs_idxrec * idxrec,
+        uint32_t len);
 
     extern int ntfs_name_cmp(TSK_FS_INFO *, const char *, const char *);
 
@@ -599,6 +599,21 @@ void xfs_close(TSK_FS_INFO * fs)
     return;
 }
 
+/**
+ * \internal
+ * Signature check for file system auto-detection.  xfs_open() needs the
+ * superblock magic value.
+ *
+ * @param a_probe Start of the volume
+ * @returns 0 if the volume cannot be opened as this type and 1 if it may
+ */
+uint8_t
+xfs_probe(const TSK_FS_PROBE * a_probe)
+{
+    return tsk_fs_probe_u32(a_probe,
+        XFS_SBOFF + offsetof(xfs_sb, sb_magicnum), XFS_FS_MAGIC);
+}
+
 TSK_FS_INFO *
 xfs_open(TSK_IMG_INFO * img_info, TSK_OFF_T offset,
     TSK_FS_TYPE_ENUM ftype, [[maybe_unused]] const char* a_pass, [[maybe_unused]] uint8_t test)
@@ -0,0 +1,42 @@
+#ifndef _IMG_CACHE_H
+#define _IMG_CACHE_H
+
+#include "tsk/img/tsk_img_i.h"
+
+/*
+ * Base of the read caches stored in IMG_INFO::cache.  The cache_read
+ * function installed next to a cache knows its concrete type; everything
+ * else only needs the lock and the destructor.
+ */
+struct ImgCache {
+  virtual ~ImgCache() = default;
+
+  /* Serializes calls into the format-specific IMG_INFO::read callbacks,
+   * which keep shared state (seek positions, handle caches) of their own.
+   * Not taken around reads of formats that set IMG_INFO::parallel_read. */
+  virtual void lock() = 0;
+
+  virtual void unlock() = 0;
+
+  virtual void clear() = 0;
+
+  /* Add counters the cache keeps outside of IMG_INFO::stats. */
+  virtual void add_stats([[maybe_unused]] Stats& stats) {}
+};
+
+/* Used with tsk_img_read_no_cache(): only the lock, no cached data. */
+struct NoCache: public ImgCache {
+  tsk_lock_t io_lock;
+
+  NoCache() { tsk_init_lock(&io_lock); }
+
+  ~NoCache() override { tsk_deinit_lock(&io_lock); }
+
+  void lock() override { tsk_take_lock(&io_lock); }
+
+  void unlock() override { tsk_release_lock(&io_lock); }
+
+  void clear() override {}
+};
+
+#endif
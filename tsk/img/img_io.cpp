@@ -12,10 +12,13 @@
 
 #include "tsk_img_i.h"
 #include "legacy_cache.h"
+#include "sharded_cache.h"
 
+#include <algorithm>
 #include <chrono>
 #include <memory>
 #include <new>
+#include <vector>
 
 class Timer {
 public:
@@ -76,6 +79,23 @@ static ssize_t img_read_no_cache(TSK_IMG_INFO * a_img_info, TSK_OFF_T a_off,
     return nbytes;
 }
 
+/*
+ * img_read_no_cache() under the cache's I/O lock, unless the format
+ * allows concurrent reads.
+ */
+static ssize_t img_read_no_cache_locked(TSK_IMG_INFO* a_img_info, ImgCache* a_cache,
+    TSK_OFF_T a_off, char* a_buf, size_t a_len)
+{
+    if (reinterpret_cast<IMG_INFO*>(a_img_info)->parallel_read) {
+        return img_read_no_cache(a_img_info, a_off, a_buf, a_len);
+    }
+
+    a_cache->lock();
+    const ssize_t read_count = img_read_no_cache(a_img_info, a_off, a_buf, a_len);
+    a_cache->unlock();
+    return read_count;
+}
+
 ssize_t tsk_img_read_no_cache(
   TSK_IMG_INFO* a_img_info,
   TSK_OFF_T a_off,
@@ -89,14 +109,15 @@ ssize_t tsk_img_read_no_cache(
 
   ssize_t read_count = 0;
 
-  auto cache = static_cast<LegacyCache*>(iif->cache);
-  cache->lock();
+  auto cache = static_cast<ImgCache*>(iif->cache);
   timer.start();
-  read_count = img_read_no_cache(a_img_info, a_off, a_buf, a_len);
+  read_count = img_read_no_cache_locked(a_img_info, cache, a_off, a_buf, a_len);
   timer.stop();
-  stats.miss_ns += timer.elapsed();
-  ++stats.misses;
-  stats.miss_bytes += read_count;
+
+  // the stats are protected by the I/O lock
+  cache->lock();
+  tsk_img_stats_add(&stats, TSK_IMG_READ_PATH_UNCACHED, timer.elapsed(),
+      read_count > 0 ? read_count : 0);
   cache->unlock();
 
   return read_count;
@@ -129,9 +150,8 @@ tsk_img_read_legacy(
         timer.start();
         read_count = img_read_no_cache(a_img_info, a_off, a_buf, a_len);
         timer.stop();
-        stats.miss_ns += timer.elapsed();
-        ++stats.misses;
-        stats.miss_bytes += read_count;
+        tsk_img_stats_add(&stats, TSK_IMG_READ_PATH_UNCACHED, timer.elapsed(),
+            read_count > 0 ? read_count : 0);
         cache->unlock();
         return read_count;
     }
@@ -178,9 +198,6 @@ tsk_img_read_legacy(
                 cache->cache_age[cache_index] = CACHE_AGE;
 
                 // we don't break out of the loop so that we update all ages
-
-                ++stats.hits;
-                stats.hit_bytes += read_count;
             }
             else {
                 /* decrease its "age" since it was not useful.
@@ -229,6 +246,7 @@ tsk_img_read_legacy(
         read_count = iif->read(a_img_info,
             cache->cache_off[cache_next],
             cache->cache[cache_next], read_size);
+        tsk_img_stats_add_backend(&stats, read_count);
 
         // if no error, then set the variables and copy the data
         // Although a read_count of -1 indicates an error,
@@ -264,22 +282,278 @@ tsk_img_read_legacy(
 
             // Something went wrong so let's try skipping the cache
             read_count = img_read_no_cache(a_img_info, a_off, a_buf, a_len);
+            tsk_img_stats_add_backend(&stats, read_count);
         }
 
         timer.stop();
-        stats.miss_ns += timer.elapsed();
-        ++stats.misses;
-        stats.miss_bytes += read_count;
+        tsk_img_stats_add(&stats, TSK_IMG_READ_PATH_MISS, timer.elapsed(),
+            read_count > 0 ? read_count : 0);
     }
     else {
         timer.stop();
-        stats.hit_ns += timer.elapsed();
+        tsk_img_stats_add(&stats, TSK_IMG_READ_PATH_HIT, timer.elapsed(), read_count);
     }
 
     cache->unlock();
     return read_count;
 }
 
+ssize_t
+tsk_img_read_sharded(
+    TSK_IMG_INFO* a_img_info,
+    TSK_OFF_T a_off,
+    char* a_buf,
+    size_t a_len)
+{
+    IMG_INFO* iif = reinterpret_cast<IMG_INFO*>(a_img_info);
+    auto cache = static_cast<ShardedCache*>(iif->cache);
+    const size_t line_len = cache->line_size();
+
+    Timer timer;
+    timer.start();
+
+    // if they ask for more than a cache line, skip the cache
+    if (a_len > line_len) {
+        ssize_t read_count = img_read_no_cache_locked(a_img_info, cache, a_off, a_buf, a_len);
+        timer.stop();
+        cache->account(a_off, TSK_IMG_READ_PATH_UNCACHED, timer.elapsed(), read_count > 0 ? read_count : 0);
+        return read_count;
+    }
+
+    // Protect against INT64_MAX + INT64_MAX > value
+    size_t len2 = a_len;
+    if ((TSK_OFF_T) len2 > a_img_info->size
+        || a_off >= a_img_info->size - (TSK_OFF_T)len2) {
+        len2 = (size_t) (a_img_info->size - a_off);
+    }
+
+    // The request covers at most two lines.  Missing lines (and any
+    // read-ahead) are read with only the I/O lock held and inserted
+    // afterwards.
+    bool hit = true;
+    size_t done = 0;
+    while (done < len2) {
+        const TSK_OFF_T pos = a_off + (TSK_OFF_T) done;
+        const TSK_OFF_T line_off = pos - pos % (TSK_OFF_T) line_len;
+        const size_t rel = (size_t) (pos - line_off);
+        const size_t want = std::min(len2 - done, line_len - rel);
+        size_t got = 0;
+        bool marker = false;
+
+        if (!cache->get(line_off, rel, a_buf + done, want, &got, &marker)) {
+            hit = false;
+
+            if (cache->fill(a_img_info, line_off) <= 0
+                || !cache->get(line_off, rel, a_buf + done, want, &got, &marker)) {
+                // Something went wrong so let's try skipping the cache
+                ssize_t read_count = img_read_no_cache_locked(a_img_info, cache, a_off, a_buf, a_len);
+                timer.stop();
+                cache->account(a_off, TSK_IMG_READ_PATH_UNCACHED, timer.elapsed(), read_count > 0 ? read_count : 0);
+                return read_count;
+            }
+        }
+
+        if (marker) {
+            cache->advance(a_img_info, line_off);
+        }
+
+        done += got;
+        if (got < want) {
+            // short line at the end of the image
+            break;
+        }
+    }
+
+    timer.stop();
+    cache->account(a_off, hit ? TSK_IMG_READ_PATH_HIT : TSK_IMG_READ_PATH_MISS, timer.elapsed(), done);
+    return (ssize_t) done;
+}
+
+void tsk_img_stats_add(Stats* a_stats, TSK_IMG_READ_PATH_ENUM a_path,
+  size_t a_ns, size_t a_bytes)
+{
+    if (a_path == TSK_IMG_READ_PATH_HIT) {
+        ++a_stats->hits;
+        a_stats->hit_ns += a_ns;
+        a_stats->hit_bytes += a_bytes;
+    }
+    else {
+        ++a_stats->misses;
+        a_stats->miss_ns += a_ns;
+        a_stats->miss_bytes += a_bytes;
+    }
+
+    if (a_path == TSK_IMG_READ_PATH_UNCACHED) {
+        ++a_stats->backend_reads;
+        a_stats->backend_bytes += a_bytes;
+    }
+
+    // log2 of the latency
+    size_t bucket = 0;
+    while ((a_ns >>= 1) && bucket < TSK_IMG_STATS_BUCKETS - 1) {
+        ++bucket;
+    }
+    ++a_stats->histogram[bucket];
+    ++a_stats->path_histogram[a_path][bucket];
+}
+
+void tsk_img_stats_add_backend(Stats* a_stats, ssize_t a_count)
+{
+    ++a_stats->backend_reads;
+    if (a_count > 0) {
+        a_stats->backend_bytes += (size_t) a_count;
+    }
+}
+
+void tsk_img_stats_merge(Stats* a_dst, const Stats* a_src)
+{
+    a_dst->hits += a_src->hits;
+    a_dst->hit_ns += a_src->hit_ns;
+    a_dst->hit_bytes += a_src->hit_bytes;
+    a_dst->misses += a_src->misses;
+    a_dst->miss_ns += a_src->miss_ns;
+    a_dst->miss_bytes += a_src->miss_bytes;
+    a_dst->backend_reads += a_src->backend_reads;
+    a_dst->backend_bytes += a_src->backend_bytes;
+    for (size_t i = 0; i < TSK_IMG_STATS_BUCKETS; ++i) {
+        a_dst->histogram[i] += a_src->histogram[i];
+    }
+    for (size_t p = 0; p < TSK_IMG_READ_PATH_COUNT; ++p) {
+        for (size_t i = 0; i < TSK_IMG_STATS_BUCKETS; ++i) {
+            a_dst->path_histogram[p][i] += a_src->path_histogram[p][i];
+        }
+    }
+}
+
+void tsk_img_collect_stats(TSK_IMG_INFO* a_img_info, Stats* a_stats)
+{
+    IMG_INFO* iif = reinterpret_cast<IMG_INFO*>(a_img_info);
+    auto cache = static_cast<ImgCache*>(iif->cache);
+
+    // uncached reads update IMG_INFO::stats under the I/O lock
+    cache->lock();
+    *a_stats = iif->stats;
+    cache->unlock();
+    cache->add_stats(*a_stats);
+}
+
+/**
+ * \ingroup imglib
+ * Get the I/O counters of an open disk image: the tsk_img_read() calls
+ * served by each cache path, with their bytes and latencies, and the
+ * reads that were passed on to the image format.
+ *
+ * @param a_img_info Disk image
+ * @param a_stats Set to the counters since the image was opened
+ * @returns 1 on error and 0 on success
+ */
+int
+tsk_img_get_stats(TSK_IMG_INFO * a_img_info, Stats * a_stats)
+{
+    if (a_img_info == NULL || a_stats == NULL) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_IMG_ARG);
+        tsk_error_set_errstr("tsk_img_get_stats: a_img_info or a_stats: NULL");
+        return 1;
+    }
+
+    IMG_INFO* iif = reinterpret_cast<IMG_INFO*>(a_img_info);
+    if (iif->cache == nullptr) {
+        memset(a_stats, 0, sizeof(*a_stats));
+        return 0;
+    }
+
+    tsk_img_collect_stats(a_img_info, a_stats);
+    return 0;
+}
+
+/*
+ * Name of the cache that serves reads of an image.
+ */
+static const char* img_cache_name(const IMG_INFO* a_iif)
+{
+    if (a_iif->cache_read == tsk_img_read_sharded) {
+        return a_iif->opts.cache == TSK_IMG_CACHE_LRU ? "lru" : "sharded";
+    }
+    if (a_iif->cache_read == tsk_img_read_no_cache) {
+        return "none";
+    }
+    return "legacy";
+}
+
+/*
+ * Print 2^a_log2 nanoseconds in ns, us, ms or s.
+ */
+static void print_latency(FILE* a_file, size_t a_log2)
+{
+    static const char* const units[] = { "ns", "us", "ms", "s" };
+    const size_t unit = std::min(a_log2 / 10, sizeof(units) / sizeof(units[0]) - 1);
+    const unsigned long long value = 1ULL << (a_log2 - unit * 10);
+    fprintf(a_file, "%6llu%-2s", value, units[unit]);
+}
+
+/**
+ * \ingroup imglib
+ * Print the I/O counters of an open disk image (see tsk_img_get_stats()):
+ * hit rate, bytes returned and read from the image, read amplification and
+ * a latency histogram for each cache path.
+ *
+ * @param a_img_info Disk image
+ * @param hFile Handle to print to
+ */
+void
+tsk_img_print_stats(TSK_IMG_INFO * a_img_info, FILE * hFile)
+{
+    Stats stats;
+    if (tsk_img_get_stats(a_img_info, &stats)) {
+        return;
+    }
+
+    const IMG_INFO* iif = reinterpret_cast<IMG_INFO*>(a_img_info);
+    size_t reads[TSK_IMG_READ_PATH_COUNT] = { 0 };
+    for (size_t p = 0; p < TSK_IMG_READ_PATH_COUNT; ++p) {
+        for (size_t i = 0; i < TSK_IMG_STATS_BUCKETS; ++i) {
+            reads[p] += stats.path_histogram[p][i];
+        }
+    }
+
+    const size_t total = stats.hits + stats.misses;
+    const size_t returned = stats.hit_bytes + stats.miss_bytes;
+
+    fprintf(hFile, "I/O statistics (cache: %s)\n", img_cache_name(iif));
+    fprintf(hFile, "  Reads: %" PRIuSIZE " (hit %" PRIuSIZE ", miss %" PRIuSIZE
+        ", uncached %" PRIuSIZE ")\n", total, reads[TSK_IMG_READ_PATH_HIT],
+        reads[TSK_IMG_READ_PATH_MISS], reads[TSK_IMG_READ_PATH_UNCACHED]);
+    fprintf(hFile, "  Hit rate: %.1f%%\n",
+        total ? 100.0 * stats.hits / total : 0.0);
+    fprintf(hFile, "  Bytes returned: %" PRIuSIZE "\n", returned);
+    fprintf(hFile, "  Bytes read from image: %" PRIuSIZE " in %" PRIuSIZE
+        " reads\n", stats.backend_bytes, stats.backend_reads);
+    fprintf(hFile, "  Read amplification: %.2f\n",
+        returned ? (double) stats.backend_bytes / returned : 0.0);
+    fprintf(hFile, "  Time: hit %.3f ms, miss %.3f ms\n",
+        stats.hit_ns / 1e6, stats.miss_ns / 1e6);
+
+    if (total == 0) {
+        return;
+    }
+
+    fprintf(hFile, "  %-9s %12s %12s %12s\n", "Latency", "hit", "miss", "uncached");
+    for (size_t i = 0; i < TSK_IMG_STATS_BUCKETS; ++i) {
+        if (stats.path_histogram[TSK_IMG_READ_PATH_HIT][i] == 0
+            && stats.path_histogram[TSK_IMG_READ_PATH_MISS][i] == 0
+            && stats.path_histogram[TSK_IMG_READ_PATH_UNCACHED][i] == 0) {
+            continue;
+        }
+        fprintf(hFile, "  <");
+        print_latency(hFile, i + 1);
+        fprintf(hFile, " %12" PRIuSIZE " %12" PRIuSIZE " %12" PRIuSIZE "\n",
+            stats.path_histogram[TSK_IMG_READ_PATH_HIT][i],
+            stats.path_histogram[TSK_IMG_READ_PATH_MISS][i],
+            stats.path_histogram[TSK_IMG_READ_PATH_UNCACHED][i]);
+    }
+}
+
 /**
  * \ingroup imglib
  * Reads data from an open disk image
@@ -344,3 +618,227 @@ tsk_img_read(TSK_IMG_INFO * a_img_info, TSK_OFF_T a_off,
 
     return reinterpret_cast<IMG_INFO*>(a_img_info)->cache_read(a_img_info, a_off, a_buf, a_len);
 }
+
+// Requests at most this far apart are read together by tsk_img_readv()
+#define TSK_IMG_READV_MAX_GAP   (32 * 1024)
+
+// Largest single read tsk_img_readv() issues for coalesced requests
+#define TSK_IMG_READV_MAX_SPAN  (1024 * 1024)
+
+/*
+ * Copy [a_off, a_off + a_len) out of the sharded cache if every line of
+ * it is there.  Read-ahead markers are honored as in tsk_img_read().
+ */
+static bool readv_from_cache(TSK_IMG_INFO* a_img_info, ShardedCache* cache,
+    TSK_OFF_T a_off, char* a_buf, size_t a_len)
+{
+    const size_t line_len = cache->line_size();
+    size_t done = 0;
+    while (done < a_len) {
+        const TSK_OFF_T pos = a_off + (TSK_OFF_T) done;
+        const TSK_OFF_T line_off = pos - pos % (TSK_OFF_T) line_len;
+        const size_t rel = (size_t) (pos - line_off);
+        const size_t want = std::min(a_len - done, line_len - rel);
+        size_t got = 0;
+        bool marker = false;
+        if (!cache->get(line_off, rel, a_buf + done, want, &got, &marker)) {
+            return false;
+        }
+        if (marker) {
+            cache->advance(a_img_info, line_off);
+        }
+        if (got < want) {
+            return false;
+        }
+        done += got;
+    }
+    return true;
+}
+
+/**
+ * \ingroup imglib
+ * Reads a batch of ranges from an open disk image.  Ranges already in the
+ * image cache are copied from it.  The rest are sorted by offset, and
+ * ranges that are close together are fetched with one larger read.  A
+ * request with a NULL buffer only loads its range into the cache, so that
+ * a file system can prefetch the blocks it will read next.  Short reads at
+ * the end of the image are not errors.
+ *
+ * @param a_img_info Disk image to read from
+ * @param a_reqs Requests; the result field of each is set
+ * @param a_count Number of requests
+ * @returns 1 if any request failed (with the error of the last failure
+ * set) and 0 otherwise
+ */
+int
+tsk_img_readv(TSK_IMG_INFO * a_img_info, TSK_IMG_READ_REQ * a_reqs,
+    size_t a_count)
+{
+    if (a_img_info == NULL || (a_reqs == NULL && a_count)) {
+        tsk_error_reset();
+        tsk_error_set_errno(TSK_ERR_IMG_ARG);
+        tsk_error_set_errstr("tsk_img_readv: a_img_info or a_reqs: NULL");
+        return 1;
+    }
+
+    IMG_INFO* iif = reinterpret_cast<IMG_INFO*>(a_img_info);
+    ShardedCache* sharded = iif->cache_read == tsk_img_read_sharded ?
+        static_cast<ShardedCache*>(iif->cache) : nullptr;
+    const size_t line_len = sharded ? sharded->line_size() : 0;
+
+    // don't let a batch evict the lines it is loading
+    size_t max_span = TSK_IMG_READV_MAX_SPAN;
+    if (sharded) {
+        max_span = std::max(std::min(max_span, sharded->capacity() / 4), line_len);
+    }
+
+    int failed = 0;
+    std::vector<size_t> todo;
+
+    for (size_t i = 0; i < a_count; ++i) {
+        TSK_IMG_READ_REQ& req = a_reqs[i];
+        req.result = -1;
+
+        if (req.off < 0 || req.off >= a_img_info->size || (TSK_OFF_T) req.len < 0) {
+            tsk_error_reset();
+            tsk_error_set_errno(req.off < 0 || (TSK_OFF_T) req.len < 0 ?
+                TSK_ERR_IMG_ARG : TSK_ERR_IMG_READ_OFF);
+            tsk_error_set_errstr("tsk_img_readv: request %" PRIuSIZE
+                ": offset %" PRIdOFF " len %" PRIuSIZE, i, req.off, req.len);
+            failed = 1;
+            continue;
+        }
+
+        // clip at the end of the image
+        if ((TSK_OFF_T) req.len > a_img_info->size - req.off) {
+            req.len = (size_t) (a_img_info->size - req.off);
+        }
+
+        if (req.len == 0) {
+            req.result = 0;
+            continue;
+        }
+
+        if (sharded && req.buf && req.len <= line_len) {
+            Timer timer;
+            timer.start();
+            if (readv_from_cache(a_img_info, sharded, req.off, req.buf, req.len)) {
+                timer.stop();
+                sharded->account(req.off, TSK_IMG_READ_PATH_HIT, timer.elapsed(), req.len);
+                req.result = (ssize_t) req.len;
+                continue;
+            }
+        }
+
+        todo.push_back(i);
+    }
+
+    std::sort(todo.begin(), todo.end(), [a_reqs](size_t a, size_t b) {
+        return a_reqs[a].off < a_reqs[b].off;
+    });
+
+    // Read a single request the same way tsk_img_read() would.
+    const auto read_one = [&](TSK_IMG_READ_REQ& req) {
+        if (req.buf) {
+            req.result = iif->cache_read(a_img_info, req.off, req.buf, req.len);
+        }
+        else if (sharded) {
+            const TSK_OFF_T start = req.off - req.off % (TSK_OFF_T) line_len;
+            const TSK_OFF_T end = req.off + (TSK_OFF_T) req.len;
+            const size_t lines = (size_t) ((end - start + line_len - 1) / line_len);
+            req.result = sharded->load(a_img_info, start,
+                std::min(lines, max_span / line_len)) < 0 ? -1 : 0;
+        }
+        else {
+            // nothing to load into
+            req.result = 0;
+        }
+        if (req.result < 0) {
+            failed = 1;
+        }
+    };
+
+    std::unique_ptr<char[]> span_buf;
+
+    size_t first = 0;
+    while (first < todo.size()) {
+        // collect the requests that go into one read
+        TSK_OFF_T start = a_reqs[todo[first]].off;
+        TSK_OFF_T end = start + (TSK_OFF_T) a_reqs[todo[first]].len;
+        size_t last = first + 1;
+        while (last < todo.size()) {
+            const TSK_IMG_READ_REQ& next = a_reqs[todo[last]];
+            const TSK_OFF_T next_end = std::max(end, next.off + (TSK_OFF_T) next.len);
+            if (next.off > end + TSK_IMG_READV_MAX_GAP
+                || next_end - start > (TSK_OFF_T) max_span) {
+                break;
+            }
+            end = next_end;
+            ++last;
+        }
+
+        if (last - first == 1) {
+            read_one(a_reqs[todo[first]]);
+            first = last;
+            continue;
+        }
+
+        if (sharded) {
+            // load the covering lines, then serve the requests from them
+            Timer timer;
+            timer.start();
+            const TSK_OFF_T line_start = start - start % (TSK_OFF_T) line_len;
+            const size_t lines = (size_t) ((end - line_start + line_len - 1) / line_len);
+            const ssize_t loaded = sharded->load(a_img_info, line_start, lines);
+            timer.stop();
+
+            for (size_t j = first; j < last; ++j) {
+                TSK_IMG_READ_REQ& req = a_reqs[todo[j]];
+                if (loaded < 0) {
+                    read_one(req);
+                }
+                else if (!req.buf) {
+                    req.result = 0;
+                }
+                else if (readv_from_cache(a_img_info, sharded, req.off, req.buf, req.len)) {
+                    sharded->account(req.off, TSK_IMG_READ_PATH_MISS, timer.elapsed() / (last - first), req.len);
+                    req.result = (ssize_t) req.len;
+                }
+                else {
+                    // evicted already; the cache is too small for the batch
+                    read_one(req);
+                }
+            }
+        }
+        else {
+            // read the whole span through the cache and split it up
+            const size_t span_len = (size_t) (end - start);
+            if (!span_buf) {
+                span_buf.reset(new(std::nothrow) char[max_span]);
+            }
+            const ssize_t cnt = span_buf ?
+                iif->cache_read(a_img_info, start, span_buf.get(), span_len) : -1;
+
+            for (size_t j = first; j < last; ++j) {
+                TSK_IMG_READ_REQ& req = a_reqs[todo[j]];
+                if (cnt < 0) {
+                    read_one(req);
+                    continue;
+                }
+                const TSK_OFF_T rel = req.off - start;
+                size_t n = 0;
+                if (rel < cnt) {
+                    n = std::min(req.len, (size_t) (cnt - rel));
+                    if (req.buf) {
+                        memcpy(req.buf, span_buf.get() + rel, n);
+                    }
+                }
+                req.result = req.buf ? (ssize_t) n : 0;
+            }
+        }
+
+        first = last;
+    }
+
+    return failed;
+}
@@ -17,6 +17,7 @@
 #include "tsk_img_i.h"
 #include "img_open.h"
 #include "legacy_cache.h"
+#include "sharded_cache.h"
 
 #include "raw.h"
 #include "logical_img.h"
@@ -45,15 +46,219 @@
 #include "aff4.h"
 #endif
 
+#include <cstdlib>
 #include <cstring>
 #include <memory>
 #include <new>
 #include <numeric>
+#include <string>
 #include <vector>
 #include <utility>
 
-const TSK_IMG_OPTIONS DEFAULT_IMG_OPTIONS{
-};
+/**
+ * \ingroup imglib
+ * Set image options to the library defaults.
+ * @param opts Options to initialize
+ */
+void tsk_img_options_init(TSK_IMG_OPTIONS* opts)
+{
+    memset(opts, 0, sizeof(*opts));
+    opts->readahead = TSK_IMG_READAHEAD_DEFAULT;
+}
+
+static bool parse_size(const char* val, size_t* out)
+{
+    char* end = nullptr;
+    const unsigned long long n = strtoull(val, &end, 10);
+    if (end == val) {
+        return false;
+    }
+
+    unsigned long long mult = 1;
+    switch (*end) {
+    case 'k': case 'K': mult = 1ULL << 10; ++end; break;
+    case 'm': case 'M': mult = 1ULL << 20; ++end; break;
+    case 'g': case 'G': mult = 1ULL << 30; ++end; break;
+    default: break;
+    }
+    if (*end != '\0' || (n && mult > SIZE_MAX / n)) {
+        return false;
+    }
+    *out = (size_t) (n * mult);
+    return true;
+}
+
+/**
+ * \ingroup imglib
+ * Update image options from a string of comma-separated key=value pairs:
+ * cache=none|legacy|lru|sharded, cache_size=N, readahead=N,
+ * backend=default|pread|mmap|direct and max_files=N.  Sizes are in bytes and take an
+ * optional K, M or G suffix.  This is the format of the TSK_IMG_OPTIONS
+ * environment variable.
+ *
+ * @param opts Options to update
+ * @param spec Option string
+ * @returns 1 on error (with the error set) and 0 on success
+ */
+int tsk_img_options_parse(TSK_IMG_OPTIONS* opts, const char* spec)
+{
+    static const std::pair<const char*, TSK_IMG_CACHE_ENUM> caches[] = {
+        { "default", TSK_IMG_CACHE_DEFAULT },
+        { "none", TSK_IMG_CACHE_NONE },
+        { "legacy", TSK_IMG_CACHE_LEGACY },
+        { "lru", TSK_IMG_CACHE_LRU },
+        { "sharded", TSK_IMG_CACHE_SHARDED },
+    };
+
+    static const std::pair<const char*, TSK_IMG_BACKEND_ENUM> backends[] = {
+        { "default", TSK_IMG_BACKEND_DEFAULT },
+        { "pread", TSK_IMG_BACKEND_PREAD },
+        { "mmap", TSK_IMG_BACKEND_MMAP },
+        { "direct", TSK_IMG_BACKEND_DIRECT },
+    };
+
+    std::string rest(spec ? spec : "");
+    while (!rest.empty()) {
+        const size_t comma = rest.find(',');
+        const std::string item = rest.substr(0, comma);
+        rest = comma == std::string::npos ? "" : rest.substr(comma + 1);
+        if (item.empty()) {
+            continue;
+        }
+
+        const size_t eq = item.find('=');
+        const std::string key = item.substr(0, eq);
+        const std::string val = eq == std::string::npos ? "" : item.substr(eq + 1);
+        bool ok = false;
+
+        if (key == "cache") {
+            for (const auto& c: caches) {
+                if (val == c.first) {
+                    opts->cache = c.second;
+                    ok = true;
+                }
+            }
+        }
+        else if (key == "backend") {
+            for (const auto& b: backends) {
+                if (val == b.first) {
+                    opts->backend = b.second;
+                    ok = true;
+                }
+            }
+        }
+        else if (key == "cache_size") {
+            ok = parse_size(val.c_str(), &opts->cache_size);
+        }
+        else if (key == "readahead") {
+            ok = parse_size(val.c_str(), &opts->readahead);
+        }
+        else if (key == "max_files") {
+            ok = parse_size(val.c_str(), &opts->max_files);
+        }
+
+        if (!ok) {
+            tsk_error_reset();
+            tsk_error_set_errno(TSK_ERR_IMG_ARG);
+            tsk_error_set_errstr("tsk_img_options_parse: invalid option: %s",
+                item.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * \ingroup imglib
+ * Set image options to the library defaults, updated from the
+ * TSK_IMG_OPTIONS environment variable if it is set (in the format of
+ * tsk_img_options_parse()).  The library never reads the variable by
+ * itself; programs that want to honor it call this and open images with
+ * tsk_img_open_opt() or TskAuto::setImageOptions().
+ *
+ * @param opts Options to initialize
+ * @returns 1 on error (with the error set) and 0 on success
+ */
+int tsk_img_options_getenv(TSK_IMG_OPTIONS* opts)
+{
+    tsk_img_options_init(opts);
+    const char* env = getenv("TSK_IMG_OPTIONS");
+    if (env && tsk_img_options_parse(opts, env)) {
+        tsk_error_set_errstr2("TSK_IMG_OPTIONS environment variable");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Resolve the options an image is opened with: the given ones or the
+ * defaults.
+ */
+static bool resolve_options(const TSK_IMG_OPTIONS* in, TSK_IMG_OPTIONS* out)
+{
+    if (in) {
+        *out = *in;
+    }
+    else {
+        tsk_img_options_init(out);
+    }
+
+    if (out->cache < TSK_IMG_CACHE_DEFAULT || out->cache > TSK_IMG_CACHE_SHARDED) {
+        tsk_error_set_errno(TSK_ERR_IMG_ARG);
+        tsk_error_set_errstr("invalid image cache policy (%d)", (int) out->cache);
+        return false;
+    }
+
+    if (out->backend < TSK_IMG_BACKEND_DEFAULT || out->backend > TSK_IMG_BACKEND_DIRECT) {
+        tsk_error_set_errno(TSK_ERR_IMG_ARG);
+        tsk_error_set_errstr("invalid image I/O backend (%d)", (int) out->backend);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Install the read cache selected by the options.
+ */
+static void img_setup_cache(IMG_INFO* iif, const TSK_IMG_OPTIONS& opts)
+{
+    iif->opts = opts;
+
+    switch (opts.cache) {
+    case TSK_IMG_CACHE_NONE:
+        iif->cache = new NoCache();
+        iif->cache_read = tsk_img_read_no_cache;
+        break;
+
+    case TSK_IMG_CACHE_DEFAULT:
+    case TSK_IMG_CACHE_LEGACY:
+    default:
+        iif->cache = new LegacyCache();
+        iif->cache_read = tsk_img_read_legacy;
+        break;
+
+    case TSK_IMG_CACHE_LRU:
+    case TSK_IMG_CACHE_SHARDED:
+    {
+        auto cache = new ShardedCache(
+            opts.cache_size ? opts.cache_size : TSK_IMG_SHARDED_CACHE_SIZE,
+            TSK_IMG_INFO_CACHE_LEN,
+            opts.cache == TSK_IMG_CACHE_LRU ? 1 : TSK_IMG_SHARDED_CACHE_SHARDS);
+        cache->set_readahead(opts.readahead == TSK_IMG_READAHEAD_DEFAULT ?
+            TSK_IMG_READAHEAD_WINDOW : opts.readahead);
+        iif->cache = cache;
+        iif->cache_read = tsk_img_read_sharded;
+        break;
+    }
+    }
+
+    if (tsk_verbose) {
+        tsk_fprintf(stderr, "tsk_img_open: cache policy %d, cache size %" PRIuSIZE
+            ", readahead %" PRIuSIZE "\n", (int) opts.cache, opts.cache_size,
+            opts.readahead);
+    }
+}
 
 bool sector_size_ok(unsigned int sector_size) {
     if (sector_size > 0 && sector_size < 512) {
@@ -280,7 +485,7 @@ TSK_IMG_INFO* img_open(
   const TSK_TCHAR* const images[],
   TSK_IMG_TYPE_ENUM type,
   unsigned int a_ssize,
-  [[maybe_unused]] const TSK_IMG_OPTIONS* opts
+  const TSK_IMG_OPTIONS* a_opts
 )
 {
     if (tsk_verbose)
@@ -288,6 +493,11 @@ TSK_IMG_INFO* img_open(
             _TSK_T("tsk_img_open: Type: %d   NumImg: %d  Img1: %" PRIttocTSK "\n"),
             type, num_img, images[0]);
 
+    TSK_IMG_OPTIONS opts;
+    if (!resolve_options(a_opts, &opts)) {
+        return nullptr;
+    }
+
     auto img_info = type == TSK_IMG_TYPE_DETECT ?
       img_open_detect_type(num_img, images, a_ssize) :
       img_open_by_type(num_img, images, type, a_ssize);
@@ -298,9 +508,12 @@ TSK_IMG_INFO* img_open(
 
     IMG_INFO* iif = reinterpret_cast<IMG_INFO*>(img_info.get());
 
-    /* we have a good img_info, set up the cache lock */
-    iif->cache = new LegacyCache();
-    iif->cache_read = tsk_img_read_legacy;
+    if (img_info->itype == TSK_IMG_TYPE_RAW) {
+        raw_set_backend(img_info.get(), opts.backend, opts.max_files);
+    }
+
+    /* we have a good img_info, set up the cache */
+    img_setup_cache(iif, opts);
 
     return img_info.release();
 }
@@ -324,7 +537,7 @@ tsk_img_open_sing(
   TSK_IMG_TYPE_ENUM type,
   unsigned int a_ssize)
 {
-    return tsk_img_open_sing_opt(a_image, type, a_ssize, &DEFAULT_IMG_OPTIONS);
+    return tsk_img_open_sing_opt(a_image, type, a_ssize, nullptr);
 }
 
 TSK_IMG_INFO*
@@ -363,9 +576,19 @@ tsk_img_open(
   TSK_IMG_TYPE_ENUM type,
   unsigned int a_ssize)
 {
-    return tsk_img_open_opt(num_img, images, type, a_ssize, &DEFAULT_IMG_OPTIONS);
+    return tsk_img_open_opt(num_img, images, type, a_ssize, nullptr);
 }
 
+/**
+ * \ingroup imglib
+ * Opens one or more disk image files with the given options.  See
+ * tsk_img_open() for the other parameters.
+ *
+ * @param opts Cache and I/O options, or NULL for the defaults (see
+ * tsk_img_options_getenv() for the TSK_IMG_OPTIONS environment variable)
+ *
+ * @return Pointer to TSK_IMG_INFO or NULL on error
+ */
 TSK_IMG_INFO*
 tsk_img_open_opt(
   int num_img,
@@ -403,7 +626,7 @@ tsk_img_open_utf8_sing(
   TSK_IMG_TYPE_ENUM type,
   unsigned int a_ssize)
 {
-    return tsk_img_open_utf8_sing_opt(a_image, type, a_ssize, &DEFAULT_IMG_OPTIONS);
+    return tsk_img_open_utf8_sing_opt(a_image, type, a_ssize, nullptr);
 }
 
 TSK_IMG_INFO*
@@ -438,7 +661,7 @@ tsk_img_open_utf8(
     TSK_IMG_TYPE_ENUM type,
     unsigned int a_ssize)
 {
-    return tsk_img_open_utf8_opt(num_img, images, type, a_ssize, &DEFAULT_IMG_OPTIONS);
+    return tsk_img_open_utf8_opt(num_img, images, type, a_ssize, nullptr);
 }
 
 TSK_IMG_INFO*
@@ -571,12 +794,13 @@ tsk_img_open_external(
     img_info->sector_size = sector_size ? sector_size : 512;
 
     IMG_INFO* iif = reinterpret_cast<IMG_INFO*>(img_info);
-    iif->cache_read = tsk_img_read_legacy;
     iif->read = read;
     iif->close = close;
     iif->imgstat = imgstat;
 
-    iif->cache = new LegacyCache();
+    TSK_IMG_OPTIONS opts;
+    tsk_img_options_init(&opts);
+    img_setup_cache(iif, opts);
 
     return img_info;
 }
@@ -704,7 +928,7 @@ tsk_img_close(TSK_IMG_INFO * a_img_info)
 
     IMG_INFO* iif = reinterpret_cast<IMG_INFO*>(a_img_info);
 
-    auto cache = static_cast<LegacyCache*>(iif->cache);
+    auto cache = static_cast<ImgCache*>(iif->cache);
     delete cache;
 
     iif->close(a_img_info);
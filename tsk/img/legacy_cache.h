@@ -1,12 +1,12 @@
 #ifndef _LEGACY_CACHE_H
 #define _LEGACY_CACHE_H
 
-#include "tsk/base/tsk_base_i.h"
+#include "img_cache.h"
 
 #define TSK_IMG_INFO_CACHE_NUM  32
 #define TSK_IMG_INFO_CACHE_LEN  65536
 
-struct LegacyCache {
+struct LegacyCache: public ImgCache {
   tsk_lock_t cache_lock;  ///< Lock for cache and associated values
   char cache[TSK_IMG_INFO_CACHE_NUM][TSK_IMG_INFO_CACHE_LEN];     ///< read cache (r/w shared - lock)
   TSK_OFF_T cache_off[TSK_IMG_INFO_CACHE_NUM];    ///< starting byte offset of corresponding cache entry (r/w shared - lock)
@@ -15,13 +15,13 @@ struct LegacyCache {
 
   LegacyCache();
 
-  ~LegacyCache();
+  ~LegacyCache() override;
 
-  void lock();
+  void lock() override;
 
-  void unlock();
+  void unlock() override;
 
-  void clear();
+  void clear() override;
 };
 
 #endif
@@ -19,6 +19,8 @@
 #include "raw.h"
 #include "tsk/util/file_system_utils.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <memory>
 
 #ifdef __APPLE__
@@ -30,6 +32,7 @@
 #else
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
 #endif
@@ -42,37 +45,97 @@
 #define S_IFDIR __S_IFDIR
 #endif
 
+#ifndef TSK_WIN32
+/* Placeholder in IMG_RAW_INFO::maps for segments that could not be mapped */
+static char raw_no_map;
+
+/* Alignment of offsets, lengths and buffers for TSK_IMG_BACKEND_DIRECT */
+#define RAW_DIRECT_ALIGN 4096
+#endif
+
+static TSK_OFF_T
+raw_segment_start(const IMG_RAW_INFO * raw_info, int idx)
+{
+    return idx > 0 ? raw_info->max_off[idx - 1] : 0;
+}
+
+static void
+raw_close_fd(IMG_SPLIT_CACHE * cimg)
+{
+#ifdef TSK_WIN32
+    CloseHandle(cimg->fd);
+#else
+    close(cimg->fd);
+#endif
+    cimg->fd = 0;
+}
+
 /**
  * \internal
- * Read from one of the multiple files in a split set of disk images.
+ * Get an open descriptor for one of the segments, opening it if needed.
+ * The slot cannot be reused for another segment until the caller is done
+ * with it and calls raw_release_segment().  If every slot is busy, the
+ * pool grows instead of waiting.
  *
- * @param split_info Disk image info to read from
- * @param idx Index of the disk image in the set to read from
- * @param buf [out] Buffer to write data to
- * @param len Number of bytes to read
- * @param rel_offset Byte offset in the disk image to read from (not the offset in the full disk image set)
+ * @param raw_info Disk image info
+ * @param idx Index of the disk image in the set
+ * @param fd [out] The descriptor
  *
- * @return -1 on error or number of bytes read
+ * @return slot in raw_info->cache or -1 on error
  */
-static ssize_t
-raw_read_segment(IMG_RAW_INFO * raw_info, int idx, char *buf,
-    size_t len, TSK_OFF_T rel_offset)
+static int
+raw_acquire_segment(IMG_RAW_INFO * raw_info, int idx,
+#ifdef TSK_WIN32
+    HANDLE * fd
+#else
+    int *fd
+#endif
+    )
 {
     TSK_IMG_INFO* img_info = &raw_info->img_info.img_info;
 
-    IMG_SPLIT_CACHE *cimg;
-    ssize_t cnt;
+    tsk_take_lock(&raw_info->read_lock);
+    std::unique_ptr<tsk_lock_t, void(*)(tsk_lock_t*)> lock_guard(
+      &raw_info->read_lock, tsk_release_lock
+    );
 
     /* Is the image already open? */
-    if (raw_info->cptr[idx] == -1) {
+    int slot = raw_info->cptr[idx];
+    if (slot == -1) {
+        /* Take an empty slot, else the idle one used longest ago */
+        for (int i = 0; i < raw_info->cache_len; i++) {
+            const IMG_SPLIT_CACHE *c = &raw_info->cache[i];
+            if (c->users) {
+                continue;
+            }
+            if (c->fd == 0) {
+                slot = i;
+                break;
+            }
+            if (slot == -1 || c->used < raw_info->cache[slot].used) {
+                slot = i;
+            }
+        }
+
+        if (slot == -1) {
+            IMG_SPLIT_CACHE *grown = (IMG_SPLIT_CACHE *) tsk_realloc(
+                raw_info->cache,
+                (raw_info->cache_len + 1) * sizeof(IMG_SPLIT_CACHE));
+            if (!grown) {
+                return -1;
+            }
+            raw_info->cache = grown;
+            slot = raw_info->cache_len++;
+            memset(&raw_info->cache[slot], 0, sizeof(IMG_SPLIT_CACHE));
+        }
+
         if (tsk_verbose) {
             tsk_fprintf(stderr,
                 "raw_read_segment: opening file into slot %d: %" PRIttocTSK
-                "\n", raw_info->next_slot, img_info->images[idx]);
+                "\n", slot, img_info->images[idx]);
         }
 
-        /* Grab the next cache slot */
-        cimg = &raw_info->cache[raw_info->next_slot];
+        IMG_SPLIT_CACHE *cimg = &raw_info->cache[slot];
 
         /* Free it if being used */
         if (cimg->fd != 0) {
@@ -81,11 +144,7 @@ raw_read_segment(IMG_RAW_INFO * raw_info, int idx, char *buf,
                     "raw_read_segment: closing file %" PRIttocTSK "\n",
                     img_info->images[cimg->image]);
             }
-#ifdef TSK_WIN32
-            CloseHandle(cimg->fd);
-#else
-            close(cimg->fd);
-#endif
+            raw_close_fd(cimg);
             raw_info->cptr[cimg->image] = -1;
         }
 
@@ -102,10 +161,20 @@ raw_read_segment(IMG_RAW_INFO * raw_info, int idx, char *buf,
                                 "\" - %d", img_info->images[idx], lastError);
             return -1;
         }
-
+        cimg->seek_pos = 0;
 #else
-        if ((cimg->fd =
-                open(img_info->images[idx], O_RDONLY | O_BINARY)) < 0) {
+        int flags = O_RDONLY | O_BINARY;
+#ifdef O_DIRECT
+        if (raw_info->backend == TSK_IMG_BACKEND_DIRECT) {
+            flags |= O_DIRECT;
+        }
+#endif
+        cimg->fd = open(img_info->images[idx], flags);
+        if (cimg->fd < 0 && flags != (O_RDONLY | O_BINARY)) {
+            /* not every file system supports O_DIRECT */
+            cimg->fd = open(img_info->images[idx], O_RDONLY | O_BINARY);
+        }
+        if (cimg->fd < 0) {
             cimg->fd = 0; /* so we don't close it next time */
             tsk_error_reset();
             tsk_error_set_errno(TSK_ERR_IMG_OPEN);
@@ -113,20 +182,156 @@ raw_read_segment(IMG_RAW_INFO * raw_info, int idx, char *buf,
                 "\" - %s", img_info->images[idx], strerror(errno));
             return -1;
         }
+#if defined(F_NOCACHE)
+        if (raw_info->backend == TSK_IMG_BACKEND_DIRECT) {
+            fcntl(cimg->fd, F_NOCACHE, 1);
+        }
+#endif
 #endif
         cimg->image = idx;
-        cimg->seek_pos = 0;
-        raw_info->cptr[idx] = raw_info->next_slot;
-        if (++raw_info->next_slot == SPLIT_CACHE) {
-            raw_info->next_slot = 0;
+        raw_info->cptr[idx] = slot;
+    }
+
+    IMG_SPLIT_CACHE *cimg = &raw_info->cache[slot];
+    ++cimg->users;
+    cimg->used = ++raw_info->cache_clock;
+    *fd = cimg->fd;
+    return slot;
+}
+
+static void
+raw_release_segment(IMG_RAW_INFO * raw_info, int slot)
+{
+    tsk_take_lock(&raw_info->read_lock);
+    --raw_info->cache[slot].users;
+    tsk_release_lock(&raw_info->read_lock);
+}
+
+#ifndef TSK_WIN32
+/**
+ * \internal
+ * Map a segment into memory the first time it is read with the mmap
+ * backend.  The file is closed again right away; the mapping stays until
+ * the image is closed.
+ *
+ * @return the mapping, or NULL to read the segment with pread instead
+ */
+static const char *
+raw_map_segment(IMG_RAW_INFO * raw_info, int idx)
+{
+    TSK_IMG_INFO* img_info = &raw_info->img_info.img_info;
+
+    tsk_take_lock(&raw_info->read_lock);
+    char *map = raw_info->maps[idx];
+    if (map == NULL) {
+        const TSK_OFF_T seg_size =
+            raw_info->max_off[idx] - raw_segment_start(raw_info, idx);
+
+        map = &raw_no_map;
+        if (seg_size > 0 && (uint64_t) seg_size <= SIZE_MAX) {
+            const int fd = open(img_info->images[idx], O_RDONLY | O_BINARY);
+            if (fd >= 0) {
+                void *p = mmap(NULL, (size_t) seg_size, PROT_READ, MAP_SHARED, fd, 0);
+                close(fd);
+                if (p != MAP_FAILED) {
+                    map = (char *) p;
+                }
+            }
         }
+        if (tsk_verbose && map == &raw_no_map) {
+            tsk_fprintf(stderr,
+                "raw_map_segment: reading %" PRIttocTSK " without mmap\n",
+                img_info->images[idx]);
+        }
+        raw_info->maps[idx] = map;
     }
-    else {
-        /* image already open */
-        cimg = &raw_info->cache[raw_info->cptr[idx]];
+    tsk_release_lock(&raw_info->read_lock);
+
+    return map == &raw_no_map ? NULL : map;
+}
+
+/* pread() until len bytes, the end of the file or an error */
+static ssize_t
+raw_pread(int fd, char *buf, size_t len, TSK_OFF_T off)
+{
+    size_t done = 0;
+    while (done < len) {
+        const ssize_t cnt = pread(fd, buf + done, len - done, off + done);
+        if (cnt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // report what we have; O_DIRECT rejects the unaligned retry
+            return done ? (ssize_t) done : -1;
+        }
+        if (cnt == 0) {
+            break;
+        }
+        done += cnt;
     }
+    return (ssize_t) done;
+}
+
+/* pread() through an aligned bounce buffer, as O_DIRECT requires */
+static ssize_t
+raw_pread_direct(int fd, char *buf, size_t len, TSK_OFF_T off)
+{
+    const TSK_OFF_T start = off - off % RAW_DIRECT_ALIGN;
+    const size_t skip = (size_t) (off - start);
+    const size_t span = roundup(skip + len, RAW_DIRECT_ALIGN);
+
+    void *bounce = NULL;
+    if (posix_memalign(&bounce, RAW_DIRECT_ALIGN, span) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ssize_t cnt = raw_pread(fd, (char *) bounce, span, start);
+    if (cnt >= 0) {
+        cnt = (size_t) cnt > skip ? (ssize_t) std::min(len, (size_t) cnt - skip) : 0;
+        memcpy(buf, (char *) bounce + skip, cnt);
+    }
+    free(bounce);
+    return cnt;
+}
+#endif
+
+/**
+ * \internal
+ * Read from one of the multiple files in a split set of disk images.
+ * Other than on Windows, this keeps no seek position and may be called
+ * from several threads at once.
+ *
+ * @param split_info Disk image info to read from
+ * @param idx Index of the disk image in the set to read from
+ * @param buf [out] Buffer to write data to
+ * @param len Number of bytes to read
+ * @param rel_offset Byte offset in the disk image to read from (not the offset in the full disk image set)
+ *
+ * @return -1 on error or number of bytes read
+ */
+static ssize_t
+raw_read_segment(IMG_RAW_INFO * raw_info, int idx, char *buf,
+    size_t len, TSK_OFF_T rel_offset)
+{
+    TSK_IMG_INFO* img_info = &raw_info->img_info.img_info;
+    ssize_t cnt;
 
 #ifdef TSK_WIN32
+    /* Windows reads move the handle's file pointer and feed the image
+     * writer, so they stay under the cache's I/O lock. */
+    HANDLE fd;
+    const int slot = raw_acquire_segment(raw_info, idx, &fd);
+    if (slot < 0) {
+        return -1;
+    }
+    struct SlotGuard {
+        IMG_RAW_INFO *raw_info;
+        int slot;
+        ~SlotGuard() { raw_release_segment(raw_info, slot); }
+    } slot_guard{raw_info, slot};
+    IMG_SPLIT_CACHE *cimg = &raw_info->cache[slot];
+
     {
         // Default to the values that were passed in
         TSK_OFF_T offset_to_read = rel_offset;
@@ -238,28 +443,40 @@ raw_read_segment(IMG_RAW_INFO * raw_info, int idx, char *buf,
         }
     }
 #else
-    if (cimg->seek_pos != rel_offset) {
-        if (lseek(cimg->fd, rel_offset, SEEK_SET) != rel_offset) {
-            tsk_error_reset();
-            tsk_error_set_errno(TSK_ERR_IMG_SEEK);
-            tsk_error_set_errstr("raw_read: file \"%" PRIttocTSK
-                "\" offset %" PRIdOFF " seek - %s", img_info->images[idx],
-                rel_offset, strerror(errno));
-            return -1;
+    if (raw_info->maps) {
+        const char *map = raw_map_segment(raw_info, idx);
+        if (map) {
+            const TSK_OFF_T seg_size =
+                raw_info->max_off[idx] - raw_segment_start(raw_info, idx);
+            if (rel_offset >= seg_size) {
+                return 0;
+            }
+            cnt = (ssize_t) std::min((TSK_OFF_T) len, seg_size - rel_offset);
+            memcpy(buf, map + rel_offset, cnt);
+            return cnt;
         }
-        cimg->seek_pos = rel_offset;
     }
 
-    cnt = read(cimg->fd, buf, len);
+    int fd;
+    const int slot = raw_acquire_segment(raw_info, idx, &fd);
+    if (slot < 0) {
+        return -1;
+    }
+
+    cnt = raw_info->backend == TSK_IMG_BACKEND_DIRECT ?
+        raw_pread_direct(fd, buf, len, rel_offset) :
+        raw_pread(fd, buf, len, rel_offset);
+    const int read_errno = errno;
+    raw_release_segment(raw_info, slot);
+
     if (cnt < 0) {
         tsk_error_reset();
         tsk_error_set_errno(TSK_ERR_IMG_READ);
         tsk_error_set_errstr("raw_read: file \"%" PRIttocTSK "\" offset: %"
 			PRIdOFF " read len: %" PRIuSIZE " - %s", img_info->images[idx],
-            rel_offset, len, strerror(errno));
+            rel_offset, len, strerror(read_errno));
         return -1;
     }
-    cimg->seek_pos += cnt;
 #endif
 
     return cnt;
@@ -271,7 +488,7 @@ raw_read_segment(IMG_RAW_INFO * raw_info, int idx, char *buf,
  * Read data from a (potentially split) raw disk image.  The offset to
  * start reading from is equal to the volume offset plus the read offset.
  *
- * Note: The routine -assumes- we are under a lock on &(img_info->cache_lock))
+ * Other than on Windows, this needs no lock (see raw_read_segment()).
  *
  * @param img_info Disk image to read from
  * @param offset Byte offset in image to start reading from
@@ -300,89 +517,83 @@ raw_read(TSK_IMG_INFO * img_info, TSK_OFF_T offset, char *buf, size_t len)
         return -1;
     }
 
-    tsk_take_lock(&raw_info->read_lock);
-    std::unique_ptr<tsk_lock_t, void(*)(tsk_lock_t*)> lock_guard(
-      &raw_info->read_lock, tsk_release_lock
-    );
-
-    // Find the location of the offset
-    for (i = 0; i < img_info->num_img; i++) {
+    // Find the segment the data starts in: the first that ends after it
+    i = (int) (std::upper_bound(raw_info->max_off,
+        raw_info->max_off + img_info->num_img, offset) - raw_info->max_off);
 
-        /* Does the data start in this image? */
-        if (offset < raw_info->max_off[i]) {
-            TSK_OFF_T rel_offset;
-            size_t read_len;
-            ssize_t cnt;
+    if (i < img_info->num_img) {
+        TSK_OFF_T rel_offset;
+        size_t read_len;
+        ssize_t cnt;
 
-            /* Get the offset relative to this image segment */
-            if (i > 0) {
-                rel_offset = offset - raw_info->max_off[i - 1];
-            }
-            else {
-                rel_offset = offset;
-            }
+        /* Get the offset relative to this image segment */
+        if (i > 0) {
+            rel_offset = offset - raw_info->max_off[i - 1];
+        }
+        else {
+            rel_offset = offset;
+        }
 
-            /* Get the length to read */
-            // NOTE: max_off - offset can be a very large number.  Do not cast to size_t
-            if (raw_info->max_off[i] - offset >= (TSK_OFF_T)len)
-                read_len = len;
-            else
-                read_len = (size_t) (raw_info->max_off[i] - offset);
+        /* Get the length to read */
+        // NOTE: max_off - offset can be a very large number.  Do not cast to size_t
+        if (raw_info->max_off[i] - offset >= (TSK_OFF_T)len)
+            read_len = len;
+        else
+            read_len = (size_t) (raw_info->max_off[i] - offset);
 
 
-            if (tsk_verbose) {
-                tsk_fprintf(stderr,
-                    "raw_read: found in image %d relative offset: %"
+        if (tsk_verbose) {
+            tsk_fprintf(stderr,
+                "raw_read: found in image %d relative offset: %"
 					PRIdOFF " len: %" PRIdOFF "\n", i, rel_offset,
-                    (TSK_OFF_T) read_len);
-            }
+                (TSK_OFF_T) read_len);
+        }
 
-            cnt = raw_read_segment(raw_info, i, buf, read_len, rel_offset);
-            if (cnt < 0) {
-                return -1;
-            }
-            if ((size_t) cnt != read_len) {
-                return cnt;
-            }
+        cnt = raw_read_segment(raw_info, i, buf, read_len, rel_offset);
+        if (cnt < 0) {
+            return -1;
+        }
+        if ((size_t) cnt != read_len) {
+            return cnt;
+        }
 
-            /* read from the next image segment(s) if needed */
-            if (((size_t) cnt == read_len) && (read_len != len)) {
+        /* read from the next image segment(s) if needed */
+        if (((size_t) cnt == read_len) && (read_len != len)) {
 
-                len -= read_len;
+            len -= read_len;
 
-                /* go to the next image segment */
-                while ((len > 0) && (i+1 < img_info->num_img)) {
-                    ssize_t cnt2;
+            /* go to the next image segment */
+            while ((len > 0) && (i+1 < img_info->num_img)) {
+                ssize_t cnt2;
 
-                    i++;
+                i++;
 
-                    if ((raw_info->max_off[i] - raw_info->max_off[i - 1]) >= (TSK_OFF_T)len)
-                        read_len = len;
-                    else
-                        read_len = (size_t) (raw_info->max_off[i] - raw_info->max_off[i - 1]);
+                if ((raw_info->max_off[i] - raw_info->max_off[i - 1]) >= (TSK_OFF_T)len)
+                    read_len = len;
+                else
+                    read_len = (size_t) (raw_info->max_off[i] - raw_info->max_off[i - 1]);
 
-                    if (tsk_verbose) {
-                        tsk_fprintf(stderr,
-                            "raw_read: additional image reads: image %d len: %"
+                if (tsk_verbose) {
+                    tsk_fprintf(stderr,
+                        "raw_read: additional image reads: image %d len: %"
 							PRIuSIZE "\n", i, read_len);
-                    }
-
-                    cnt2 = raw_read_segment(raw_info, i, &buf[cnt],
-                        read_len, 0);
-                    if (cnt2 < 0) {
-                        return -1;
-                    }
-                    cnt += cnt2;
+                }
 
-                    if ((size_t) cnt2 != read_len) {
-                        return cnt;
-                    }
+                cnt2 = raw_read_segment(raw_info, i, &buf[cnt],
+                    read_len, 0);
+                if (cnt2 < 0) {
+                    return -1;
+                }
+                cnt += cnt2;
 
-                    len -= cnt2;
+                if ((size_t) cnt2 != read_len) {
+                    return cnt;
                 }
+
+                len -= cnt2;
             }
-            return cnt;
         }
+        return cnt;
     }
 
     tsk_error_reset();
@@ -450,17 +661,26 @@ raw_close(TSK_IMG_INFO * img_info)
     }
 #endif
 
-    for (i = 0; i < SPLIT_CACHE; i++) {
+    for (i = 0; i < raw_info->cache_len; i++) {
         if (raw_info->cache[i].fd != 0)
-#ifdef TSK_WIN32
-            CloseHandle(raw_info->cache[i].fd);
-#else
-            close(raw_info->cache[i].fd);
-#endif
+            raw_close_fd(&raw_info->cache[i]);
     }
 
+#ifndef TSK_WIN32
+    if (raw_info->maps) {
+        for (i = 0; i < img_info->num_img; i++) {
+            char *map = raw_info->maps[i];
+            if (map && map != &raw_no_map) {
+                munmap(map, (size_t) (raw_info->max_off[i] - raw_segment_start(raw_info, i)));
+            }
+        }
+        free(raw_info->maps);
+    }
+#endif
+
     free(raw_info->max_off);
     free(raw_info->cptr);
+    free(raw_info->cache);
 
     tsk_deinit_lock(&(raw_info->read_lock));
     tsk_img_free(raw_info);
@@ -604,6 +824,7 @@ raw_open(int a_num_img, const TSK_TCHAR * const a_images[],
         if (raw_info) {
             free(raw_info->cptr);
             free(raw_info->max_off);
+            free(raw_info->cache);
         }
         tsk_img_free(raw_info);
     };
@@ -618,6 +839,8 @@ raw_open(int a_num_img, const TSK_TCHAR * const a_images[],
 
     raw_info->cptr = nullptr;
     raw_info->max_off = nullptr;
+    raw_info->cache = nullptr;
+    raw_info->maps = nullptr;
     img_info = (TSK_IMG_INFO *) raw_info.get();
 
     img_info->itype = TSK_IMG_TYPE_RAW;
@@ -628,6 +851,13 @@ raw_open(int a_num_img, const TSK_TCHAR * const a_images[],
 
     raw_info->is_winobj = 0;
 
+#ifdef TSK_WIN32
+    raw_info->backend = TSK_IMG_BACKEND_DEFAULT;
+#else
+    raw_info->backend = TSK_IMG_BACKEND_PREAD;
+    raw_info->img_info.parallel_read = 1;
+#endif
+
 #if defined(TSK_WIN32) || defined(__CYGWIN__)
     /* determine if this is the path to a Windows device object */
     if ((a_images[0][0] == _TSK_T('\\'))
@@ -691,9 +921,13 @@ raw_open(int a_num_img, const TSK_TCHAR * const a_images[],
     if (!raw_info->cptr) {
         return nullptr;
     }
-    memset((void *) &raw_info->cache, 0,
-        SPLIT_CACHE * sizeof(IMG_SPLIT_CACHE));
-    raw_info->next_slot = 0;
+    raw_info->cache =
+        (IMG_SPLIT_CACHE *) tsk_malloc(SPLIT_CACHE * sizeof(IMG_SPLIT_CACHE));
+    if (!raw_info->cache) {
+        return nullptr;
+    }
+    raw_info->cache_len = SPLIT_CACHE;
+    raw_info->cache_clock = 0;
 
     /* initialize the offset table and re-use the first segment
      * size gathered above */
@@ -746,3 +980,66 @@ raw_open(int a_num_img, const TSK_TCHAR * const a_images[],
 
     return (TSK_IMG_INFO*) raw_info.release();
 }
+
+/**
+ * \internal
+ * Choose how the segments of a raw image are read.  Call this right after
+ * raw_open(), before the first read.  Backends that are not available
+ * here fall back to the default.
+ *
+ * @param a_img_info Image opened with raw_open()
+ * @param a_backend Backend to use
+ * @param a_max_files Number of segment files to keep open (0 for the default)
+ */
+void
+raw_set_backend(TSK_IMG_INFO * a_img_info, TSK_IMG_BACKEND_ENUM a_backend,
+    size_t a_max_files)
+{
+    IMG_RAW_INFO *raw_info = (IMG_RAW_INFO *) a_img_info;
+
+#ifdef TSK_WIN32
+    a_backend = TSK_IMG_BACKEND_DEFAULT;
+#else
+    if (a_backend == TSK_IMG_BACKEND_DEFAULT) {
+        a_backend = TSK_IMG_BACKEND_PREAD;
+    }
+
+    if (a_backend == TSK_IMG_BACKEND_MMAP && !raw_info->maps) {
+        raw_info->maps =
+            (char **) tsk_malloc(a_img_info->num_img * sizeof(char *));
+        if (!raw_info->maps) {
+            tsk_error_reset();
+            a_backend = TSK_IMG_BACKEND_PREAD;
+        }
+    }
+#endif
+    raw_info->backend = a_backend;
+
+    if (a_max_files > 0 && a_max_files <= INT_MAX
+        && (int) a_max_files != raw_info->cache_len) {
+        IMG_SPLIT_CACHE *cache = (IMG_SPLIT_CACHE *)
+            tsk_malloc(a_max_files * sizeof(IMG_SPLIT_CACHE));
+        if (!cache) {
+            tsk_error_reset();
+            return;
+        }
+
+        for (int i = 0; i < raw_info->cache_len; i++) {
+            if (raw_info->cache[i].fd != 0) {
+                raw_close_fd(&raw_info->cache[i]);
+            }
+        }
+        for (int i = 0; i < a_img_info->num_img; i++) {
+            raw_info->cptr[i] = -1;
+        }
+        free(raw_info->cache);
+        raw_info->cache = cache;
+        raw_info->cache_len = (int) a_max_files;
+    }
+
+    if (tsk_verbose) {
+        tsk_fprintf(stderr,
+            "raw_set_backend: backend %d, %d open files\n",
+            (int) raw_info->backend, raw_info->cache_len);
+    }
+}
@@ -24,29 +24,38 @@ extern "C" {
     extern TSK_IMG_INFO *raw_open(int a_num_img,
         const TSK_TCHAR * const a_images[], unsigned int a_ssize);
 
+    extern void raw_set_backend(TSK_IMG_INFO * a_img_info,
+        TSK_IMG_BACKEND_ENUM a_backend, size_t a_max_files);
+
 #define SPLIT_CACHE	15
 
     typedef struct {
 #ifdef TSK_WIN32
         HANDLE fd;
+        TSK_OFF_T seek_pos;
 #else
         int fd;
 #endif
         int image;
-        TSK_OFF_T seek_pos;
+        int users;              /* reads in progress that use fd */
+        uint64_t used;          /* last use, to pick a slot to reuse */
     } IMG_SPLIT_CACHE;
 
     typedef struct {
         IMG_INFO img_info;
         uint8_t is_winobj;
         TSK_IMG_WRITER *img_writer;
+        TSK_IMG_BACKEND_ENUM backend;
+
+        TSK_OFF_T *max_off;     /* end of each segment, fixed after open */
 
         tsk_lock_t read_lock;
         // the following are protected by read_lock
-        TSK_OFF_T *max_off;
         int *cptr;              /* exists for each image - points to entry in cache */
-        IMG_SPLIT_CACHE cache[SPLIT_CACHE];     /* small number of fds for open images */
-        int next_slot;
+        IMG_SPLIT_CACHE *cache; /* small number of fds for open images */
+        int cache_len;
+        uint64_t cache_clock;
+        char **maps;            /* exists for each image with the mmap backend */
     } IMG_RAW_INFO;
 
 #ifdef __cplusplus
@@ -0,0 +1,522 @@
+#include "sharded_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <system_error>
+
+// A miss up to this many lines past a stream still continues it, so
+// strided readers get read-ahead too.
+static const uint64_t RA_MAX_GAP = 4;
+
+ShardedCache::ShardedCache(size_t capacity, size_t line_size, size_t nshards):
+  line_len(line_size ? line_size : 65536),
+  ra_lines(1),
+  ra_clock(0),
+  streams()
+#ifdef TSK_MULTITHREAD_LIB
+  , stopping(false)
+#endif
+{
+  if (nshards == 0) {
+    nshards = 1;
+  }
+
+  // Every shard holds at least one line, so tiny capacities still cache.
+  const size_t lines = std::max(capacity / line_len, nshards);
+  lines_per_shard = lines / nshards;
+
+  tsk_init_lock(&io_lock);
+  tsk_init_lock(&ra_lock);
+  shards.reserve(nshards);
+  for (size_t i = 0; i < nshards; ++i) {
+    std::unique_ptr<Shard> s(new Shard());
+    tsk_init_lock(&s->lock);
+    s->index.reserve(lines_per_shard);
+    shards.push_back(std::move(s));
+  }
+}
+
+ShardedCache::~ShardedCache() {
+#ifdef TSK_MULTITHREAD_LIB
+  // The image is closed after its cache, so the worker must be done.
+  {
+    std::lock_guard<std::mutex> guard(queue_mutex);
+    stopping = true;
+    queue.clear();
+  }
+  queue_cv.notify_all();
+  if (worker.joinable()) {
+    worker.join();
+  }
+#endif
+
+  for (auto& s: shards) {
+    tsk_deinit_lock(&s->lock);
+  }
+  tsk_deinit_lock(&ra_lock);
+  tsk_deinit_lock(&io_lock);
+}
+
+void ShardedCache::set_readahead(size_t max_bytes) {
+  // A window never takes more than a quarter of the cache, so that
+  // read-ahead does not evict what it has just read.
+  const size_t lines = std::min(max_bytes / line_len, capacity() / line_len / 4);
+
+  tsk_take_lock(&ra_lock);
+  ra_lines = std::max(lines, (size_t) 1);
+  tsk_release_lock(&ra_lock);
+}
+
+void ShardedCache::lock() {
+  tsk_take_lock(&io_lock);
+}
+
+void ShardedCache::unlock() {
+  tsk_release_lock(&io_lock);
+}
+
+void ShardedCache::clear() {
+  for (auto& s: shards) {
+    tsk_take_lock(&s->lock);
+    s->index.clear();
+    s->lru.clear();
+    s->spare.clear();
+    tsk_release_lock(&s->lock);
+  }
+}
+
+void ShardedCache::add_stats(Stats& stats) {
+  for (auto& s: shards) {
+    tsk_take_lock(&s->lock);
+    tsk_img_stats_merge(&stats, &s->stats);
+    tsk_release_lock(&s->lock);
+  }
+}
+
+ShardedCache::Shard& ShardedCache::shard_for(TSK_OFF_T line_off) {
+  // Fibonacci hashing spreads consecutive lines over all shards.
+  const uint64_t h = (uint64_t) (line_off / line_len) * 0x9E3779B97F4A7C15ULL;
+  return *shards[(h >> 32) % shards.size()];
+}
+
+bool ShardedCache::get(
+  TSK_OFF_T line_off,
+  size_t rel,
+  char* buf,
+  size_t len,
+  size_t* copied,
+  bool* marker)
+{
+  Shard& s = shard_for(line_off);
+  tsk_take_lock(&s.lock);
+
+  const auto i = s.index.find(line_off);
+  if (i == s.index.end()) {
+    tsk_release_lock(&s.lock);
+    return false;
+  }
+
+  Line& line = *i->second;
+  const size_t n = rel < line.len ? std::min(len, line.len - rel) : 0;
+  memcpy(buf, line.data.get() + rel, n);
+  s.lru.splice(s.lru.begin(), s.lru, i->second);
+  if (marker) {
+    *marker = line.marker;
+    line.marker = false;
+  }
+
+  tsk_release_lock(&s.lock);
+  *copied = n;
+  return true;
+}
+
+std::unique_ptr<char[]> ShardedCache::take_buffer(TSK_OFF_T line_off) {
+  Shard& s = shard_for(line_off);
+  std::unique_ptr<char[]> buf;
+
+  tsk_take_lock(&s.lock);
+  if (!s.spare.empty()) {
+    buf = std::move(s.spare.back());
+    s.spare.pop_back();
+  }
+  tsk_release_lock(&s.lock);
+
+  if (!buf) {
+    buf.reset(new(std::nothrow) char[line_len]);
+    if (!buf) {
+      tsk_error_reset();
+      tsk_error_set_errno(TSK_ERR_AUX_MALLOC);
+      tsk_error_set_errstr("ShardedCache::take_buffer: %" PRIuSIZE " bytes", line_len);
+    }
+  }
+  return buf;
+}
+
+void ShardedCache::put(
+  TSK_OFF_T line_off,
+  std::unique_ptr<char[]> data,
+  size_t len,
+  bool marker)
+{
+  Shard& s = shard_for(line_off);
+  tsk_take_lock(&s.lock);
+
+  // Running out of memory for the bookkeeping drops the line (or the
+  // spare buffer); the next read of it goes to the image again.
+  try {
+    const auto i = s.index.find(line_off);
+    if (i != s.index.end()) {
+      // another thread loaded the same line while we were reading it
+      s.spare.push_back(std::move(data));
+    }
+    else {
+      if (s.lru.size() >= lines_per_shard) {
+        std::unique_ptr<char[]> old = std::move(s.lru.back().data);
+        s.index.erase(s.lru.back().off);
+        s.lru.pop_back();
+        s.spare.push_back(std::move(old));
+      }
+      s.lru.push_front(Line{line_off, len, std::move(data), marker});
+      try {
+        s.index.emplace(line_off, s.lru.begin());
+      }
+      catch (const std::bad_alloc&) {
+        s.lru.pop_front();
+      }
+    }
+  }
+  catch (const std::bad_alloc&) {
+  }
+
+  tsk_release_lock(&s.lock);
+}
+
+void ShardedCache::account(TSK_OFF_T off, TSK_IMG_READ_PATH_ENUM path, size_t ns, size_t bytes) {
+  Shard& s = shard_for(off - off % (TSK_OFF_T) line_len);
+  tsk_take_lock(&s.lock);
+  tsk_img_stats_add(&s.stats, path, ns, bytes);
+  tsk_release_lock(&s.lock);
+}
+
+void ShardedCache::account_backend(TSK_OFF_T off, ssize_t count) {
+  Shard& s = shard_for(off);
+  tsk_take_lock(&s.lock);
+  tsk_img_stats_add_backend(&s.stats, count);
+  tsk_release_lock(&s.lock);
+}
+
+#ifdef TSK_MULTITHREAD_LIB
+bool ShardedCache::in_flight(TSK_OFF_T line_off) const {
+  for (const auto& f: flights) {
+    if (line_off >= f.first && line_off < f.second) {
+      return true;
+    }
+  }
+  return false;
+}
+#endif
+
+bool ShardedCache::contains(TSK_OFF_T line_off) {
+  Shard& s = shard_for(line_off);
+  tsk_take_lock(&s.lock);
+  const bool found = s.index.find(line_off) != s.index.end();
+  tsk_release_lock(&s.lock);
+  return found;
+}
+
+ssize_t ShardedCache::fill(TSK_IMG_INFO* img, TSK_OFF_T line_off) {
+  Window w{img, line_off, 1, -1};
+  const uint64_t line = (uint64_t) (line_off / line_len);
+
+  tsk_take_lock(&ra_lock);
+  if (ra_lines > 1) {
+    Stream* oldest = &streams[0];
+    Stream* match = nullptr;
+    bool inside = false;
+    for (auto& s: streams) {
+      if (s.window && line >= s.next && line <= s.next + RA_MAX_GAP) {
+        match = &s;
+        break;
+      }
+      if (s.window && line < s.next && line + s.window >= s.next) {
+        // The reader caught up with a window that is still queued (or
+        // was evicted): read the rest of it now.
+        match = &s;
+        inside = true;
+        w.lines = (size_t) (s.next - line);
+        if (s.marker >= line && s.marker < s.next) {
+          w.marker = (TSK_OFF_T) (s.marker * line_len);
+        }
+        s.used = ++ra_clock;
+        break;
+      }
+      if (s.used < oldest->used) {
+        oldest = &s;
+      }
+    }
+
+    if (!match) {
+      *oldest = Stream{line + 1, UINT64_MAX, 1, ++ra_clock};
+    }
+    else if (!inside) {
+      match->window = std::min(std::max(match->window * 2, (size_t) 2), ra_lines);
+      match->next = line + match->window;
+      match->marker = line + match->window / 2;
+      match->used = ++ra_clock;
+      w.lines = match->window;
+      w.marker = (TSK_OFF_T) (match->marker * line_len);
+    }
+  }
+  tsk_release_lock(&ra_lock);
+
+  // Stop the window at the end of the image or at a line we already have.
+  for (size_t i = 1; i < w.lines; ++i) {
+    const TSK_OFF_T off = line_off + (TSK_OFF_T) (i * line_len);
+    if (off >= img->size || contains(off)) {
+      w.lines = i;
+      break;
+    }
+  }
+
+  return read_window(w);
+}
+
+void ShardedCache::advance(TSK_IMG_INFO* img, TSK_OFF_T line_off) {
+  const uint64_t line = (uint64_t) (line_off / line_len);
+  Window w{img, 0, 0, -1};
+
+  tsk_take_lock(&ra_lock);
+  for (auto& s: streams) {
+    if (s.window && s.marker == line) {
+      s.window = std::min(s.window * 2, ra_lines);
+      w.off = (TSK_OFF_T) (s.next * line_len);
+      w.lines = s.window;
+      w.marker = w.off;
+      s.marker = s.next;
+      s.next += s.window;
+      s.used = ++ra_clock;
+      break;
+    }
+  }
+  tsk_release_lock(&ra_lock);
+
+  if (w.lines == 0 || w.off >= img->size) {
+    return;
+  }
+  queue_window(w);
+}
+
+ssize_t ShardedCache::load(TSK_IMG_INFO* img, TSK_OFF_T line_off, size_t lines) {
+  return read_window(Window{img, line_off, lines ? lines : 1, -1});
+}
+
+ssize_t ShardedCache::read_window(const Window& a_w) {
+  IMG_INFO* iif = reinterpret_cast<IMG_INFO*>(a_w.img);
+  Window w = a_w;
+
+  size_t len = w.lines * line_len;
+  if (w.off + (TSK_OFF_T) len > w.img->size) {
+    len = (size_t) (w.img->size - w.off);
+  }
+
+  std::unique_ptr<char[]> buf;
+  if (w.lines == 1) {
+    buf = take_buffer(w.off);
+    if (!buf) {
+      return -1;
+    }
+  }
+  else {
+    buf.reset(new(std::nothrow) char[len]);
+    if (!buf) {
+      tsk_error_reset();
+      tsk_error_set_errno(TSK_ERR_AUX_MALLOC);
+      tsk_error_set_errstr("ShardedCache::read_window: %" PRIuSIZE " bytes", len);
+      return -1;
+    }
+  }
+
+  // Formats that allow concurrent reads do not need the I/O lock.
+  const bool locked = !iif->parallel_read;
+  if (locked) {
+    lock();
+  }
+
+#ifdef TSK_MULTITHREAD_LIB
+  std::unique_lock<std::mutex> flight_guard(flight_mutex, std::defer_lock);
+  if (!locked) {
+    flight_guard.lock();
+  }
+  const auto loading = [&](TSK_OFF_T off) {
+    return !locked && in_flight(off);
+  };
+#else
+  const auto loading = [](TSK_OFF_T) { return false; };
+#endif
+
+  for (;;) {
+    // Skip lines another reader loaded while we waited for the lock
+    // (usually a reader that caught up with its own read-ahead).
+    while (w.lines && contains(w.off)) {
+      w.off += (TSK_OFF_T) line_len;
+      --w.lines;
+      len = len > line_len ? len - line_len : 0;
+    }
+#ifdef TSK_MULTITHREAD_LIB
+    // Wait for a reader that is loading the first line.
+    if (w.lines && loading(w.off)) {
+      flight_cv.wait(flight_guard);
+      continue;
+    }
+#endif
+    break;
+  }
+
+  // Stop at a line that an earlier window already read or that another
+  // reader is loading.
+  for (size_t i = 1; i < w.lines; ++i) {
+    const TSK_OFF_T off = w.off + (TSK_OFF_T) (i * line_len);
+    if (contains(off) || loading(off)) {
+      w.lines = i;
+      len = std::min(len, w.lines * line_len);
+      break;
+    }
+  }
+
+  if (w.lines == 0 || len == 0) {
+    if (locked) {
+      unlock();
+    }
+    return 1;
+  }
+
+#ifdef TSK_MULTITHREAD_LIB
+  const std::pair<TSK_OFF_T, TSK_OFF_T> flight(w.off, w.off + (TSK_OFF_T) len);
+  bool tracked = false;
+  if (!locked) {
+    try {
+      flights.push_back(flight);
+      tracked = true;
+    }
+    catch (const std::bad_alloc&) {
+      // read it untracked; a reader that wants the same lines reads
+      // them again and put() keeps the first copy
+    }
+    flight_guard.unlock();
+  }
+#endif
+
+  const ssize_t read_count = iif->read(w.img, w.off, buf.get(), len);
+
+  // Insert before releasing the I/O lock (or the lines in flight), so
+  // that a reader waiting for them finds them instead of reading them
+  // again.
+  if (read_count > 0) {
+    insert_window(w, std::move(buf), len, (size_t) read_count, a_w.lines == 1);
+  }
+  if (locked) {
+    unlock();
+  }
+#ifdef TSK_MULTITHREAD_LIB
+  else if (tracked) {
+    flight_guard.lock();
+    flights.erase(std::find(flights.begin(), flights.end(), flight));
+    flight_guard.unlock();
+    flight_cv.notify_all();
+  }
+#endif
+
+  account_backend(w.off, read_count);
+  return read_count;
+}
+
+void ShardedCache::insert_window(const Window& w, std::unique_ptr<char[]> buf,
+  size_t len, size_t got, bool single)
+{
+  if (single) {
+    // buf came from take_buffer()
+    put(w.off, std::move(buf), got, w.off == w.marker);
+    return;
+  }
+
+  // Insert back to front so the first line, which a reader is waiting
+  // for, is the last one a small shard would evict.
+  size_t end = got;
+  if (got < len && w.off + (TSK_OFF_T) got < w.img->size) {
+    // short read: keep only whole lines, but always the first one
+    end = std::max(got - got % line_len, std::min(got, line_len));
+  }
+  for (size_t done = (end - 1) / line_len * line_len; ; done -= line_len) {
+    const TSK_OFF_T off = w.off + (TSK_OFF_T) done;
+    const size_t n = std::min(line_len, end - done);
+    std::unique_ptr<char[]> line = take_buffer(off);
+    if (line) {
+      memcpy(line.get(), buf.get() + done, n);
+      put(off, std::move(line), n, off == w.marker);
+    }
+    else {
+      // the line is read again when it is needed
+      tsk_error_reset();
+    }
+    if (done == 0) {
+      break;
+    }
+  }
+}
+
+void ShardedCache::queue_window(const Window& w) {
+#ifdef TSK_MULTITHREAD_LIB
+  {
+    std::lock_guard<std::mutex> guard(queue_mutex);
+    if (!worker.joinable()) {
+      try {
+        worker = std::thread(&ShardedCache::run_worker, this);
+      }
+      catch (const std::system_error&) {
+        // no thread, read it now instead
+      }
+    }
+    if (worker.joinable()) {
+      // readers that moved on do not need their old windows
+      if (queue.size() >= TSK_IMG_READAHEAD_STREAMS) {
+        queue.pop_front();
+      }
+      try {
+        queue.push_back(w);
+        queue_cv.notify_one();
+      }
+      catch (const std::bad_alloc&) {
+        // drop the read-ahead
+      }
+      return;
+    }
+  }
+#endif
+
+  if (read_window(w) < 0) {
+    tsk_error_reset();
+  }
+}
+
+#ifdef TSK_MULTITHREAD_LIB
+void ShardedCache::run_worker() {
+  for (;;) {
+    Window w;
+    {
+      std::unique_lock<std::mutex> guard(queue_mutex);
+      queue_cv.wait(guard, [this]() { return stopping || !queue.empty(); });
+      if (stopping) {
+        return;
+      }
+      w = queue.front();
+      queue.pop_front();
+    }
+
+    // Errors are left for the reader to hit when it gets there.
+    if (read_window(w) < 0) {
+      tsk_error_reset();
+    }
+  }
+}
+#endif
@@ -0,0 +1,176 @@
+#ifndef _SHARDED_CACHE_H
+#define _SHARDED_CACHE_H
+
+#include "img_cache.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#ifdef TSK_MULTITHREAD_LIB
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#endif
+
+#define TSK_IMG_SHARDED_CACHE_SIZE    (16 * 1024 * 1024)
+#define TSK_IMG_SHARDED_CACHE_SHARDS  16
+#define TSK_IMG_READAHEAD_WINDOW      (1024 * 1024)
+#define TSK_IMG_READAHEAD_STREAMS     8
+
+/*
+ * Read cache split into independently locked shards.  Lines are aligned
+ * blocks of line_size() bytes; a line is found by hashing its offset to
+ * a shard and looking it up in that shard's table, and each shard evicts
+ * its least recently used line.  Shard locks are only held to look up,
+ * copy and insert lines, never across a backend read, so threads reading
+ * different parts of an image only meet on lock() around the actual I/O,
+ * and not at all if the format sets IMG_INFO::parallel_read.
+ *
+ * With set_readahead(), misses also feed a stream detector.  A miss just
+ * past (or a few lines past) what a stream fetched before fetches a
+ * window of lines in one backend read, doubling the window up to the
+ * limit; any other miss starts a new stream that reads a single line,
+ * so random access keeps the one-line behavior.  Each window has a
+ * marker line, and a reader reaching it queues the next window for a
+ * background thread, so a sequential reader finds its data cached.
+ *
+ * Formats with parallel_read are read without the I/O lock, so readers
+ * record the lines they are loading, and a reader that needs one of them
+ * waits for it instead of reading it again.
+ */
+class ShardedCache: public ImgCache {
+public:
+  ShardedCache(
+    size_t capacity = TSK_IMG_SHARDED_CACHE_SIZE,
+    size_t line_size = 65536,
+    size_t shards = TSK_IMG_SHARDED_CACHE_SHARDS
+  );
+
+  ~ShardedCache() override;
+
+  // Read up to max_bytes ahead of sequential readers (0 disables).
+  void set_readahead(size_t max_bytes);
+
+  void lock() override;
+
+  void unlock() override;
+
+  void clear() override;
+
+  void add_stats(Stats& stats) override;
+
+  size_t line_size() const { return line_len; }
+
+  size_t capacity() const { return line_len * lines_per_shard * shards.size(); }
+
+  /*
+   * Copy up to len bytes starting at rel within the line at line_off.
+   * Returns false if the line is not cached; otherwise *copied is the
+   * number of bytes copied, which is short if the line is.  *marker is
+   * set if this was the first hit on a read-ahead marker line.
+   */
+  bool get(TSK_OFF_T line_off, size_t rel, char* buf, size_t len, size_t* copied, bool* marker = nullptr);
+
+  /*
+   * Load the line at line_off after a miss, together with any read-ahead
+   * the stream detector asks for.  Returns the backend result for the
+   * first line (<= 0 on error or end of image).
+   */
+  ssize_t fill(TSK_IMG_INFO* img, TSK_OFF_T line_off);
+
+  // Start the next read-ahead window after a hit on a marker line.
+  void advance(TSK_IMG_INFO* img, TSK_OFF_T line_off);
+
+  // Load the given number of lines from line_off on in one backend read.
+  ssize_t load(TSK_IMG_INFO* img, TSK_OFF_T line_off, size_t lines);
+
+  // A buffer of line_size() bytes to read a line into.
+  std::unique_ptr<char[]> take_buffer(TSK_OFF_T line_off);
+
+  // Insert a line that was read into a buffer from take_buffer().
+  void put(TSK_OFF_T line_off, std::unique_ptr<char[]> data, size_t len, bool marker = false);
+
+  // Count one tsk_img_read() call served by this cache.
+  void account(TSK_OFF_T off, TSK_IMG_READ_PATH_ENUM path, size_t ns, size_t bytes);
+
+private:
+  struct Line {
+    TSK_OFF_T off;
+    size_t len;
+    std::unique_ptr<char[]> data;
+    bool marker;
+  };
+
+  struct Shard {
+    tsk_lock_t lock;
+    std::list<Line> lru;      // most recently used first
+    std::unordered_map<TSK_OFF_T, std::list<Line>::iterator> index;
+    std::vector<std::unique_ptr<char[]>> spare;   // buffers of evicted lines
+    Stats stats{};
+  };
+
+  // A sequential or strided reader, in units of lines.
+  struct Stream {
+    uint64_t next;      // first line after the last window
+    uint64_t marker;    // hitting this line fetches the next window
+    size_t window;      // lines in the last window, 0 if unused
+    uint64_t used;      // for replacing the oldest stream
+  };
+
+  struct Window {
+    TSK_IMG_INFO* img;
+    TSK_OFF_T off;
+    size_t lines;
+    TSK_OFF_T marker;
+  };
+
+  Shard& shard_for(TSK_OFF_T line_off);
+
+  bool contains(TSK_OFF_T line_off);
+
+  ssize_t read_window(const Window& w);
+
+  // Put the got bytes read for w into the cache.
+  void insert_window(const Window& w, std::unique_ptr<char[]> buf, size_t len, size_t got, bool single);
+
+  // Count one read of the image format in the stats of line_off's shard.
+  void account_backend(TSK_OFF_T line_off, ssize_t count);
+
+  void queue_window(const Window& w);
+
+  tsk_lock_t io_lock;
+  size_t line_len;
+  size_t lines_per_shard;
+  std::vector<std::unique_ptr<Shard>> shards;
+
+  tsk_lock_t ra_lock;
+  size_t ra_lines;      // largest window, 1 if read-ahead is off
+  uint64_t ra_clock;
+  Stream streams[TSK_IMG_READAHEAD_STREAMS];
+
+#ifdef TSK_MULTITHREAD_LIB
+  void run_worker();
+
+  // Whether a reader without the I/O lock is loading line_off.  The
+  // caller holds flight_mutex.
+  bool in_flight(TSK_OFF_T line_off) const;
+
+  std::mutex flight_mutex;
+  std::condition_variable flight_cv;
+  std::vector<std::pair<TSK_OFF_T, TSK_OFF_T>> flights;   // [start, end)
+
+  std::mutex queue_mutex;
+  std::condition_variable queue_cv;
+  std::deque<Window> queue;
+  bool stopping;
+  std::thread worker;
+#endif
+};
+
+#endif
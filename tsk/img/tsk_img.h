@@ -83,16 +83,75 @@ extern "C" {
         TSK_IMG_TYPE_UNSUPP = 0xffff      ///< Unsupported disk image type
     } TSK_IMG_TYPE_ENUM;
 
+    /**
+     * Read cache placed in front of an image (see TSK_IMG_OPTIONS).
+     */
+    typedef enum {
+        TSK_IMG_CACHE_DEFAULT = 0,  ///< Library default (TSK_IMG_CACHE_LEGACY)
+        TSK_IMG_CACHE_NONE,         ///< No cache, every read goes to the image format code
+        TSK_IMG_CACHE_LEGACY,       ///< Fixed 32 x 64 KiB cache behind a single lock
+        TSK_IMG_CACHE_LRU,          ///< One LRU list of 64 KiB lines behind a single lock
+        TSK_IMG_CACHE_SHARDED       ///< LRU lines spread over independently locked shards
+    } TSK_IMG_CACHE_ENUM;
+
+    /**
+     * How raw image segments are read (see TSK_IMG_OPTIONS).  Other image
+     * formats ignore this.  Backends a platform lacks fall back to the
+     * default.
+     */
+    typedef enum {
+        TSK_IMG_BACKEND_DEFAULT = 0,    ///< Format default (TSK_IMG_BACKEND_PREAD where available)
+        TSK_IMG_BACKEND_PREAD,          ///< Positional reads without a shared file offset
+        TSK_IMG_BACKEND_MMAP,           ///< Memory-mapped segments
+        TSK_IMG_BACKEND_DIRECT          ///< Positional reads that bypass the OS page cache
+    } TSK_IMG_BACKEND_ENUM;
+
+    /**
+     * Options for tsk_img_open_opt() and friends.  Initialize them with
+     * tsk_img_options_init() and set the fields of interest.  Zero means
+     * the library default, except for readahead, where it turns read-ahead
+     * off.  The tsk_img_open() functions without
+     * options use the defaults: the legacy cache, without read-ahead or
+     * background threads.  The LRU and sharded caches, and the
+     * TSK_IMG_OPTIONS environment variable (see tsk_img_options_getenv()),
+     * only take effect when a caller asks for them.
+     */
     typedef struct TSK_IMG_OPTIONS {
-        int dummy;
+        TSK_IMG_CACHE_ENUM cache;       ///< Read cache policy
+        size_t cache_size;              ///< Cache capacity in bytes (LRU and sharded caches)
+        size_t readahead;               ///< Largest read-ahead window in bytes (LRU and sharded caches; TSK_IMG_READAHEAD_DEFAULT for the library default, 0 or less than 64 KiB turns read-ahead off)
+        TSK_IMG_BACKEND_ENUM backend;   ///< Raw image I/O backend
+        size_t max_files;               ///< Most segment files a raw image keeps open
     } TSK_IMG_OPTIONS;
 
+/** TSK_IMG_OPTIONS::readahead for the library default window */
+#define TSK_IMG_READAHEAD_DEFAULT ((size_t) -1)
+
 #define TSK_IMG_INFO_CACHE_NUM  32
 #define TSK_IMG_INFO_CACHE_LEN  65536
 
     typedef struct TSK_IMG_INFO TSK_IMG_INFO;
 #define TSK_IMG_INFO_TAG 0x39204231
 
+    /**
+     * How the image cache served a tsk_img_read() call.
+     */
+    typedef enum {
+        TSK_IMG_READ_PATH_HIT = 0,      ///< Copied out of the cache
+        TSK_IMG_READ_PATH_MISS,         ///< Read into the cache first
+        TSK_IMG_READ_PATH_UNCACHED,     ///< Read from the image, bypassing the cache
+        TSK_IMG_READ_PATH_COUNT
+    } TSK_IMG_READ_PATH_ENUM;
+
+#define TSK_IMG_STATS_BUCKETS   64
+
+    /**
+     * I/O counters of an open image, see tsk_img_get_stats().  Uncached
+     * reads are counted as misses.  histogram[i] counts the reads that
+     * took at least 2^i and less than 2^(i+1) nanoseconds (bucket 0 also
+     * counts faster ones); path_histogram splits them by cache path.
+     * Fields are only ever added at the end.
+     */
     typedef struct Stats {
       size_t hits;
       size_t hit_ns;
@@ -100,7 +159,10 @@ extern "C" {
       size_t misses;
       size_t miss_ns;
       size_t miss_bytes;
-      size_t histogram[64];
+      size_t histogram[TSK_IMG_STATS_BUCKETS];
+      size_t backend_reads;     ///< Reads passed to the image format, including read-ahead
+      size_t backend_bytes;     ///< Bytes those reads returned
+      size_t path_histogram[TSK_IMG_READ_PATH_COUNT][TSK_IMG_STATS_BUCKETS];
     } Stats;
 
     /**
@@ -164,6 +226,10 @@ extern "C" {
         const TSK_IMG_OPTIONS* opts
     );
 
+    extern void tsk_img_options_init(TSK_IMG_OPTIONS* opts);
+    extern int tsk_img_options_parse(TSK_IMG_OPTIONS* opts, const char* spec);
+    extern int tsk_img_options_getenv(TSK_IMG_OPTIONS* opts);
+
     extern TSK_IMG_INFO *tsk_img_open_external(void* ext_img_info,
         TSK_OFF_T size, unsigned int sector_size,
         ssize_t(*read) (TSK_IMG_INFO * img, TSK_OFF_T off, char *buf, size_t len),
@@ -172,9 +238,25 @@ extern "C" {
 
     extern void tsk_img_close(TSK_IMG_INFO *);
 
+    /**
+     * One range of a batch read with tsk_img_readv().
+     */
+    typedef struct TSK_IMG_READ_REQ {
+        TSK_OFF_T off;      ///< Byte offset in the image
+        char *buf;          ///< Buffer to read into, or NULL to only load the range into the cache
+        size_t len;         ///< Number of bytes to read
+        ssize_t result;     ///< Set to the number of bytes read (0 for cache loads) or -1 on error
+    } TSK_IMG_READ_REQ;
+
     // read functions
     extern ssize_t tsk_img_read(TSK_IMG_INFO * img, TSK_OFF_T off,
         char *buf, size_t len);
+    extern int tsk_img_readv(TSK_IMG_INFO * img, TSK_IMG_READ_REQ * reqs,
+        size_t count);
+
+    // statistics functions
+    extern int tsk_img_get_stats(TSK_IMG_INFO * img, Stats * stats);
+    extern void tsk_img_print_stats(TSK_IMG_INFO * img, FILE * hFile);
 
     // type conversion functions
     extern TSK_IMG_TYPE_ENUM tsk_img_type_toid_utf8(const char *);
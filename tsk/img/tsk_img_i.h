@@ -41,6 +41,8 @@ struct IMG_INFO {
 
   void* cache;
   Stats stats;
+  TSK_IMG_OPTIONS opts;   ///< Options the image was opened with
+  uint8_t parallel_read;  ///< 1 if read can run concurrently without the cache's I/O lock
 
   ssize_t (*cache_read)(TSK_IMG_INFO* img, TSK_OFF_T off, char *buf, size_t len);
 
@@ -71,6 +73,27 @@ ssize_t tsk_img_read_no_cache(
   size_t a_len
 );
 
+ssize_t tsk_img_read_sharded(
+  TSK_IMG_INFO* a_img_info,
+  TSK_OFF_T a_off,
+  char* a_buf,
+  size_t a_len
+);
+
+/* Read counters of an image, including those kept by its cache. */
+void tsk_img_collect_stats(TSK_IMG_INFO* a_img_info, Stats* a_stats);
+
+/* Count one read served by a_path.  Uncached reads also count as a
+ * backend read of a_bytes. */
+void tsk_img_stats_add(Stats* a_stats, TSK_IMG_READ_PATH_ENUM a_path,
+  size_t a_ns, size_t a_bytes);
+
+/* Count one read passed to the image format. */
+void tsk_img_stats_add_backend(Stats* a_stats, ssize_t a_count);
+
+/* Add all counters of a_src to a_dst. */
+void tsk_img_stats_merge(Stats* a_dst, const Stats* a_src);
+
 #ifdef __cplusplus
 }
 #endif